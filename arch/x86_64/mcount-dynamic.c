@@ -1,5 +1,8 @@
 #include <string.h>
+#include <signal.h>
+#include <ucontext.h>
 #include <sys/mman.h>
+#include <sys/syscall.h>
 #include <unistd.h>
 
 /* This should be defined before #include "utils.h" */
@@ -83,7 +86,7 @@ int mcount_setup_trampoline(struct mcount_dynamic_info *mdi)
 
 void mcount_cleanup_trampoline(struct mcount_dynamic_info *mdi)
 {
-	if (mprotect((void *)mdi->addr, mdi->size, PROT_EXEC))
+	if (mprotect((void *)mdi->addr, mdi->size, PROT_READ | PROT_EXEC))
 		pr_err("cannot restore trampoline due to protection");
 }
 
@@ -195,6 +198,9 @@ static int patch_fentry_func(struct mcount_dynamic_info *mdi, struct sym *sym)
 	/* hopefully we're not patching 'memcpy' itself */
 	memcpy(&insn[1], &target_addr, sizeof(target_addr));
 
+	/* just skip the call when it's being updated */
+	mcount_save_patch_site(sym->addr, nop, sizeof(nop), sizeof(nop));
+
 	pr_dbg3("update function '%s' dynamically to call __fentry__\n",
 		sym->name);
 
@@ -212,6 +218,7 @@ static int patch_xray_func(struct mcount_dynamic_info *mdi, struct sym *sym,
 	unsigned char nop4[] = { 0x0f, 0x1f, 0x40, 0x00 };
 	unsigned int target_addr;
 	unsigned char *func = (void *)xrmap->addr;
+	unsigned char orig[2 + sizeof(pad)];
 	union {
 		unsigned long word;
 		char bytes[8];
@@ -220,6 +227,8 @@ static int patch_xray_func(struct mcount_dynamic_info *mdi, struct sym *sym,
 	if (memcmp(func + 2, pad, sizeof(pad)))
 		return -1;
 
+	memcpy(orig, func, sizeof(orig));
+
 	if (xrmap->type == 0) {  /* ENTRY */
 		if (memcmp(func, entry_insn, sizeof(entry_insn)))
 			return -1;
@@ -234,6 +243,9 @@ static int patch_xray_func(struct mcount_dynamic_info *mdi, struct sym *sym,
 		memcpy(&patch.bytes[5], nop6, 3);
 
 		memcpy(func, patch.bytes, sizeof(patch));
+
+		/* skip the whole sled */
+		mcount_save_patch_site(xrmap->addr, orig, sizeof(orig), sizeof(orig));
 	}
 	else {  /* EXIT */
 		if (memcmp(func, exit_insn, sizeof(exit_insn)))
@@ -249,6 +261,9 @@ static int patch_xray_func(struct mcount_dynamic_info *mdi, struct sym *sym,
 		memcpy(&patch.bytes[5], nop4, 3);
 
 		memcpy(func, patch.bytes, sizeof(patch));
+
+		/* return from the function as the original code does */
+		mcount_save_patch_site(xrmap->addr, orig, 5 + sizeof(nop4), 0);
 	}
 
 	pr_dbg("update function '%s' dynamically to call xray functions\n",
@@ -288,3 +303,113 @@ int mcount_patch_func(struct mcount_dynamic_info *mdi, struct sym *sym)
 		return patch_fentry_func(mdi, sym);
 }
 
+#ifndef __NR_membarrier
+# define __NR_membarrier  324
+#endif
+
+#define MEMBARRIER_CMD_SYNC_CORE           (1 << 5)
+#define MEMBARRIER_CMD_REGISTER_SYNC_CORE  (1 << 6)
+
+#define INT3_INSN  0xcc
+
+static bool use_membarrier;
+
+/* SIGTRAP handler of the program before it's replaced */
+static struct sigaction old_trap_action;
+
+/* make other threads see the new code, it's a no-op for old kernels */
+static void sync_cores(void)
+{
+	if (use_membarrier)
+		syscall(__NR_membarrier, MEMBARRIER_CMD_SYNC_CORE, 0);
+}
+
+/* a thread hits an SDT probe or a site being updated, bypass it */
+static void patch_trap_handler(int sig, siginfo_t *info, void *arg)
+{
+	ucontext_t *ctx = arg;
+	greg_t *gregs = ctx->uc_mcontext.gregs;
+	struct mcount_patch_site *site;
+	struct mcount_event_info *mei;
+	unsigned long addr = gregs[REG_RIP] - 1;  /* after the int3 */
+
+	mei = mcount_lookup_event(addr);
+	if (mei != NULL) {
+		/* save the event and skip the probe */
+		mcount_arch_hit_event(mei, ctx);
+		return;
+	}
+
+	site = mcount_find_patch_site(addr);
+	if (site == NULL) {
+		/* not ours, pass it to the program's handler */
+		if (old_trap_action.sa_flags & SA_SIGINFO) {
+			old_trap_action.sa_sigaction(sig, info, arg);
+		}
+		else if (old_trap_action.sa_handler == SIG_DFL) {
+			/* it's delivered again after return and kills us */
+			sigaction(sig, &old_trap_action, NULL);
+			raise(sig);
+		}
+		else if (old_trap_action.sa_handler != SIG_IGN) {
+			old_trap_action.sa_handler(sig);
+		}
+		return;
+	}
+
+	/* the update is done already, run the new code */
+	if (*(volatile unsigned char *)addr != INT3_INSN)
+		return;
+
+	if (site->skip) {
+		gregs[REG_RIP] = addr + site->skip;
+	}
+	else {
+		/* emulate "ret" */
+		unsigned long *sp = (void *)gregs[REG_RSP];
+
+		gregs[REG_RIP] = *sp;
+		gregs[REG_RSP] += sizeof(*sp);
+	}
+}
+
+/*
+ * Other threads might run the code while it's being updated.  So put
+ * an int3 at the first byte to trap them and write the rest of code,
+ * then replace the first byte (like text_poke_bp() in the kernel).
+ */
+int mcount_update_site(struct mcount_patch_site *site, void *code)
+{
+	static bool trap_handler_set;
+	volatile unsigned char *insn = (void *)site->addr;
+	unsigned char *new_code = code;
+	unsigned i;
+
+	if (!trap_handler_set) {
+		struct sigaction act = {
+			.sa_flags     = SA_SIGINFO,
+			.sa_sigaction = patch_trap_handler,
+		};
+
+		sigemptyset(&act.sa_mask);
+		if (sigaction(SIGTRAP, &act, &old_trap_action) < 0)
+			return -1;
+
+		if (syscall(__NR_membarrier, MEMBARRIER_CMD_REGISTER_SYNC_CORE, 0) == 0)
+			use_membarrier = true;
+
+		trap_handler_set = true;
+	}
+
+	insn[0] = INT3_INSN;
+	sync_cores();
+
+	for (i = 1; i < site->len; i++)
+		insn[i] = new_code[i];
+	sync_cores();
+
+	insn[0] = new_code[0];
+	sync_cores();
+
+	return 0;
+}
@@ -1,8 +1,7 @@
 #include <signal.h>
 #include <stdbool.h>
+#include <stdlib.h>
 #include <ucontext.h>
-#include <assert.h>
-#include <sys/mman.h>
 
 /* This should be defined before #include "utils.h" */
 #define PR_FMT     "event"
@@ -10,52 +9,426 @@
 
 #include "libmcount/internal.h"
 
-#define INVALID_OPCODE  0xce
-#define PAGE_SIZE       4096
-#define PAGE_ADDR(a)    ((void *)((a) & ~(PAGE_SIZE - 1)))
+#define INT3_INSN  0xcc
 
-static void sdt_handler(int sig, siginfo_t *info, void *arg)
+/* this is defined in sdt.S */
+extern void sdt_trampoline(void);
+
+enum sdt_reg_index {
+	SDT_REG_RAX, SDT_REG_RBX, SDT_REG_RCX, SDT_REG_RDX,
+	SDT_REG_RSI, SDT_REG_RDI, SDT_REG_RBP, SDT_REG_RSP,
+	SDT_REG_R8,  SDT_REG_R9,  SDT_REG_R10, SDT_REG_R11,
+	SDT_REG_R12, SDT_REG_R13, SDT_REG_R14, SDT_REG_R15,
+
+	SDT_NR_REGS,
+};
+
+/* register names in 64, 32, 16 and 8-bit (low and high) */
+static const char *sdt_reg_names[SDT_NR_REGS][5] = {
+	{ "rax", "eax",  "ax",   "al",   "ah" },
+	{ "rbx", "ebx",  "bx",   "bl",   "bh" },
+	{ "rcx", "ecx",  "cx",   "cl",   "ch" },
+	{ "rdx", "edx",  "dx",   "dl",   "dh" },
+	{ "rsi", "esi",  "si",   "sil"  },
+	{ "rdi", "edi",  "di",   "dil"  },
+	{ "rbp", "ebp",  "bp",   "bpl"  },
+	{ "rsp", "esp",  "sp",   "spl"  },
+	{ "r8",  "r8d",  "r8w",  "r8b"  },
+	{ "r9",  "r9d",  "r9w",  "r9b"  },
+	{ "r10", "r10d", "r10w", "r10b" },
+	{ "r11", "r11d", "r11w", "r11b" },
+	{ "r12", "r12d", "r12w", "r12b" },
+	{ "r13", "r13d", "r13w", "r13b" },
+	{ "r14", "r14d", "r14w", "r14b" },
+	{ "r15", "r15d", "r15w", "r15b" },
+};
+
+enum sdt_arg_type {
+	SDT_ARG_NONE,	/* not supported, always 0 */
+	SDT_ARG_REG,	/* %reg */
+	SDT_ARG_MEM,	/* disp(%reg) */
+	SDT_ARG_IMM,	/* $imm */
+};
+
+struct sdt_arg {
+	int			size;	/* in byte, negative if signed */
+	enum sdt_arg_type	type;
+	int			reg;
+	bool			high;	/* %ah, %bh, %ch or %dh */
+	long			val;	/* displacement or immediate */
+};
+
+struct sdt_arg_info {
+	unsigned		nop_size;  /* size of the probe insn */
+	int			nr_args;
+	struct sdt_arg		args[SDT_MAX_ARGS];
+};
+
+/* registers saved by sdt_trampoline (in the reverse order of push) */
+struct sdt_regs {
+	unsigned long r15, r14, r13, r12, r11, r10, r9, r8;
+	unsigned long rbp, rdi, rsi, rdx, rcx, rbx, rax;
+	unsigned long flags;
+	unsigned long ret;	/* return address to the stub */
+	unsigned long mei;	/* pushed by the stub */
+};
+
+/* size of the red zone skipped by the stub */
+#define SDT_RED_ZONE  128
+
+static int sdt_reg_index(char *name, int len, bool *high)
 {
-	ucontext_t *ctx = arg;
-	unsigned long addr = ctx->uc_mcontext.gregs[REG_RIP];
-	struct mcount_event_info * mei;
+	int i, k;
 
-	mei = mcount_lookup_event(addr);
-	assert(mei != NULL);
+	for (i = 0; i < SDT_NR_REGS; i++) {
+		for (k = 0; k < 5; k++) {
+			const char *reg = sdt_reg_names[i][k];
 
-	/* TODO: collect and write arguments */
-	mcount_save_event(mei);
+			if (reg == NULL)
+				continue;
 
-	/* skip the invalid insn and continue */
-	ctx->uc_mcontext.gregs[REG_RIP] = addr + 1;
+			if ((int)strlen(reg) == len && !strncmp(name, reg, len)) {
+				*high = (k == 4);
+				return i;
+			}
+		}
+	}
+	return -1;
 }
 
-int mcount_arch_enable_event(struct mcount_event_info *mei)
+/* parse an argument spec like "-4@%edi" or "8@-16(%rbp)" */
+static void parse_sdt_arg(struct sdt_arg *arg, char *spec)
 {
-	static bool sdt_handler_set = false;
+	char *op = strchr(spec, '@');
+	char *end;
 
-	if (!sdt_handler_set) {
-		struct sigaction act = {
-			.sa_flags     = SA_SIGINFO,
-			.sa_sigaction = sdt_handler,
-		};
+	arg->type = SDT_ARG_NONE;
+	arg->size = 8;
+	arg->high = false;
 
-		sigemptyset(&act.sa_mask);
-		sigaction(SIGILL, &act, NULL);
+	if (op) {
+		arg->size = strtol(spec, NULL, 0);
+		if (arg->size == 0 || abs(arg->size) > 8)
+			arg->size = 8;
+		op++;
+	}
+	else
+		op = spec;
 
-		sdt_handler_set = true;
+	if (*op == '$') {
+		arg->val = strtol(op + 1, &end, 0);
+		if (*end == '\0')
+			arg->type = SDT_ARG_IMM;
+	}
+	else if (*op == '%') {
+		arg->reg = sdt_reg_index(op + 1, strlen(op + 1), &arg->high);
+		if (arg->reg >= 0)
+			arg->type = SDT_ARG_REG;
 	}
+	else {
+		char *close;
+		bool high;
+
+		/* symbolic displacement like "foo(%rip)" is not supported */
+		arg->val = strtol(op, &end, 0);
+		if (end[0] != '(' || end[1] != '%')
+			return;
+
+		/* index register like "(%rax,%rcx,8)" is not supported */
+		close = strchr(end, ')');
+		if (close == NULL || strchr(end, ',') != NULL)
+			return;
+
+		arg->reg = sdt_reg_index(end + 2, close - (end + 2), &high);
+		if (arg->reg >= 0 && !high)
+			arg->type = SDT_ARG_MEM;
+	}
+}
+
+static struct sdt_arg_info *parse_sdt_args(char *arguments)
+{
+	struct sdt_arg_info *sai;
+	char *str, *spec, *pos;
+
+	if (arguments == NULL || *arguments == '\0')
+		return NULL;
+
+	sai = xzalloc(sizeof(*sai));
+	str = xstrdup(arguments);
+
+	spec = strtok_r(str, " ", &pos);
+	while (spec && sai->nr_args < SDT_MAX_ARGS) {
+		parse_sdt_arg(&sai->args[sai->nr_args++], spec);
+		spec = strtok_r(NULL, " ", &pos);
+	}
+
+	free(str);
+	return sai;
+}
 
-	if (mprotect(PAGE_ADDR(mei->addr), PAGE_SIZE, PROT_READ | PROT_WRITE)) {
+static uint64_t get_sdt_arg(struct sdt_arg *arg, unsigned long *regs)
+{
+	uint64_t val = 0;
+	int size = abs(arg->size);
+	int shift;
+
+	switch (arg->type) {
+	case SDT_ARG_REG:
+		val = regs[arg->reg];
+		if (arg->high)
+			val >>= 8;
+		break;
+	case SDT_ARG_MEM:
+		memcpy(&val, (void *)(regs[arg->reg] + arg->val), size);
+		break;
+	case SDT_ARG_IMM:
+		return arg->val;
+	default:
+		return 0;
+	}
+
+	if (size == 8)
+		return val;
+
+	/* truncate or extend the value to 64-bit */
+	shift = 64 - size * 8;
+	if (arg->size < 0)
+		val = (int64_t)(val << shift) >> shift;
+	else
+		val = (val << shift) >> shift;
+
+	return val;
+}
+
+static void save_sdt_event(struct mcount_event_info *mei, unsigned long *regs)
+{
+	struct sdt_arg_info *sai = mei->arch;
+	uint64_t args[SDT_MAX_ARGS];
+	int i;
+
+	if (sai->nr_args == 0) {
+		mcount_save_event(mei, NULL, 0);
+		return;
+	}
+
+	for (i = 0; i < sai->nr_args; i++)
+		args[i] = get_sdt_arg(&sai->args[i], regs);
+
+	mcount_save_event(mei, args, sai->nr_args * sizeof(*args));
+}
+
+/* called from sdt_trampoline */
+void sdt_entry(struct mcount_event_info *mei, struct sdt_regs *sr)
+{
+	unsigned long regs[SDT_NR_REGS] = {
+		sr->rax, sr->rbx, sr->rcx, sr->rdx,
+		sr->rsi, sr->rdi, sr->rbp,
+		(unsigned long)(sr + 1) + SDT_RED_ZONE,
+		sr->r8,  sr->r9,  sr->r10, sr->r11,
+		sr->r12, sr->r13, sr->r14, sr->r15,
+	};
+
+	save_sdt_event(mei, regs);
+}
+
+/* called from the SIGTRAP handler when a thread hits an int3 at the probe */
+void mcount_arch_hit_event(struct mcount_event_info *mei, void *arg)
+{
+	ucontext_t *ctx = arg;
+	greg_t *gregs = ctx->uc_mcontext.gregs;
+	struct sdt_arg_info *sai = mei->arch;
+	unsigned long regs[SDT_NR_REGS] = {
+		gregs[REG_RAX], gregs[REG_RBX], gregs[REG_RCX], gregs[REG_RDX],
+		gregs[REG_RSI], gregs[REG_RDI], gregs[REG_RBP], gregs[REG_RSP],
+		gregs[REG_R8],  gregs[REG_R9],  gregs[REG_R10], gregs[REG_R11],
+		gregs[REG_R12], gregs[REG_R13], gregs[REG_R14], gregs[REG_R15],
+	};
+
+	save_sdt_event(mei, regs);
+
+	/* skip the probe and continue */
+	gregs[REG_RIP] = mei->addr + sai->nop_size;
+}
+
+/* replace the NOP to an int3 so that it can catch SIGTRAP */
+static int enable_sdt_trap(struct mcount_event_info *mei)
+{
+	unsigned char int3 = INT3_INSN;
+
+	if (mcount_patch_code(mei->addr, &int3, sizeof(int3)) < 0) {
 		pr_dbg("cannot enable event due to protection: %m\n");
 		return -1;
 	}
+	return 0;
+}
+
+/*
+ * The probe site can be patched to a jump if it has a 5-byte NOP.
+ * This can be done by defining _SDT_NOP before including sys/sdt.h:
+ *
+ *   #define _SDT_NOP  .byte 0x0f, 0x1f, 0x44, 0x00, 0x00
+ *
+ * Otherwise it uses an int3 and skips the NOP in the SIGTRAP handler.
+ */
+static const unsigned char sdt_nops[][5] = {
+	{ 0x90, },				/* nop */
+	{ 0x66, 0x90, },			/* xchg %ax,%ax */
+	{ 0x0f, 0x1f, 0x00, },			/* nopl (%rax) */
+	{ 0x0f, 0x1f, 0x40, 0x00, },		/* nopl 0x0(%rax) */
+	{ 0x0f, 0x1f, 0x44, 0x00, 0x00, },	/* nopl 0x0(%rax,%rax,1) */
+};
+
+static unsigned sdt_nop_size(unsigned long addr)
+{
+	unsigned i;
+
+	for (i = ARRAY_SIZE(sdt_nops); i > 0; i--) {
+		if (!memcmp((void *)addr, sdt_nops[i - 1], i))
+			return i;
+	}
+	return 0;
+}
+
+#define JMP_INSN_SIZE   5
+#define SDT_STUB_SIZE   48
+#define SDT_STUB_MEI    32
+#define SDT_STUB_FUNC   40
+
+static int enable_sdt_trampoline(struct mcount_event_info *mei)
+{
+	unsigned long stub;
+	unsigned long trampoline = (unsigned long)sdt_trampoline;
+	unsigned char code[] = {
+		/* lea  -0x80(%rsp),%rsp */
+		0x48, 0x8d, 0x64, 0x24, 0x80,
+		/* pushq  <mei>(%rip) */
+		0xff, 0x35, SDT_STUB_MEI - 11, 0x00, 0x00, 0x00,
+		/* callq  *<sdt_trampoline>(%rip) */
+		0xff, 0x15, SDT_STUB_FUNC - 17, 0x00, 0x00, 0x00,
+		/* lea  0x88(%rsp),%rsp */
+		0x48, 0x8d, 0xa4, 0x24, 0x88, 0x00, 0x00, 0x00,
+		/* jmpq  <probe + 5> */
+		0xe9, 0x00, 0x00, 0x00, 0x00,
+	};
+	unsigned char buf[SDT_STUB_SIZE];
+	unsigned char jump[JMP_INSN_SIZE] = { 0xe9, };
+	int offset;
+
+	stub = mcount_alloc_stub(mei->addr, SDT_STUB_SIZE);
+	if (stub == 0) {
+		pr_dbg("cannot allocate SDT stub for %s:%s\n",
+		       mei->provider, mei->event);
+		return -1;
+	}
+
+	offset = mei->addr + JMP_INSN_SIZE - (stub + sizeof(code));
+	memcpy(&code[sizeof(code) - 4], &offset, sizeof(offset));
 
-	/* replace NOP to an invalid OP so that it can catch SIGILL */
-	memset((void *)mei->addr, INVALID_OPCODE, 1);
+	memset(buf, INT3_INSN, sizeof(buf));
+	memcpy(buf, code, sizeof(code));
+	memcpy(buf + SDT_STUB_MEI, &mei, sizeof(mei));
+	memcpy(buf + SDT_STUB_FUNC, &trampoline, sizeof(trampoline));
+
+	if (mcount_write_stub(stub, buf, sizeof(buf)) < 0) {
+		pr_dbg("cannot write SDT stub due to protection: %m\n");
+		return -1;
+	}
 
-	if (mprotect(PAGE_ADDR(mei->addr), PAGE_SIZE, PROT_EXEC))
-		pr_err("cannot setup event due to protection");
+	/* replace the NOP to jump to the stub */
+	offset = stub - (mei->addr + JMP_INSN_SIZE);
+	memcpy(&jump[1], &offset, sizeof(offset));
 
+	if (mcount_patch_code(mei->addr, jump, sizeof(jump)) < 0) {
+		pr_dbg("cannot enable event due to protection: %m\n");
+		return -1;
+	}
+
+	pr_dbg2("SDT event (%s:%s) uses a stub at %#lx\n",
+		mei->provider, mei->event, stub);
 	return 0;
 }
+
+int mcount_arch_enable_event(struct mcount_event_info *mei)
+{
+	struct sdt_arg_info *sai;
+
+	sai = parse_sdt_args(mei->arguments);
+	if (sai == NULL)
+		sai = xzalloc(sizeof(*sai));
+	mei->arch = sai;
+
+	sai->nop_size = sdt_nop_size(mei->addr);
+	if (sai->nop_size == 0) {
+		pr_dbg("SDT event (%s:%s) doesn't have a known NOP\n",
+		       mei->provider, mei->event);
+		return -1;
+	}
+
+	/* use the trampoline if possible, otherwise fall back to int3 */
+	if (sai->nop_size == JMP_INSN_SIZE && enable_sdt_trampoline(mei) == 0)
+		return 0;
+
+	return enable_sdt_trap(mei);
+}
+
+#ifdef UNIT_TEST
+
+TEST_CASE(mcount_sdt_args)
+{
+	struct sdt_arg_info *sai;
+	unsigned long regs[SDT_NR_REGS] = { 0, };
+	long mem = 0x1234;
+
+	sai = parse_sdt_args("-4@%edi 8@-8(%rbp) 1@$3 8@foo(%rip) 2@(%rax,%rcx,2) %rsi "
+			     "1@%ch 8@8(%ah)");
+	TEST_NE(sai, NULL);
+	TEST_EQ(sai->nr_args, 8);
+
+	TEST_EQ(sai->args[0].type, SDT_ARG_REG);
+	TEST_EQ(sai->args[0].size, -4);
+	TEST_EQ(sai->args[0].reg,  SDT_REG_RDI);
+
+	TEST_EQ(sai->args[1].type, SDT_ARG_MEM);
+	TEST_EQ(sai->args[1].reg,  SDT_REG_RBP);
+	TEST_EQ(sai->args[1].val,  -8);
+
+	TEST_EQ(sai->args[2].type, SDT_ARG_IMM);
+	TEST_EQ(sai->args[2].val,  3);
+
+	TEST_EQ(sai->args[3].type, SDT_ARG_NONE);
+	TEST_EQ(sai->args[4].type, SDT_ARG_NONE);
+
+	TEST_EQ(sai->args[5].type, SDT_ARG_REG);
+	TEST_EQ(sai->args[5].size, 8);
+	TEST_EQ(sai->args[5].reg,  SDT_REG_RSI);
+
+	TEST_EQ(sai->args[6].type, SDT_ARG_REG);
+	TEST_EQ(sai->args[6].size, 1);
+	TEST_EQ(sai->args[6].reg,  SDT_REG_RCX);
+	TEST_EQ(sai->args[6].high, true);
+
+	TEST_EQ(sai->args[7].type, SDT_ARG_NONE);
+
+	regs[SDT_REG_RDI] = 0xffffffffUL;
+	regs[SDT_REG_RBP] = (unsigned long)&mem + 8;
+	regs[SDT_REG_RSI] = 0xdeadbeefUL;
+	regs[SDT_REG_RCX] = 0xabcdUL;
+
+	TEST_EQ(get_sdt_arg(&sai->args[0], regs), (uint64_t)-1);
+	TEST_EQ(get_sdt_arg(&sai->args[1], regs), 0x1234);
+	TEST_EQ(get_sdt_arg(&sai->args[2], regs), 3);
+	TEST_EQ(get_sdt_arg(&sai->args[3], regs), 0);
+	TEST_EQ(get_sdt_arg(&sai->args[5], regs), 0xdeadbeefUL);
+	TEST_EQ(get_sdt_arg(&sai->args[6], regs), 0xab);
+
+	/* unsigned 32-bit value should be zero-extended */
+	sai->args[0].size = 4;
+	TEST_EQ(get_sdt_arg(&sai->args[0], regs), 0xffffffffUL);
+
+	TEST_EQ(parse_sdt_args(""), NULL);
+
+	free(sai);
+	return TEST_OK;
+}
+
+#endif /* UNIT_TEST */
@@ -152,6 +152,22 @@ void mcount_restore_arch_context(struct mcount_arch_context *ctx)
 	asm volatile ("movsd %0, %%xmm7\n" :: "m" (ctx->xmm[7]));
 }
 
+/*
+ * Only %xmm0 and %xmm1 can have a (floating-point) return value at exit
+ * and others are caller-saved so no need to keep them.
+ */
+void mcount_save_arch_exit_context(struct mcount_arch_context *ctx)
+{
+	asm volatile ("movsd %%xmm0, %0\n" : "=m" (ctx->xmm[0]));
+	asm volatile ("movsd %%xmm1, %0\n" : "=m" (ctx->xmm[1]));
+}
+
+void mcount_restore_arch_exit_context(struct mcount_arch_context *ctx)
+{
+	asm volatile ("movsd %0, %%xmm0\n" :: "m" (ctx->xmm[0]));
+	asm volatile ("movsd %0, %%xmm1\n" :: "m" (ctx->xmm[1]));
+}
+
 #define R_OFFSET_POS  2
 #define PUSH_IDX_POS  1
 #define JMP_OFS_POS   7
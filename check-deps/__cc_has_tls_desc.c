@@ -0,0 +1,6 @@
+static __thread int tls_desc;
+
+int main(void)
+{
+	return tls_desc;
+}
@@ -436,6 +436,11 @@ static void pr_event(int eid, void *ptr, int len)
 	union {
 		struct uftrace_proc_statm *statm;
 		struct uftrace_page_fault *pgfault;
+		struct uftrace_pmu_cycle *cycle;
+		struct uftrace_pmu_cache *cache;
+		struct uftrace_pmu_branch *branch;
+		struct uftrace_max_rss *max_rss;
+		struct uftrace_ctx_switch *ctxsw;
 	} d;
 
 	/* built-in events */
@@ -450,6 +455,30 @@ static void pr_event(int eid, void *ptr, int len)
 		pr_out("  page-fault: major=%"PRIu64" minor=%"PRIu64"\n",
 		       d.pgfault->major, d.pgfault->minor);
 		break;
+	case EVENT_ID_READ_PMU_CYCLE:
+		d.cycle = ptr;
+		pr_out("  pmu-cycle: cycle=%"PRIu64" instructions=%"PRIu64"\n",
+		       d.cycle->cycles, d.cycle->instrs);
+		break;
+	case EVENT_ID_READ_PMU_CACHE:
+		d.cache = ptr;
+		pr_out("  pmu-cache: refers=%"PRIu64" misses=%"PRIu64"\n",
+		       d.cache->refers, d.cache->misses);
+		break;
+	case EVENT_ID_READ_PMU_BRANCH:
+		d.branch = ptr;
+		pr_out("  pmu-branch: branch=%"PRIu64" misses=%"PRIu64"\n",
+		       d.branch->branch, d.branch->misses);
+		break;
+	case EVENT_ID_READ_MAX_RSS:
+		d.max_rss = ptr;
+		pr_out("  max-rss: grow=%"PRIu64"K\n", d.max_rss->grow);
+		break;
+	case EVENT_ID_READ_CTX_SWITCH:
+		d.ctxsw = ptr;
+		pr_out("  ctx-switch: voluntary=%"PRIu64" involuntary=%"PRIu64"\n",
+		       d.ctxsw->voluntary, d.ctxsw->involuntary);
+		break;
 	default:
 		break;
 	}
@@ -464,7 +493,8 @@ static void get_feature_string(char *buf, size_t sz, uint64_t feature_mask)
 	bool first = true;
 	const char *feat_str[] = { "PLTHOOK", "TASK_SESSION", "KERNEL",
 				   "ARGUMENT", "RETVAL", "SYM_REL_ADDR",
-				   "MAX_STACK", "EVENT", "PERF_EVENT" };
+				   "MAX_STACK", "EVENT", "PERF_EVENT",
+				   "COMPLETE_RECORD", "EVENT_ARGUMENT" };
 
 	/* feat_str should match to enum uftrace_feat_bits */
 	for (i = 0; i < FEAT_BIT_MAX; i++) {
@@ -1228,7 +1258,7 @@ static void do_dump_file(struct uftrace_dump_ops *ops, struct opts *opts,
 				continue;
 			}
 
-			sym = find_symtabs(&fsess->symtabs, frs->addr);
+			sym = find_symtabs(fsess->symtabs, frs->addr);
 			name = symbol_getname(sym, frs->addr);
 
 			ops->kernel_func(ops, kernel, i, frs, name);
@@ -1375,7 +1405,7 @@ static void do_dump_replay(struct uftrace_dump_ops *ops, struct opts *opts,
 				fstack[-1].child_time += fstack->total_time;
 
 			/* make sure is_kernel_record() working correctly */
-			if (is_kernel_address(&fsess->symtabs, fstack->addr))
+			if (is_kernel_address(fsess->symtabs, fstack->addr))
 				task->rstack = &task->kstack;
 			else
 				task->rstack = &task->ustack;
@@ -10,6 +10,7 @@
 #include "utils/symbol.h"
 #include "utils/filter.h"
 #include "utils/fstack.h"
+#include "utils/cache.h"
 
 
 struct graph_backtrace {
@@ -97,7 +98,7 @@ static struct uftrace_graph * get_graph(struct ftrace_task_handle *task,
 	if (sess == NULL) {
 		struct uftrace_session *fsess = sessions->first;
 
-		if (is_kernel_address(&fsess->symtabs, addr))
+		if (is_kernel_address(fsess->symtabs, addr))
 			sess = fsess;
 		else
 			return NULL;
@@ -211,7 +212,7 @@ static int print_backtrace(struct uftrace_graph *graph)
 		pr_out("\n");
 
 		for (k = 0; k < bt->len; k++) {
-			sym = find_symtabs(&graph->sess->symtabs, bt->addr[k]);
+			sym = find_symtabs(graph->sess->symtabs, bt->addr[k]);
 			if (sym == NULL)
 				sym = session_find_dlsym(graph->sess,
 							 bt->time, bt->addr[k]);
@@ -299,7 +300,7 @@ static int add_graph_exit(struct task_graph *tg)
 		return -1;
 
 	if (tg->lost) {
-		if (is_kernel_address(&tg->task->h->sessions.first->symtabs,
+		if (is_kernel_address(tg->task->h->sessions.first->symtabs,
 				      fstack->addr))
 			return 1;
 
@@ -396,7 +397,7 @@ static void print_graph_node(struct uftrace_graph *graph,
 	if (node->addr == EVENT_ID_PERF_SCHED_IN)
 		sym = &sched_sym;
 	else
-		sym = find_symtabs(&graph->sess->symtabs, node->addr);
+		sym = find_symtabs(graph->sess->symtabs, node->addr);
 
 	symname = symbol_getname(sym, node->addr);
 
@@ -479,7 +480,7 @@ static void build_graph_node(struct ftrace_task_handle *task, uint64_t time,
 	if (type == UFTRACE_EVENT)
 		return;
 
-	sym = find_symtabs(&tg->graph->sess->symtabs, addr);
+	sym = find_symtabs(tg->graph->sess->symtabs, addr);
 	name = symbol_getname(sym, addr);
 
 	if (!strcmp(name, func)) {
@@ -495,14 +496,10 @@ static void build_graph_node(struct ftrace_task_handle *task, uint64_t time,
 static int build_graph(struct opts *opts, struct ftrace_file_handle *handle,
 		       char *func)
 {
-	int ret = 0;
 	struct ftrace_task_handle *task;
-	struct uftrace_graph *graph;
 	uint64_t prev_time = 0;
 	int i;
 
-	setup_graph_list(handle, opts, func);
-
 	while (!read_rstack(handle, &task) && !uftrace_done) {
 		struct uftrace_record *frs = task->rstack;
 
@@ -558,10 +555,10 @@ static int build_graph(struct opts *opts, struct ftrace_file_handle *handle,
 			/* force to find a session for kernel function */
 			fsess = task->h->sessions.first;
 			tg = get_task_graph(task, prev_time,
-					    fsess->symtabs.kernel_base + 1);
+					    fsess->symtabs->kernel_base + 1);
 			tg->lost = true;
 
-			if (tg->enabled && is_kernel_address(&fsess->symtabs,
+			if (tg->enabled && is_kernel_address(fsess->symtabs,
 							     tg->node->addr))
 				pr_dbg("not returning to user after LOST\n");
 
@@ -616,6 +613,226 @@ static int build_graph(struct opts *opts, struct ftrace_file_handle *handle,
 		}
 	}
 
+	return 0;
+}
+
+static void write_graph_node(struct uftrace_cache *cache,
+			     struct graph_node *node)
+{
+	struct graph_node *child;
+
+	cache_write_u64(cache, node->addr);
+	cache_write_u64(cache, node->nr_calls);
+	cache_write_u64(cache, node->time);
+	cache_write_u64(cache, node->child_time);
+	cache_write_u64(cache, node->nr_edges);
+
+	list_for_each_entry(child, &node->head, list)
+		write_graph_node(cache, child);
+}
+
+static void write_graph_cache(struct uftrace_cache *cache)
+{
+	struct uftrace_graph *graph;
+	struct graph_backtrace *bt;
+	uint64_t count = 0;
+	int i;
+
+	for (graph = graph_list; graph; graph = graph->next)
+		count++;
+
+	cache_write_u64(cache, count);
+
+	for (graph = graph_list; graph; graph = graph->next) {
+		char sid[SESSION_ID_LEN + 1];
+
+		memcpy(sid, graph->sess->sid, SESSION_ID_LEN);
+		sid[SESSION_ID_LEN] = '\0';
+		cache_write_str(cache, sid);
+
+		count = 0;
+		list_for_each_entry(bt, &graph->bt_list, list)
+			count++;
+		cache_write_u64(cache, count);
+
+		/* write in reverse order as it's added to the head */
+		list_for_each_entry_reverse(bt, &graph->bt_list, list) {
+			cache_write_u64(cache, bt->len);
+			cache_write_u64(cache, bt->hit);
+			cache_write_u64(cache, bt->time);
+			for (i = 0; i < bt->len; i++)
+				cache_write_u64(cache, bt->addr[i]);
+		}
+
+		write_graph_node(cache, &graph->root);
+	}
+}
+
+/* a node in the cache has 5 u64 values */
+#define GRAPH_NODE_CACHE_SIZE  (5 * sizeof(uint64_t))
+
+/*
+ * @nr_left is the max number of nodes in the rest of the cache file.
+ * The counts in the cache should be checked before allocating memory
+ * or going deeper since the file might be broken.
+ */
+static int read_graph_node(struct uftrace_cache *cache,
+			   struct graph_node *node,
+			   uint64_t *nr_left, int depth)
+{
+	struct graph_node *child;
+	uint64_t val[5];
+	int i;
+
+	if (*nr_left == 0 || depth > OPT_RSTACK_MAX)
+		return -1;
+	(*nr_left)--;
+
+	for (i = 0; i < 5; i++) {
+		if (cache_read_u64(cache, &val[i]) < 0)
+			return -1;
+	}
+
+	/* each child takes a node at least */
+	if (val[4] > *nr_left)
+		return -1;
+
+	node->addr       = val[0];
+	node->nr_calls   = val[1];
+	node->time       = val[2];
+	node->child_time = val[3];
+	node->nr_edges   = val[4];
+
+	for (i = 0; i < node->nr_edges; i++) {
+		child = xcalloc(1, sizeof(*child));
+		INIT_LIST_HEAD(&child->head);
+
+		child->parent = node;
+		list_add_tail(&child->list, &node->head);
+
+		if (read_graph_node(cache, child, nr_left, depth + 1) < 0)
+			return -1;
+	}
+	return 0;
+}
+
+static bool read_graph_cache(struct uftrace_cache *cache)
+{
+	struct uftrace_graph *graph;
+	struct graph_backtrace *bt;
+	uint64_t count, nr_bt, nr_nodes, val[3];
+	char *sid;
+	int i;
+
+	if (cache_read_u64(cache, &count) < 0)
+		return false;
+
+	while (count--) {
+		sid = cache_read_str(cache);
+		if (sid == NULL)
+			return false;
+
+		for (graph = graph_list; graph; graph = graph->next) {
+			if (!strncmp(graph->sess->sid, sid, SESSION_ID_LEN))
+				break;
+		}
+		free(sid);
+
+		if (graph == NULL || cache_read_u64(cache, &nr_bt) < 0)
+			return false;
+
+		while (nr_bt--) {
+			for (i = 0; i < 3; i++) {
+				if (cache_read_u64(cache, &val[i]) < 0)
+					return false;
+			}
+
+			/* sanity check: it cannot be deeper than max stack */
+			if (val[0] > OPT_RSTACK_MAX)
+				return false;
+
+			bt = xmalloc(sizeof(*bt) + val[0] * sizeof(*bt->addr));
+			bt->len  = val[0];
+			bt->hit  = val[1];
+			bt->time = val[2];
+			list_add(&bt->list, &graph->bt_list);
+
+			for (i = 0; i < bt->len; i++) {
+				if (cache_read_u64(cache, &bt->addr[i]) < 0)
+					return false;
+			}
+		}
+
+		nr_nodes = cache_remaining(cache) / GRAPH_NODE_CACHE_SIZE;
+		if (read_graph_node(cache, &graph->root, &nr_nodes, 0) < 0)
+			return false;
+	}
+	return true;
+}
+
+static void free_graph_node(struct graph_node *node)
+{
+	struct graph_node *child, *tmp;
+
+	list_for_each_entry_safe(child, tmp, &node->head, list) {
+		free_graph_node(child);
+		list_del(&child->list);
+		free(child);
+	}
+}
+
+static void reset_graph_list(void)
+{
+	struct uftrace_graph *graph;
+	struct graph_backtrace *bt, *tmp;
+
+	/* release the partial graph nodes from broken cache */
+	for (graph = graph_list; graph; graph = graph->next) {
+		list_for_each_entry_safe(bt, tmp, &graph->bt_list, list) {
+			list_del(&bt->list);
+			free(bt);
+		}
+		free_graph_node(&graph->root);
+		memset(&graph->root, 0, sizeof(graph->root));
+		INIT_LIST_HEAD(&graph->root.head);
+	}
+}
+
+/* build graph from the cache if possible, and save it otherwise */
+static int load_graph(struct opts *opts, struct ftrace_file_handle *handle,
+		      char *func)
+{
+	struct uftrace_cache cache = {};
+	char *dirname = (char *)handle->dirname;
+	int ret;
+
+	if (!opts->no_cache) {
+		cache_setup(&cache, opts, "graph", func);
+
+		if (cache_open_read(&cache, dirname)) {
+			if (read_graph_cache(&cache)) {
+				cache_finish(&cache, true);
+				return 0;
+			}
+			reset_graph_list();
+		}
+	}
+
+	ret = build_graph(opts, handle, func);
+
+	if (!opts->no_cache && !uftrace_done && ret == 0 &&
+	    cache_open_write(&cache, dirname))
+		write_graph_cache(&cache);
+
+	cache_finish(&cache, !uftrace_done && ret == 0);
+	return ret;
+}
+
+static void print_graphs(struct opts *opts, char *func)
+{
+	int ret = 0;
+	struct uftrace_graph *graph;
+
 	graph = graph_list;
 	while (graph && !uftrace_done) {
 		ret += print_graph(graph, opts);
@@ -627,8 +844,6 @@ static int build_graph(struct opts *opts, struct ftrace_file_handle *handle,
 		if (opts_has_filter(opts))
 			pr_out("\t please check your filter settings.\n");
 	}
-
-	return 0;
 }
 
 struct find_func_data {
@@ -639,7 +854,7 @@ struct find_func_data {
 static int find_func(struct uftrace_session *s, void *arg)
 {
 	struct find_func_data *data = arg;
-	struct symtabs *symtabs = &s->symtabs;
+	struct symtabs *symtabs = s->symtabs;
 
 	if (find_symname(&symtabs->symtab, data->name))
 		data->found = true;
@@ -697,8 +912,11 @@ int command_graph(int argc, char *argv[], struct opts *opts)
 	}
 
 	fstack_setup_filters(opts, &handle);
+	setup_graph_list(&handle, opts, func);
 
-	ret = build_graph(opts, &handle, func);
+	ret = load_graph(opts, &handle, func);
+	if (ret == 0)
+		print_graphs(opts, func);
 
 	close_data_file(opts, &handle);
 
@@ -13,7 +13,6 @@
 #include <sys/stat.h>
 #include <sys/resource.h>
 #include <time.h>
-#include <gelf.h>
 #include <argp.h>
 #include <fcntl.h>
 
@@ -21,9 +20,6 @@
 #include "libmcount/mcount.h"
 #include "utils/utils.h"
 
-#define BUILD_ID_SIZE 20
-#define BUILD_ID_STR_SIZE (BUILD_ID_SIZE * 2 + 1)
-
 struct fill_handler_arg {
 	int fd;
 	int exit_status;
@@ -76,76 +72,11 @@ static int read_exe_name(void *arg)
 static int fill_exe_build_id(void *arg)
 {
 	struct fill_handler_arg *fha = arg;
-	unsigned char build_id[BUILD_ID_SIZE];
 	char build_id_str[BUILD_ID_STR_SIZE];
-	int fd;
-	Elf *elf;
-	Elf_Scn *sec = NULL;
-	Elf_Data *data;
-	GElf_Nhdr nhdr;
-	size_t shdrstr_idx;
-	size_t offset = 0;
-	size_t name_offset, desc_offset;
-
-	fd = open(fha->opts->exename, O_RDONLY);
-	if (fd < 0)
-		return -1;
-
-	elf_version(EV_CURRENT);
-
-	elf = elf_begin(fd, ELF_C_READ_MMAP, NULL);
-	if (elf == NULL)
-		goto close_fd;
-
-	if (elf_getshdrstrndx(elf, &shdrstr_idx) < 0)
-		goto end_elf;
-
-	while ((sec = elf_nextscn(elf, sec)) != NULL) {
-		GElf_Shdr shdr;
-		char *str;
-
-		if (gelf_getshdr(sec, &shdr) == NULL)
-			goto end_elf;
 
-		str = elf_strptr(elf, shdrstr_idx, shdr.sh_name);
-		if (!strcmp(str, ".note.gnu.build-id"))
-			break;
-	}
-
-	if (sec == NULL)
-		goto end_elf;
-
-	data = elf_getdata(sec, NULL);
-	if (data == NULL)
-		goto end_elf;
-
-	while ((offset = gelf_getnote(data, offset, &nhdr,
-				      &name_offset, &desc_offset)) != 0) {
-		if (nhdr.n_type == NT_GNU_BUILD_ID &&
-		    !strcmp((char *)data->d_buf + name_offset, "GNU")) {
-			memcpy(build_id, (void *)data->d_buf + desc_offset, BUILD_ID_SIZE);
-			break;
-		}
-	}
-end_elf:
-	elf_end(elf);
-close_fd:
-	close(fd);
-
-	if (offset == 0) {
-		if (sec == NULL)
-			pr_dbg("cannot find build-id section\n");
-		else
-			pr_dbg("error during ELF processing: %s\n",
-			       elf_errmsg(elf_errno()));
+	if (read_build_id(fha->opts->exename, build_id_str,
+			  sizeof(build_id_str)) < 0)
 		return -1;
-	}
-
-	for (offset = 0; offset < BUILD_ID_SIZE; offset++) {
-		unsigned char c = build_id[offset];
-		sprintf(&build_id_str[offset*2], "%02x", c);
-	}
-	build_id_str[BUILD_ID_STR_SIZE - 1] = '\0';
 
 	return dprintf(fha->fd, "build_id:%s\n", build_id_str);
 }
@@ -805,6 +736,154 @@ static int read_record_date(void *arg)
 	return 0;
 }
 
+static int fill_auto_notrace(void *arg)
+{
+	struct fill_handler_arg *fha = arg;
+	char *filename = NULL;
+	char **names = NULL;
+	char *line = NULL;
+	size_t len = 0;
+	int i, nr = 0;
+	FILE *fp;
+
+	if (fha->opts->auto_notrace == NULL)
+		return -1;
+
+	xasprintf(&filename, "%s/%s", fha->opts->dirname, AUTO_NOTRACE_FILE);
+	fp = fopen(filename, "r");
+	free(filename);
+
+	if (fp == NULL)
+		return -1;
+
+	/* each line has "<addr> <name>", the same name can be saved twice */
+	while (getline(&line, &len, fp) >= 0) {
+		char *name = strchr(line, ' ');
+
+		if (name == NULL)
+			continue;
+		name = copy_info_str(name + 1);
+
+		for (i = 0; i < nr; i++) {
+			if (!strcmp(names[i], name))
+				break;
+		}
+		if (i < nr) {
+			free(name);
+			continue;
+		}
+
+		names = xrealloc(names, (nr + 1) * sizeof(*names));
+		names[nr++] = name;
+	}
+
+	free(line);
+	fclose(fp);
+
+	if (nr == 0)
+		return -1;
+
+	dprintf(fha->fd, "auto_notrace:lines=%d\n", nr);
+	for (i = 0; i < nr; i++) {
+		dprintf(fha->fd, "auto_notrace:%s\n", names[i]);
+		free(names[i]);
+	}
+	free(names);
+
+	return 0;
+}
+
+static int read_auto_notrace(void *arg)
+{
+	struct ftrace_file_handle *handle = arg;
+	struct uftrace_info *info = &handle->info;
+	char buf[4096];
+	int i, lines;
+
+	if (fgets(buf, sizeof(buf), handle->fp) == NULL)
+		return -1;
+
+	if (strncmp(buf, "auto_notrace:", 13))
+		return -1;
+
+	if (sscanf(&buf[13], "lines=%d\n", &lines) == EOF)
+		return -1;
+
+	for (i = 0; i < lines; i++) {
+		char *name;
+
+		if (fgets(buf, sizeof(buf), handle->fp) == NULL)
+			return -1;
+
+		if (strncmp(buf, "auto_notrace:", 13))
+			return -1;
+
+		name = copy_info_str(&buf[13]);
+		info->auto_notrace = strjoin(info->auto_notrace, name, ", ");
+		free(name);
+	}
+	info->nr_auto_notrace = lines;
+
+	return 0;
+}
+
+static int fill_profile(void *arg)
+{
+	struct fill_handler_arg *fha = arg;
+	struct opts *opts = fha->opts;
+
+	if (opts->profile == NULL)
+		return -1;
+
+	dprintf(fha->fd, "profile:lines=%d\n", opts->profile_notrace ? 3 : 2);
+	dprintf(fha->fd, "profile:data=%s\n", opts->profile);
+	dprintf(fha->fd, "profile:filter=%s\n", opts->profile_filter);
+	if (opts->profile_notrace)
+		dprintf(fha->fd, "profile:notrace=%s\n", opts->profile_notrace);
+
+	return 0;
+}
+
+static int read_profile(void *arg)
+{
+	struct ftrace_file_handle *handle = arg;
+	struct uftrace_info *info = &handle->info;
+	char buf[4096];
+	char *line = NULL;
+	size_t len = 0;
+	int i, lines;
+	int ret = -1;
+
+	if (fgets(buf, sizeof(buf), handle->fp) == NULL)
+		return -1;
+
+	if (strncmp(buf, "profile:", 8))
+		return -1;
+
+	if (sscanf(&buf[8], "lines=%d\n", &lines) == EOF)
+		return -1;
+
+	/* the list of functions can be long */
+	for (i = 0; i < lines; i++) {
+		if (getline(&line, &len, handle->fp) < 0)
+			goto out;
+
+		if (strncmp(line, "profile:", 8))
+			goto out;
+
+		if (!strncmp(&line[8], "data=", 5))
+			info->profile = copy_info_str(&line[13]);
+		else if (!strncmp(&line[8], "filter=", 7))
+			info->profile_filter = copy_info_str(&line[15]);
+		else if (!strncmp(&line[8], "notrace=", 8))
+			info->profile_notrace = copy_info_str(&line[16]);
+	}
+	ret = 0;
+out:
+	free(line);
+	return ret;
+}
+
 struct uftrace_info_handler {
 	enum uftrace_info_bits bit;
 	int (*handler)(void *arg);
@@ -835,6 +914,8 @@ void fill_uftrace_info(uint64_t *info_mask, int fd, struct opts *opts, int statu
 		{ LOADINFO,	fill_loadinfo },
 		{ ARG_SPEC,	fill_arg_spec },
 		{ RECORD_DATE,	fill_record_date },
+		{ AUTO_NOTRACE,	fill_auto_notrace },
+		{ PROFILE,	fill_profile },
 	};
 
 	for (i = 0; i < ARRAY_SIZE(fill_handlers); i++) {
@@ -873,6 +954,8 @@ int read_uftrace_info(uint64_t info_mask, struct ftrace_file_handle *handle)
 		{ LOADINFO,	read_loadinfo },
 		{ ARG_SPEC,	read_arg_spec },
 		{ RECORD_DATE,	read_record_date },
+		{ AUTO_NOTRACE,	read_auto_notrace },
+		{ PROFILE,	read_profile },
 	};
 
 	memset(&handle->info, 0, sizeof(handle->info));
@@ -903,6 +986,10 @@ void clear_uftrace_info(struct uftrace_info *info)
 	free(info->argspec);
 	free(info->record_date);
 	free(info->elapsed_time);
+	free(info->auto_notrace);
+	free(info->profile);
+	free(info->profile_filter);
+	free(info->profile_notrace);
 }
 
 int command_info(int argc, char *argv[], struct opts *opts)
@@ -1006,6 +1093,19 @@ int command_info(int argc, char *argv[], struct opts *opts)
 	if (handle.hdr.info_mask & (1UL << ARG_SPEC))
 		pr_out(fmt, "arguments/retval", handle.info.argspec);
 
+	if (handle.hdr.info_mask & (1UL << AUTO_NOTRACE)) {
+		pr_out("# %-20s: %d function(s)\n", "auto notrace",
+		       handle.info.nr_auto_notrace);
+		pr_out(fmt, "dropped functions", handle.info.auto_notrace);
+	}
+
+	if (handle.hdr.info_mask & (1UL << PROFILE)) {
+		pr_out(fmt, "profile data", handle.info.profile);
+		pr_out(fmt, "profile filter", handle.info.profile_filter);
+		if (handle.info.profile_notrace)
+			pr_out(fmt, "profile notrace", handle.info.profile_notrace);
+	}
+
 	if (handle.hdr.info_mask & (1UL << EXIT_STATUS)) {
 		int status = handle.info.exit_status;
 
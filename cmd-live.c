@@ -57,6 +57,9 @@ static void reset_live_opts(struct opts *opts)
 	opts->depth	= MCOUNT_DEFAULT_DEPTH;
 	opts->disabled	= false;
 	opts->threshold = 0;
+
+	/* the data will be removed soon, no need to save cache */
+	opts->no_cache	= true;
 }
 
 static void sigsegv_handler(int sig)
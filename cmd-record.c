@@ -27,6 +27,7 @@
 #include "utils/filter.h"
 #include "utils/kernel.h"
 #include "utils/perf.h"
+#include "utils/msg-ring.h"
 
 #define SHMEM_NAME_SIZE (64 - (int)sizeof(struct list_head))
 
@@ -57,6 +58,10 @@ static int thread_ctl[2];
 
 static bool has_perf_event;
 
+/* shared memory ring for messages from libmcount */
+static struct uftrace_msg_ring *msg_ring;
+static int msg_ring_fd = -1;
+
 
 static bool can_use_fast_libmcount(struct opts *opts)
 {
@@ -66,7 +71,8 @@ static bool can_use_fast_libmcount(struct opts *opts)
 		return false;
 	if (getenv("UFTRACE_FILTER") || getenv("UFTRACE_TRIGGER") ||
 	    getenv("UFTRACE_ARGUMENT") || getenv("UFTRACE_RETVAL") ||
-	    getenv("UFTRACE_PATCH") || getenv("UFTRACE_SCRIPT"))
+	    getenv("UFTRACE_PATCH") || getenv("UFTRACE_SCRIPT") ||
+	    getenv("UFTRACE_AUTO_NOTRACE"))
 		return false;
 	return true;
 }
@@ -160,8 +166,16 @@ static void setup_child_environ(struct opts *opts, int pfd)
 			setenv("UFTRACE_PATCH", patch_str, 1);
 			free(patch_str);
 		}
+
+		if (opts->patch_signal) {
+			snprintf(buf, sizeof(buf), "%d", opts->patch_signal);
+			setenv("UFTRACE_PATCH_SIGNAL", buf, 1);
+		}
 	}
 
+	if (opts->auto_notrace)
+		setenv("UFTRACE_AUTO_NOTRACE", opts->auto_notrace, 1);
+
 	if (opts->event) {
 		char *event_str = uftrace_clear_kernel(opts->event);
 
@@ -213,6 +227,14 @@ static void setup_child_environ(struct opts *opts, int pfd)
 
 	snprintf(buf, sizeof(buf), "%d", pfd);
 	setenv("UFTRACE_PIPE", buf, 1);
+
+	if (msg_ring_fd >= 0) {
+		/* shm_open() sets FD_CLOEXEC, clear it for the child */
+		fcntl(msg_ring_fd, F_SETFD, 0);
+
+		snprintf(buf, sizeof(buf), "%d", msg_ring_fd);
+		setenv("UFTRACE_MSG_RING", buf, 1);
+	}
 	setenv("UFTRACE_SHMEM", "1", 1);
 
 	if (debug) {
@@ -291,6 +313,9 @@ static uint64_t calc_feat_mask(struct opts *opts)
 	/* save mcount_max_stack */
 	features |= MAX_STACK;
 
+	/* libmcount writes complete records for leaf functions */
+	features |= COMPLETE_RECORD;
+
 	if (opts->libcall)
 		features |= PLTHOOK;
 
@@ -304,7 +329,7 @@ static uint64_t calc_feat_mask(struct opts *opts)
 		features |= RETVAL;
 
 	if (opts->event)
-		features |= EVENT;
+		features |= EVENT | EVENT_ARGUMENT;
 
 	if (has_perf_event)
 		features |= PERF_EVENT;
@@ -952,12 +977,15 @@ struct dlopen_list {
 
 static LIST_HEAD(dlopen_libs);
 
-static void read_record_mmap(int pfd, const char *dirname, int bufsize)
+/* max payload: struct uftrace_msg_dlopen + library name */
+#define MSG_DATA_SIZE  (sizeof(struct uftrace_msg_dlopen) + PATH_MAX)
+
+static void handle_record_msg(struct uftrace_msg *msg, void *data,
+			      const char *dirname, int bufsize)
 {
 	char buf[128];
 	struct shmem_list *sl, *tmp;
 	struct tid_list *tl, *pos;
-	struct uftrace_msg msg;
 	struct uftrace_msg_task tmsg;
 	struct uftrace_msg_sess sess;
 	struct uftrace_msg_dlopen dmsg;
@@ -965,23 +993,15 @@ static void read_record_mmap(int pfd, const char *dirname, int bufsize)
 	char *exename;
 	int lost;
 
-	if (read_all(pfd, &msg, sizeof(msg)) < 0)
-		pr_err("reading pipe failed:");
-
-	if (msg.magic != UFTRACE_MSG_MAGIC)
-		pr_err_ns("invalid message received: %x\n", msg.magic);
-
-	switch (msg.type) {
+	switch (msg->type) {
 	case UFTRACE_MSG_REC_START:
-		if (msg.len >= SHMEM_NAME_SIZE)
+		if (msg->len >= SHMEM_NAME_SIZE)
 			pr_err_ns("invalid message length\n");
 
 		sl = xmalloc(sizeof(*sl));
 
-		if (read_all(pfd, sl->id, msg.len) < 0)
-			pr_err("reading pipe failed");
-
-		sl->id[msg.len] = '\0';
+		memcpy(sl->id, data, msg->len);
+		sl->id[msg->len] = '\0';
 		pr_dbg2("MSG START: %s\n", sl->id);
 
 		/* link to shmem_list */
@@ -989,13 +1009,11 @@ static void read_record_mmap(int pfd, const char *dirname, int bufsize)
 		break;
 
 	case UFTRACE_MSG_REC_END:
-		if (msg.len >= SHMEM_NAME_SIZE)
+		if (msg->len >= SHMEM_NAME_SIZE)
 			pr_err_ns("invalid message length\n");
 
-		if (read_all(pfd, buf, msg.len) < 0)
-			pr_err("reading pipe failed");
-
-		buf[msg.len] = '\0';
+		memcpy(buf, data, msg->len);
+		buf[msg->len] = '\0';
 		pr_dbg2("MSG  END : %s\n", buf);
 
 		/* remove from shmem_list */
@@ -1011,12 +1029,10 @@ static void read_record_mmap(int pfd, const char *dirname, int bufsize)
 		break;
 
 	case UFTRACE_MSG_TASK_START:
-		if (msg.len != sizeof(tmsg))
+		if (msg->len != sizeof(tmsg))
 			pr_err_ns("invalid message length\n");
 
-		if (read_all(pfd, &tmsg, sizeof(tmsg)) < 0)
-			pr_err("reading pipe failed");
-
+		memcpy(&tmsg, data, sizeof(tmsg));
 		pr_dbg2("MSG TASK_START : %d/%d\n", tmsg.pid, tmsg.tid);
 
 		/* check existing tid (due to exec) */
@@ -1034,12 +1050,10 @@ static void read_record_mmap(int pfd, const char *dirname, int bufsize)
 		break;
 
 	case UFTRACE_MSG_TASK_END:
-		if (msg.len != sizeof(tmsg))
+		if (msg->len != sizeof(tmsg))
 			pr_err_ns("invalid message length\n");
 
-		if (read_all(pfd, &tmsg, sizeof(tmsg)) < 0)
-			pr_err("reading pipe failed");
-
+		memcpy(&tmsg, data, sizeof(tmsg));
 		pr_dbg2("MSG TASK_END : %d/%d\n", tmsg.pid, tmsg.tid);
 
 		/* mark test exited */
@@ -1052,23 +1066,20 @@ static void read_record_mmap(int pfd, const char *dirname, int bufsize)
 		break;
 
 	case UFTRACE_MSG_FORK_START:
-		if (msg.len != sizeof(tmsg))
+		if (msg->len != sizeof(tmsg))
 			pr_err_ns("invalid message length\n");
 
-		if (read_all(pfd, &tmsg, sizeof(tmsg)) < 0)
-			pr_err("reading pipe failed");
-
+		memcpy(&tmsg, data, sizeof(tmsg));
 		pr_dbg2("MSG FORK1: %d/%d\n", tmsg.pid, -1);
 
 		add_tid_list(tmsg.pid, -1);
 		break;
 
 	case UFTRACE_MSG_FORK_END:
-		if (msg.len != sizeof(tmsg))
+		if (msg->len != sizeof(tmsg))
 			pr_err_ns("invalid message length\n");
 
-		if (read_all(pfd, &tmsg, sizeof(tmsg)) < 0)
-			pr_err("reading pipe failed");
+		memcpy(&tmsg, data, sizeof(tmsg));
 
 		list_for_each_entry(tl, &tid_list_head, list) {
 			if (tl->pid == tmsg.pid && tl->tid == -1)
@@ -1102,15 +1113,15 @@ static void read_record_mmap(int pfd, const char *dirname, int bufsize)
 		break;
 
 	case UFTRACE_MSG_SESSION:
-		if (msg.len < sizeof(sess))
+		if (msg->len < sizeof(sess))
 			pr_err_ns("invalid message length\n");
 
-		if (read_all(pfd, &sess, sizeof(sess)) < 0)
-			pr_err("reading pipe failed");
+		memcpy(&sess, data, sizeof(sess));
+		if (msg->len != sizeof(sess) + sess.namelen)
+			pr_err_ns("invalid message length\n");
 
 		exename = xmalloc(sess.namelen + 1);
-		if (read_all(pfd, exename, sess.namelen) < 0)
-			pr_err("reading pipe failed");
+		memcpy(exename, data + sizeof(sess), sess.namelen);
 		exename[sess.namelen] = '\0';
 
 		memcpy(buf, sess.sid, 16);
@@ -1123,25 +1134,23 @@ static void read_record_mmap(int pfd, const char *dirname, int bufsize)
 		break;
 
 	case UFTRACE_MSG_LOST:
-		if (msg.len < sizeof(lost))
+		if (msg->len < sizeof(lost))
 			pr_err_ns("invalid message length\n");
 
-		if (read_all(pfd, &lost, sizeof(lost)) < 0)
-			pr_err("reading pipe failed");
-
+		memcpy(&lost, data, sizeof(lost));
 		shmem_lost_count += lost;
 		break;
 
 	case UFTRACE_MSG_DLOPEN:
-		if (msg.len < sizeof(dmsg))
+		if (msg->len < sizeof(dmsg))
 			pr_err_ns("invalid message length\n");
 
-		if (read_all(pfd, &dmsg, sizeof(dmsg)) < 0)
-			pr_err("reading pipe failed");
+		memcpy(&dmsg, data, sizeof(dmsg));
+		if (msg->len != sizeof(dmsg) + dmsg.namelen)
+			pr_err_ns("invalid message length\n");
 
 		exename = xmalloc(dmsg.namelen + 1);
-		if (read_all(pfd, exename, dmsg.namelen) < 0)
-			pr_err("reading pipe failed");
+		memcpy(exename, data + sizeof(dmsg), dmsg.namelen);
 		exename[dmsg.namelen] = '\0';
 
 		pr_dbg2("MSG DLOPEN: %d: %#lx %s\n", dmsg.task.tid, dmsg.base_addr, exename);
@@ -1158,12 +1167,103 @@ static void read_record_mmap(int pfd, const char *dirname, int bufsize)
 		pr_dbg2("MSG FINISH\n");
 		break;
 
+	case UFTRACE_MSG_DOORBELL:
+		/* messages in the ring will be read by the caller */
+		break;
+
 	default:
-		pr_warn("Unknown message type: %u\n", msg.type);
+		pr_warn("Unknown message type: %u\n", msg->type);
 		break;
 	}
 }
 
+static int read_msg_ring(const char *dirname, int bufsize);
+
+static void read_record_mmap(int pfd, const char *dirname, int bufsize)
+{
+	struct uftrace_msg msg;
+	char data[MSG_DATA_SIZE];
+
+	if (read_all(pfd, &msg, sizeof(msg)) < 0)
+		pr_err("reading pipe failed:");
+
+	if (msg.magic != UFTRACE_MSG_MAGIC)
+		pr_err_ns("invalid message received: %x\n", msg.magic);
+
+	if (msg.len > sizeof(data))
+		pr_err_ns("invalid message length\n");
+
+	if (read_all(pfd, data, msg.len) < 0)
+		pr_err("reading pipe failed");
+
+	/* messages in the ring were sent before this (if not a doorbell) */
+	if (msg.type != UFTRACE_MSG_DOORBELL)
+		read_msg_ring(dirname, bufsize);
+
+	handle_record_msg(&msg, data, dirname, bufsize);
+}
+
+static void setup_msg_ring(void)
+{
+	struct uftrace_msg_ring *ring;
+	size_t size = msg_ring_size(MSG_RING_NR_SLOTS);
+	char name[64];
+	int fd;
+
+	snprintf(name, sizeof(name), "/uftrace-msg-ring-%d", getpid());
+
+	fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+	if (fd < 0) {
+		pr_dbg("cannot create message ring: %m\n");
+		return;
+	}
+
+	/* it'll be passed to children by the fd */
+	shm_unlink(name);
+
+	if (ftruncate(fd, size) < 0) {
+		pr_dbg("cannot resize message ring: %m\n");
+		goto out;
+	}
+
+	ring = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (ring == MAP_FAILED) {
+		pr_dbg("cannot map message ring: %m\n");
+		goto out;
+	}
+
+	msg_ring_init(ring, MSG_RING_NR_SLOTS);
+
+	msg_ring = ring;
+	msg_ring_fd = fd;
+	return;
+
+out:
+	close(fd);
+}
+
+/* returns number of messages read from the ring */
+static int read_msg_ring(const char *dirname, int bufsize)
+{
+	struct uftrace_msg msg;
+	char data[MSG_DATA_SIZE];
+	int count = 0;
+	int ret;
+
+	if (msg_ring == NULL)
+		return 0;
+
+	while ((ret = msg_ring_read(msg_ring, &msg, data, sizeof(data))) != 0) {
+		if (ret < 0)
+			pr_err_ns("invalid message length\n");
+
+		handle_record_msg(&msg, data, dirname, bufsize);
+		count++;
+	}
+
+	return count;
+}
+
 static void send_task_file(int sock, const char *dirname)
 {
 	send_trace_metadata(sock, dirname, "task.txt");
@@ -1281,6 +1381,7 @@ static void save_session_symbols(struct opts *opts)
 	for (i = 0; i < maps; i++) {
 		struct symtabs symtabs = {
 			.loaded = false,
+			.flags = SYMTAB_FL_PARALLEL,
 		};
 		struct uftrace_mmap *map, *tmp;
 		char sid[20] = { 0, };
@@ -1293,11 +1394,13 @@ static void save_session_symbols(struct opts *opts)
 		read_session_map(opts->dirname, &symtabs, sid);
 
 		/* main executable */
-		load_symtabs(&symtabs, opts->dirname, symtabs.maps->libname);
-		save_symbol_file(&symtabs, opts->dirname, symtabs.filename);
+		if (link_cached_symbol_file(&symtabs, opts->dirname,
+					    symtabs.maps->libname) < 0) {
+			load_symtabs(&symtabs, opts->dirname, symtabs.maps->libname);
+			save_symbol_file(&symtabs, opts->dirname, symtabs.filename);
+		}
 
-		/* shared libraries */
-		load_module_symtabs(&symtabs);
+		/* shared libraries (it loads symbols as well) */
 		save_module_symtabs(&symtabs);
 
 		map = symtabs.maps;
@@ -1308,6 +1411,7 @@ static void save_session_symbols(struct opts *opts)
 			free(tmp);
 		}
 		symtabs.maps = NULL;
+		free(symtabs.maps_index);
 
 		unload_symtabs(&symtabs);
 	}
@@ -1515,6 +1619,8 @@ static void setup_writers(struct writer_data *wd, struct opts *opts)
 	if (opts->host) {
 		wd->sock = setup_client_socket(opts);
 		send_trace_dir_name(wd->sock, opts->dirname);
+		sync_trace_clock(wd->sock);
+		setup_send_streams(opts, wd->sock);
 	}
 	else
 		wd->sock = -1;
@@ -1625,10 +1731,13 @@ static int stop_tracing(struct writer_data *wd, struct opts *opts)
 	int status = -1;
 	int ret = UFTRACE_EXIT_SUCCESS;
 
-	/* child finished, read remaining data in the pipe */
+	/* child finished, read remaining data in the ring and the pipe */
 	while (!uftrace_done) {
 		int remaining = 0;
 
+		if (read_msg_ring(opts->dirname, opts->bufsize))
+			continue;
+
 		if (ioctl(wd->pipefd, FIONREAD, &remaining) < 0)
 			break;
 
@@ -1722,6 +1831,8 @@ static void write_symbol_files(struct writer_data *wd, struct opts *opts)
 {
 	struct dlopen_list *dlib, *tmp;
 
+	setup_symbol_cache(opts->symbol_cache);
+
 	/* main executable and shared libraries */
 	save_session_symbols(opts);
 
@@ -1731,8 +1842,12 @@ static void write_symbol_files(struct writer_data *wd, struct opts *opts)
 			.loaded = false,
 		};
 
-		load_symtabs(&dlib_symtabs, opts->dirname, dlib->libname);
-		save_symbol_file(&dlib_symtabs, opts->dirname, dlib->libname);
+		if (link_cached_symbol_file(&dlib_symtabs, opts->dirname,
+					    dlib->libname) < 0) {
+			load_symtabs(&dlib_symtabs, opts->dirname, dlib->libname);
+			save_symbol_file(&dlib_symtabs, opts->dirname, dlib->libname);
+		}
+		unload_symtabs(&dlib_symtabs);
 
 		list_del(&dlib->list);
 
@@ -1743,6 +1858,9 @@ static void write_symbol_files(struct writer_data *wd, struct opts *opts)
 	if (opts->host) {
 		int sock = wd->sock;
 
+		/* metadata is sent directly after all data is sent */
+		finish_send_streams();
+
 		send_task_file(sock, opts->dirname);
 		send_map_files(sock, opts->dirname);
 		send_sym_files(sock, opts->dirname);
@@ -1781,7 +1899,14 @@ int do_main_loop(int pfd[2], int ready, struct opts *opts, int pid)
 			.events = POLLIN,
 		};
 
+		/* the pipe is only used as a doorbell if the ring is empty */
+		read_msg_ring(opts->dirname, opts->bufsize);
+		if (msg_ring && !msg_ring_prepare_wait(msg_ring))
+			continue;
+
 		ret = poll(&pollfd, 1, 1000);
+		if (msg_ring)
+			msg_ring_finish_wait(msg_ring);
 		if (ret < 0 && errno == EINTR)
 			continue;
 		if (ret < 0)
@@ -1821,6 +1946,54 @@ int do_child_exec(int pfd[2], int ready, struct opts *opts, char *argv[])
 	abort();
 }
 
+/* apply functions selected from the previous trace to the filters */
+static void setup_profile(struct opts *opts)
+{
+	char *filter, *notrace;
+	char *str, *pos, *name;
+	int nr;
+
+	nr = report_profile(opts, &filter, &notrace);
+	if (nr <= 0) {
+		pr_warn("no function selected from the profile: %s\n",
+			opts->profile);
+		free(filter);
+		free(notrace);
+		opts->profile = NULL;
+		return;
+	}
+
+	pr_dbg("%d function(s) selected from the profile\n", nr);
+
+	/*
+	 * Patch the selected functions only if dynamic tracing is used.
+	 * Otherwise every function is traced unless it's excluded, and
+	 * '-F' cannot limit it since the top-level function is selected.
+	 * So exclude the other functions in the profile with '-N'.
+	 */
+	if (opts->patch) {
+		if (strcmp(opts->patch, ".")) {
+			pr_warn("-P patterns are replaced by the profile: %s\n",
+				opts->patch);
+		}
+		free(opts->patch);
+		opts->patch = xstrdup(filter);
+	}
+	else if (notrace) {
+		str = pos = xstrdup(notrace);
+
+		while ((name = strsep(&pos, ";")) != NULL) {
+			name = strjoin(xstrdup("!"), name, "");
+			opts->filter = strjoin(opts->filter, name, ";");
+			free(name);
+		}
+		free(str);
+	}
+
+	opts->profile_filter  = filter;
+	opts->profile_notrace = notrace;
+}
+
 int command_record(int argc, char *argv[], struct opts *opts)
 {
 	int pid;
@@ -1831,6 +2004,12 @@ int command_record(int argc, char *argv[], struct opts *opts)
 	if (pipe(pfd) < 0)
 		pr_err("cannot setup internal pipe");
 
+	setup_msg_ring();
+
+	/* it should be done before the data directory is renamed */
+	if (opts->profile)
+		setup_profile(opts);
+
 	if (create_directory(opts->dirname) < 0)
 		return -1;
 
@@ -10,22 +10,22 @@
 #include <netdb.h>
 #include <sys/signalfd.h>
 #include <sys/epoll.h>
+#include <poll.h>
 #include <linux/limits.h>
 #include <sys/stat.h>
 #include <errno.h>
 #include <sys/wait.h>
+#include <pthread.h>
+#include <time.h>
 
 #include "uftrace.h"
 #include "utils/utils.h"
 #include "utils/list.h"
+#include "utils/rbtree.h"
 
-struct client_data {
-	struct list_head	list;
-	int			sock;
-	char			*dirname;
-};
-
-static LIST_HEAD(client_list);
+#ifdef HAVE_LIBZ
+# include <zlib.h>
+#endif
 
 static int server_socket(struct opts *opts)
 {
@@ -121,60 +121,462 @@ void send_trace_dir_name(int sock, char *name)
 		pr_err("send header failed");
 }
 
-void send_trace_data(int sock, int tid, void *data, size_t len)
+/* number of round trips to estimate clock offset */
+#define CLOCK_SYNC_ROUNDS  8
+
+/* msec to wait for the reply (old receivers don't reply) */
+#define CLOCK_SYNC_TIMEOUT  1000
+
+static uint64_t clock_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+/**
+ * sync_trace_clock - estimate clock offset to the receiver
+ * @sock: socket to the receiver
+ *
+ * It asks the current time of the receiver a few times and sends the
+ * offset of the fastest round trip.  The offset is saved in the data
+ * directory and used to merge data from other hosts later.  The
+ * request has no payload so that old receivers can ignore it.
+ */
+void sync_trace_clock(int sock)
 {
-	int32_t msg_tid = htonl(tid);
 	struct uftrace_msg msg = {
 		.magic = htons(UFTRACE_MSG_MAGIC),
-		.type  = htons(UFTRACE_MSG_SEND_DATA),
-		.len   = htonl(sizeof(msg_tid) + len),
+		.type  = htons(UFTRACE_MSG_SEND_CLOCK),
+		.len   = 0,
 	};
-	struct iovec iov[] = {
-		{ .iov_base = &msg,     .iov_len = sizeof(msg), },
-		{ .iov_base = &msg_tid, .iov_len = sizeof(msg_tid), },
-		{ .iov_base = data,     .iov_len = len, },
+	struct uftrace_msg reply;
+	struct pollfd pfd = {
+		.fd     = sock,
+		.events = POLLIN,
 	};
+	uint64_t t1, t2, t3;
+	uint64_t rtt = 0;
+	int64_t offset = 0;
+	uint64_t result[2];
+	struct iovec iov[2];
+	int i;
+
+	for (i = 0; i < CLOCK_SYNC_ROUNDS; i++) {
+		t1 = clock_now();
+		if (write_all(sock, &msg, sizeof(msg)) < 0)
+			pr_err("send clock message failed");
+
+		if (poll(&pfd, 1, CLOCK_SYNC_TIMEOUT) <= 0) {
+			pr_dbg("no clock reply from the receiver\n");
+			return;
+		}
+
+		if (read_all(sock, &reply, sizeof(reply)) < 0 ||
+		    ntohs(reply.type) != UFTRACE_MSG_SEND_CLOCK ||
+		    ntohl(reply.len) != sizeof(t2) ||
+		    read_all(sock, &t2, sizeof(t2)) < 0)
+			pr_err_ns("invalid clock reply from the receiver\n");
+
+		t3 = clock_now();
+		t2 = ntohq(t2);
+
+		/* assume that both directions take the same time */
+		if (i == 0 || t3 - t1 < rtt) {
+			rtt = t3 - t1;
+			offset = t2 - (t1 + rtt / 2);
+		}
+	}
+
+	pr_dbg("clock offset to the receiver: %"PRId64" nsec (rtt: %"PRIu64" nsec)\n",
+	       offset, rtt);
+
+	result[0] = htonq(offset);
+	result[1] = htonq(rtt);
+
+	msg.type = htons(UFTRACE_MSG_SEND_CLOCK_OFFSET);
+	msg.len  = htonl(sizeof(result));
+
+	iov[0].iov_base = &msg;
+	iov[0].iov_len  = sizeof(msg);
+	iov[1].iov_base = result;
+	iov[1].iov_len  = sizeof(result);
 
-	pr_dbg2("send UFTRACE_MSG_SEND_DATA\n");
 	if (writev_all(sock, iov, ARRAY_SIZE(iov)) < 0)
-		pr_err("send data failed");
+		pr_err("send clock offset failed");
 }
 
-void send_trace_kernel_data(int sock, int cpu, void *data, size_t len)
+/*
+ * Pipelined transport (--num-stream and/or --compress).  Writer threads
+ * put data into a bounded queue and sender threads send it over one or
+ * more connections.  Data of a task (or a cpu) always goes to the same
+ * connection to keep the order in the file.  Writers block when the
+ * queue is full, and data for a failed connection is dropped (and
+ * counted) rather than killing the recording.
+ */
+#define SEND_QUEUE_SIZE  (32 * 1024 * 1024)
+
+/* max (uncompressed) size of a compressed message, larger ones sent as is */
+#define MAX_COMPRESS_SIZE  (64 * 1024 * 1024)
+
+struct send_chunk {
+	struct list_head	list;
+	int			type;
+	int			id;
+	size_t			len;
+	char			data[];
+};
+
+struct send_stream {
+	pthread_t		thread;
+	int			sock;
+	int			idx;
+	bool			failed;
+	struct list_head	queue;
+	void			*zbuf;
+	size_t			zbuf_size;
+};
+
+static struct send_stream *send_streams;
+static int nr_send_streams;
+static bool send_compress;
+static bool send_done;
+static size_t send_queued;
+
+static pthread_mutex_t send_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t send_data_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t send_space_cond = PTHREAD_COND_INITIALIZER;
+
+static struct {
+	uint64_t	bytes;
+	uint64_t	wire_bytes;
+	uint64_t	stalls;
+	uint64_t	drops;
+	uint64_t	drop_bytes;
+} send_stats;
+
+static int send_data_msg(int sock, int type, int id, void *data, size_t len)
 {
-	int32_t msg_cpu = htonl(cpu);
+	int32_t msg_id = htonl(id);
 	struct uftrace_msg msg = {
 		.magic = htons(UFTRACE_MSG_MAGIC),
-		.type  = htons(UFTRACE_MSG_SEND_KERNEL_DATA),
-		.len   = htonl(sizeof(msg_cpu) + len),
+		.type  = htons(type),
+		.len   = htonl(sizeof(msg_id) + len),
 	};
 	struct iovec iov[] = {
-		{ .iov_base = &msg,     .iov_len = sizeof(msg), },
-		{ .iov_base = &msg_cpu, .iov_len = sizeof(msg_cpu), },
-		{ .iov_base = data,     .iov_len = len, },
+		{ .iov_base = &msg,    .iov_len = sizeof(msg), },
+		{ .iov_base = &msg_id, .iov_len = sizeof(msg_id), },
+		{ .iov_base = data,    .iov_len = len, },
 	};
 
-	pr_dbg2("send UFTRACE_MSG_SEND_KERNEL_DATA\n");
-	if (writev_all(sock, iov, ARRAY_SIZE(iov)) < 0)
-		pr_err("send kernel data failed");
+	__sync_fetch_and_add(&send_stats.wire_bytes,
+			     sizeof(msg) + sizeof(msg_id) + len);
+	return writev_all(sock, iov, ARRAY_SIZE(iov));
 }
 
-void send_trace_perf_data(int sock, int cpu, void *data, size_t len)
+#ifdef HAVE_LIBZ
+/* returns 1 if it sent compressed data, 0 if it's not compressible or -1 */
+static int send_compressed_msg(struct send_stream *s, struct send_chunk *chunk)
 {
-	int32_t msg_cpu = htonl(cpu);
+	uLongf zlen = compressBound(chunk->len);
+	int32_t hdr[3];
 	struct uftrace_msg msg = {
 		.magic = htons(UFTRACE_MSG_MAGIC),
-		.type  = htons(UFTRACE_MSG_SEND_PERF_DATA),
-		.len   = htonl(sizeof(msg_cpu) + len),
+		.type  = htons(UFTRACE_MSG_SEND_COMPRESSED),
 	};
 	struct iovec iov[] = {
-		{ .iov_base = &msg,     .iov_len = sizeof(msg), },
-		{ .iov_base = &msg_cpu, .iov_len = sizeof(msg_cpu), },
-		{ .iov_base = data,     .iov_len = len, },
+		{ .iov_base = &msg,    .iov_len = sizeof(msg), },
+		{ .iov_base = hdr,     .iov_len = sizeof(hdr), },
+		{ /* to be filled */ },
 	};
 
-	pr_dbg2("send UFTRACE_MSG_SEND_PERF_DATA\n");
+	if (chunk->len > MAX_COMPRESS_SIZE)
+		return 0;
+
+	if (s->zbuf_size < zlen) {
+		s->zbuf = xrealloc(s->zbuf, zlen);
+		s->zbuf_size = zlen;
+	}
+
+	if (compress2(s->zbuf, &zlen, (void *)chunk->data, chunk->len,
+		      Z_BEST_SPEED) != Z_OK || zlen >= chunk->len)
+		return 0;
+
+	/* original message type, id and data length */
+	hdr[0] = htonl(chunk->type);
+	hdr[1] = htonl(chunk->id);
+	hdr[2] = htonl(chunk->len);
+
+	msg.len = htonl(sizeof(hdr) + zlen);
+	iov[2].iov_base = s->zbuf;
+	iov[2].iov_len  = zlen;
+
+	__sync_fetch_and_add(&send_stats.wire_bytes,
+			     sizeof(msg) + sizeof(hdr) + zlen);
+	if (writev_all(s->sock, iov, ARRAY_SIZE(iov)) < 0)
+		return -1;
+	return 1;
+}
+#else
+static int send_compressed_msg(struct send_stream *s, struct send_chunk *chunk)
+{
+	return 0;
+}
+#endif
+
+static int send_chunk(struct send_stream *s, struct send_chunk *chunk)
+{
+	int ret = 0;
+
+	if (send_compress)
+		ret = send_compressed_msg(s, chunk);
+
+	if (ret == 0) {
+		ret = send_data_msg(s->sock, chunk->type, chunk->id,
+				    chunk->data, chunk->len);
+	}
+	return ret < 0 ? -1 : 0;
+}
+
+static void *send_stream_thread(void *arg)
+{
+	struct send_stream *s = arg;
+	struct send_chunk *chunk;
+	sigset_t sigset;
+	bool failed;
+
+	sigfillset(&sigset);
+	pthread_sigmask(SIG_BLOCK, &sigset, NULL);
+
+	while (true) {
+		pthread_mutex_lock(&send_lock);
+		while (list_empty(&s->queue) && !send_done)
+			pthread_cond_wait(&send_data_cond, &send_lock);
+
+		if (list_empty(&s->queue)) {
+			pthread_mutex_unlock(&send_lock);
+			break;
+		}
+
+		chunk = list_first_entry(&s->queue, struct send_chunk, list);
+		list_del(&chunk->list);
+		failed = s->failed;
+		pthread_mutex_unlock(&send_lock);
+
+		if (!failed && send_chunk(s, chunk) < 0) {
+			pr_warn("send data failed on stream %d: %m\n", s->idx);
+			failed = true;
+		}
+
+		pthread_mutex_lock(&send_lock);
+		if (failed) {
+			s->failed = true;
+			send_stats.drops++;
+			send_stats.drop_bytes += chunk->len;
+		}
+		send_queued -= chunk->len;
+		pthread_cond_broadcast(&send_space_cond);
+		pthread_mutex_unlock(&send_lock);
+
+		free(chunk);
+	}
+	return NULL;
+}
+
+/* returns true if the data is handled by the pipelined transport */
+static bool queue_send_data(int type, int id, void *data, size_t len)
+{
+	struct send_stream *s;
+	struct send_chunk *chunk;
+
+	if (nr_send_streams == 0)
+		return false;
+
+	s = &send_streams[(unsigned)id % nr_send_streams];
+
+	chunk = xmalloc(sizeof(*chunk) + len);
+	chunk->type = type;
+	chunk->id   = id;
+	chunk->len  = len;
+	memcpy(chunk->data, data, len);
+
+	pthread_mutex_lock(&send_lock);
+
+	send_stats.bytes += len;
+
+	/* wait for senders to make a room (backpressure) */
+	if (send_queued + len > SEND_QUEUE_SIZE && !s->failed) {
+		send_stats.stalls++;
+
+		while (send_queued && send_queued + len > SEND_QUEUE_SIZE &&
+		       !s->failed)
+			pthread_cond_wait(&send_space_cond, &send_lock);
+	}
+
+	if (s->failed) {
+		send_stats.drops++;
+		send_stats.drop_bytes += len;
+		pthread_mutex_unlock(&send_lock);
+		free(chunk);
+		return true;
+	}
+
+	list_add_tail(&chunk->list, &s->queue);
+	send_queued += len;
+
+	pthread_cond_broadcast(&send_data_cond);
+	pthread_mutex_unlock(&send_lock);
+	return true;
+}
+
+static void send_trace_stream_name(int sock, char *name)
+{
+	ssize_t len = strlen(name);
+	struct uftrace_msg msg = {
+		.magic = htons(UFTRACE_MSG_MAGIC),
+		.type  = htons(UFTRACE_MSG_SEND_STREAM),
+		.len   = htonl(len),
+	};
+	struct iovec iov[] = {
+		{ .iov_base = &msg, .iov_len = sizeof(msg), },
+		{ .iov_base = name, .iov_len = len, },
+	};
+
+	pr_dbg2("send UFTRACE_MSG_SEND_STREAM\n");
 	if (writev_all(sock, iov, ARRAY_SIZE(iov)) < 0)
+		pr_err("send stream name failed");
+}
+
+/**
+ * setup_send_streams - start the pipelined transport if requested
+ * @opts: options for --num-stream and --compress
+ * @sock: socket already connected (and sent dir name)
+ *
+ * It makes additional connections to the server and starts a sender
+ * thread for each connection.  The original @sock is used for the
+ * first stream and for metadata after finish_send_streams().
+ */
+void setup_send_streams(struct opts *opts, int sock)
+{
+	struct send_stream *s;
+	int nr = opts->nr_stream ?: 1;
+	int i;
+
+	if (opts->nr_stream == 0 && !opts->compress)
+		return;
+
+#ifdef HAVE_LIBZ
+	send_compress = opts->compress;
+#else
+	if (opts->compress)
+		pr_warn("--compress is ignored: zlib is not available\n");
+#endif
+
+	send_streams = xcalloc(nr, sizeof(*send_streams));
+
+	for (i = 0; i < nr; i++) {
+		s = &send_streams[i];
+
+		s->idx = i;
+		INIT_LIST_HEAD(&s->queue);
+
+		if (i == 0) {
+			s->sock = sock;
+		}
+		else {
+			s->sock = setup_client_socket(opts);
+			send_trace_stream_name(s->sock, opts->dirname);
+		}
+
+		if (pthread_create(&s->thread, NULL, send_stream_thread, s) != 0)
+			pr_err("cannot create sender thread");
+	}
+
+	pr_dbg("send data using %d stream(s)%s\n", nr,
+	       send_compress ? " with compression" : "");
+	nr_send_streams = nr;
+}
+
+/* wait until the server finishes the stream (and closes the socket) */
+static void close_send_stream(struct send_stream *s)
+{
+	char buf[64];
+
+	shutdown(s->sock, SHUT_WR);
+	while (read(s->sock, buf, sizeof(buf)) > 0)
+		continue;
+	close(s->sock);
+}
+
+/**
+ * finish_send_streams - flush queued data and stop the transport
+ *
+ * It should be called after all writers are done.  The data in
+ * additional streams is saved when this function returns so that
+ * the END message (in the first stream) can be sent safely.
+ */
+void finish_send_streams(void)
+{
+	int i;
+
+	if (nr_send_streams == 0)
+		return;
+
+	pthread_mutex_lock(&send_lock);
+	send_done = true;
+	pthread_cond_broadcast(&send_data_cond);
+	pthread_mutex_unlock(&send_lock);
+
+	for (i = 0; i < nr_send_streams; i++)
+		pthread_join(send_streams[i].thread, NULL);
+
+	for (i = 1; i < nr_send_streams; i++)
+		close_send_stream(&send_streams[i]);
+
+	pr_dbg("sent %"PRIu64" bytes of data as %"PRIu64" bytes (%d stalls)\n",
+	       send_stats.bytes, send_stats.wire_bytes, send_stats.stalls);
+	if (send_stats.drops) {
+		pr_warn("%"PRIu64" chunks (%"PRIu64" bytes) were dropped "
+			"due to send failure\n",
+			send_stats.drops, send_stats.drop_bytes);
+	}
+
+	for (i = 0; i < nr_send_streams; i++)
+		free(send_streams[i].zbuf);
+	free(send_streams);
+
+	send_streams = NULL;
+	nr_send_streams = 0;
+}
+
+void send_trace_data(int sock, int tid, void *data, size_t len)
+{
+	if (queue_send_data(UFTRACE_MSG_SEND_DATA, tid, data, len))
+		return;
+
+	pr_dbg2("send UFTRACE_MSG_SEND_DATA\n");
+	if (send_data_msg(sock, UFTRACE_MSG_SEND_DATA, tid, data, len) < 0)
+		pr_err("send data failed");
+}
+
+void send_trace_kernel_data(int sock, int cpu, void *data, size_t len)
+{
+	if (queue_send_data(UFTRACE_MSG_SEND_KERNEL_DATA, cpu, data, len))
+		return;
+
+	pr_dbg2("send UFTRACE_MSG_SEND_KERNEL_DATA\n");
+	if (send_data_msg(sock, UFTRACE_MSG_SEND_KERNEL_DATA, cpu, data, len) < 0)
+		pr_err("send kernel data failed");
+}
+
+void send_trace_perf_data(int sock, int cpu, void *data, size_t len)
+{
+	if (queue_send_data(UFTRACE_MSG_SEND_PERF_DATA, cpu, data, len))
+		return;
+
+	pr_dbg2("send UFTRACE_MSG_SEND_PERF_DATA\n");
+	if (send_data_msg(sock, UFTRACE_MSG_SEND_PERF_DATA, cpu, data, len) < 0)
 		pr_err("send kernel data failed");
 }
 
@@ -267,198 +669,465 @@ void send_trace_end(int sock)
 
 
 /* server (recv) side API */
-static struct client_data *find_client(int sock)
+
+/*
+ * Each client is served by a dedicated worker thread until it sends the
+ * END message.  Idle workers are reused for new clients and a new worker
+ * is created only when all of them are busy.  Trace data is moved from
+ * the socket to the file using splice() through a per-worker pipe, and
+ * files are kept open until the client finishes.
+ */
+#define RECV_BUF_SIZE  (128 * 1024)
+
+struct client_file {
+	struct rb_node		node;
+	struct list_head	lru;
+	char			*name;
+	int			fd;	/* -1 if closed */
+};
+
+struct client_data {
+	struct list_head	list;
+	struct list_head	session;
+	int			sock;
+	char			*dirname;
+	char			host[NI_MAXHOST];
+	struct rb_root		files;
+	struct list_head	open_files;	/* in LRU order */
+	int			nr_open_files;
+
+	/* stats */
+	uint64_t		nr_msgs;
+	uint64_t		nr_bytes;
+	struct timespec		start;
+};
+
+struct recv_worker {
+	struct list_head	list;
+	pthread_t		thread;
+	struct opts		*opts;
+	struct client_data	*client;
+	int			pipe[2];
+	bool			no_splice;
+	void			*buf;
+};
+
+/* pending clients which are not assigned to a worker yet */
+static LIST_HEAD(client_list);
+static LIST_HEAD(worker_list);
+static int nr_workers;
+
+/* clients which own the directory (for additional streams) */
+static LIST_HEAD(session_list);
+
+/* number of workers which are idle and not reserved for a pending client */
+static int nr_idle_workers;
+
+static pthread_mutex_t recv_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t recv_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t session_cond = PTHREAD_COND_INITIALIZER;
+
+/* seconds to wait for the first stream to create the directory */
+#define STREAM_WAIT_TIME  10
+
+/* max number of open files per client, others are reopened on demand */
+#define MAX_CLIENT_FILES  64
+
+static void close_lru_file(struct client_data *c)
 {
-	struct client_data *c;
+	struct client_file *file;
 
-	list_for_each_entry(c, &client_list, list) {
-		if (c->sock == sock)
-			return c;
-	}
-	return NULL;
+	file = list_last_entry(&c->open_files, struct client_file, lru);
+	list_del(&file->lru);
+	close(file->fd);
+	file->fd = -1;
+	c->nr_open_files--;
 }
 
-#define O_CLIENT_FLAGS  (O_WRONLY | O_APPEND | O_CREAT)
-
-static void write_client_file(struct client_data *c, char *filename, int nr, ...)
+static int open_client_file(struct client_data *c, struct client_file *file)
 {
-	int i, fd;
-	va_list ap;
-	struct iovec iov[nr];
 	char buf[PATH_MAX];
+	int fd;
+
+	if (c->nr_open_files >= MAX_CLIENT_FILES)
+		close_lru_file(c);
 
-	snprintf(buf, sizeof(buf), "%s/%s", c->dirname, filename);
-	fd = open(buf, O_CLIENT_FLAGS, 0644);
+	/* splice() doesn't allow O_APPEND, move to the end instead */
+	snprintf(buf, sizeof(buf), "%s/%s", c->dirname, file->name);
+	fd = open(buf, O_WRONLY | O_CREAT, 0644);
+	if (fd < 0 && errno == EMFILE && c->nr_open_files > 0) {
+		/* other clients have too many files, give up one of ours */
+		close_lru_file(c);
+		fd = open(buf, O_WRONLY | O_CREAT, 0644);
+	}
 	if (fd < 0)
 		pr_err("file open failed: %s", buf);
+	lseek(fd, 0, SEEK_END);
 
-	va_start(ap, nr);
-	for (i = 0; i < nr; i++) {
-		iov[i].iov_base = va_arg(ap, void *);
-		iov[i].iov_len  = va_arg(ap, int);
+	file->fd = fd;
+	list_add(&file->lru, &c->open_files);
+	c->nr_open_files++;
+
+	return fd;
+}
+
+static int get_client_file(struct client_data *c, char *filename)
+{
+	struct rb_node *parent = NULL;
+	struct rb_node **p = &c->files.rb_node;
+	struct client_file *file;
+	int cmp;
+
+	while (*p) {
+		parent = *p;
+		file = rb_entry(parent, struct client_file, node);
+
+		cmp = strcmp(file->name, filename);
+		if (cmp == 0) {
+			if (file->fd < 0)
+				return open_client_file(c, file);
+
+			/* move it to the head of the LRU list */
+			list_move(&file->lru, &c->open_files);
+			return file->fd;
+		}
+
+		if (cmp > 0)
+			p = &parent->rb_left;
+		else
+			p = &parent->rb_right;
 	}
-	va_end(ap);
 
-	if (writev_all(fd, iov, nr) < 0)
-		pr_err("write client data failed on %s", buf);
+	file = xmalloc(sizeof(*file));
+	file->name = xstrdup(filename);
 
-	close(fd);
+	rb_link_node(&file->node, parent, p);
+	rb_insert_color(&file->node, &c->files);
+
+	return open_client_file(c, file);
+}
+
+static void close_client_files(struct client_data *c)
+{
+	struct rb_node *node;
+	struct client_file *file;
+
+	while (!RB_EMPTY_ROOT(&c->files)) {
+		node = rb_first(&c->files);
+		file = rb_entry(node, struct client_file, node);
+
+		rb_erase(node, &c->files);
+		if (file->fd >= 0)
+			close(file->fd);
+		free(file->name);
+		free(file);
+	}
+
+	INIT_LIST_HEAD(&c->open_files);
+	c->nr_open_files = 0;
+}
+
+static void copy_pipe_data(struct recv_worker *w, int fd, size_t len)
+{
+	ssize_t n;
+
+	while (len > 0) {
+		n = splice(w->pipe[0], NULL, fd, NULL, len, SPLICE_F_MOVE);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			break;
+
+		len -= n;
+	}
+
+	if (len == 0)
+		return;
+
+	/* the file doesn't support splice(), copy the rest in the pipe */
+	pr_dbg("splice to file failed, fallback to copy: %m\n");
+	w->no_splice = true;
+
+	if (read_all(w->pipe[0], w->buf, len) < 0 ||
+	    write_all(fd, w->buf, len) < 0)
+		pr_err("write client data failed");
 }
 
-static void recv_trace_dir_name(int sock, int len)
+/* save @len bytes from the client socket to @fd */
+static int recv_client_data(struct recv_worker *w, struct client_data *c,
+			    int fd, size_t len)
+{
+	ssize_t n;
+	size_t size;
+
+	c->nr_bytes += len;
+
+	while (len > 0 && !w->no_splice) {
+		size = len < RECV_BUF_SIZE ? len : RECV_BUF_SIZE;
+
+		n = splice(c->sock, NULL, w->pipe[1], NULL, size,
+			   SPLICE_F_MOVE | SPLICE_F_MORE);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0 && errno == EINVAL) {
+			pr_dbg("splice from socket failed, fallback to copy\n");
+			w->no_splice = true;
+			break;
+		}
+		if (n <= 0)
+			return -1;
+
+		copy_pipe_data(w, fd, n);
+		len -= n;
+	}
+
+	while (len > 0) {
+		size = len < RECV_BUF_SIZE ? len : RECV_BUF_SIZE;
+
+		if (read_all(c->sock, w->buf, size) < 0)
+			return -1;
+		if (write_all(fd, w->buf, size) < 0)
+			pr_err("write client data failed");
+
+		len -= size;
+	}
+	return 0;
+}
+
+static int recv_trace_dir_name(struct client_data *c, size_t len)
 {
 	char dirname[len + 1];
-	struct client_data *client;
 
-	if (read_all(sock, dirname, len) < 0)
-		pr_err("recv header failed");
+	if (read_all(c->sock, dirname, len) < 0)
+		return -1;
 	dirname[len] = '\0';
 
-	client = xmalloc(sizeof(*client));
-
-	client->sock = sock;
-	client->dirname = xstrdup(dirname);
-	INIT_LIST_HEAD(&client->list);
+	free(c->dirname);
+	c->dirname = xstrdup(dirname);
 
 	create_directory(dirname);
 	pr_dbg3("create directory: %s\n", dirname);
 
-	list_add(&client->list, &client_list);
+	pthread_mutex_lock(&recv_lock);
+	list_add(&c->session, &session_list);
+	pthread_cond_broadcast(&session_cond);
+	pthread_mutex_unlock(&recv_lock);
+	return 0;
 }
 
-static void recv_trace_data(int sock, int len)
+static int recv_trace_clock(struct client_data *c)
 {
-	struct client_data *client;
-	int32_t tid;
-	char *filename = NULL;
-	void *buffer;
+	struct uftrace_msg msg = {
+		.magic = htons(UFTRACE_MSG_MAGIC),
+		.type  = htons(UFTRACE_MSG_SEND_CLOCK),
+		.len   = htonl(sizeof(uint64_t)),
+	};
+	uint64_t now = htonq(clock_now());
+	struct iovec iov[] = {
+		{ .iov_base = &msg, .iov_len = sizeof(msg), },
+		{ .iov_base = &now, .iov_len = sizeof(now), },
+	};
 
-	client = find_client(sock);
-	if (client == NULL)
-		pr_err("no client on this socket\n");
+	return writev_all(c->sock, iov, ARRAY_SIZE(iov));
+}
 
-	if (read_all(sock, &tid, sizeof(tid)) < 0)
-		pr_err("recv tid failed");
-	tid = ntohl(tid);
+/* save the clock offset of the client for merging data later */
+static int recv_trace_clock_offset(struct client_data *c, size_t len)
+{
+	uint64_t result[2];
+	char buf[128];
+	int fd, n;
 
-	xasprintf(&filename, "%d.dat", tid);
+	if (len != sizeof(result) || read_all(c->sock, result, len) < 0)
+		return -1;
 
-	len -= sizeof(tid);
-	buffer = xmalloc(len);
+	n = snprintf(buf, sizeof(buf), "offset=%"PRId64" rtt=%"PRIu64"\n",
+		     (int64_t)ntohq(result[0]), ntohq(result[1]));
 
-	if (read_all(sock, buffer, len) < 0)
-		pr_err("recv buffer failed");
+	fd = get_client_file(c, "clock.txt");
+	if (write_all(fd, buf, n) < 0)
+		pr_err("write client data failed on %s/clock.txt", c->dirname);
 
-	write_client_file(client, filename, 1, buffer, len);
+	c->nr_bytes += len;
+	return 0;
+}
 
-	free(buffer);
-	free(filename);
+static bool find_stream_session(char *dirname)
+{
+	struct client_data *c;
+
+	list_for_each_entry(c, &session_list, session) {
+		if (!strcmp(c->dirname, dirname))
+			return true;
+	}
+	return false;
 }
 
-static void recv_trace_kernel_data(int sock, int len)
+/* additional stream joins to the directory of the first stream */
+static int recv_trace_stream(struct client_data *c, size_t len)
 {
-	struct client_data *client;
-	int32_t cpu;
-	char *filename = NULL;
-	void *buffer;
+	char dirname[len + 1];
+	struct timespec deadline;
+	bool found;
 
-	client = find_client(sock);
-	if (client == NULL)
-		pr_err("no client on this socket\n");
+	if (read_all(c->sock, dirname, len) < 0)
+		return -1;
+	dirname[len] = '\0';
+
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	deadline.tv_sec += STREAM_WAIT_TIME;
+
+	pthread_mutex_lock(&recv_lock);
+	while (!(found = find_stream_session(dirname)) && !uftrace_done) {
+		if (pthread_cond_timedwait(&session_cond, &recv_lock,
+					   &deadline) == ETIMEDOUT)
+			break;
+	}
+	pthread_mutex_unlock(&recv_lock);
 
-	if (read_all(sock, &cpu, sizeof(cpu)) < 0)
-		pr_err("recv cpu failed");
-	cpu = ntohl(cpu);
+	if (!found) {
+		pr_warn("cannot find the first stream for %s\n", dirname);
+		return -1;
+	}
 
-	xasprintf(&filename, "kernel-cpu%d.dat", cpu);
+	free(c->dirname);
+	c->dirname = xstrdup(dirname);
+	return 0;
+}
 
-	len -= sizeof(cpu);
-	buffer = xmalloc(len);
+static const char *data_filename_fmt(int type)
+{
+	switch (type) {
+	case UFTRACE_MSG_SEND_DATA:
+		return "%d.dat";
+	case UFTRACE_MSG_SEND_KERNEL_DATA:
+		return "kernel-cpu%d.dat";
+	case UFTRACE_MSG_SEND_PERF_DATA:
+		return "perf-cpu%d.dat";
+	}
+	return NULL;
+}
 
-	if (read_all(sock, buffer, len) < 0)
-		pr_err("recv buffer failed");
+/* data messages have a 32-bit id (tid or cpu) followed by raw data */
+static int recv_trace_data(struct recv_worker *w, struct client_data *c,
+			   int type, size_t len)
+{
+	const char *fmt = data_filename_fmt(type);
+	int32_t id;
+	char *filename = NULL;
+	int fd;
 
-	write_client_file(client, filename, 1, buffer, len);
+	if (len < sizeof(id) || read_all(c->sock, &id, sizeof(id)) < 0)
+		return -1;
 
-	free(buffer);
+	xasprintf(&filename, fmt, ntohl(id));
+	fd = get_client_file(c, filename);
 	free(filename);
+
+	return recv_client_data(w, c, fd, len - sizeof(id));
 }
 
-static void recv_trace_perf_data(int sock, int len)
+/* compressed data has original type, id and length followed by zlib data */
+static int recv_trace_compressed(struct client_data *c, size_t len)
 {
-	struct client_data *client;
-	int32_t cpu;
+#ifdef HAVE_LIBZ
+	int32_t hdr[3];
+	const char *fmt;
 	char *filename = NULL;
-	void *buffer;
+	void *zbuf, *data;
+	uLongf size;
+	int fd;
+	int ret = -1;
 
-	client = find_client(sock);
-	if (client == NULL)
-		pr_err("no client on this socket\n");
+	if (len < sizeof(hdr) || read_all(c->sock, hdr, sizeof(hdr)) < 0)
+		return -1;
 
-	if (read_all(sock, &cpu, sizeof(cpu)) < 0)
-		pr_err("recv cpu failed");
-	cpu = ntohl(cpu);
+	fmt = data_filename_fmt(ntohl(hdr[0]));
+	if (fmt == NULL)
+		return -1;
 
-	xasprintf(&filename, "perf-cpu%d.dat", cpu);
+	len -= sizeof(hdr);
+	size = ntohl(hdr[2]);
+
+	/* do not trust the size from peer */
+	if (size > MAX_COMPRESS_SIZE || len > compressBound(size)) {
+		pr_warn("invalid compressed data size from %s\n", c->host);
+		return -1;
+	}
 
-	len -= sizeof(cpu);
-	buffer = xmalloc(len);
+	zbuf = xmalloc(len);
+	data = xmalloc(size);
 
-	if (read_all(sock, buffer, len) < 0)
-		pr_err("recv buffer failed");
+	if (read_all(c->sock, zbuf, len) < 0)
+		goto out;
 
-	write_client_file(client, filename, 1, buffer, len);
+	if (uncompress(data, &size, zbuf, len) != Z_OK ||
+	    size != (uLongf)ntohl(hdr[2])) {
+		pr_warn("invalid compressed data from %s\n", c->host);
+		goto out;
+	}
 
-	free(buffer);
+	xasprintf(&filename, fmt, ntohl(hdr[1]));
+	fd = get_client_file(c, filename);
 	free(filename);
+
+	if (write_all(fd, data, size) < 0)
+		pr_err("write client data failed");
+
+	c->nr_bytes += sizeof(hdr) + len;
+	ret = 0;
+
+out:
+	free(zbuf);
+	free(data);
+	return ret;
+#else
+	pr_warn("cannot receive compressed data: zlib is not available\n");
+	return -1;
+#endif
 }
 
-static void recv_trace_metadata(int sock, int len)
+static int recv_trace_metadata(struct recv_worker *w, struct client_data *c,
+			       size_t len)
 {
-	struct client_data *client;
 	int32_t namelen;
-	char *filename = NULL;
-	void *filedata;
-
-	client = find_client(sock);
-	if (client == NULL)
-		pr_err("no client on this socket\n");
+	char *filename;
+	int fd;
 
-	if (read_all(sock, &namelen, sizeof(namelen)) < 0)
-		pr_err("recv symfile name length failed");
+	if (len < sizeof(namelen) ||
+	    read_all(c->sock, &namelen, sizeof(namelen)) < 0)
+		return -1;
 
 	namelen = ntohl(namelen);
-	filename = xmalloc(namelen + 1);
+	len -= sizeof(namelen);
+	if (namelen < 0 || (size_t)namelen > len)
+		return -1;
 
-	if (read_all(sock, filename, namelen) < 0)
-		pr_err("recv file name failed");
+	filename = xmalloc(namelen + 1);
+	if (read_all(c->sock, filename, namelen) < 0) {
+		free(filename);
+		return -1;
+	}
 	filename[namelen] = '\0';
 
-	len -= sizeof(namelen) + namelen;
-	filedata = xmalloc(len);
-
-	pr_dbg2("reading %s (%d bytes)\n", filename, len);
-	if (read_all(sock, filedata, len) < 0)
-		pr_err("recv symfile failed");
-
-	write_client_file(client, filename, 1, filedata, len);
+	len -= namelen;
+	pr_dbg2("reading %s (%zd bytes)\n", filename, len);
 
-	free(filedata);
+	fd = get_client_file(c, filename);
 	free(filename);
+
+	return recv_client_data(w, c, fd, len);
 }
 
-static void recv_trace_info(int sock, int len)
+static int recv_trace_info(struct client_data *c, size_t len)
 {
-	struct client_data *client;
 	struct uftrace_file_header hdr;
 	void *info;
+	int fd;
+	struct iovec iov[2];
 
-	client = find_client(sock);
-	if (client == NULL)
-		pr_err("no client on this socket\n");
-
-	if (read_all(sock, &hdr, sizeof(hdr)) < 0)
-		pr_err("recv file header failed");
+	if (len < sizeof(hdr) || read_all(c->sock, &hdr, sizeof(hdr)) < 0)
+		return -1;
 
 	hdr.version     = ntohl(hdr.version);
 	hdr.header_size = ntohs(hdr.header_size);
@@ -469,32 +1138,133 @@ static void recv_trace_info(int sock, int len)
 	len -= sizeof(hdr);
 	info = xmalloc(len);
 
-	if (read_all(sock, info, len) < 0)
-		pr_err("recv info failed");
+	if (read_all(c->sock, info, len) < 0) {
+		free(info);
+		return -1;
+	}
+
+	iov[0].iov_base = &hdr;
+	iov[0].iov_len  = sizeof(hdr);
+	iov[1].iov_base = info;
+	iov[1].iov_len  = len;
 
-	write_client_file(client, "info", 2, &hdr, sizeof(hdr), info, len);
+	fd = get_client_file(c, "info");
+	if (writev_all(fd, iov, ARRAY_SIZE(iov)) < 0)
+		pr_err("write client data failed on %s/info", c->dirname);
 
+	c->nr_bytes += sizeof(hdr) + len;
 	free(info);
+	return 0;
 }
 
-static void recv_trace_end(int sock, int efd)
+/* returns 1 if it receives the END message, 0 if it continues or -1 */
+static int handle_client_msg(struct recv_worker *w, struct client_data *c)
 {
-	struct client_data *client;
+	struct uftrace_msg msg;
+	int ret = -1;
 
-	client = find_client(sock);
-	if (client) {
-		list_del(&client->list);
+	if (read_all(c->sock, &msg, sizeof(msg)) < 0) {
+		pr_dbg("client socket closed\n");
+		return -1;
+	}
 
-		pr_dbg("wrote client data to %s\n", client->dirname);
+	msg.magic = ntohs(msg.magic);
+	msg.type  = ntohs(msg.type);
+	msg.len   = ntohl(msg.len);
+
+	if (msg.magic != UFTRACE_MSG_MAGIC) {
+		pr_warn("invalid message from %s\n", c->host);
+		return -1;
+	}
 
-		free(client->dirname);
-		free(client);
+	/* every message except the dir name needs the directory */
+	if (c->dirname == NULL && msg.type != UFTRACE_MSG_SEND_DIR_NAME &&
+	    msg.type != UFTRACE_MSG_SEND_STREAM &&
+	    msg.type != UFTRACE_MSG_SEND_END) {
+		pr_warn("no directory for client %s\n", c->host);
+		return -1;
 	}
 
-	if (epoll_ctl(efd, EPOLL_CTL_DEL, sock, NULL) < 0)
-		pr_err("epoll del failed");
+	c->nr_msgs++;
 
-	close(sock);
+	switch (msg.type) {
+	case UFTRACE_MSG_SEND_DIR_NAME:
+		pr_dbg2("receive UFTRACE_MSG_SEND_DIR_NAME\n");
+		ret = recv_trace_dir_name(c, msg.len);
+		break;
+	case UFTRACE_MSG_SEND_STREAM:
+		pr_dbg2("receive UFTRACE_MSG_SEND_STREAM\n");
+		ret = recv_trace_stream(c, msg.len);
+		break;
+	case UFTRACE_MSG_SEND_DATA:
+		pr_dbg2("receive UFTRACE_MSG_SEND_DATA\n");
+		ret = recv_trace_data(w, c, msg.type, msg.len);
+		break;
+	case UFTRACE_MSG_SEND_KERNEL_DATA:
+		pr_dbg2("receive UFTRACE_MSG_SEND_KERNEL_DATA\n");
+		ret = recv_trace_data(w, c, msg.type, msg.len);
+		break;
+	case UFTRACE_MSG_SEND_PERF_DATA:
+		pr_dbg2("receive UFTRACE_MSG_SEND_PERF_DATA\n");
+		ret = recv_trace_data(w, c, msg.type, msg.len);
+		break;
+	case UFTRACE_MSG_SEND_COMPRESSED:
+		pr_dbg2("receive UFTRACE_MSG_SEND_COMPRESSED\n");
+		ret = recv_trace_compressed(c, msg.len);
+		break;
+	case UFTRACE_MSG_SEND_CLOCK:
+		pr_dbg2("receive UFTRACE_MSG_SEND_CLOCK\n");
+		ret = recv_trace_clock(c);
+		break;
+	case UFTRACE_MSG_SEND_CLOCK_OFFSET:
+		pr_dbg2("receive UFTRACE_MSG_SEND_CLOCK_OFFSET\n");
+		ret = recv_trace_clock_offset(c, msg.len);
+		break;
+	case UFTRACE_MSG_SEND_INFO:
+		pr_dbg2("receive UFTRACE_MSG_SEND_INFO\n");
+		ret = recv_trace_info(c, msg.len);
+		break;
+	case UFTRACE_MSG_SEND_META_DATA:
+		pr_dbg2("receive UFTRACE_MSG_SEND_META_DATA\n");
+		ret = recv_trace_metadata(w, c, msg.len);
+		break;
+	case UFTRACE_MSG_SEND_END:
+		pr_dbg2("receive UFTRACE_MSG_SEND_END\n");
+		ret = 1;
+		break;
+	default:
+		pr_dbg("unknown message: %d\n", msg.type);
+		ret = 0;
+		break;
+	}
+
+	if (ret < 0)
+		pr_warn("receiving data from %s failed\n", c->host);
+	return ret;
+}
+
+static void finish_client(struct client_data *c)
+{
+	struct timespec now;
+	double elapsed;
+
+	close_client_files(c);
+	close(c->sock);
+
+	if (c->dirname) {
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		elapsed = (now.tv_sec - c->start.tv_sec) +
+			  (now.tv_nsec - c->start.tv_nsec) / 1e9;
+
+		pr_dbg("wrote client data to %s\n", c->dirname);
+		pr_dbg("%s: %"PRIu64" bytes in %"PRIu64" messages, "
+		       "%.3f sec (%.2f MB/sec)\n", c->host, c->nr_bytes,
+		       c->nr_msgs, elapsed,
+		       elapsed ? c->nr_bytes / elapsed / (1024 * 1024) : 0);
+	}
+
+	free(c->dirname);
+	free(c);
 }
 
 static void execute_run_cmd(char **argv) {
@@ -511,6 +1281,109 @@ static void execute_run_cmd(char **argv) {
 	}
 }
 
+static void *recv_worker_main(void *arg)
+{
+	struct recv_worker *w = arg;
+	struct client_data *c;
+	int ret;
+
+	while (true) {
+		pthread_mutex_lock(&recv_lock);
+		while (list_empty(&client_list) && !uftrace_done)
+			pthread_cond_wait(&recv_cond, &recv_lock);
+
+		if (uftrace_done) {
+			pthread_mutex_unlock(&recv_lock);
+			break;
+		}
+
+		c = list_first_entry(&client_list, struct client_data, list);
+		list_del(&c->list);
+		w->client = c;
+		pthread_mutex_unlock(&recv_lock);
+
+		do {
+			ret = handle_client_msg(w, c);
+		}
+		while (ret == 0);
+
+		pthread_mutex_lock(&recv_lock);
+		list_del_init(&c->session);
+		w->client = NULL;
+		nr_idle_workers++;
+		pthread_mutex_unlock(&recv_lock);
+
+		finish_client(c);
+
+		/* run the command after all files are closed */
+		if (ret > 0)
+			execute_run_cmd(w->opts->run_cmd);
+	}
+	return NULL;
+}
+
+/* should be called with recv_lock held */
+static void start_worker(struct opts *opts)
+{
+	struct recv_worker *w;
+
+	w = xzalloc(sizeof(*w));
+	w->opts = opts;
+	w->buf = xmalloc(RECV_BUF_SIZE);
+
+	if (pipe(w->pipe) < 0) {
+		pr_dbg("cannot create pipe, splice is disabled: %m\n");
+		w->pipe[0] = w->pipe[1] = -1;
+		w->no_splice = true;
+	}
+	else {
+		/* it's ok to fail, splice will move less data at once */
+		fcntl(w->pipe[1], F_SETPIPE_SZ, RECV_BUF_SIZE);
+	}
+
+	if (pthread_create(&w->thread, NULL, recv_worker_main, w) != 0)
+		pr_err("cannot create recv worker");
+
+	list_add_tail(&w->list, &worker_list);
+	nr_idle_workers++;
+	nr_workers++;
+
+	pr_dbg2("start a new worker (total %d)\n", nr_workers);
+}
+
+static void stop_workers(void)
+{
+	struct recv_worker *w, *tmp_w;
+	struct client_data *c, *tmp_c;
+
+	/* wake up idle workers and disconnect active clients */
+	pthread_mutex_lock(&recv_lock);
+	uftrace_done = true;
+	list_for_each_entry(w, &worker_list, list) {
+		if (w->client)
+			shutdown(w->client->sock, SHUT_RDWR);
+	}
+	pthread_cond_broadcast(&recv_cond);
+	pthread_mutex_unlock(&recv_lock);
+
+	list_for_each_entry_safe(w, tmp_w, &worker_list, list) {
+		pthread_join(w->thread, NULL);
+
+		if (w->pipe[0] >= 0) {
+			close(w->pipe[0]);
+			close(w->pipe[1]);
+		}
+		list_del(&w->list);
+		free(w->buf);
+		free(w);
+	}
+
+	list_for_each_entry_safe(c, tmp_c, &client_list, list) {
+		list_del(&c->list);
+		finish_client(c);
+	}
+}
+
 static void epoll_add(int efd, int fd, unsigned event)
 {
 	struct epoll_event ev = {
@@ -524,80 +1397,39 @@ static void epoll_add(int efd, int fd, unsigned event)
 		pr_err("epoll add failed");
 }
 
-static void handle_server_sock(struct epoll_event *ev, int efd)
+static void handle_server_sock(struct epoll_event *ev, struct opts *opts)
 {
-	int client;
 	int sock = ev->data.fd;
+	struct client_data *c;
 	struct sockaddr_in addr;
 	socklen_t len = sizeof(addr);
-	char hbuf[NI_MAXHOST];
 
-	client = accept(sock, &addr, &len);
-	if (client < 0)
+	c = xzalloc(sizeof(*c));
+
+	c->sock = accept(sock, &addr, &len);
+	if (c->sock < 0)
 		pr_err("socket accept failed");
 
-	getnameinfo((struct sockaddr *)&addr, len, hbuf, sizeof(hbuf),
+	getnameinfo((struct sockaddr *)&addr, len, c->host, sizeof(c->host),
 		    NULL, 0, NI_NUMERICHOST);
 
-	epoll_add(efd, client, EPOLLIN);
-	pr_dbg("new connection added from %s\n", hbuf);
-}
+	c->files = RB_ROOT;
+	INIT_LIST_HEAD(&c->open_files);
+	INIT_LIST_HEAD(&c->session);
+	clock_gettime(CLOCK_MONOTONIC, &c->start);
 
-static void handle_client_sock(struct epoll_event *ev, int efd, struct opts *opts)
-{
-	int sock = ev->data.fd;
-	struct uftrace_msg msg;
-
-	if (ev->events & (EPOLLERR | EPOLLHUP)) {
-		pr_dbg("client socket closed\n");
-		recv_trace_end(sock, efd);
-		return;
-	}
-
-	if (read_all(sock, &msg, sizeof(msg)) < 0)
-		pr_err("message recv failed");
+	pthread_mutex_lock(&recv_lock);
+	list_add_tail(&c->list, &client_list);
 
-	msg.magic = ntohs(msg.magic);
-	msg.type  = ntohs(msg.type);
-	msg.len   = ntohl(msg.len);
+	/* reserve an idle worker for this client */
+	if (nr_idle_workers == 0)
+		start_worker(opts);
+	nr_idle_workers--;
 
-	if (msg.magic != UFTRACE_MSG_MAGIC)
-		pr_err_ns("invalid message\n");
+	pthread_cond_signal(&recv_cond);
+	pthread_mutex_unlock(&recv_lock);
 
-	switch (msg.type) {
-	case UFTRACE_MSG_SEND_DIR_NAME:
-		pr_dbg2("receive UFTRACE_MSG_SEND_DIR_NAME\n");
-		recv_trace_dir_name(sock, msg.len);
-		break;
-	case UFTRACE_MSG_SEND_DATA:
-		pr_dbg2("receive UFTRACE_MSG_SEND_DATA\n");
-		recv_trace_data(sock, msg.len);
-		break;
-	case UFTRACE_MSG_SEND_KERNEL_DATA:
-		pr_dbg2("receive UFTRACE_MSG_SEND_KERNEL_DATA\n");
-		recv_trace_kernel_data(sock, msg.len);
-		break;
-	case UFTRACE_MSG_SEND_PERF_DATA:
-		pr_dbg2("receive UFTRACE_MSG_SEND_PERF_DATA\n");
-		recv_trace_perf_data(sock, msg.len);
-		break;
-	case UFTRACE_MSG_SEND_INFO:
-		pr_dbg2("receive UFTRACE_MSG_SEND_INFO\n");
-		recv_trace_info(sock, msg.len);
-		break;
-	case UFTRACE_MSG_SEND_META_DATA:
-		pr_dbg2("receive UFTRACE_MSG_SEND_META_DATA\n");
-		recv_trace_metadata(sock, msg.len);
-		break;
-	case UFTRACE_MSG_SEND_END:
-		pr_dbg2("receive UFTRACE_MSG_SEND_END\n");
-		recv_trace_end(sock, efd);
-		execute_run_cmd(opts->run_cmd);
-		break;
-	default:
-		pr_dbg("unknown message: %d\n", msg.type);
-		break;
-	}
+	pr_dbg("new connection added from %s\n", c->host);
 }
 
 int command_recv(int argc, char *argv[], struct opts *opts)
@@ -618,6 +1450,7 @@ int command_recv(int argc, char *argv[], struct opts *opts)
 	}
 
 	sock = server_socket(opts);
+	/* workers will inherit the signal mask */
 	sigfd = signal_fd(opts);
 
 	efd = epoll_create1(EPOLL_CLOEXEC);
@@ -644,12 +1477,12 @@ int command_recv(int argc, char *argv[], struct opts *opts)
 					uftrace_done = true;
 			}
 			else if (ev[i].data.fd == sock)
-				handle_server_sock(&ev[i], efd);
-			else
-				handle_client_sock(&ev[i], efd, opts);
+				handle_server_sock(&ev[i], opts);
 		}
 	}
 
+	stop_workers();
+
 	close(efd);
 	close(sigfd);
 	close(sock);
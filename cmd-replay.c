@@ -332,8 +332,19 @@ static void print_event(struct ftrace_task_handle *task,
 	char *evt_name = get_event_name(task->h, evt_id);
 
 	if (evt_id >= EVENT_ID_USER) {
-		/* TODO: some events might have arguments */
+		uint64_t *args = task->args.data;
+		unsigned i;
+
 		pr_color(color, "%s", evt_name);
+
+		/* SDT arguments are saved as an array of 64-bit values */
+		if (urec->more && (task->h->hdr.feat_mask & EVENT_ARGUMENT)) {
+			for (i = 0; i < task->args.len / sizeof(*args); i++) {
+				pr_color(color, "%s%#"PRIx64, i ? ", " : " (",
+					 args[i]);
+			}
+			pr_color(color, ")");
+		}
 	}
 	else if (evt_id >= EVENT_ID_PERF) {
 		pr_color(color, "%s", evt_name);
@@ -341,6 +352,11 @@ static void print_event(struct ftrace_task_handle *task,
 	else if (evt_id >= EVENT_ID_BUILTIN) {
 		struct uftrace_proc_statm *statm;
 		struct uftrace_page_fault *page_fault;
+		struct uftrace_pmu_cycle *cycle;
+		struct uftrace_pmu_cache *cache;
+		struct uftrace_pmu_branch *branch;
+		struct uftrace_max_rss *max_rss;
+		struct uftrace_ctx_switch *ctxsw;
 
 		switch (evt_id) {
 		case EVENT_ID_PROC_STATM:
@@ -353,6 +369,33 @@ static void print_event(struct ftrace_task_handle *task,
 			pr_color(color, "%s (major=%"PRIu64", minor=%"PRIu64")",
 				 evt_name, page_fault->major, page_fault->minor);
 			return;
+		case EVENT_ID_READ_PMU_CYCLE:
+			cycle = task->args.data;
+			pr_color(color, "%s (cycle=%"PRIu64", instructions=%"PRIu64", IPC=%.2f)",
+				 evt_name, cycle->cycles, cycle->instrs,
+				 cycle->cycles ? (double)cycle->instrs / cycle->cycles : 0);
+			return;
+		case EVENT_ID_READ_PMU_CACHE:
+			cache = task->args.data;
+			pr_color(color, "%s (refers=%"PRIu64", misses=%"PRIu64", miss=%.2f%%)",
+				 evt_name, cache->refers, cache->misses,
+				 cache->refers ? 100.0 * cache->misses / cache->refers : 0);
+			return;
+		case EVENT_ID_READ_PMU_BRANCH:
+			branch = task->args.data;
+			pr_color(color, "%s (branch=%"PRIu64", misses=%"PRIu64", miss=%.2f%%)",
+				 evt_name, branch->branch, branch->misses,
+				 branch->branch ? 100.0 * branch->misses / branch->branch : 0);
+			return;
+		case EVENT_ID_READ_MAX_RSS:
+			max_rss = task->args.data;
+			pr_color(color, "%s (+%"PRIu64"KB)", evt_name, max_rss->grow);
+			return;
+		case EVENT_ID_READ_CTX_SWITCH:
+			ctxsw = task->args.data;
+			pr_color(color, "%s (voluntary=%"PRIu64", involuntary=%"PRIu64")",
+				 evt_name, ctxsw->voluntary, ctxsw->involuntary);
+			return;
 		default:
 			pr_color(color, "%s", evt_name);
 			break;
@@ -887,7 +930,7 @@ static bool skip_sys_exit(struct opts *opts, struct ftrace_task_handle *task)
 		return false;
 
 	ip = task->func_stack[0].addr;
-	sym = find_symtabs(&task->h->sessions.first->symtabs, ip);
+	sym = find_symtabs(task->h->sessions.first->symtabs, ip);
 
 	if (sym && !strncmp(sym->name, "sys_exit", 8))
 		return true;
@@ -6,8 +6,10 @@
 #include "utils/utils.h"
 #include "utils/rbtree.h"
 #include "utils/symbol.h"
+#include "utils/filter.h"
 #include "utils/list.h"
 #include "utils/fstack.h"
+#include "utils/cache.h"
 
 
 enum {
@@ -17,6 +19,9 @@ enum {
 	AVG_ANY,
 } avg_mode = AVG_NONE;
 
+/* number of read events saved as diffs: pmu-*, max-rss and ctx-switch */
+#define NR_REPORT_READ  (EVENT_ID_READ_CTX_SWITCH - EVENT_ID_READ_PMU_CYCLE + 1)
+
 struct trace_entry {
 	int pid;
 	struct sym *sym;
@@ -28,10 +33,18 @@ struct trace_entry {
 	uint64_t time_min;
 	uint64_t time_max;
 	unsigned long nr_called;
+	/* sum of counter diffs (read=pmu-*, max-rss and ctx-switch) */
+	unsigned read_types;
+	uint64_t read_val[NR_REPORT_READ * 2];
 	struct trace_entry *pair;
 	struct rb_node link;
+	/* the sym (and its name) is allocated when read from the cache */
+	bool sym_cached;
 };
 
+/* read types found in the data (bit of the read event index) */
+static unsigned report_read_types;
+
 /* this will be used when pair entry wasn't found for diff */
 static struct trace_entry dummy_entry;
 
@@ -47,6 +60,7 @@ static void insert_entry(struct rb_root *root, struct trace_entry *te, bool thre
 	struct rb_node *parent = NULL;
 	struct rb_node **p = &root->rb_node;
 	uint64_t entry_time = 0;
+	int i;
 
 	pr_dbg3("%s: [%5d] %"PRIu64"/%"PRIu64" (%lu) %-s\n",
 		__func__, te->pid, te->time_total, te->time_self, te->nr_called,
@@ -82,6 +96,10 @@ static void insert_entry(struct rb_root *root, struct trace_entry *te, bool thre
 
 			entry->time_recursive += te->time_recursive;
 
+			for (i = 0; i < NR_REPORT_READ * 2; i++)
+				entry->read_val[i] += te->read_val[i];
+			entry->read_types |= te->read_types;
+
 			if (entry->sym == NULL && te->sym)
 				entry->sym = te->sym;
 
@@ -97,6 +115,7 @@ static void insert_entry(struct rb_root *root, struct trace_entry *te, bool thre
 	entry = xmalloc(sizeof(*entry));
 	entry->pid = te->pid;
 	entry->sym = te->sym;
+	entry->sym_cached = false;
 	entry->addr = te->addr;
 	entry->time_total = te->time_total;
 	entry->time_self  = te->time_self;
@@ -112,6 +131,9 @@ static void insert_entry(struct rb_root *root, struct trace_entry *te, bool thre
 	entry->time_max = entry_time;
 	entry->time_recursive = te->time_recursive;
 
+	entry->read_types = te->read_types;
+	memcpy(entry->read_val, te->read_val, sizeof(entry->read_val));
+
 	rb_link_node(&entry->link, parent, p);
 	rb_insert_color(&entry->link, root);
 }
@@ -132,6 +154,9 @@ static void fill_entry_sym(struct trace_entry *te,
 	te->time_self  = te->time_total - fstack->child_time;
 	te->nr_called  = 1;
 
+	te->read_types = 0;
+	memset(te->read_val, 0, sizeof(te->read_val));
+
 	/* some LOST entries make invalid self tiem */
 	if (te->time_self > te->time_total)
 		te->time_self = te->time_total;
@@ -155,13 +180,13 @@ static bool fill_entry(struct trace_entry *te, struct ftrace_task_handle *task,
 	sess = sessions->first;
 
 	/* skip user functions if --kernel-only is set */
-	if (opts->kernel_only && !is_kernel_address(&sess->symtabs, addr))
+	if (opts->kernel_only && !is_kernel_address(sess->symtabs, addr))
 		return false;
 
 	if (opts->kernel_skip_out) {
 		/* skip kernel functions outside user functions */
 		if (task->user_stack_count == 0 &&
-		    is_kernel_address(&sess->symtabs, addr))
+		    is_kernel_address(sess->symtabs, addr))
 			return false;
 	}
 
@@ -171,6 +196,27 @@ static bool fill_entry(struct trace_entry *te, struct ftrace_task_handle *task,
 	return true;
 }
 
+/* read diffs are saved right before the exit of the function */
+struct pending_read {
+	unsigned types;
+	uint64_t val[NR_REPORT_READ * 2];
+};
+
+static void save_pending_read(struct pending_read *pp,
+			     struct ftrace_task_handle *task, uint64_t evt_id)
+{
+	int idx = evt_id - EVENT_ID_READ_PMU_CYCLE;
+	uint64_t *val = task->args.data;
+
+	if (val == NULL || task->args.len < sizeof(*val))
+		return;
+
+	/* max-rss has a single value */
+	pp->types |= 1U << idx;
+	pp->val[idx * 2]     = val[0];
+	pp->val[idx * 2 + 1] = task->args.len >= 2 * sizeof(*val) ? val[1] : 0;
+}
+
 static void build_function_tree(struct ftrace_file_handle *handle,
 				struct rb_root *root, struct opts *opts)
 {
@@ -178,8 +224,11 @@ static void build_function_tree(struct ftrace_file_handle *handle,
 	struct uftrace_record *rstack;
 	struct ftrace_task_handle *task;
 	struct fstack *fstack;
+	struct pending_read *pending;
 	int i;
 
+	pending = xcalloc(handle->nr_tasks, sizeof(*pending));
+
 	while (read_rstack(handle, &task) >= 0 && !uftrace_done) {
 		rstack = task->rstack;
 
@@ -208,6 +257,11 @@ static void build_function_tree(struct ftrace_file_handle *handle,
 					       sched_sym.addr);
 				insert_entry(root, &te, false);
 			}
+			else if (rstack->addr >= EVENT_ID_READ_PMU_CYCLE &&
+				 rstack->addr <= EVENT_ID_READ_CTX_SWITCH) {
+				save_pending_read(&pending[task - handle->tasks],
+						 task, rstack->addr);
+			}
 			continue;
 		}
 
@@ -230,10 +284,21 @@ static void build_function_tree(struct ftrace_file_handle *handle,
 		}
 
 		/* rstack->type == UFTRACE_EXIT */
-		if (fill_entry(&te, task, rstack->time, rstack->addr, opts))
+		if (fill_entry(&te, task, rstack->time, rstack->addr, opts)) {
+			struct pending_read *pp = &pending[task - handle->tasks];
+
+			if (pp->types) {
+				te.read_types = pp->types;
+				memcpy(te.read_val, pp->val, sizeof(te.read_val));
+				report_read_types |= pp->types;
+			}
 			insert_entry(root, &te, false);
+		}
+		pending[task - handle->tasks].types = 0;
 	}
 
+	free(pending);
+
 	if (uftrace_done)
 		return;
 
@@ -273,6 +338,154 @@ static void build_function_tree(struct ftrace_file_handle *handle,
 	}
 }
 
+static void write_function_cache(struct uftrace_cache *cache,
+				 struct rb_root *root)
+{
+	struct rb_node *node;
+	struct trace_entry *entry;
+	uint64_t count = 0;
+	int i;
+
+	for (node = rb_first(root); node; node = rb_next(node))
+		count++;
+
+	cache_write_u64(cache, count);
+
+	for (node = rb_first(root); node; node = rb_next(node)) {
+		entry = rb_entry(node, struct trace_entry, link);
+
+		cache_write_u64(cache, entry->pid);
+		cache_write_u64(cache, entry->addr);
+		cache_write_u64(cache, entry->time_total);
+		cache_write_u64(cache, entry->time_self);
+		cache_write_u64(cache, entry->time_recursive);
+		cache_write_u64(cache, entry->time_min);
+		cache_write_u64(cache, entry->time_max);
+		cache_write_u64(cache, entry->nr_called);
+		cache_write_u64(cache, entry->read_types);
+		for (i = 0; i < NR_REPORT_READ * 2; i++)
+			cache_write_u64(cache, entry->read_val[i]);
+
+		/* symbol might not be available */
+		cache_write_str(cache, entry->sym ? entry->sym->name : NULL);
+		if (entry->sym) {
+			cache_write_u64(cache, entry->sym->addr);
+			cache_write_u64(cache, entry->sym->size);
+			cache_write_u64(cache, entry->sym->type);
+		}
+	}
+}
+
+static void free_entry(struct trace_entry *entry)
+{
+	if (entry->sym_cached) {
+		free(entry->sym->name);
+		free(entry->sym);
+	}
+	free(entry);
+}
+
+static void delete_function_tree(struct rb_root *root)
+{
+	while (!RB_EMPTY_ROOT(root)) {
+		struct rb_node *node = rb_first(root);
+
+		rb_erase(node, root);
+		free_entry(rb_entry(node, struct trace_entry, link));
+	}
+}
+
+static bool read_function_cache(struct uftrace_cache *cache,
+				struct rb_root *root)
+{
+	struct rb_node *parent = NULL;
+	struct rb_node **p = &root->rb_node;
+	struct trace_entry *entry;
+	uint64_t count, val[9 + NR_REPORT_READ * 2];
+	char *name;
+	unsigned i;
+
+	if (cache_read_u64(cache, &count) < 0)
+		return false;
+
+	while (count--) {
+		for (i = 0; i < ARRAY_SIZE(val); i++) {
+			if (cache_read_u64(cache, &val[i]) < 0)
+				goto broken;
+		}
+
+		entry = xzalloc(sizeof(*entry));
+		entry->pid            = val[0];
+		entry->addr           = val[1];
+		entry->time_total     = val[2];
+		entry->time_self      = val[3];
+		entry->time_recursive = val[4];
+		entry->time_min       = val[5];
+		entry->time_max       = val[6];
+		entry->nr_called      = val[7];
+		entry->read_types      = val[8];
+		memcpy(entry->read_val, &val[9], sizeof(entry->read_val));
+
+		report_read_types |= entry->read_types;
+
+		name = cache_read_str(cache);
+		if (name) {
+			for (i = 0; i < 3; i++) {
+				if (cache_read_u64(cache, &val[i]) < 0) {
+					free(name);
+					free(entry);
+					goto broken;
+				}
+			}
+
+			entry->sym = xmalloc(sizeof(*entry->sym));
+			entry->sym->name = name;
+			entry->sym->addr = val[0];
+			entry->sym->size = val[1];
+			entry->sym->type = val[2];
+			entry->sym_cached = true;
+		}
+
+		/* entries were saved in order, just add it to the rightmost */
+		rb_link_node(&entry->link, parent, p);
+		rb_insert_color(&entry->link, root);
+
+		parent = &entry->link;
+		p = &parent->rb_right;
+	}
+	return true;
+
+broken:
+	delete_function_tree(root);
+	return false;
+}
+
+/* build function tree from the cache if possible, and save it otherwise */
+static void load_function_tree(struct ftrace_file_handle *handle,
+			       struct rb_root *root, struct opts *opts)
+{
+	struct uftrace_cache cache = {};
+	char *dirname = (char *)handle->dirname;
+
+	if (!opts->no_cache) {
+		cache_setup(&cache, opts, "report", NULL);
+
+		if (cache_open_read(&cache, dirname) &&
+		    read_function_cache(&cache, root)) {
+			cache_finish(&cache, true);
+			return;
+		}
+	}
+
+	build_function_tree(handle, root, opts);
+
+	if (!opts->no_cache && !uftrace_done &&
+	    cache_open_write(&cache, dirname))
+		write_function_cache(&cache, root);
+
+	cache_finish(&cache, !uftrace_done);
+}
+
 struct sort_item {
 	const char *name;
 	int (*cmp)(struct trace_entry *a, struct trace_entry *b, int column);
@@ -658,8 +871,49 @@ static void print_and_delete(struct rb_root *root,
 		print_func(entry);
 
 		if (entry->pair && entry->pair != &dummy_entry)
-			free(entry->pair);
-		free(entry);
+			free_entry(entry->pair);
+		free_entry(entry);
+	}
+}
+
+static const char *read_column_names[NR_REPORT_READ] = {
+	"IPC", "Cache miss", "Branch miss", "RSS grow", "Ctx switch",
+};
+
+static void print_read_header(const char *line)
+{
+	int i;
+
+	for (i = 0; i < NR_REPORT_READ; i++) {
+		if (report_read_types & (1U << i))
+			pr_out("  %11.11s", line ?: read_column_names[i]);
+	}
+}
+
+/* show IPC for pmu-cycle, miss rates for other pmu and sums for rusage */
+static void print_read_value(struct trace_entry *entry)
+{
+	int i;
+
+	for (i = 0; i < NR_REPORT_READ; i++) {
+		uint64_t base  = entry->read_val[i * 2];
+		uint64_t value = entry->read_val[i * 2 + 1];
+
+		if (!(report_read_types & (1U << i)))
+			continue;
+
+		if (!(entry->read_types & (1U << i)))
+			pr_out("  %11s", "");
+		else if (i + EVENT_ID_READ_PMU_CYCLE == EVENT_ID_READ_MAX_RSS)
+			pr_out("  %9"PRIu64"KB", base);
+		else if (i + EVENT_ID_READ_PMU_CYCLE == EVENT_ID_READ_CTX_SWITCH)
+			pr_out("  %11"PRIu64, base + value);
+		else if (base == 0)
+			pr_out("  %11s", "");
+		else if (i == 0)
+			pr_out("  %11.2f", (double)value / base);
+		else
+			pr_out("  %10.2f%%", 100.0 * value / base);
 	}
 }
 
@@ -672,7 +926,9 @@ static void print_function(struct trace_entry *entry)
 		print_time_unit(entry->time_total - entry->time_recursive);
 		pr_out("  ");
 		print_time_unit(entry->time_self);
-		pr_out("  %10lu  %-s\n", entry->nr_called, symname);
+		pr_out("  %10lu", entry->nr_called);
+		print_read_value(entry);
+		pr_out("  %-s\n", symname);
 	} else {
 		pr_out("  ");
 		print_time_unit(entry->time_avg);
@@ -691,9 +947,10 @@ static void report_functions(struct ftrace_file_handle *handle, struct opts *opt
 	struct rb_root name_tree = RB_ROOT;
 	struct rb_root sort_tree = RB_ROOT;
 	const char f_format[] = "  %10.10s  %10.10s  %10.10s  %-s\n";
+	const char p_format[] = "  %10.10s  %10.10s  %10.10s";
 	const char line[] = "====================================";
 
-	build_function_tree(handle, &name_tree, opts);
+	load_function_tree(handle, &name_tree, opts);
 
 	while (!RB_EMPTY_ROOT(&name_tree) && !uftrace_done) {
 		struct rb_node *node;
@@ -714,16 +971,47 @@ static void report_functions(struct ftrace_file_handle *handle, struct opts *opt
 	if (uftrace_done)
 		return;
 
-	if (avg_mode == AVG_NONE)
-		pr_out(f_format, "Total time", "Self time", "Calls", "Function");
-	else if (avg_mode == AVG_TOTAL)
-		pr_out(f_format, "Avg total", "Min total", "Max total", "Function");
-	else if (avg_mode == AVG_SELF)
-		pr_out(f_format, "Avg self", "Min self", "Max self", "Function");
+	if (avg_mode == AVG_NONE && report_read_types) {
+		/* hardware counter columns before the function name */
+		pr_out(p_format, "Total time", "Self time", "Calls");
+		print_read_header(NULL);
+		pr_out("  %-s\n", "Function");
+		pr_out(p_format, line, line, line);
+		print_read_header(line);
+		pr_out("  %-s\n", line);
+	}
+	else {
+		if (avg_mode == AVG_NONE)
+			pr_out(f_format, "Total time", "Self time", "Calls", "Function");
+		else if (avg_mode == AVG_TOTAL)
+			pr_out(f_format, "Avg total", "Min total", "Max total", "Function");
+		else if (avg_mode == AVG_SELF)
+			pr_out(f_format, "Avg self", "Min self", "Max self", "Function");
 
-	pr_out(f_format, line, line, line, line);
+		pr_out(f_format, line, line, line, line);
+	}
 
 	print_and_delete(&sort_tree, print_function);
+
+	/* self time of the callers includes the dropped functions */
+	if (handle->hdr.info_mask & (1UL << AUTO_NOTRACE)) {
+		pr_out("\n  # %d function(s) dropped by --auto-notrace: %s\n",
+		       handle->info.nr_auto_notrace, handle->info.auto_notrace);
+	}
+}
+
+/* the first task in each (merged) data is the main thread */
+static bool is_main_task(struct ftrace_file_handle *handle,
+			 struct ftrace_task_handle *task)
+{
+	int host = task->tid / UFTRACE_HOST_TID_BASE;
+	int i;
+
+	for (i = 0; i < handle->nr_tasks; i++) {
+		if (handle->tasks[i].tid / UFTRACE_HOST_TID_BASE == host)
+			return task == &handle->tasks[i];
+	}
+	return false;
 }
 
 static struct sym * find_task_sym(struct ftrace_file_handle *handle,
@@ -731,10 +1019,9 @@ static struct sym * find_task_sym(struct ftrace_file_handle *handle,
 				  struct uftrace_record *rstack)
 {
 	struct sym *sym;
-	struct ftrace_task_handle *main_task = &handle->tasks[0];
 	struct uftrace_session *sess = find_task_session(&handle->sessions,
 							 task->tid, rstack->time);
-	struct symtabs *symtabs = &sess->symtabs;
+	struct symtabs *symtabs = sess->symtabs;
 
 	if (task->func)
 		return task->func;
@@ -744,7 +1031,7 @@ static struct sym * find_task_sym(struct ftrace_file_handle *handle,
 		return NULL;
 	}
 
-	if (task == main_task) {
+	if (is_main_task(handle, task)) {
 		/* This is the main thread */
 		task->func = sym = find_symname(&symtabs->symtab, "main");
 		if (sym)
@@ -870,7 +1157,7 @@ static void sort_by_name(struct rb_root *root, struct trace_entry *te)
 			if (entry->time_max < te->time_max)
 				entry->time_max = te->time_max;
 
-			free(te);
+			free_entry(te);
 			return;
 		};
 
@@ -1069,6 +1356,7 @@ static void report_diff(struct ftrace_file_handle *handle, struct opts *opts)
 		.dirname = opts->diff,
 		.kernel  = opts->kernel,
 		.depth   = opts->depth,
+		.no_cache = opts->no_cache,
 	};
 	struct diff_data data = {
 		.dirname = opts->diff,
@@ -1090,7 +1378,7 @@ static void report_diff(struct ftrace_file_handle *handle, struct opts *opts)
 	int h_idx = (avg_mode == AVG_NONE) ? 0 : (avg_mode == AVG_TOTAL) ? 1 : 2;
 	int f_idx = diff_percent ? 1 : 0;
 
-	build_function_tree(handle, &tmp, opts);
+	load_function_tree(handle, &tmp, opts);
 	sort_function_name(&tmp, &name_tree);
 
 	tmp = RB_ROOT;
@@ -1101,7 +1389,7 @@ static void report_diff(struct ftrace_file_handle *handle, struct opts *opts)
 	}
 
 	fstack_setup_filters(&dummy_opts, &data.handle);
-	build_function_tree(&data.handle, &tmp, &dummy_opts);
+	load_function_tree(&data.handle, &tmp, &dummy_opts);
 	sort_function_name(&tmp, &data.root);
 
 	calculate_diff(&name_tree, &data.root, &diff_tree, opts->sort_column);
@@ -1146,6 +1434,129 @@ static void apply_diff_policy(char *policy)
 	free(str);
 }
 
+/* make a filter pattern to match the exact name */
+static char *profile_pattern(char *name)
+{
+	char *pattern, *p;
+
+	if (!strpbrk(name, REGEX_CHARS))
+		return xstrdup(name);
+
+	p = pattern = xmalloc(strlen(name) * 2 + 3);
+
+	*p++ = '^';
+	while (*name) {
+		if (strchr(REGEX_CHARS, *name))
+			*p++ = '\\';
+		*p++ = *name++;
+	}
+	*p++ = '$';
+	*p = '\0';
+
+	return pattern;
+}
+
+/**
+ * report_profile - select functions to trace from a previous trace
+ * @opts: options of record (uses ->profile, ->profile_share and ->auto_notrace)
+ * @filter: (output) functions to trace, separated by ';'
+ * @notrace: (output) other functions not to trace
+ *
+ * It loads the function statistics (like report) from the data given
+ * by @opts->profile.  Functions which take more than the share of the
+ * total time are selected, except for hot and tiny ones found by the
+ * thresholds of --auto-notrace (default: 5%).  All other functions in
+ * the profile are added to @notrace.
+ *
+ * It returns the number of selected functions or -1 on error.
+ */
+int report_profile(struct opts *opts, char **filter, char **notrace)
+{
+	struct opts popts = {
+		.dirname	= opts->profile,
+		.depth		= OPT_DEPTH_DEFAULT,
+		.kernel_skip_out= true,
+		.event_skip_out	= true,
+		.no_cache	= opts->no_cache,
+	};
+	struct ftrace_file_handle handle;
+	struct rb_root name_tree = RB_ROOT;
+	struct uftrace_session *sess;
+	struct rb_node *node;
+	struct trace_entry *entry;
+	char *spec = opts->auto_notrace ?: "5%";
+	uint64_t max_rate, max_time;
+	uint64_t base = 0;
+	int nr_filter = 0;
+
+	*filter = *notrace = NULL;
+
+	if (parse_auto_notrace(spec, &max_rate, &max_time) < 0)
+		return -1;
+
+	if (open_data_file(&popts, &handle) < 0) {
+		pr_warn("cannot open profile data: %s: %m\n", opts->profile);
+		return -1;
+	}
+
+	fstack_setup_filters(&popts, &handle);
+	load_function_tree(&handle, &name_tree, &popts);
+
+	/* the total time of the top-level function (i.e. main) */
+	for (node = rb_first(&name_tree); node; node = rb_next(node)) {
+		entry = rb_entry(node, struct trace_entry, link);
+
+		if (base < entry->time_total - entry->time_recursive)
+			base = entry->time_total - entry->time_recursive;
+	}
+
+	sess = handle.sessions.first;
+
+	for (node = rb_first(&name_tree); node && base; node = rb_next(node)) {
+		uint64_t total;
+		char *name;
+
+		entry = rb_entry(node, struct trace_entry, link);
+		total = entry->time_total - entry->time_recursive;
+
+		/* skip unknown, kernel functions and sched event */
+		if (entry->sym == NULL || entry->addr == EVENT_ID_PERF_SCHED_IN ||
+		    (sess && is_kernel_address(sess->symtabs, entry->addr)))
+			continue;
+
+		/* '@' is used for triggers */
+		if (strchr(entry->sym->name, '@'))
+			continue;
+
+		name = profile_pattern(entry->sym->name);
+
+		/*
+		 * calls per second (during the run) and average time.
+		 * Like the runtime governor, it needs enough calls (1024)
+		 * so that short-running functions are not treated as hot.
+		 */
+		if (entry->nr_called >= 1024 &&
+		    entry->nr_called * NSEC_PER_SEC >= max_rate * base &&
+		    entry->time_total <= max_time * entry->nr_called) {
+			*notrace = strjoin(*notrace, name, ";");
+		}
+		else if (total * 100 >= base * opts->profile_share) {
+			*filter = strjoin(*filter, name, ";");
+			nr_filter++;
+		}
+		else {
+			*notrace = strjoin(*notrace, name, ";");
+		}
+
+		free(name);
+	}
+
+	delete_function_tree(&name_tree);
+	close_data_file(&popts, &handle);
+
+	return nr_filter;
+}
+
 int command_report(int argc, char *argv[], struct opts *opts)
 {
 	int ret;
@@ -1,5 +1,5 @@
 /*
- * Python script binding for function entry and exit
+ * Script binding for function entry and exit
  *
  * Copyright (C) 2017, LG Electronics, Honggyu Kim <hong.gyu.kim@lge.com>
  *
@@ -117,7 +117,32 @@ static int run_script_for_rstack(struct ftrace_file_handle *handle,
 		/* Do nothing as of now */
 	}
 	else if (rstack->type == UFTRACE_EVENT) {
-		/* TODO: event handling */
+		char *evt_name;
+
+		/* only native scripts handle events as of now */
+		if (script_uftrace_event == NULL)
+			goto out;
+
+		evt_name = get_event_name(handle, rstack->addr);
+
+		if (script_match_filter(evt_name)) {
+			struct script_context sc_ctx = {
+				.tid       = task->tid,
+				.depth     = task->display_depth,
+				.timestamp = rstack->time,
+				.address   = rstack->addr,
+				.name      = evt_name,
+			};
+
+			/* raw event data (no argspec) */
+			if (rstack->more) {
+				sc_ctx.argbuf = task->args.data;
+				sc_ctx.arglen = task->args.len;
+			}
+
+			script_uftrace_event(&sc_ctx);
+		}
+		free(evt_name);
 	}
 out:
 	symbol_putname(sym, symname);
@@ -130,11 +155,6 @@ int command_script(int argc, char *argv[], struct opts *opts)
 	struct ftrace_file_handle handle;
 	struct ftrace_task_handle *task;
 
-	if (!SCRIPT_ENABLED) {
-		pr_warn("script command is not supported due to missing libpython2.7.so\n");
-		return -1;
-	}
-
 	if (!opts->script_file) {
 		pr_out("Usage: uftrace script [-S|--script] [<script_file>]\n");
 		return -1;
@@ -172,6 +192,9 @@ int command_script(int argc, char *argv[], struct opts *opts)
 	if (script_init(opts->script_file) < 0)
 		return -1;
 
+	/* deliver records at once if the script wants */
+	script_enable_batch();
+
 	while (read_rstack(&handle, &task) == 0 && !uftrace_done) {
 		struct uftrace_record *rstack = task->rstack;
 
@@ -1,6 +1,8 @@
 #include <string.h>
 #include <link.h>
 #include <regex.h>
+#include <assert.h>
+#include <sys/mman.h>
 
 /* This should be defined before #include "utils.h" */
 #define PR_FMT     "dynamic"
@@ -20,6 +22,17 @@ static struct mcount_dynamic_stats {
 	int nomatch;
 } stats;
 
+/* sites patched by mcount_patch_func() */
+static struct mcount_patch_site *patch_sites;
+static int nr_patch_sites;
+static bool sites_patched;
+
+/* requested state of the sites and a lock for mcount_dynamic_toggle() */
+static volatile bool patch_target;
+static int toggle_lock;
+
+#define PAGE_SIZE  4096
+
 /* dummy functions (will be overridden by arch-specific code) */
 __weak int mcount_setup_trampoline(struct mcount_dynamic_info *mdi)
 {
@@ -40,6 +53,11 @@ __weak void mcount_arch_find_module(struct mcount_dynamic_info *mdi)
 	mdi->arch = NULL;
 }
 
+__weak int mcount_update_site(struct mcount_patch_site *site, void *code)
+{
+	return -1;
+}
+
 /* callback for dl_iterate_phdr() */
 static int find_dynamic_module(struct dl_phdr_info *info, size_t sz, void *data)
 {
@@ -180,6 +198,307 @@ static void finish_dynamic_update(void)
 	}
 }
 
+/**
+ * mcount_save_patch_site - save a site patched by dynamic tracing
+ * @addr: address of the site
+ * @orig: original code
+ * @len: length of the code
+ * @skip: bytes to skip if a thread hits the site during update (0 to return)
+ *
+ * This function should be called by the arch code after patching a
+ * site so that it can be unpatched and patched again at runtime.
+ */
+void mcount_save_patch_site(unsigned long addr, void *orig,
+			    unsigned len, unsigned skip)
+{
+	struct mcount_patch_site *site;
+
+	assert(len <= PATCH_SITE_SIZE);
+
+	patch_sites = xrealloc(patch_sites,
+			       (nr_patch_sites + 1) * sizeof(*patch_sites));
+	site = &patch_sites[nr_patch_sites++];
+
+	site->addr = addr;
+	site->len  = len;
+	site->skip = skip;
+	memcpy(site->orig, orig, len);
+	memcpy(site->code, (void *)addr, len);
+}
+
+static int protect_code(unsigned long addr, unsigned len, int prot)
+{
+	unsigned long start = addr & ~(PAGE_SIZE - 1);
+	unsigned long end = ALIGN(addr + len, PAGE_SIZE);
+
+	return mprotect((void *)start, end - start, prot);
+}
+
+static int patch_site(struct mcount_patch_site *site, void *code)
+{
+	int ret;
+
+	/* keep it executable as other threads might run the code */
+	if (protect_code(site->addr, site->len,
+			 PROT_READ | PROT_WRITE | PROT_EXEC) < 0)
+		return -1;
+
+	ret = mcount_update_site(site, code);
+
+	if (protect_code(site->addr, site->len, PROT_READ | PROT_EXEC) < 0)
+		return -1;
+	return ret;
+}
+
+/**
+ * mcount_patch_code - update code which other threads might be running
+ * @addr: address of the code
+ * @code: new code
+ * @len: length of the code
+ *
+ * This function replaces the code at @addr using the same mechanism as
+ * mcount_dynamic_toggle().  It's used for SDT probes, and threads hitting
+ * the probe during the update are handled as the event by the SIGTRAP
+ * handler.
+ */
+int mcount_patch_code(unsigned long addr, void *code, unsigned len)
+{
+	struct mcount_patch_site site = {
+		.addr = addr,
+		.len  = len,
+		.skip = len,
+	};
+
+	assert(len <= PATCH_SITE_SIZE);
+	memcpy(site.orig, (void *)addr, len);
+	memcpy(site.code, code, len);
+
+	return patch_site(&site, code);
+}
+
+/* a chunk of executable memory for stubs (see mcount_alloc_stub) */
+struct stub_area {
+	struct stub_area *next;
+	unsigned long start;
+	unsigned long curr;
+	unsigned long end;
+};
+
+static struct stub_area *stub_areas;
+
+/* stubs should be reachable by a 32-bit jump from the code */
+#define STUB_DISTANCE  (1UL << 30)
+
+/* unused space at the end of code segment is kept for the trampoline */
+#define STUB_RESERVED  32
+
+static bool stub_reachable(unsigned long stub, unsigned long addr)
+{
+	if (stub > addr)
+		return stub - addr < STUB_DISTANCE;
+	else
+		return addr - stub < STUB_DISTANCE;
+}
+
+/* callback for dl_iterate_phdr(): find end of code segment for the addr */
+static int find_code_end(struct dl_phdr_info *info, size_t sz, void *data)
+{
+	unsigned long *addr = data;
+	unsigned i;
+
+	for (i = 0; i < info->dlpi_phnum; i++) {
+		const ElfW(Phdr) *phdr = &info->dlpi_phdr[i];
+		unsigned long start = info->dlpi_addr + phdr->p_vaddr;
+
+		if (phdr->p_type != PT_LOAD || !(phdr->p_flags & PF_X))
+			continue;
+
+		if (start <= *addr && *addr < start + phdr->p_memsz) {
+			*addr = start + phdr->p_memsz;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static struct stub_area *new_stub_area(unsigned long addr)
+{
+	struct stub_area *area;
+	unsigned long code_end = addr;
+	unsigned long start = 0;
+	unsigned long end = 0;
+	unsigned long hint;
+	void *page;
+	int i;
+
+	/* use unused space at the end of code segment like the trampoline */
+	if (dl_iterate_phdr(find_code_end, &code_end)) {
+		start = ALIGN(code_end, 16);
+		end = ALIGN(code_end, PAGE_SIZE) - STUB_RESERVED;
+
+		for (area = stub_areas; area; area = area->next) {
+			if (area->start == start)
+				break;
+		}
+		if (area != NULL || start >= end)
+			start = end = 0;
+	}
+
+	for (i = 0; start == 0 && i < 2 * 10; i++) {
+		unsigned long base = addr & ~(PAGE_SIZE - 1);
+
+		/* try +/- 1MB, 2MB, 4MB, ... 512MB from the code */
+		if (i % 2)
+			hint = base - (1UL << (20 + i / 2));
+		else
+			hint = base + (1UL << (20 + i / 2));
+
+		page = mmap((void *)hint, PAGE_SIZE, PROT_READ | PROT_EXEC,
+			    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (page == MAP_FAILED)
+			return NULL;
+
+		if (stub_reachable((unsigned long)page, addr) &&
+		    stub_reachable((unsigned long)page + PAGE_SIZE, addr)) {
+			start = (unsigned long)page;
+			end = start + PAGE_SIZE;
+			break;
+		}
+
+		munmap(page, PAGE_SIZE);
+	}
+
+	if (start == 0)
+		return NULL;
+
+	area = xmalloc(sizeof(*area));
+	area->start = area->curr = start;
+	area->end = end;
+	area->next = stub_areas;
+	stub_areas = area;
+
+	return area;
+}
+
+/**
+ * mcount_alloc_stub - allocate executable memory near the code
+ * @addr: address of the code which jumps to the stub
+ * @size: size of the stub
+ *
+ * This function returns an address of the new stub which is within a
+ * 32-bit offset from @addr or 0 if it cannot find one.  It uses unused
+ * space at the end of the code segment first, and then maps new pages.
+ * The stub should be written by mcount_write_stub().
+ */
+unsigned long mcount_alloc_stub(unsigned long addr, unsigned size)
+{
+	struct stub_area *area;
+	unsigned long stub;
+
+	size = ALIGN(size, 16);
+
+	for (area = stub_areas; area; area = area->next) {
+		if (area->curr + size <= area->end &&
+		    stub_reachable(area->start, addr) &&
+		    stub_reachable(area->end, addr))
+			break;
+	}
+
+	if (area == NULL) {
+		area = new_stub_area(addr);
+		if (area == NULL || area->curr + size > area->end)
+			return 0;
+	}
+
+	stub = area->curr;
+	area->curr += size;
+	return stub;
+}
+
+/**
+ * mcount_write_stub - write code to a stub
+ * @stub: address of the stub returned by mcount_alloc_stub()
+ * @code: code of the stub
+ * @len: length of the code
+ *
+ * The page of the stub might be shared with other stubs or code run by
+ * other threads, so it's kept executable while writing.
+ */
+int mcount_write_stub(unsigned long stub, void *code, unsigned len)
+{
+	if (protect_code(stub, len, PROT_READ | PROT_WRITE | PROT_EXEC) < 0)
+		return -1;
+
+	memcpy((void *)stub, code, len);
+
+	return protect_code(stub, len, PROT_READ | PROT_EXEC);
+}
+
+/**
+ * mcount_find_patch_site - find a dynamic tracing site
+ * @addr: address of the site
+ *
+ * This function returns the site at @addr or %NULL.  It's called from
+ * the SIGTRAP handler, and the table is not changed after startup.
+ */
+struct mcount_patch_site *mcount_find_patch_site(unsigned long addr)
+{
+	int i;
+
+	for (i = 0; i < nr_patch_sites; i++) {
+		if (patch_sites[i].addr == addr)
+			return &patch_sites[i];
+	}
+	return NULL;
+}
+
+static int update_patch_sites(bool enable)
+{
+	int i;
+
+	for (i = 0; i < nr_patch_sites; i++) {
+		struct mcount_patch_site *site = &patch_sites[i];
+
+		if (patch_site(site, enable ? site->code : site->orig) < 0)
+			return -1;
+	}
+
+	sites_patched = enable;
+	return 0;
+}
+
+/**
+ * mcount_dynamic_toggle - patch or unpatch the dynamic tracing sites
+ * @enable: %true to patch the sites, %false to restore original code
+ *
+ * This function can be called from a signal handler while other
+ * threads are running.  The trampolines are never released so threads
+ * running inside of them (or patched functions) return normally.
+ *
+ * Signal handlers in different threads (or a nested one) can call this
+ * at the same time.  Only one of them updates the sites and it keeps
+ * going until the sites are in the last requested state.  Others just
+ * leave their request and return.
+ */
+int mcount_dynamic_toggle(bool enable)
+{
+	int ret = 0;
+
+	patch_target = enable;
+
+	while (!__sync_lock_test_and_set(&toggle_lock, 1)) {
+		while (ret == 0 && sites_patched != patch_target)
+			ret = update_patch_sites(patch_target);
+
+		__sync_lock_release(&toggle_lock);
+
+		/* check the request during the release */
+		if (ret < 0 || sites_patched == patch_target)
+			break;
+	}
+	return ret;
+}
+
 static float calc_percent(int n, int total)
 {
 	if (total == 0)
@@ -199,6 +518,7 @@ int mcount_dynamic_update(struct symtabs *symtabs, char *patch_funcs)
 	}
 
 	ret = do_dynamic_update(symtabs, patch_funcs);
+	sites_patched = true;
 
 	success = stats.total - stats.failed - stats.skipped;
 	pr_dbg("dynamic update stats:\n");
@@ -213,3 +533,94 @@ int mcount_dynamic_update(struct symtabs *symtabs, char *patch_funcs)
 	finish_dynamic_update();
 	return ret;
 }
+
+#ifdef UNIT_TEST
+
+TEST_CASE(dynamic_toggle)
+{
+	/* mov $0,%eax ; ret */
+	unsigned char func[] = { 0xb8, 0x00, 0x00, 0x00, 0x00, 0xc3 };
+	unsigned char *code;
+	int (*fn)(void);
+
+	code = mmap(NULL, PAGE_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC,
+		    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	TEST_NE(code, MAP_FAILED);
+
+	memcpy(code, func, sizeof(func));
+	fn = (void *)code;
+	TEST_EQ(fn(), 0);
+
+	/* patch it to "mov $1,%eax" */
+	code[1] = 1;
+	mcount_save_patch_site((unsigned long)code, func, 5, 5);
+	sites_patched = true;
+	TEST_EQ(fn(), 1);
+
+	TEST_EQ(mcount_dynamic_toggle(false), 0);
+	TEST_EQ(fn(), 0);
+	TEST_EQ(memcmp(code, func, sizeof(func)), 0);
+
+	/* it should not change if it's already unpatched */
+	TEST_EQ(mcount_dynamic_toggle(false), 0);
+	TEST_EQ(fn(), 0);
+
+	TEST_EQ(mcount_dynamic_toggle(true), 0);
+	TEST_EQ(fn(), 1);
+
+	TEST_EQ(mcount_find_patch_site((unsigned long)code), &patch_sites[0]);
+	TEST_EQ(mcount_find_patch_site((unsigned long)code + 1), NULL);
+
+	/* another request during the update should be done by the owner */
+	toggle_lock = 1;
+	TEST_EQ(mcount_dynamic_toggle(false), 0);
+	TEST_EQ(fn(), 1);
+	toggle_lock = 0;
+	TEST_EQ(mcount_dynamic_toggle(false), 0);
+	TEST_EQ(fn(), 0);
+
+	munmap(code, PAGE_SIZE);
+	free(patch_sites);
+	patch_sites = NULL;
+	nr_patch_sites = 0;
+	sites_patched = false;
+
+	return TEST_OK;
+}
+
+TEST_CASE(dynamic_stub)
+{
+	/* mov $1,%eax ; ret */
+	unsigned char func[] = { 0xb8, 0x01, 0x00, 0x00, 0x00, 0xc3 };
+	unsigned long addr = (unsigned long)mcount_patch_code;
+	unsigned long stub1, stub2;
+	int (*fn)(void);
+
+	stub1 = mcount_alloc_stub(addr, sizeof(func));
+	TEST_NE(stub1, 0);
+	TEST_LT(stub1 > addr ? stub1 - addr : addr - stub1, STUB_DISTANCE);
+
+	stub2 = mcount_alloc_stub(addr, sizeof(func));
+	TEST_NE(stub2, 0);
+	TEST_NE(stub1, stub2);
+
+	TEST_EQ(mcount_write_stub(stub1, func, sizeof(func)), 0);
+	fn = (void *)stub1;
+	TEST_EQ(fn(), 1);
+
+	func[1] = 2;
+	TEST_EQ(mcount_write_stub(stub2, func, sizeof(func)), 0);
+	fn = (void *)stub2;
+	TEST_EQ(fn(), 2);
+
+	while (stub_areas) {
+		struct stub_area *area = stub_areas;
+
+		stub_areas = area->next;
+		free(area);
+	}
+
+	return TEST_OK;
+}
+
+#endif /* UNIT_TEST */
@@ -6,6 +6,7 @@
 #include <libelf.h>
 #include <gelf.h>
 #include <fnmatch.h>
+#include <sys/mman.h>
 
 /* This should be defined before #include "utils.h" */
 #define PR_FMT     "event"
@@ -142,6 +143,7 @@ static int search_sdt_event(struct dl_phdr_info *info, size_t sz, void *data)
 		mei->provider  = xstrdup(vendor);
 		mei->event     = xstrdup(event);
 		mei->arguments = xstrdup(args);
+		mei->arch      = NULL;
 
 		pr_dbg("adding SDT event (%s:%s) from %s at %#lx\n",
 		       mei->provider, mei->event, mei->module, mei->addr);
@@ -262,6 +264,162 @@ void mcount_finish_events(void)
 		free(mei->provider);
 		free(mei->event);
 		free(mei->arguments);
+		free(mei->arch);
 		free(mei);
 	}
 }
+
+/* dsize of the padding at the end of the event ring */
+#define EVENT_PAD  0xffff
+
+#define RING_OFFSET(pos)  ((pos) & (EVENT_RING_SIZE - 1))
+
+static unsigned event_size(struct mcount_event *event)
+{
+	return ALIGN(sizeof(*event) + event->dsize, 16);
+}
+
+/**
+ * mcount_alloc_event - allocate an event in the per-thread ring
+ * @mtdp: thread data
+ * @dsize: size of the event data
+ *
+ * This function returns a new event at the end of the ring or %NULL
+ * if the ring is full.  The caller should fill the event.
+ */
+struct mcount_event *mcount_alloc_event(struct mcount_thread_data *mtdp,
+					unsigned dsize)
+{
+	struct mcount_event_ring *ring = &mtdp->event_ring;
+	struct mcount_event *event;
+	unsigned size = ALIGN(sizeof(*event) + dsize, 16);
+	unsigned off;
+	unsigned pad = 0;
+
+	if (unlikely(ring->buf == NULL)) {
+		void *buf;
+
+		buf = mmap(NULL, EVENT_RING_SIZE, PROT_READ | PROT_WRITE,
+			   MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+		if (buf == MAP_FAILED) {
+			pr_dbg("cannot allocate event ring: %m\n");
+			return NULL;
+		}
+
+		ring->buf  = buf;
+		ring->head = ring->tail = 0;
+		mtdp->nr_events = 0;
+	}
+
+	/* an event cannot be split, put a padding at the end */
+	off = RING_OFFSET(ring->tail);
+	if (off + size > EVENT_RING_SIZE)
+		pad = EVENT_RING_SIZE - off;
+
+	if (ring->tail + pad + size - ring->head > EVENT_RING_SIZE) {
+		static bool warned;
+
+		if (!warned) {
+			pr_dbg("event ring is full, dropping events\n");
+			warned = true;
+		}
+		return NULL;
+	}
+
+	if (pad) {
+		event = ring->buf + off;
+		event->dsize = EVENT_PAD;
+		ring->tail += pad;
+	}
+
+	event = ring->buf + RING_OFFSET(ring->tail);
+	event->dsize = dsize;
+
+	ring->tail += size;
+	mtdp->nr_events++;
+
+	return event;
+}
+
+/**
+ * mcount_next_event - get the next pending event
+ * @mtdp: thread data
+ * @event: current event or %NULL
+ *
+ * This function returns the event after @event.  If @event is %NULL,
+ * it returns the first (oldest) event.  The caller should not call
+ * this more than mtdp->nr_events times.
+ */
+struct mcount_event *mcount_next_event(struct mcount_thread_data *mtdp,
+				       struct mcount_event *event)
+{
+	struct mcount_event_ring *ring = &mtdp->event_ring;
+	unsigned off;
+
+	if (event == NULL)
+		off = RING_OFFSET(ring->head);
+	else
+		off = RING_OFFSET((void *)event - ring->buf + event_size(event));
+
+	event = ring->buf + off;
+	if (event->dsize == EVENT_PAD)
+		event = ring->buf;
+
+	return event;
+}
+
+/* remove the first event in the ring */
+void mcount_consume_event(struct mcount_thread_data *mtdp)
+{
+	struct mcount_event_ring *ring = &mtdp->event_ring;
+	struct mcount_event *event;
+	unsigned end;
+
+	if (mtdp->nr_events == 0)
+		return;
+
+	event = mcount_next_event(mtdp, NULL);
+	end = (void *)event - ring->buf + event_size(event);
+
+	ring->head += RING_OFFSET(end - RING_OFFSET(ring->head));
+	if (--mtdp->nr_events == 0)
+		ring->head = ring->tail;
+}
+
+/* keep first @nr events and discard the rest */
+void mcount_keep_events(struct mcount_thread_data *mtdp, int nr)
+{
+	struct mcount_event_ring *ring = &mtdp->event_ring;
+	struct mcount_event *event = NULL;
+	unsigned end;
+	int i;
+
+	if (nr >= mtdp->nr_events)
+		return;
+
+	if (nr == 0) {
+		ring->tail = ring->head;
+		mtdp->nr_events = 0;
+		return;
+	}
+
+	for (i = 0; i < nr; i++)
+		event = mcount_next_event(mtdp, event);
+
+	end = (void *)event - ring->buf + event_size(event);
+
+	ring->tail = ring->head + RING_OFFSET(end - RING_OFFSET(ring->head));
+	mtdp->nr_events = nr;
+}
+
+void mcount_release_events(struct mcount_thread_data *mtdp)
+{
+	struct mcount_event_ring *ring = &mtdp->event_ring;
+
+	if (ring->buf)
+		munmap(ring->buf, EVENT_RING_SIZE);
+
+	ring->buf = NULL;
+	ring->head = ring->tail = 0;
+	mtdp->nr_events = 0;
+}
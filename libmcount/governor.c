@@ -0,0 +1,293 @@
+/*
+ * Runtime governor to drop hot and tiny functions (--auto-notrace)
+ *
+ * Released under the GPL v2.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+/* This should be defined before #include "utils.h" */
+#define PR_FMT     "mcount"
+#define PR_DOMAIN  DBG_MCOUNT
+
+#include "libmcount/mcount.h"
+#include "libmcount/internal.h"
+#include "utils/utils.h"
+#include "utils/symbol.h"
+
+extern struct symtabs symtabs;
+
+#ifndef DISABLE_MCOUNT_FILTER
+
+/* number of per-thread stats (should be power of 2) */
+#define GOVERNOR_STAT_SIZE  1024
+
+/* number of calls to check the rate of a function */
+#define GOVERNOR_WINDOW  1024
+
+/* max number of (global) dropped functions (should be power of 2) */
+#define GOVERNOR_HASH_SIZE  4096
+
+/*
+ * Per-thread call stats for a function.  It's a direct-mapped table
+ * so other function can take the slot and reset the stats.  It's ok
+ * as hot functions will take it back soon.
+ */
+struct mcount_governor_stat {
+	unsigned long		addr;
+	unsigned		count;
+	uint64_t		total;
+	uint64_t		start;
+};
+
+bool mcount_governor_enabled;
+
+static uint64_t governor_rate;  /* calls per second */
+static uint64_t governor_time;  /* nsec */
+static int governor_fd = -1;
+
+/* open-addressing hash table of dropped functions, shared by threads */
+static unsigned long governor_dropped[GOVERNOR_HASH_SIZE];
+static int nr_governor_dropped;
+
+static unsigned governor_hash(unsigned long addr)
+{
+	/* functions are usually aligned to 16 bytes */
+	return (addr >> 4) * 2654435761U;
+}
+
+/**
+ * mcount_setup_governor - setup thresholds of the runtime governor
+ * @spec: spec of --auto-notrace option (see parse_auto_notrace)
+ * @dirname: directory to save the list of dropped functions
+ *
+ * This function returns 0 if the governor is enabled or -1.
+ */
+int mcount_setup_governor(char *spec, const char *dirname)
+{
+	char *filename = NULL;
+
+	if (parse_auto_notrace(spec, &governor_rate, &governor_time) < 0) {
+		pr_warn("invalid auto-notrace spec: %s\n", spec);
+		return -1;
+	}
+
+	xasprintf(&filename, "%s/%s", dirname, AUTO_NOTRACE_FILE);
+	governor_fd = open(filename, O_WRONLY | O_CREAT | O_APPEND, 0644);
+	if (governor_fd < 0)
+		pr_dbg("cannot open %s: %m\n", filename);
+	free(filename);
+
+	pr_dbg("drop functions called > %"PRIu64"/sec and run < %"PRIu64" nsec\n",
+	       governor_rate, governor_time);
+
+	mcount_governor_enabled = true;
+	return 0;
+}
+
+/* lock-free lookup since it's called on every function entry */
+bool mcount_governor_dropped(unsigned long addr)
+{
+	unsigned idx = governor_hash(addr);
+	unsigned long val;
+	int i;
+
+	for (i = 0; i < GOVERNOR_HASH_SIZE; i++) {
+		val = governor_dropped[(idx + i) & (GOVERNOR_HASH_SIZE - 1)];
+
+		if (val == addr)
+			return true;
+		if (val == 0)
+			break;
+	}
+	return false;
+}
+
+static bool governor_add(unsigned long addr)
+{
+	unsigned idx = governor_hash(addr);
+	unsigned long *slot;
+	int i;
+
+	/* keep the table sparse to make lookup fast */
+	if (nr_governor_dropped >= GOVERNOR_HASH_SIZE / 2)
+		return false;
+
+	for (i = 0; i < GOVERNOR_HASH_SIZE; i++) {
+		slot = &governor_dropped[(idx + i) & (GOVERNOR_HASH_SIZE - 1)];
+
+		if (__sync_bool_compare_and_swap(slot, 0, addr)) {
+			__sync_fetch_and_add(&nr_governor_dropped, 1);
+			return true;
+		}
+		/* other thread dropped it already */
+		if (*slot == addr)
+			return false;
+	}
+	return false;
+}
+
+static void governor_drop(unsigned long addr)
+{
+	struct sym *sym;
+	char *symname;
+	char buf[4096];
+	int len;
+
+	if (!governor_add(addr))
+		return;
+
+	sym = find_symtabs(&symtabs, addr);
+	symname = symbol_getname(sym, addr);
+
+	pr_dbg("drop %s (%#lx) by auto-notrace\n", symname, addr);
+
+	if (governor_fd >= 0) {
+		/* a line should be written at once for O_APPEND */
+		len = snprintf(buf, sizeof(buf), "%#lx %s\n", addr, symname);
+		if (len >= (int)sizeof(buf)) {
+			len = sizeof(buf);
+			buf[len - 1] = '\n';
+		}
+		if (write(governor_fd, buf, len) != len)
+			pr_dbg("cannot save dropped function: %m\n");
+	}
+
+	symbol_putname(sym, symname);
+}
+
+/**
+ * mcount_governor_update - update call stats of a function at exit
+ * @mtdp: thread data
+ * @rstack: return stack of the function
+ *
+ * It checks the call rate and average duration of the function every
+ * GOVERNOR_WINDOW calls and drops it if it's hot and tiny.  Dropped
+ * functions are not traced anymore from the next call (in all threads).
+ */
+void mcount_governor_update(struct mcount_thread_data *mtdp,
+			    struct mcount_ret_stack *rstack)
+{
+	struct mcount_governor_stat *stat;
+	unsigned long addr = rstack->child_ip;
+	uint64_t elapsed;
+
+	/*
+	 * functions with filters or triggers are not the target, but ones
+	 * with children can be dropped (their children are still traced)
+	 */
+	if (rstack->flags & (MCOUNT_FL_FILTERED | MCOUNT_FL_NOTRACE |
+			     MCOUNT_FL_TRACE | MCOUNT_FL_ARGUMENT |
+			     MCOUNT_FL_RETVAL | MCOUNT_FL_WRITTEN |
+			     MCOUNT_FL_READ | MCOUNT_FL_SCRIPT))
+		return;
+
+	if (unlikely(mtdp->gov_stats == NULL)) {
+		void *buf;
+
+		buf = mmap(NULL, GOVERNOR_STAT_SIZE * sizeof(*stat),
+			   PROT_READ | PROT_WRITE,
+			   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (buf == MAP_FAILED)
+			return;
+
+		mtdp->gov_stats = buf;
+	}
+
+	stat = &mtdp->gov_stats[governor_hash(addr) & (GOVERNOR_STAT_SIZE - 1)];
+	if (stat->addr != addr) {
+		stat->addr  = addr;
+		stat->count = 0;
+		stat->total = 0;
+		stat->start = rstack->start_time;
+	}
+
+	stat->count++;
+	stat->total += rstack->end_time - rstack->start_time;
+
+	if (stat->count < GOVERNOR_WINDOW)
+		return;
+
+	elapsed = rstack->end_time - stat->start;
+
+	/* rate >= governor_rate && average <= governor_time */
+	if ((uint64_t)stat->count * NSEC_PER_SEC >= governor_rate * elapsed &&
+	    stat->total <= governor_time * stat->count)
+		governor_drop(addr);
+
+	/* start a new window */
+	stat->count = 0;
+	stat->total = 0;
+	stat->start = rstack->end_time;
+}
+
+void mcount_governor_release(struct mcount_thread_data *mtdp)
+{
+	if (mtdp->gov_stats) {
+		munmap(mtdp->gov_stats,
+		       GOVERNOR_STAT_SIZE * sizeof(*mtdp->gov_stats));
+	}
+	mtdp->gov_stats = NULL;
+}
+
+#ifdef UNIT_TEST
+TEST_CASE(mcount_governor)
+{
+	struct mcount_thread_data mtd_test = {};
+	struct mcount_ret_stack rstack = {};
+	unsigned long hot = 0x1000;
+	unsigned long slow = 0x2000;
+	uint64_t now = 1000;
+	int i;
+
+	governor_rate = 100000;  /* 100K calls/sec */
+	governor_time = 1000;    /* 1 usec */
+
+	/* 1 call per 2 usec (500K calls/sec) and it takes 100 nsec */
+	for (i = 0; i < GOVERNOR_WINDOW; i++) {
+		rstack.child_ip   = hot;
+		rstack.start_time = now;
+		rstack.end_time   = now + 100;
+		mcount_governor_update(&mtd_test, &rstack);
+
+		now += 2000;
+	}
+	TEST_EQ(mcount_governor_dropped(hot), true);
+
+	/* same rate but it takes 1.5 usec */
+	for (i = 0; i < GOVERNOR_WINDOW; i++) {
+		rstack.child_ip   = slow;
+		rstack.start_time = now;
+		rstack.end_time   = now + 1500;
+		mcount_governor_update(&mtd_test, &rstack);
+
+		now += 2000;
+	}
+	TEST_EQ(mcount_governor_dropped(slow), false);
+
+	/* not hot: 1 call per 20 usec */
+	rstack.child_ip = slow + 0x10;
+	for (i = 0; i < GOVERNOR_WINDOW; i++) {
+		rstack.start_time = now;
+		rstack.end_time   = now + 100;
+		mcount_governor_update(&mtd_test, &rstack);
+
+		now += 20000;
+	}
+	TEST_EQ(mcount_governor_dropped(slow + 0x10), false);
+
+	mcount_governor_release(&mtd_test);
+	TEST_EQ(mtd_test.gov_stats, NULL);
+
+	memset(governor_dropped, 0, sizeof(governor_dropped));
+	nr_governor_dropped = 0;
+
+	return TEST_OK;
+}
+#endif /* UNIT_TEST */
+
+#endif /* DISABLE_MCOUNT_FILTER */
@@ -17,6 +17,7 @@
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/syscall.h>
+#include <sys/uio.h>
 
 #include "uftrace.h"
 #include "mcount-arch.h"
@@ -24,6 +25,7 @@
 #include "utils/symbol.h"
 #include "utils/filter.h"
 #include "utils/compiler.h"
+#include "utils/msg-ring.h"
 
 enum filter_result {
 	FILTER_RSTACK = -1,
@@ -54,21 +56,36 @@ struct mcount_shmem {
 	struct mcount_shmem_buffer	**buffer;
 };
 
-/* first 4 byte saves the actual size of the argbuf */
+/*
+ * Max size of argument data for a function.  The first 4 byte saves
+ * the actual size and the rest is packed in the argbuf arena.  The
+ * size of the arena (mcount_argbuf_size()) depends on the argument specs.
+ */
 #define ARGBUF_SIZE  1024
-#define EVTBUF_SIZE  (ARGBUF_SIZE - 16)
 
 struct mcount_event {
 	uint64_t	time;
 	uint32_t	id;
 	uint16_t	dsize;
 	uint16_t	idx;
-	uint8_t		data[EVTBUF_SIZE];
+	uint8_t		data[];
 };
 
 #define ASYNC_IDX 0xffff
 
-#define MAX_EVENT  4
+/* size of per-thread event ring (should be power of 2) */
+#define EVENT_RING_SIZE  (64 * 1024)
+
+/*
+ * Pending events are saved in a ring buffer in the order of time.
+ * Each event takes the header and the actual data only, and the
+ * ring is allocated when the first event is saved.
+ */
+struct mcount_event_ring {
+	void				*buf;
+	unsigned			head;
+	unsigned			tail;
+};
 
 /*
  * The idx and record_idx are to save current index of the rstack.
@@ -87,30 +104,62 @@ struct mcount_thread_data {
 	bool				recursion_guard;
 	unsigned long			cygprof_dummy;
 	struct mcount_ret_stack		*rstack;
+	/* arena to save arguments and return values, allocated lazily */
 	void				*argbuf;
+	size_t				argbuf_size;
+	unsigned			argbuf_used;
+	bool				argbuf_warned;
 	struct filter_control		filter;
 	bool				enable_cached;
 	struct mcount_shmem		shmem;
-	struct mcount_event		event[MAX_EVENT];
+	struct mcount_event_ring	event_ring;
 	int				nr_events;
+	/* call stats for --auto-notrace, allocated lazily */
+	struct mcount_governor_stat	*gov_stats;
+	/* hardware counters for read trigger, allocated lazily */
+	struct mcount_pmu		*pmu;
+	/* rusage at function entry for read trigger, allocated lazily */
+	struct mcount_rusage_entry	*rusage;
 	struct mcount_arch_context	arch;
 };
 
 #ifdef HAVE_MCOUNT_ARCH_CONTEXT
 extern void mcount_save_arch_context(struct mcount_arch_context *ctx);
 extern void mcount_restore_arch_context(struct mcount_arch_context *ctx);
+extern void mcount_save_arch_exit_context(struct mcount_arch_context *ctx);
+extern void mcount_restore_arch_exit_context(struct mcount_arch_context *ctx);
 #else
 static inline void mcount_save_arch_context(struct mcount_arch_context *ctx) {}
 static inline void mcount_restore_arch_context(struct mcount_arch_context *ctx) {}
+static inline void mcount_save_arch_exit_context(struct mcount_arch_context *ctx) {}
+static inline void mcount_restore_arch_exit_context(struct mcount_arch_context *ctx) {}
 #endif
 
 #ifdef SINGLE_THREAD
 # define TLS
 # define get_thread_data()  &mtd
+# define set_thread_data(mtdp)  do { } while (0)
 # define check_thread_data(mtdp)  (mtdp->rstack == NULL)
 #else
 # define TLS  __thread
-# define get_thread_data()  pthread_getspecific(mtd_key)
+# ifdef HAVE_TLS_DESC
+/*
+ * Accessing the mtd directly takes a call to __tls_get_addr() since
+ * libmcount is a shared library.  With TLS descriptors, a pointer to
+ * the mtd is read from the static TLS block when libmcount is loaded
+ * at startup (LD_PRELOAD), and from the dynamic TLS when it's loaded
+ * by dlopen() later.  So it works in both cases without failing.
+ * The TSD (mtd_key) is still set to call mtd_dtor() at thread exit.
+ * Compilers without the support use the TSD to access the mtd.
+ */
+#  define get_thread_data()  mtdp_tls
+#  define set_thread_data(mtdp)  (mtdp_tls = (mtdp))
+
+extern TLS struct mcount_thread_data *mtdp_tls;
+# else
+#  define get_thread_data()  pthread_getspecific(mtd_key)
+#  define set_thread_data(mtdp)  do { } while (0)
+# endif
 # define check_thread_data(mtdp)  (mtdp == NULL)
 #endif
 
@@ -120,6 +169,7 @@ extern uint64_t mcount_threshold;  /* nsec */
 extern pthread_key_t mtd_key;
 extern int shmem_bufsize;
 extern int pfd;
+extern struct uftrace_msg_ring *msg_ring;
 extern char *mcount_exename;
 extern int page_size_in_kb;
 extern bool kernel_pid_update;
@@ -130,6 +180,8 @@ enum mcount_global_flag {
 };
 
 extern unsigned long mcount_global_flags;
+extern int mcount_rstack_max;
+size_t mcount_argbuf_size(void);
 
 static inline bool mcount_should_stop(void)
 {
@@ -140,6 +192,16 @@ static inline bool mcount_should_stop(void)
 static inline void mcount_filter_init(void) {}
 static inline void mcount_filter_setup(struct mcount_thread_data *mtdp) {}
 static inline void mcount_filter_release(struct mcount_thread_data *mtdp) {}
+static inline void mcount_script_filter_init(void) {}
+static inline int mcount_setup_governor(char *spec, const char *dirname)
+{
+	return -1;
+}
+static inline void mcount_script_dlopen(const char *libname,
+					unsigned long base_addr) {}
+static inline void mcount_pmu_reset(struct mcount_thread_data *mtdp) {}
+#else
+void mcount_script_dlopen(const char *libname, unsigned long base_addr);
 #endif /* DISABLE_MCOUNT_FILTER */
 
 static inline uint64_t mcount_gettime(void)
@@ -205,7 +267,9 @@ extern struct mcount_thread_data * mcount_prepare(void);
 
 extern void update_kernel_tid(int tid);
 extern const char *mcount_session_name(void);
+extern void mcount_setup_msg_ring(const char *ringfd_str);
 extern void uftrace_send_message(int type, void *data, size_t len);
+extern void uftrace_send_messagev(int type, struct iovec *iov, int iovcnt);
 extern void build_debug_domain(char *dbg_domain_str);
 
 extern void mcount_rstack_restore(struct mcount_thread_data *mtdp);
@@ -226,11 +290,6 @@ enum plthook_special_action {
 	PLT_FL_EXCEPT		= 1U << 5,
 };
 
-struct plthook_special_func {
-	unsigned idx;
-	unsigned flags;  /* enum plthook_special_action */
-};
-
 struct plthook_data {
 	struct list_head		list;
 	const char			*mod_name;
@@ -240,8 +299,8 @@ struct plthook_data {
 	struct symtab			dsymtab;
 	unsigned long			*pltgot_ptr;
 	unsigned long			*resolved_addr;
-	struct plthook_special_func	*special_funcs;
-	int				nr_special;
+	/* enum plthook_special_action indexed by dynsym index */
+	unsigned char			*special_flags;
 };
 
 unsigned long setup_pltgot(struct plthook_data *pd, int got_idx, int sym_idx,
@@ -294,6 +353,7 @@ extern int record_trace_data(struct mcount_thread_data *mtdp,
 			     struct mcount_ret_stack *mrstack, long *retval);
 extern void record_proc_maps(char *dirname, const char *sess_id,
 			     struct symtabs *symtabs);
+extern void reset_proc_statm(void);
 
 #ifndef DISABLE_MCOUNT_FILTER
 extern void save_argument(struct mcount_thread_data *mtdp,
@@ -305,6 +365,25 @@ void save_retval(struct mcount_thread_data *mtdp,
 void save_trigger_read(struct mcount_thread_data *mtdp,
 		       struct mcount_ret_stack *rstack,
 		       enum trigger_read_type type);
+void save_trigger_read_exit(struct mcount_thread_data *mtdp,
+			    struct mcount_ret_stack *rstack);
+void mcount_rusage_release(struct mcount_thread_data *mtdp);
+
+extern bool mcount_governor_enabled;
+
+int mcount_setup_governor(char *spec, const char *dirname);
+bool mcount_governor_dropped(unsigned long addr);
+void mcount_governor_update(struct mcount_thread_data *mtdp,
+			    struct mcount_ret_stack *rstack);
+void mcount_governor_release(struct mcount_thread_data *mtdp);
+
+void save_pmu_entry(struct mcount_thread_data *mtdp,
+		    struct mcount_ret_stack *rstack,
+		    enum trigger_read_type type);
+void save_pmu_exit(struct mcount_thread_data *mtdp,
+		   struct mcount_ret_stack *rstack);
+void mcount_pmu_reset(struct mcount_thread_data *mtdp);
+void mcount_pmu_release(struct mcount_thread_data *mtdp);
 #endif  /* DISABLE_MCOUNT_FILTER */
 
 struct mcount_dynamic_info {
@@ -316,12 +395,37 @@ struct mcount_dynamic_info {
 	void *arch;
 };
 
+/* max size of code changed by dynamic patching at a site */
+#define PATCH_SITE_SIZE  16
+
+/*
+ * A site of code patched by dynamic tracing.  It keeps both original
+ * and patched code to (un)patch it at runtime.  If a thread hits the
+ * site while it's being updated, it skips the site by @skip bytes or
+ * returns from the function if @skip is 0.
+ */
+struct mcount_patch_site {
+	unsigned long	addr;
+	unsigned	len;
+	unsigned	skip;
+	unsigned char	orig[PATCH_SITE_SIZE];
+	unsigned char	code[PATCH_SITE_SIZE];
+};
+
 int mcount_dynamic_update(struct symtabs *symtabs, char *patch_funcs);
+void mcount_save_patch_site(unsigned long addr, void *orig,
+			    unsigned len, unsigned skip);
+int mcount_dynamic_toggle(bool enable);
+struct mcount_patch_site *mcount_find_patch_site(unsigned long addr);
+int mcount_patch_code(unsigned long addr, void *code, unsigned len);
+unsigned long mcount_alloc_stub(unsigned long addr, unsigned size);
+int mcount_write_stub(unsigned long stub, void *code, unsigned len);
 
 /* these should be implemented for each architecture */
 int mcount_setup_trampoline(struct mcount_dynamic_info *adi);
 void mcount_cleanup_trampoline(struct mcount_dynamic_info *mdi);
 int mcount_patch_func(struct mcount_dynamic_info *mdi, struct sym *sym);
+int mcount_update_site(struct mcount_patch_site *site, void *code);
 
 struct mcount_event_info {
 	char *module;
@@ -332,15 +436,27 @@ struct mcount_event_info {
 	unsigned id;
 	unsigned long addr;
 	struct list_head list;
+
+	/* arch-specific data like parsed arguments */
+	void *arch;
 };
 
 int mcount_setup_events(char *dirname, char *event_str);
 struct mcount_event_info * mcount_lookup_event(unsigned long addr);
-int mcount_save_event(struct mcount_event_info *mei);
+int mcount_save_event(struct mcount_event_info *mei, void *data, unsigned dsize);
 void mcount_finish_events(void);
+
+struct mcount_event *mcount_alloc_event(struct mcount_thread_data *mtdp,
+					unsigned dsize);
+struct mcount_event *mcount_next_event(struct mcount_thread_data *mtdp,
+				       struct mcount_event *event);
+void mcount_consume_event(struct mcount_thread_data *mtdp);
+void mcount_keep_events(struct mcount_thread_data *mtdp, int nr);
+void mcount_release_events(struct mcount_thread_data *mtdp);
 void mcount_list_events(void);
 
 int mcount_arch_enable_event(struct mcount_event_info *mei);
+void mcount_arch_hit_event(struct mcount_event_info *mei, void *ctx);
 
 void mcount_hook_functions(void);
 
@@ -16,6 +16,7 @@
 #include <signal.h>
 #include <sys/stat.h>
 #include <sys/uio.h>
+#include <sys/mman.h>
 
 /* This should be defined before #include "utils.h" */
 #define PR_FMT     "mcount"
@@ -49,11 +50,16 @@ pthread_key_t mtd_key = (pthread_key_t)-1;
 /* thread local data to trace function execution */
 TLS struct mcount_thread_data mtd;
 
+#if !defined(SINGLE_THREAD) && defined(HAVE_TLS_DESC)
+/* fast path to access the mtd above (NULL if not prepared) */
+TLS struct mcount_thread_data *mtdp_tls;
+#endif
+
 /* pipe file descriptor to communite to uftrace */
 int pfd = -1;
 
 /* maximum depth of mcount rstack */
-static int mcount_rstack_max = MCOUNT_RSTACK_MAX;
+int mcount_rstack_max = MCOUNT_RSTACK_MAX;
 
 /* name of main executable */
 char *mcount_exename;
@@ -77,6 +83,58 @@ static enum filter_mode __maybe_unused mcount_filter_mode = FILTER_MODE_NONE;
 static struct rb_root __maybe_unused mcount_triggers = RB_ROOT;
 
 #ifndef DISABLE_MCOUNT_FILTER
+/* max size of argument (or return value) data of a function in argbuf */
+static unsigned argbuf_frame_size(struct rb_root *root)
+{
+	struct rb_node *node = rb_first(root);
+	struct uftrace_filter *filter;
+	struct uftrace_arg_spec *spec;
+	unsigned max_size = 0;
+
+	while (node) {
+		unsigned size[2] = { 0, 0 };  /* arguments and return value */
+
+		filter = rb_entry(node, struct uftrace_filter, node);
+		node = rb_next(node);
+
+		if (filter->trigger.pargs == NULL)
+			continue;
+
+		list_for_each_entry(spec, filter->trigger.pargs, list) {
+			int i = spec->idx == RETVAL_IDX;
+
+			/* strings are truncated in ARGBUF_SIZE anyway */
+			if (spec->fmt == ARG_FMT_STR ||
+			    spec->fmt == ARG_FMT_STD_STRING)
+				size[i] += ARGBUF_SIZE;
+			else
+				size[i] += ALIGN(spec->size, 4);
+		}
+
+		/* the return value reuses the space for arguments */
+		if (size[0] < size[1])
+			size[0] = size[1];
+		if (max_size < size[0])
+			max_size = size[0];
+	}
+
+	if (max_size == 0)
+		return 0;
+
+	/* the first 4 byte is for the size */
+	max_size += sizeof(unsigned);
+	if (max_size > ARGBUF_SIZE)
+		max_size = ARGBUF_SIZE;
+
+	return ALIGN(max_size, 8);
+}
+
+/* size of argbuf arena for a thread with the current argument specs */
+size_t mcount_argbuf_size(void)
+{
+	return mcount_rstack_max * argbuf_frame_size(&mcount_triggers);
+}
+
 static void mcount_filter_init(void)
 {
 	char *filter_str    = getenv("UFTRACE_FILTER");
@@ -105,13 +163,200 @@ static void mcount_filter_setup(struct mcount_thread_data *mtdp)
 	mtdp->filter.depth  = mcount_depth;
 	mtdp->filter.time   = mcount_threshold;
 	mtdp->enable_cached = mcount_enabled;
-	mtdp->argbuf        = xmalloc(mcount_rstack_max * ARGBUF_SIZE);
+
+	/* argbuf will be allocated when it sees an argument (or retval) */
+	mtdp->argbuf        = NULL;
+	mtdp->argbuf_size   = 0;
+	mtdp->argbuf_used   = 0;
+	mtdp->argbuf_warned = false;
 }
 
 static void mcount_filter_release(struct mcount_thread_data *mtdp)
 {
-	free(mtdp->argbuf);
+	if (mtdp->argbuf)
+		munmap(mtdp->argbuf, mtdp->argbuf_size);
 	mtdp->argbuf = NULL;
+
+	mcount_governor_release(mtdp);
+	mcount_pmu_release(mtdp);
+	mcount_rusage_release(mtdp);
+}
+
+/* script runs for all functions if it doesn't have a filter */
+static bool mcount_script_all;
+
+/* resolve script filters to the trigger table not to match at runtime */
+static void mcount_script_filter_init(void)
+{
+	mcount_script_all = !script_setup_trigger(&symtabs, &mcount_triggers);
+}
+
+/*
+ * Libraries loaded by dlopen() are not in the symbol tables, so the
+ * script filters were not resolved for them.  The dlopen() wrapper
+ * matches the filters to the symbols of the library once and keeps
+ * the functions in a table sorted by address.  The table is replaced
+ * by a new one for each library and old tables are not freed since
+ * other threads might be looking at them.
+ */
+struct script_dlopen_func {
+	unsigned long		addr;
+	unsigned long		size;
+	char			*name;
+};
+
+struct script_dlopen_table {
+	size_t			nr;
+	struct script_dlopen_func funcs[];
+};
+
+static struct script_dlopen_table *script_dlopen_table;
+static pthread_mutex_t script_dlopen_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int script_dlopen_cmp(const void *a, const void *b)
+{
+	const struct script_dlopen_func *x = a;
+	const struct script_dlopen_func *y = b;
+
+	if (x->addr == y->addr)
+		return 0;
+	return x->addr < y->addr ? -1 : 1;
+}
+
+static void add_script_dlopen_funcs(struct script_dlopen_func **funcs,
+				    size_t *nr, struct symtab *stab)
+{
+	size_t i;
+
+	for (i = 0; i < stab->nr_sym; i++) {
+		struct sym *sym = &stab->sym[i];
+
+		if (!script_match_filter(sym->name))
+			continue;
+
+		*funcs = xrealloc(*funcs, (*nr + 1) * sizeof(**funcs));
+		(*funcs)[*nr].addr = sym->addr;
+		(*funcs)[*nr].size = sym->size;
+		(*funcs)[*nr].name = xstrdup(sym->name);
+		(*nr)++;
+	}
+}
+
+/**
+ * mcount_script_dlopen - resolve script filters for a dlopen-ed library
+ * @libname: path of the library
+ * @base_addr: load address of the library
+ */
+void mcount_script_dlopen(const char *libname, unsigned long base_addr)
+{
+	struct symtabs dlib = {
+		.flags = symtabs.flags,
+	};
+	struct script_dlopen_table *old, *new;
+	struct script_dlopen_func *funcs = NULL;
+	unsigned long start, end;
+	size_t nr = 0;
+	size_t i, k;
+
+	if (!SCRIPT_ENABLED || script_str == NULL || mcount_script_all)
+		return;
+
+	load_dlopen_symtabs(&dlib, base_addr, libname);
+	add_script_dlopen_funcs(&funcs, &nr, &dlib.symtab);
+	add_script_dlopen_funcs(&funcs, &nr, &dlib.dsymtab);
+	unload_symtabs(&dlib);
+
+	if (nr == 0)
+		return;
+
+	qsort(funcs, nr, sizeof(*funcs), script_dlopen_cmp);
+
+	/* normal and dynamic symbols can have same function */
+	for (i = 1, k = 1; i < nr; i++) {
+		if (funcs[k-1].addr == funcs[i].addr) {
+			free(funcs[i].name);
+			continue;
+		}
+		funcs[k++] = funcs[i];
+	}
+	nr = k;
+
+	start = funcs[0].addr;
+	end   = funcs[nr-1].addr + funcs[nr-1].size;
+
+	pthread_mutex_lock(&script_dlopen_lock);
+
+	old = script_dlopen_table;
+	new = xmalloc(sizeof(*new) + (nr + (old ? old->nr : 0)) * sizeof(*funcs));
+	memcpy(new->funcs, funcs, nr * sizeof(*funcs));
+	k = nr;
+
+	for (i = 0; old && i < old->nr; i++) {
+		struct script_dlopen_func *func = &old->funcs[i];
+
+		/* the library was already loaded, or a closed one was there */
+		if (start <= func->addr && func->addr < end)
+			continue;
+
+		new->funcs[k++] = *func;
+	}
+	qsort(new->funcs, k, sizeof(*funcs), script_dlopen_cmp);
+	new->nr = k;
+	free(funcs);
+
+	/* publish the table after it's filled */
+	__sync_synchronize();
+	script_dlopen_table = new;
+
+	pthread_mutex_unlock(&script_dlopen_lock);
+
+	pr_dbg2("script filters matched %zu functions in %s\n", nr, libname);
+}
+
+static int script_dlopen_find(const void *a, const void *b)
+{
+	const struct script_dlopen_func *key = a;
+	const struct script_dlopen_func *func = b;
+
+	if (key->addr < func->addr)
+		return -1;
+	if (key->addr >= func->addr + func->size)
+		return 1;
+	return 0;
+}
+
+static struct script_dlopen_func *mcount_script_find_dlopen(unsigned long addr)
+{
+	struct script_dlopen_table *table = script_dlopen_table;
+	struct script_dlopen_func key = {
+		.addr = addr,
+	};
+
+	if (likely(table == NULL))
+		return NULL;
+
+	return bsearch(&key, table->funcs, table->nr, sizeof(key),
+		       script_dlopen_find);
+}
+
+static bool mcount_script_match_dlopen(unsigned long addr)
+{
+	return mcount_script_find_dlopen(addr) != NULL;
+}
+
+/* same as symbol_getname() but knows functions in dlopen-ed libraries */
+static char *mcount_script_getname(struct sym *sym, unsigned long addr)
+{
+	struct script_dlopen_func *func = NULL;
+
+	if (sym == NULL)
+		func = mcount_script_find_dlopen(addr);
+
+	/* it'll be freed by symbol_putname() */
+	if (func)
+		return xstrdup(func->name);
+
+	return symbol_getname(sym, addr);
 }
 #endif /* DISABLE_MCOUNT_FILTER */
 
@@ -125,27 +370,18 @@ static void send_session_msg(struct mcount_thread_data *mtdp, const char *sess_i
 		},
 		.namelen = strlen(mcount_exename),
 	};
-	struct uftrace_msg msg = {
-		.magic = UFTRACE_MSG_MAGIC,
-		.type = UFTRACE_MSG_SESSION,
-		.len = sizeof(sess) + sess.namelen,
-	};
 	struct iovec iov[3] = {
-		{ .iov_base = &msg, .iov_len = sizeof(msg), },
+		{ /* header */ },
 		{ .iov_base = &sess, .iov_len = sizeof(sess), },
 		{ .iov_base = mcount_exename, .iov_len = sess.namelen, },
 	};
-	int len = sizeof(msg) + msg.len;
 
 	if (pfd < 0)
 		return;
 
 	mcount_memcpy4(sess.sid, sess_id, sizeof(sess.sid));
 
-	if (writev(pfd, iov, 3) != len) {
-		if (!mcount_should_stop())
-			pr_err("write tid info failed");
-	}
+	uftrace_send_messagev(UFTRACE_MSG_SESSION, iov, 3);
 }
 
 /* to be used by pthread_create_key() */
@@ -156,12 +392,14 @@ static void mtd_dtor(void *arg)
 
 	/* this thread is done, do not enter anymore */
 	mtdp->recursion_guard = true;
+	set_thread_data(NULL);
 
-	free(mtdp->rstack);
+	munmap(mtdp->rstack, mcount_rstack_max * sizeof(*mtdp->rstack));
 	mtdp->rstack = NULL;
 
 	mcount_filter_release(mtdp);
 	shmem_finish(mtdp);
+	mcount_release_events(mtdp);
 
 	tmsg.pid = getpid(),
 	tmsg.tid = mcount_gettid(mtdp),
@@ -260,12 +498,22 @@ struct mcount_thread_data * mcount_prepare(void)
 	compiler_barrier();
 
 	mcount_filter_setup(mtdp);
-	mtdp->rstack = xmalloc(mcount_rstack_max * sizeof(*mtd.rstack));
+
+	/*
+	 * Reserve the address space only, so that the pages are
+	 * allocated when the call stack actually goes deep.
+	 */
+	mtdp->rstack = mmap(NULL, mcount_rstack_max * sizeof(*mtd.rstack),
+			    PROT_READ | PROT_WRITE,
+			    MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (mtdp->rstack == MAP_FAILED)
+		pr_err("cannot allocate rstack");
 
 	pthread_once(&once_control, mcount_init_file);
 	prepare_shmem_buffer(mtdp);
 
 	pthread_setspecific(mtd_key, mtdp);
+	set_thread_data(mtdp);
 
 	/* time should be get after session message sent */
 	tmsg.pid = getpid(),
@@ -291,6 +539,7 @@ static void mcount_finish(void)
 
 	pthread_key_delete(mtd_key);
 	if (pfd != -1) {
+		msg_ring = NULL;
 		close(pfd);
 		pfd = -1;
 	}
@@ -351,6 +600,11 @@ enum filter_result mcount_entry_filter_check(struct mcount_thread_data *mtdp,
 		if (mcount_filter_mode == FILTER_MODE_IN &&
 		    mtdp->filter.in_count == 0)
 			return FILTER_OUT;
+
+		/* dropped by the governor (w/o any trigger) */
+		if (mcount_governor_enabled && tr->flags == 0 &&
+		    mcount_governor_dropped(child))
+			return FILTER_OUT;
 	}
 
 #define FLAGS_TO_CHECK  (TRIGGER_FL_DEPTH | TRIGGER_FL_TRACE_ON |	\
@@ -443,16 +697,20 @@ void mcount_entry_filter_record(struct mcount_thread_data *mtdp,
 				save_trigger_read(mtdp, rstack, tr->read);
 
 			if (mtdp->nr_events) {
+				struct mcount_event *event = NULL;
 				bool flush = false;
 				int i;
 
 				/*
 				 * Flush rstacks if async event was recorded
-				 * as it only has limited space for the events.
+				 * so that it's written in time order and not
+				 * kept in the event ring until the exit.
 				 */
-				for (i = 0; i < mtdp->nr_events; i++)
-					if (mtdp->event[i].idx == ASYNC_IDX)
+				for (i = 0; i < mtdp->nr_events; i++) {
+					event = mcount_next_event(mtdp, event);
+					if (event->idx == ASYNC_IDX)
 						flush = true;
+				}
 
 				if (flush)
 					record_trace_data(mtdp, rstack, NULL);
@@ -460,14 +718,16 @@ void mcount_entry_filter_record(struct mcount_thread_data *mtdp,
 		}
 
 		/* script hooking for function entry */
-		if (SCRIPT_ENABLED && script_str) {
+		if (SCRIPT_ENABLED && script_str &&
+		    (mcount_script_all || (tr->flags & TRIGGER_FL_SCRIPT) ||
+		     mcount_script_match_dlopen(rstack->child_ip))) {
 			unsigned long entry_addr = rstack->child_ip;
 			struct sym *sym = find_symtabs(&symtabs, entry_addr);
-			char *symname = symbol_getname(sym, entry_addr);
+			char *symname = mcount_script_getname(sym, entry_addr);
 			struct script_context sc_ctx;
 
-			if (!script_match_filter(symname))
-				goto skip;
+			/* to run the script at exit too */
+			rstack->flags |= MCOUNT_FL_SCRIPT;
 
 			sc_ctx.tid       = mcount_gettid(mtdp);
 			sc_ctx.depth     = rstack->depth;
@@ -475,7 +735,7 @@ void mcount_entry_filter_record(struct mcount_thread_data *mtdp,
 			sc_ctx.address   = entry_addr;
 			sc_ctx.name      = symname;
 
-			if (tr->flags & TRIGGER_FL_ARGUMENT) {
+			if (rstack->flags & MCOUNT_FL_ARGUMENT) {
 				unsigned *argbuf = get_argbuf(mtdp, rstack);
 
 				sc_ctx.arglen  = argbuf[0];
@@ -492,7 +752,6 @@ void mcount_entry_filter_record(struct mcount_thread_data *mtdp,
 			script_uftrace_entry(&sc_ctx);
 			mcount_restore_arch_context(&mtdp->arch);
 
-skip:
 			symbol_putname(sym, symname);
 		}
 
@@ -544,7 +803,13 @@ void mcount_exit_filter_record(struct mcount_thread_data *mtdp,
 			mtdp->record_idx--;
 
 		if (!mcount_enabled)
-			return;
+			goto out;
+
+		if (mcount_governor_enabled)
+			mcount_governor_update(mtdp, rstack);
+
+		if (rstack->flags & MCOUNT_FL_READ)
+			save_trigger_read_exit(mtdp, rstack);
 
 		if (!(rstack->flags & MCOUNT_FL_RETVAL))
 			retval = NULL;
@@ -555,6 +820,7 @@ void mcount_exit_filter_record(struct mcount_thread_data *mtdp,
 				pr_err("error during record");
 		}
 		else if (mtdp->nr_events) {
+			struct mcount_event *event = NULL;
 			bool flush = false;
 			int i, k;
 
@@ -564,28 +830,26 @@ void mcount_exit_filter_record(struct mcount_thread_data *mtdp,
 			 * update event count to drop filtered ones.
 			 */
 			for (i = 0, k = 0; i < mtdp->nr_events; i++) {
-				if (mtdp->event[i].idx == ASYNC_IDX)
+				event = mcount_next_event(mtdp, event);
+				if (event->idx == ASYNC_IDX)
 					flush = true;
-				if (mtdp->event[i].idx < mtdp->idx)
+				if (event->idx < mtdp->idx)
 					k = i + 1;
 			}
 
 			if (flush)
 				record_trace_data(mtdp, rstack, retval);
 			else
-				mtdp->nr_events = k;  /* invalidate sync events */
+				mcount_keep_events(mtdp, k);  /* invalidate sync events */
 		}
 
 		/* script hooking for function exit */
-		if (SCRIPT_ENABLED && script_str) {
+		if (SCRIPT_ENABLED && (rstack->flags & MCOUNT_FL_SCRIPT)) {
 			unsigned long entry_addr = rstack->child_ip;
 			struct sym *sym = find_symtabs(&symtabs, entry_addr);
-			char *symname = symbol_getname(sym, entry_addr);
+			char *symname = mcount_script_getname(sym, entry_addr);
 			struct script_context sc_ctx;
 
-			if (!script_match_filter(symname))
-				goto skip;
-
 			sc_ctx.tid       = mcount_gettid(mtdp);
 			sc_ctx.depth     = rstack->depth;
 			sc_ctx.timestamp = rstack->start_time;
@@ -593,7 +857,8 @@ void mcount_exit_filter_record(struct mcount_thread_data *mtdp,
 			sc_ctx.address   = entry_addr;
 			sc_ctx.name      = symname;
 
-			if (rstack->flags & MCOUNT_FL_RETVAL) {
+			if (rstack->flags & MCOUNT_FL_RETVAL &&
+			    get_argbuf(mtdp, rstack) != NULL) {
 				unsigned *argbuf = get_argbuf(mtdp, rstack);
 
 				sc_ctx.arglen  = argbuf[0];
@@ -605,15 +870,19 @@ void mcount_exit_filter_record(struct mcount_thread_data *mtdp,
 				sc_ctx.arglen  = 0;
 			}
 
-			/* accessing argument in script might change arch-context */
-			mcount_save_arch_context(&mtdp->arch);
+			/* only return registers are live at exit */
+			mcount_save_arch_exit_context(&mtdp->arch);
 			script_uftrace_exit(&sc_ctx);
-			mcount_restore_arch_context(&mtdp->arch);
+			mcount_restore_arch_exit_context(&mtdp->arch);
 
-skip:
 			symbol_putname(sym, symname);
 		}
 	}
+
+out:
+	/* release the argbuf space used by this function */
+	if (rstack->flags & MCOUNT_FL_ARGUMENT)
+		mtdp->argbuf_used = rstack->argbuf_off;
 }
 
 #else /* DISABLE_MCOUNT_FILTER */
@@ -670,7 +939,7 @@ int mcount_entry(unsigned long *parent_loc, unsigned long child,
 	if (unlikely(mcount_should_stop()))
 		return -1;
 
-	/* Access the mtd through TSD pointer to reduce TLS overhead */
+	/* Access the mtd through TLS pointer to reduce TLS overhead */
 	mtdp = get_thread_data();
 	if (unlikely(check_thread_data(mtdp))) {
 		mtdp = mcount_prepare();
@@ -757,7 +1026,7 @@ static int cygprof_entry(unsigned long parent, unsigned long child)
 	if (unlikely(mcount_should_stop()))
 		return -1;
 
-	/* Access the mtd through TSD pointer to reduce TLS overhead */
+	/* Access the mtd through TLS pointer to reduce TLS overhead */
 	mtdp = get_thread_data();
 	if (unlikely(check_thread_data(mtdp))) {
 		mtdp = mcount_prepare();
@@ -860,7 +1129,7 @@ void xray_entry(unsigned long parent, unsigned long child,
 	if (unlikely(mcount_should_stop()))
 		return;
 
-	/* Access the mtd through TSD pointer to reduce TLS overhead */
+	/* Access the mtd through TLS pointer to reduce TLS overhead */
 	mtdp = get_thread_data();
 	if (unlikely(check_thread_data(mtdp))) {
 		mcount_prepare();
@@ -938,10 +1207,11 @@ out:
 	mtdp->recursion_guard = false;
 }
 
-/* save an asynchronous event */
-int mcount_save_event(struct mcount_event_info *mei)
+/* save an asynchronous event with optional data (arguments) */
+int mcount_save_event(struct mcount_event_info *mei, void *data, unsigned dsize)
 {
 	struct mcount_thread_data *mtdp;
+	struct mcount_event *event;
 
 	if (unlikely(mcount_should_stop()))
 		return -1;
@@ -950,18 +1220,65 @@ int mcount_save_event(struct mcount_event_info *mei)
 	if (unlikely(check_thread_data(mtdp)))
 		return -1;
 
-	if (mtdp->nr_events < MAX_EVENT) {
-		int i = mtdp->nr_events++;
+	event = mcount_alloc_event(mtdp, dsize);
+	if (event) {
+		event->id   = mei->id;
+		event->time = mcount_gettime();
+		event->idx  = ASYNC_IDX;
 
-		mtdp->event[i].id   = mei->id;
-		mtdp->event[i].time = mcount_gettime();
-		mtdp->event[i].dsize = 0;
-		mtdp->event[i].idx   = ASYNC_IDX;
+		if (dsize)
+			memcpy(event->data, data, dsize);
 	}
 
 	return 0;
 }
 
+/* whether dynamic patching is enabled by the signal */
+static int patch_enabled = true;
+
+static void patch_signal_handler(int sig)
+{
+	bool enable;
+
+	/* the signal can be delivered to different threads at the same time */
+	enable = !__sync_fetch_and_xor(&patch_enabled, 1);
+
+	/* stop recording first, and start it after patching */
+	if (!enable)
+		mcount_enabled = false;
+
+	mcount_dynamic_toggle(enable);
+
+	if (enable)
+		mcount_enabled = true;
+}
+
+/*
+ * Toggle dynamic patching (and recording) at runtime whenever the
+ * signal is received.  It starts unpatched when tracing is disabled.
+ */
+static void mcount_setup_patch_signal(char *sig_str)
+{
+	struct sigaction act = {
+		.sa_handler = patch_signal_handler,
+		.sa_flags   = SA_RESTART,
+	};
+	int sig = strtol(sig_str, NULL, 0);
+
+	sigemptyset(&act.sa_mask);
+	if (sigaction(sig, &act, NULL) < 0) {
+		pr_dbg("cannot set patch signal %d: %m\n", sig);
+		return;
+	}
+
+	pr_dbg("dynamic patching is toggled by signal %d\n", sig);
+
+	if (!mcount_enabled) {
+		patch_enabled = false;
+		mcount_dynamic_toggle(false);
+	}
+}
+
 static void atfork_prepare_handler(void)
 {
 	struct uftrace_msg_task tmsg = {
@@ -991,8 +1308,12 @@ static void atfork_child_handler(void)
 
 	/* update tid cache */
 	mtdp->tid = tmsg.tid;
+	/* it has the fd of parent's /proc/self/statm */
+	reset_proc_statm();
+	/* and the parent's hardware counters */
+	mcount_pmu_reset(mtdp);
 	/* flush event data */
-	mtdp->nr_events = 0;
+	mcount_keep_events(mtdp, 0);
 
 	mtdp->recursion_guard = true;
 
@@ -1009,6 +1330,7 @@ static void atfork_child_handler(void)
 static void mcount_startup(void)
 {
 	char *pipefd_str;
+	char *ringfd_str;
 	char *logfd_str;
 	char *debug_str;
 	char *bufsize_str;
@@ -1019,6 +1341,7 @@ static void mcount_startup(void)
 	char *plthook_str;
 	char *patch_str;
 	char *event_str;
+	char *auto_notrace_str;
 	char *dirname;
 	struct stat statbuf;
 	bool nest_libcall;
@@ -1035,6 +1358,7 @@ static void mcount_startup(void)
 		pr_err("cannot create mtd key");
 
 	pipefd_str = getenv("UFTRACE_PIPE");
+	ringfd_str = getenv("UFTRACE_MSG_RING");
 	logfd_str = getenv("UFTRACE_LOGFD");
 	debug_str = getenv("UFTRACE_DEBUG");
 	bufsize_str = getenv("UFTRACE_BUFFER");
@@ -1045,6 +1369,7 @@ static void mcount_startup(void)
 	plthook_str = getenv("UFTRACE_PLTHOOK");
 	patch_str = getenv("UFTRACE_PATCH");
 	event_str = getenv("UFTRACE_EVENT");
+	auto_notrace_str = getenv("UFTRACE_AUTO_NOTRACE");
 	script_str = getenv("UFTRACE_SCRIPT");
 	nest_libcall = !!getenv("UFTRACE_NEST_LIBCALL");
 
@@ -1081,6 +1406,8 @@ static void mcount_startup(void)
 			pr_dbg("ignore invalid pipe fd: %d\n", pfd);
 			pfd = -1;
 		}
+		else if (ringfd_str)
+			mcount_setup_msg_ring(ringfd_str);
 	}
 
 	if (getenv("UFTRACE_LIST_EVENT")) {
@@ -1102,20 +1429,28 @@ static void mcount_startup(void)
 	set_kernel_base(&symtabs, mcount_session_name());
 	load_symtabs(&symtabs, NULL, mcount_exename);
 
-	mcount_filter_init();
-
+	/* it's needed to set the size of argbuf */
 	if (maxstack_str)
 		mcount_rstack_max = strtol(maxstack_str, NULL, 0);
 
+	mcount_filter_init();
+
 	if (threshold_str)
 		mcount_threshold = strtoull(threshold_str, NULL, 0);
 
-	if (patch_str)
+	if (patch_str) {
 		mcount_dynamic_update(&symtabs, patch_str);
 
+		if (getenv("UFTRACE_PATCH_SIGNAL"))
+			mcount_setup_patch_signal(getenv("UFTRACE_PATCH_SIGNAL"));
+	}
+
 	if (event_str)
 		mcount_setup_events(dirname, event_str);
 
+	if (auto_notrace_str)
+		mcount_setup_governor(auto_notrace_str, dirname);
+
 	if (plthook_str)
 		mcount_setup_plthook(mcount_exename, nest_libcall);
 
@@ -1127,9 +1462,12 @@ static void mcount_startup(void)
 	mcount_hook_functions();
 
 	/* initialize script binding */
-	if (SCRIPT_ENABLED && script_str)
+	if (SCRIPT_ENABLED && script_str) {
 		if (script_init(script_str) < 0)
 			script_str = NULL;
+		else
+			mcount_script_filter_init();
+	}
 
 	compiler_barrier();
 	pr_dbg("mcount setup done\n");
@@ -35,6 +35,8 @@ enum mcount_rstack_flag {
 	MCOUNT_FL_RETVAL	= (1U << 9),
 	MCOUNT_FL_TRACE		= (1U << 10),
 	MCOUNT_FL_ARGUMENT	= (1U << 11),
+	MCOUNT_FL_READ		= (1U << 12),
+	MCOUNT_FL_SCRIPT	= (1U << 13),
 };
 
 struct plthook_data;
@@ -56,6 +58,8 @@ struct mcount_ret_stack {
 	struct plthook_data *pd;
 	/* set arg_spec at function entry and use it at exit */
 	struct list_head *pargs;
+	/* offset of the saved arguments in the argbuf arena */
+	unsigned argbuf_off;
 };
 
 void __monstartup(unsigned long low, unsigned long high);
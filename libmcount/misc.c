@@ -1,6 +1,9 @@
 #include <unistd.h>
 #include <string.h>
+#include <errno.h>
 #include <sys/uio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 /* This should be defined before #include "utils.h" */
 #define PR_FMT     "mcount"
@@ -10,6 +13,9 @@
 #include "libmcount/internal.h"
 #include "utils/utils.h"
 
+/* shared with the record process, the pipe is used as a doorbell */
+struct uftrace_msg_ring *msg_ring;
+
 /* old kernel never updates pid filter for a forked child */
 void update_kernel_tid(int tid)
 {
@@ -75,26 +81,171 @@ const char *mcount_session_name(void)
 	return session;
 }
 
-void uftrace_send_message(int type, void *data, size_t len)
+void mcount_setup_msg_ring(const char *ringfd_str)
+{
+	int fd = strtol(ringfd_str, NULL, 0);
+	struct uftrace_msg_ring *ring;
+	struct stat statbuf;
+
+	/* minimal sanity check */
+	if (fstat(fd, &statbuf) < 0 ||
+	    statbuf.st_size < (off_t)msg_ring_size(0)) {
+		pr_dbg("ignore invalid message ring fd: %d\n", fd);
+		return;
+	}
+
+	ring = mmap(NULL, statbuf.st_size, PROT_READ | PROT_WRITE,
+		    MAP_SHARED, fd, 0);
+	if (ring == MAP_FAILED) {
+		pr_dbg("cannot map message ring: %m\n");
+		return;
+	}
+
+	if (statbuf.st_size < (off_t)msg_ring_size(ring->nr_slots)) {
+		pr_dbg("ignore invalid message ring size\n");
+		munmap(ring, statbuf.st_size);
+		return;
+	}
+
+	pr_dbg2("using message ring with %u slots\n", ring->nr_slots);
+
+	/* keep the fd open for exec-ed children */
+	msg_ring = ring;
+}
+
+static int send_doorbell(void)
 {
 	struct uftrace_msg msg = {
 		.magic = UFTRACE_MSG_MAGIC,
-		.type = type,
-		.len = len,
+		.type = UFTRACE_MSG_DOORBELL,
+		.len = 0,
 	};
-	struct iovec iov[2] = {
-		{ .iov_base = &msg, .iov_len = sizeof(msg), },
-		{ .iov_base = data, .iov_len = len, },
+
+	return write(pfd, &msg, sizeof(msg)) == sizeof(msg) ? 0 : -1;
+}
+
+/* max number of retries (every 100 usec) when the ring is full */
+#define MSG_RING_MAX_RETRY  1000
+
+/* end position of the last message written to the ring by this thread */
+static TLS uint64_t msg_ring_last;
+/* this thread is writing to the ring (a signal handler can interrupt it) */
+static TLS bool msg_ring_busy;
+
+static int send_msg_ring(struct uftrace_msg_ring *ring, int type,
+			 struct iovec *iov, int iovcnt)
+{
+	int ret;
+	int retry = 0;
+
+	while ((ret = msg_ring_write(ring, type, iov, iovcnt,
+				     &msg_ring_last)) == -EAGAIN) {
+		/*
+		 * The recorder might not drain it because of a stalled
+		 * writer (maybe this thread was interrupted by a signal
+		 * in the middle of writing).  Give up and use the pipe.
+		 */
+		if (retry == MSG_RING_MAX_RETRY)
+			return -EAGAIN;
+
+		/* ring is full: make sure the recorder is draining it */
+		if ((retry++ % 100) == 0 && send_doorbell() < 0)
+			return -1;
+		usleep(100);
+	}
+
+	if (ret < 0)
+		return ret;
+
+	if (msg_ring_need_kick(ring))
+		return send_doorbell();
+	return 0;
+}
+
+/*
+ * The recorder reads the messages in the ring before one in the pipe,
+ * but it stops at a message which is not published yet (by other
+ * threads).  Wait until it reads all messages of this thread in the
+ * ring so that they are not handled after the message in the pipe.
+ */
+static void wait_msg_ring(struct uftrace_msg_ring *ring)
+{
+	int retry = 0;
+
+	while (!msg_ring_consumed(ring, msg_ring_last)) {
+		/* the recorder gives up stalled slots in a second */
+		if (retry == MSG_RING_MAX_RETRY * 2) {
+			pr_dbg("message ring is not drained\n");
+			break;
+		}
+
+		if ((retry++ % 100) == 0 && send_doorbell() < 0)
+			break;
+		usleep(100);
+	}
+}
+
+/* @iov should have a space for the message header at the first entry */
+void uftrace_send_messagev(int type, struct iovec *iov, int iovcnt)
+{
+	struct uftrace_msg msg = {
+		.magic = UFTRACE_MSG_MAGIC,
+		.type = type,
+		.len = 0,
 	};
+	struct uftrace_msg_ring *ring = msg_ring;
+	ssize_t len;
+	int i;
 
 	if (pfd < 0)
 		return;
 
-	len += sizeof(msg);
-	if (writev(pfd, iov, 2) != (ssize_t)len) {
-		if (!mcount_should_stop())
-			pr_err("writing shmem name to pipe");
+	/* nested call from a signal handler uses the pipe */
+	if (ring && !msg_ring_busy) {
+		int ret;
+
+		msg_ring_busy = true;
+		ret = send_msg_ring(ring, type, &iov[1], iovcnt - 1);
+
+		/*
+		 * The message is sent through the pipe if the ring is full
+		 * (-EAGAIN), it's too big for the ring (-E2BIG) or the
+		 * recorder gave up the slots (-ESTALE).  It's decided for
+		 * each message, next one will try the ring again.
+		 */
+		if (ret < 0 && ret != -1)
+			wait_msg_ring(ring);
+		msg_ring_busy = false;
+
+		if (ret == 0)
+			return;
+		if (ret == -1)
+			goto err;
 	}
+
+	for (i = 1; i < iovcnt; i++)
+		msg.len += iov[i].iov_len;
+
+	iov[0].iov_base = &msg;
+	iov[0].iov_len  = sizeof(msg);
+
+	len = sizeof(msg) + msg.len;
+	if (writev(pfd, iov, iovcnt) == len)
+		return;
+
+err:
+	if (!mcount_should_stop())
+		pr_err("writing message to pipe");
+}
+
+void uftrace_send_message(int type, void *data, size_t len)
+{
+	struct iovec iov[2] = {
+		{ .iov_base = NULL, .iov_len = 0, },
+		{ .iov_base = data, .iov_len = len, },
+	};
+
+	uftrace_send_messagev(type, iov, 2);
 }
 
 void build_debug_domain(char *dbg_domain_str)
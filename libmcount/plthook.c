@@ -24,6 +24,12 @@ unsigned long plthook_resolver_addr;
 
 static LIST_HEAD(plthook_modules);
 
+/* max number of modules (should be power of 2) */
+#define PLTHOOK_MODULE_HASH_SIZE  64
+
+/* open-addressing hash table to find plthook data by module id */
+static struct plthook_data *plthook_module_hash[PLTHOOK_MODULE_HASH_SIZE];
+
 static bool plthook_no_pltbind;
 
 static unsigned long got_addr;
@@ -32,6 +38,56 @@ static volatile bool segv_handled;
 #define PAGE_SIZE  4096
 #define PAGE_ADDR(addr)  ((void *)((addr) & ~(PAGE_SIZE - 1)))
 
+static unsigned module_hash(unsigned long module_id)
+{
+	/* module id is an address of link_map (or plthook_data) */
+	return ((module_id >> 4) * 2654435761U) & (PLTHOOK_MODULE_HASH_SIZE - 1);
+}
+
+static void add_module_hash(struct plthook_data *pd)
+{
+	unsigned idx = module_hash(pd->module_id);
+	int i;
+
+	for (i = 0; i < PLTHOOK_MODULE_HASH_SIZE; i++) {
+		struct plthook_data **slot;
+
+		slot = &plthook_module_hash[(idx + i) & (PLTHOOK_MODULE_HASH_SIZE - 1)];
+		if (*slot == NULL) {
+			*slot = pd;
+			return;
+		}
+	}
+
+	/* plthook_entry() will fall back to the list */
+	pr_dbg("too many modules for plthook hash\n");
+}
+
+static struct plthook_data *find_plthook_data(unsigned long module_id)
+{
+	unsigned idx = module_hash(module_id);
+	struct plthook_data *pd;
+	int i;
+
+	for (i = 0; i < PLTHOOK_MODULE_HASH_SIZE; i++) {
+		pd = plthook_module_hash[(idx + i) & (PLTHOOK_MODULE_HASH_SIZE - 1)];
+
+		if (pd == NULL)
+			break;
+		if (pd->module_id == module_id)
+			return pd;
+	}
+
+	if (likely(i < PLTHOOK_MODULE_HASH_SIZE))
+		return NULL;
+
+	list_for_each_entry(pd, &plthook_modules, list) {
+		if (pd->module_id == module_id)
+			return pd;
+	}
+	return NULL;
+}
+
 static void segv_handler(int sig, siginfo_t *si, void *ctx)
 {
 	if (segv_handled)
@@ -237,8 +293,7 @@ static int find_got(Elf *elf, const char *modname,
 	load_elf_dynsymtab(&pd->dsymtab, elf, pd->base_addr, SYMTAB_FL_DEMANGLE);
 
 	pd->resolved_addr = xcalloc(pd->dsymtab.nr_sym, sizeof(long));
-	pd->special_funcs = NULL;
-	pd->nr_special    = 0;
+	pd->special_flags = NULL;
 
 	list_add_tail(&pd->list, &plthook_modules);
 
@@ -264,6 +319,8 @@ static int find_got(Elf *elf, const char *modname,
 		}
 	}
 
+	add_module_hash(pd);
+
 	if (getenv("LD_BIND_NOT"))
 		plthook_no_pltbind = true;
 
@@ -380,29 +437,6 @@ static const char *except_syms[] = {
 	"_Unwind_RaiseException",
 };
 
-static void add_special_func(struct plthook_data *pd, unsigned idx, unsigned flags)
-{
-	int i;
-	struct plthook_special_func *func;
-
-	for (i = 0; i < pd->nr_special; i++) {
-		func = &pd->special_funcs[i];
-
-		if (func->idx == idx) {
-			func->flags |= flags;
-			return;
-		}
-	}
-
-	pd->special_funcs = xrealloc(pd->special_funcs,
-				     (pd->nr_special + 1) * sizeof(*func));
-
-	func = &pd->special_funcs[pd->nr_special++];
-
-	func->idx     = idx;
-	func->flags   = flags;
-}
-
 static void build_special_funcs(struct plthook_data *pd, const char *syms[],
 				unsigned nr_sym, unsigned flag)
 {
@@ -411,35 +445,16 @@ static void build_special_funcs(struct plthook_data *pd, const char *syms[],
 
 	build_dynsym_idxlist(&pd->dsymtab, &idxlist, syms, nr_sym);
 	for (i = 0; i < idxlist.count; i++)
-		add_special_func(pd, idxlist.idx[i], flag);
+		pd->special_flags[idxlist.idx[i]] |= flag;
 	destroy_dynsym_idxlist(&idxlist);
 }
 
-static int idxsort(const void *a, const void *b)
-{
-	const struct plthook_special_func *func_a = a;
-	const struct plthook_special_func *func_b = b;
-
-	if (func_a->idx > func_b->idx)
-		return 1;
-	if (func_a->idx < func_b->idx)
-		return -1;
-	return 0;
-}
-
-static int idxfind(const void *a, const void *b)
-{
-	unsigned idx = (unsigned long) a;
-	const struct plthook_special_func *func = b;
-
-	if (func->idx == idx)
-		return 0;
-
-	return (idx > func->idx) ? 1 : -1;
-}
-
 void setup_dynsym_indexes(struct plthook_data *pd)
 {
+	/* flags are indexed by dynsym index to avoid searching at runtime */
+	pd->special_flags = xcalloc(pd->dsymtab.nr_sym + 1,
+				    sizeof(*pd->special_flags));
+
 	build_special_funcs(pd, skip_syms, ARRAY_SIZE(skip_syms),
 			    PLT_FL_SKIP);
 	build_special_funcs(pd, longjmp_syms, ARRAY_SIZE(longjmp_syms),
@@ -452,9 +467,6 @@ void setup_dynsym_indexes(struct plthook_data *pd)
 			    PLT_FL_FLUSH);
 	build_special_funcs(pd, except_syms, ARRAY_SIZE(except_syms),
 			    PLT_FL_EXCEPT);
-
-	/* built all table, now sorting */
-	qsort(pd->special_funcs, pd->nr_special, sizeof(*pd->special_funcs), idxsort);
 }
 
 void destroy_dynsym_indexes(void)
@@ -464,9 +476,8 @@ void destroy_dynsym_indexes(void)
 	pr_dbg("destroy plthook special function index\n");
 
 	list_for_each_entry(pd, &plthook_modules, list) {
-		free(pd->special_funcs);
-		pd->special_funcs = NULL;
-		pd->nr_special = 0;
+		free(pd->special_flags);
+		pd->special_flags = NULL;
 	}
 }
 
@@ -541,6 +552,7 @@ struct mcount_jmpbuf_rstack {
 	unsigned long addr;
 	int count;
 	int record_idx;
+	unsigned argbuf_used;
 	struct mcount_ret_stack rstack[MCOUNT_RSTACK_MAX];
 };
 
@@ -566,8 +578,9 @@ static void setup_jmpbuf_rstack(struct mcount_thread_data *mtdp,
 	pr_dbg2("setup jmpbuf rstack at %lx (%d entries)\n", addr, mtdp->idx);
 
 	/* currently, only saves a single jmpbuf */
-	jbstack->count      = mtdp->idx;
-	jbstack->record_idx = mtdp->record_idx;
+	jbstack->count       = mtdp->idx;
+	jbstack->record_idx  = mtdp->record_idx;
+	jbstack->argbuf_used = mtdp->argbuf_used;
 
 	for (i = 0; i < jbstack->count; i++)
 		jbstack->rstack[i] = mtdp->rstack[i];
@@ -587,8 +600,9 @@ static void restore_jmpbuf_rstack(struct mcount_thread_data *mtdp,
 
 	pr_dbg2("restore jmpbuf rstack at %lx (%d entries)\n", addr, jbstack->count);
 
-	mtdp->idx        = jbstack->count;
-	mtdp->record_idx = jbstack->record_idx;
+	mtdp->idx         = jbstack->count;
+	mtdp->record_idx  = jbstack->record_idx;
+	mtdp->argbuf_used = jbstack->argbuf_used;
 
 	for (i = 0; i < jbstack->count; i++) {
 		mtdp->rstack[i] = jbstack->rstack[i];
@@ -602,6 +616,7 @@ static void restore_jmpbuf_rstack(struct mcount_thread_data *mtdp,
 static int vfork_parent;
 static int vfork_rstack_idx;
 static int vfork_record_idx;
+static unsigned vfork_argbuf_used;
 static struct mcount_ret_stack vfork_rstack;
 static struct mcount_shmem vfork_shmem;
 
@@ -612,6 +627,7 @@ static void prepare_vfork(struct mcount_thread_data *mtdp,
 	vfork_parent = getpid();
 	vfork_rstack_idx = mtdp->idx;
 	vfork_record_idx = mtdp->record_idx;
+	vfork_argbuf_used = mtdp->argbuf_used;
 
 	mcount_memcpy4(&vfork_rstack, rstack, sizeof(*rstack));
 	/* it will be force flushed */
@@ -656,6 +672,7 @@ static struct mcount_ret_stack * restore_vfork(struct mcount_thread_data *mtdp,
 
 		mtdp->idx = vfork_rstack_idx;
 		mtdp->record_idx = vfork_record_idx;
+		mtdp->argbuf_used = vfork_argbuf_used;
 		rstack = &mtdp->rstack[mtdp->idx - 1];
 
 		vfork_parent = 0;
@@ -715,18 +732,12 @@ unsigned long plthook_entry(unsigned long *ret_addr, unsigned long child_idx,
 	bool recursion = true;
 	enum filter_result filtered;
 	struct plthook_data *pd;
-	struct plthook_special_func *func;
 	unsigned long special_flag = 0;
 	unsigned long real_addr = 0;
 
-	list_for_each_entry(pd, &plthook_modules, list) {
-		if (module_id == pd->module_id)
-			break;
-	}
-
-	if (list_no_entry(pd, &plthook_modules, list)) {
+	pd = find_plthook_data(module_id);
+	if (unlikely(pd == NULL)) {
 		pr_dbg("cannot find pd for module id: %lx\n", module_id);
-		pd = NULL;
 		goto out;
 	}
 
@@ -744,10 +755,8 @@ unsigned long plthook_entry(unsigned long *ret_addr, unsigned long child_idx,
 
 	recursion = false;
 
-	func = bsearch((void *)child_idx, pd->special_funcs, pd->nr_special,
-		       sizeof(*func), idxfind);
-	if (func)
-		special_flag |= func->flags;
+	if (likely(pd->special_flags && child_idx < pd->dsymtab.nr_sym))
+		special_flag = pd->special_flags[child_idx];
 
 	if (unlikely(special_flag & PLT_FL_SKIP))
 		goto out;
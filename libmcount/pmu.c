@@ -0,0 +1,472 @@
+/*
+ * Hardware performance counters for read trigger (pmu-*)
+ *
+ * Released under the GPL v2.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+/* This should be defined before #include "utils.h" */
+#define PR_FMT     "mcount"
+#define PR_DOMAIN  DBG_MCOUNT
+
+#include "libmcount/mcount.h"
+#include "libmcount/internal.h"
+#include "utils/utils.h"
+#include "utils/filter.h"
+#include "utils/compiler.h"
+
+#ifndef DISABLE_MCOUNT_FILTER
+
+/* each read type has two counters */
+#define NR_PMU_TYPES     3
+#define NR_PMU_COUNTERS  (NR_PMU_TYPES * 2)
+
+static const struct pmu_config {
+	enum trigger_read_type	type;
+	enum uftrace_event_id	id;
+	const char		*name;
+	uint64_t		config[2];
+} pmu_configs[NR_PMU_TYPES] = {
+	{
+		TRIGGER_READ_PMU_CYCLE, EVENT_ID_READ_PMU_CYCLE, "pmu-cycle",
+		{ PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS },
+	},
+	{
+		TRIGGER_READ_PMU_CACHE, EVENT_ID_READ_PMU_CACHE, "pmu-cache",
+		{ PERF_COUNT_HW_CACHE_REFERENCES, PERF_COUNT_HW_CACHE_MISSES },
+	},
+	{
+		TRIGGER_READ_PMU_BRANCH, EVENT_ID_READ_PMU_BRANCH, "pmu-branch",
+		{ PERF_COUNT_HW_BRANCH_INSTRUCTIONS, PERF_COUNT_HW_BRANCH_MISSES },
+	},
+};
+
+/* counter values at function entry (per rstack) */
+struct mcount_pmu_entry {
+	enum trigger_read_type	type;
+	uint64_t		val[NR_PMU_COUNTERS];
+};
+
+/* per-thread counters, allocated when it sees a pmu read trigger */
+struct mcount_pmu {
+	int				tid;
+	enum trigger_read_type		opened;
+	enum trigger_read_type		failed;
+	int				fd[NR_PMU_COUNTERS];
+	struct perf_event_mmap_page	*page[NR_PMU_COUNTERS];
+	struct mcount_pmu_entry		*entry;
+};
+
+static size_t pmu_page_size;
+
+static int open_pmu_counter(uint64_t config, int group_fd)
+{
+	struct perf_event_attr attr = {
+		.size			= sizeof(attr),
+		.type			= PERF_TYPE_HARDWARE,
+		.config			= config,
+		.exclude_kernel		= 1,
+		.exclude_hv		= 1,
+	};
+
+	return syscall(SYS_perf_event_open, &attr, 0, -1, group_fd, 0);
+}
+
+static int open_pmu_type(struct mcount_pmu *pmu, int i)
+{
+	const struct pmu_config *cfg = &pmu_configs[i];
+	int k;
+
+	/* open both counters in a group so that they run together */
+	pmu->fd[i * 2] = open_pmu_counter(cfg->config[0], -1);
+	if (pmu->fd[i * 2] < 0)
+		goto err;
+
+	pmu->fd[i * 2 + 1] = open_pmu_counter(cfg->config[1], pmu->fd[i * 2]);
+	if (pmu->fd[i * 2 + 1] < 0) {
+		close(pmu->fd[i * 2]);
+		pmu->fd[i * 2] = -1;
+		goto err;
+	}
+
+	/* the first page has info for user-space counter access (rdpmc) */
+	for (k = i * 2; k < i * 2 + 2; k++) {
+		pmu->page[k] = mmap(NULL, pmu_page_size, PROT_READ, MAP_SHARED,
+				    pmu->fd[k], 0);
+		if (pmu->page[k] == MAP_FAILED)
+			pmu->page[k] = NULL;
+	}
+
+	pmu->opened |= cfg->type;
+	pr_dbg2("open %s counters for task %d\n", cfg->name, pmu->tid);
+	return 0;
+
+err:
+	pr_dbg("cannot open %s counters: %m\n", cfg->name);
+	pmu->failed |= cfg->type;
+	return -1;
+}
+
+static void close_pmu_counters(struct mcount_pmu *pmu)
+{
+	int i;
+
+	for (i = 0; i < NR_PMU_COUNTERS; i++) {
+		if (pmu->page[i])
+			munmap(pmu->page[i], pmu_page_size);
+		if (pmu->fd[i] >= 0)
+			close(pmu->fd[i]);
+
+		pmu->page[i] = NULL;
+		pmu->fd[i] = -1;
+	}
+
+	pmu->opened = 0;
+	pmu->failed = 0;
+}
+
+static struct mcount_pmu *prepare_pmu(struct mcount_thread_data *mtdp)
+{
+	struct mcount_pmu *pmu = mtdp->pmu;
+	int i;
+
+	if (likely(pmu)) {
+		/* counters are attached to a task, reopen them after fork */
+		if (unlikely(pmu->tid != mcount_gettid(mtdp))) {
+			close_pmu_counters(pmu);
+			pmu->tid = mcount_gettid(mtdp);
+		}
+		return pmu;
+	}
+
+	if (pmu_page_size == 0)
+		pmu_page_size = sysconf(_SC_PAGESIZE);
+
+	pmu = mmap(NULL, sizeof(*pmu), PROT_READ | PROT_WRITE,
+		   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (pmu == MAP_FAILED)
+		return NULL;
+
+	pmu->entry = mmap(NULL, mcount_rstack_max * sizeof(*pmu->entry),
+			  PROT_READ | PROT_WRITE,
+			  MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (pmu->entry == MAP_FAILED) {
+		munmap(pmu, sizeof(*pmu));
+		return NULL;
+	}
+
+	for (i = 0; i < NR_PMU_COUNTERS; i++)
+		pmu->fd[i] = -1;
+	pmu->tid = mcount_gettid(mtdp);
+
+	mtdp->pmu = pmu;
+	return pmu;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+static inline uint64_t rdpmc(unsigned counter)
+{
+	unsigned low, high;
+
+	asm volatile ("rdpmc" : "=a" (low), "=d" (high) : "c" (counter));
+	return low | ((uint64_t)high << 32);
+}
+
+/* see the comment of struct perf_event_mmap_page in linux/perf_event.h */
+static bool read_pmu_user(struct perf_event_mmap_page *pc, uint64_t *val)
+{
+	uint32_t seq, idx;
+	uint64_t count;
+	int shift;
+
+	if (pc == NULL || !pc->cap_user_rdpmc)
+		return false;
+
+	do {
+		seq = pc->lock;
+		compiler_barrier();
+
+		idx = pc->index;
+		if (idx == 0)
+			return false;
+
+		count = pc->offset;
+		shift = 64 - pc->pmc_width;
+		count += (int64_t)(rdpmc(idx - 1) << shift) >> shift;
+
+		compiler_barrier();
+	} while (pc->lock != seq);
+
+	*val = count;
+	return true;
+}
+#else
+static bool read_pmu_user(struct perf_event_mmap_page *pc, uint64_t *val)
+{
+	return false;
+}
+#endif
+
+static uint64_t read_pmu_counter(struct mcount_pmu *pmu, int i)
+{
+	uint64_t val = 0;
+
+	if (read_pmu_user(pmu->page[i], &val))
+		return val;
+
+	/* fall back to read(2) if rdpmc is not permitted */
+	if (read(pmu->fd[i], &val, sizeof(val)) != sizeof(val))
+		val = 0;
+
+	return val;
+}
+
+/**
+ * save_pmu_entry - save hardware counters at function entry
+ * @mtdp: thread data
+ * @rstack: return stack of the function
+ * @type: read trigger type (only pmu types are used)
+ *
+ * It saves current counter values for the function and sets the READ
+ * flag in the @rstack so that save_pmu_exit() can record the diff.
+ */
+void save_pmu_entry(struct mcount_thread_data *mtdp,
+		    struct mcount_ret_stack *rstack,
+		    enum trigger_read_type type)
+{
+	struct mcount_pmu *pmu;
+	struct mcount_pmu_entry *entry;
+	int i;
+
+	pmu = prepare_pmu(mtdp);
+	if (pmu == NULL)
+		return;
+
+	for (i = 0; i < NR_PMU_TYPES; i++) {
+		enum trigger_read_type t = pmu_configs[i].type;
+
+		if ((type & t) && !((pmu->opened | pmu->failed) & t))
+			open_pmu_type(pmu, i);
+	}
+
+	entry = &pmu->entry[rstack - mtdp->rstack];
+
+	/* don't leave a stale type in case it has other read types */
+	type &= pmu->opened;
+	entry->type = type;
+	if (type == 0)
+		return;
+
+	for (i = 0; i < NR_PMU_TYPES; i++) {
+		if (!(type & pmu_configs[i].type))
+			continue;
+
+		entry->val[i * 2]     = read_pmu_counter(pmu, i * 2);
+		entry->val[i * 2 + 1] = read_pmu_counter(pmu, i * 2 + 1);
+	}
+
+	rstack->flags |= MCOUNT_FL_READ;
+}
+
+/**
+ * save_pmu_exit - save diff of hardware counters at function exit
+ * @mtdp: thread data
+ * @rstack: return stack of the function
+ *
+ * It saves an event for each pmu type with the counter diffs since
+ * the function entry.  It's called for other read types too, so the
+ * type is cleared after use.
+ */
+void save_pmu_exit(struct mcount_thread_data *mtdp,
+		   struct mcount_ret_stack *rstack)
+{
+	struct mcount_pmu *pmu = mtdp->pmu;
+	struct mcount_pmu_entry *entry;
+	struct mcount_event *event;
+	uint64_t *diff;
+	int i;
+
+	if (pmu == NULL)
+		return;
+
+	entry = &pmu->entry[rstack - mtdp->rstack];
+
+	/* the entry has values of the parent's counters after fork */
+	if (unlikely(pmu->tid != mcount_gettid(mtdp)))
+		goto out;
+
+	for (i = 0; i < NR_PMU_TYPES; i++) {
+		if (!(entry->type & pmu_configs[i].type))
+			continue;
+
+		event = mcount_alloc_event(mtdp, 2 * sizeof(*diff));
+		if (event == NULL)
+			break;
+
+		/* it should be written before the exit record */
+		event->id   = pmu_configs[i].id;
+		event->time = rstack->end_time - 1;
+		event->idx  = mtdp->idx;
+
+		diff = (void *)event->data;
+		diff[0] = read_pmu_counter(pmu, i * 2) - entry->val[i * 2];
+		diff[1] = read_pmu_counter(pmu, i * 2 + 1) - entry->val[i * 2 + 1];
+	}
+
+out:
+	entry->type = 0;
+}
+
+/**
+ * mcount_pmu_reset - reset hardware counters in a forked child
+ * @mtdp: thread data
+ *
+ * The child cannot use the counters of the parent.  Close them so that
+ * they are reopened for the child, and invalidate the values saved at
+ * entry of the functions that were called before the fork.
+ */
+void mcount_pmu_reset(struct mcount_thread_data *mtdp)
+{
+	struct mcount_pmu *pmu = mtdp->pmu;
+	int i;
+
+	if (pmu == NULL)
+		return;
+
+	close_pmu_counters(pmu);
+	pmu->tid = mcount_gettid(mtdp);
+
+	for (i = 0; i < mcount_rstack_max; i++)
+		pmu->entry[i].type = 0;
+}
+
+void mcount_pmu_release(struct mcount_thread_data *mtdp)
+{
+	struct mcount_pmu *pmu = mtdp->pmu;
+
+	if (pmu == NULL)
+		return;
+
+	close_pmu_counters(pmu);
+	munmap(pmu->entry, mcount_rstack_max * sizeof(*pmu->entry));
+	munmap(pmu, sizeof(*pmu));
+
+	mtdp->pmu = NULL;
+}
+
+#ifdef UNIT_TEST
+TEST_CASE(mcount_pmu)
+{
+	struct mcount_thread_data mtd_test = {};
+	struct mcount_ret_stack rstack[2] = {};
+	uint64_t *diff;
+
+	mtd_test.rstack = rstack;
+	mtd_test.idx = 1;
+
+	save_pmu_entry(&mtd_test, &rstack[0], TRIGGER_READ_PMU_CYCLE);
+	TEST_NE(mtd_test.pmu, NULL);
+
+	if (!(mtd_test.pmu->opened & TRIGGER_READ_PMU_CYCLE)) {
+		/* hardware counters are not available (in VM?) */
+		TEST_EQ(rstack[0].flags & MCOUNT_FL_READ, 0);
+		mcount_pmu_release(&mtd_test);
+		return TEST_SKIP;
+	}
+	TEST_EQ(rstack[0].flags & MCOUNT_FL_READ, MCOUNT_FL_READ);
+
+	rstack[0].end_time = 100;
+	save_pmu_exit(&mtd_test, &rstack[0]);
+	TEST_EQ(mtd_test.nr_events, 1);
+
+	diff = (void *)mcount_next_event(&mtd_test, NULL)->data;
+	TEST_GT(diff[0], 0);  /* cycles */
+	TEST_GT(diff[1], 0);  /* instructions */
+
+	mcount_release_events(&mtd_test);
+	mcount_pmu_release(&mtd_test);
+	TEST_EQ(mtd_test.pmu, NULL);
+
+	return TEST_OK;
+}
+
+TEST_CASE(mcount_pmu_rusage)
+{
+	struct mcount_thread_data mtd_test = {};
+	struct mcount_ret_stack rstack[2] = {};
+	struct mcount_pmu *pmu;
+	struct mcount_event *event;
+	int nr_pmu;
+
+	mtd_test.rstack = rstack;
+	mtd_test.idx = 1;
+
+	save_trigger_read(&mtd_test, &rstack[0],
+			  TRIGGER_READ_PMU_CYCLE | TRIGGER_READ_MAX_RSS);
+	pmu = mtd_test.pmu;
+	TEST_NE(pmu, NULL);
+	TEST_EQ(rstack[0].flags & MCOUNT_FL_READ, MCOUNT_FL_READ);
+
+	/* pmu counters might not be available (in VM?) */
+	nr_pmu = (pmu->opened & TRIGGER_READ_PMU_CYCLE) ? 1 : 0;
+
+	rstack[0].end_time = 100;
+	save_trigger_read_exit(&mtd_test, &rstack[0]);
+	TEST_EQ(mtd_test.nr_events, nr_pmu + 1);
+	TEST_EQ(pmu->entry[0].type, 0);
+	mcount_release_events(&mtd_test);
+
+	/* rusage only at the same depth should not save pmu events */
+	save_trigger_read(&mtd_test, &rstack[0], TRIGGER_READ_MAX_RSS);
+	save_trigger_read_exit(&mtd_test, &rstack[0]);
+	TEST_EQ(mtd_test.nr_events, 1);
+
+	event = mcount_next_event(&mtd_test, NULL);
+	TEST_EQ(event->id, EVENT_ID_READ_MAX_RSS);
+	mcount_release_events(&mtd_test);
+
+	/* a stale type (e.g. after longjmp) is reset if nothing is opened */
+	pmu->entry[0].type = TRIGGER_READ_PMU_CYCLE;
+	pmu->failed |= TRIGGER_READ_PMU_CACHE;
+
+	save_trigger_read(&mtd_test, &rstack[0],
+			  TRIGGER_READ_PMU_CACHE | TRIGGER_READ_MAX_RSS);
+	TEST_EQ(pmu->entry[0].type, 0);
+
+	save_trigger_read_exit(&mtd_test, &rstack[0]);
+	TEST_EQ(mtd_test.nr_events, 1);
+
+	event = mcount_next_event(&mtd_test, NULL);
+	TEST_EQ(event->id, EVENT_ID_READ_MAX_RSS);
+	mcount_release_events(&mtd_test);
+
+	/* values saved by the parent should not be used after fork */
+	pmu->entry[0].type = TRIGGER_READ_PMU_CYCLE;
+	pmu->tid = mcount_gettid(&mtd_test) + 1;
+
+	save_pmu_exit(&mtd_test, &rstack[0]);
+	TEST_EQ(mtd_test.nr_events, 0);
+	TEST_EQ(pmu->entry[0].type, 0);
+
+	pmu->entry[0].type = TRIGGER_READ_PMU_CYCLE;
+	pmu->entry[1].type = TRIGGER_READ_PMU_CYCLE;
+
+	mcount_pmu_reset(&mtd_test);
+	TEST_EQ(pmu->tid, mcount_gettid(&mtd_test));
+	TEST_EQ(pmu->opened, 0);
+	TEST_EQ(pmu->entry[0].type, 0);
+	TEST_EQ(pmu->entry[1].type, 0);
+
+	mcount_rusage_release(&mtd_test);
+	mcount_pmu_release(&mtd_test);
+	return TEST_OK;
+}
+#endif /* UNIT_TEST */
+
+#endif /* DISABLE_MCOUNT_FILTER */
@@ -225,20 +225,84 @@ void shmem_finish(struct mcount_thread_data *mtdp)
 void *get_argbuf(struct mcount_thread_data *mtdp,
 		 struct mcount_ret_stack *rstack)
 {
-	ptrdiff_t idx = rstack - mtdp->rstack;
+	if (mtdp->argbuf == NULL)
+		return NULL;
 
-	return mtdp->argbuf + (idx * ARGBUF_SIZE);
+	return mtdp->argbuf + rstack->argbuf_off;
+}
+
+/*
+ * The argbuf is a per-thread arena to save argument data.  As functions
+ * are called in LIFO order, it just bumps the used size by the actual
+ * size of the data and the exit path resets it to the offset of the
+ * function.  Only the address space is reserved at first, so a thread
+ * uses pages only for argument data it actually saved.  The size is
+ * decided when the thread first saves an argument (or return value).
+ */
+static int prepare_argbuf(struct mcount_thread_data *mtdp)
+{
+	size_t size;
+	void *buf;
+
+	if (likely(mtdp->argbuf))
+		return 0;
+
+	size = mcount_argbuf_size();
+	if (size == 0)
+		return -1;
+
+	buf = mmap(NULL, size,
+		   PROT_READ | PROT_WRITE,
+		   MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (buf == MAP_FAILED) {
+		pr_dbg("cannot allocate argbuf: %m\n");
+		return -1;
+	}
+
+	mtdp->argbuf = buf;
+	mtdp->argbuf_size = size;
+	mtdp->argbuf_used = 0;
+	return 0;
+}
+
+/* available space for a function starting at @off (w/o the size) */
+static unsigned argbuf_space(struct mcount_thread_data *mtdp, unsigned off)
+{
+	size_t space = ARGBUF_SIZE;
+
+	if (off + sizeof(unsigned) >= mtdp->argbuf_size)
+		return 0;
+
+	if (space > mtdp->argbuf_size - off)
+		space = mtdp->argbuf_size - off;
+
+	return space - sizeof(unsigned);
+}
+
+/* it'd be too noisy to warn on every call of a deep recursion */
+static void warn_argbuf_full(struct mcount_thread_data *mtdp, const char *what)
+{
+	if (mtdp->argbuf_warned)
+		return;
+
+	pr_warn("%s data is too big (further ones are dropped silently)\n",
+		what);
+	mtdp->argbuf_warned = true;
 }
 
 static unsigned save_to_argbuf(void *argbuf, struct list_head *args_spec,
-			       struct mcount_arg_context *ctx)
+			       struct mcount_arg_context *ctx,
+			       unsigned max_size)
 {
 	struct uftrace_arg_spec *spec;
 	unsigned size, total_size = 0;
-	unsigned max_size = ARGBUF_SIZE - sizeof(size);
 	bool is_retval = !!ctx->retval;
 	void *ptr;
 
+	/* no space even for the size */
+	if (max_size == 0)
+		return -1U;
+
 	ptr = argbuf + sizeof(total_size);
 	list_for_each_entry(spec, args_spec, list) {
 		if (is_retval != (spec->idx == RETVAL_IDX))
@@ -266,6 +330,10 @@ static unsigned save_to_argbuf(void *argbuf, struct list_head *args_spec,
 				str = _M_dataplus;
 			}
 
+			/* 2-byte length and (at least) 4 byte for "NULL" */
+			if (total_size + 6 > max_size)
+				return -1U;
+
 			if (str) {
 				unsigned i;
 				char *dst = ptr + 2;
@@ -276,7 +344,7 @@ static unsigned save_to_argbuf(void *argbuf, struct list_head *args_spec,
 				 * implementation.  Do it manually.
 				 */
 				len = 0;
-				for (i = 0; i < max_size - total_size; i++) {
+				for (i = 0; i < max_size - total_size - 2; i++) {
 					dst[i] = str[i];
 					if (!str[i])
 						break;
@@ -296,6 +364,8 @@ static unsigned save_to_argbuf(void *argbuf, struct list_head *args_spec,
 		}
 		else {
 			size = ALIGN(spec->size, 4);
+			if (total_size + size > max_size)
+				return -1U;
 			mcount_memcpy4(ptr, ctx->val.v, size);
 		}
 		ptr += size;
@@ -313,36 +383,62 @@ void save_argument(struct mcount_thread_data *mtdp,
 		   struct list_head *args_spec,
 		   struct mcount_regs *regs)
 {
-	void *argbuf = get_argbuf(mtdp, rstack);
+	void *argbuf;
 	unsigned size;
 	struct mcount_arg_context ctx = {
 		.regs = regs,
 		.stack_base = rstack->parent_loc,
 	};
 
-	size = save_to_argbuf(argbuf, args_spec, &ctx);
+	if (prepare_argbuf(mtdp) < 0)
+		return;
+
+	rstack->argbuf_off = mtdp->argbuf_used;
+	argbuf = get_argbuf(mtdp, rstack);
+
+	/* the arena might be used up by deep recursion */
+	size = save_to_argbuf(argbuf, args_spec, &ctx,
+			      argbuf_space(mtdp, rstack->argbuf_off));
 	if (size == -1U) {
-		pr_warn("argument data is too big\n");
+		warn_argbuf_full(mtdp, "argument");
 		return;
 	}
 
 	*(unsigned *)argbuf = size;
 	rstack->flags |= MCOUNT_FL_ARGUMENT;
+
+	/* keep the data until the function returns */
+	mtdp->argbuf_used += ALIGN(size + sizeof(size), 8);
 }
 
 void save_retval(struct mcount_thread_data *mtdp,
 		 struct mcount_ret_stack *rstack, long *retval)
 {
 	struct list_head *args_spec = rstack->pargs;
-	void *argbuf = get_argbuf(mtdp, rstack);
+	void *argbuf;
 	unsigned size;
 	struct mcount_arg_context ctx = {
 		.retval = retval,
 	};
 
-	size = save_to_argbuf(argbuf, args_spec, &ctx);
+	if (prepare_argbuf(mtdp) < 0) {
+		rstack->flags &= ~MCOUNT_FL_RETVAL;
+		return;
+	}
+
+	/*
+	 * Arguments were already written at this point so it can reuse
+	 * the space.  Otherwise use the space at the end of the arena
+	 * as all the child functions have returned.
+	 */
+	if (!(rstack->flags & MCOUNT_FL_ARGUMENT))
+		rstack->argbuf_off = mtdp->argbuf_used;
+	argbuf = get_argbuf(mtdp, rstack);
+
+	size = save_to_argbuf(argbuf, args_spec, &ctx,
+			      argbuf_space(mtdp, rstack->argbuf_off));
 	if (size == -1U) {
-		pr_warn("retval data is too big\n");
+		warn_argbuf_full(mtdp, "retval");
 		rstack->flags &= ~MCOUNT_FL_RETVAL;
 		return;
 	}
@@ -350,26 +446,118 @@ void save_retval(struct mcount_thread_data *mtdp,
 	*(unsigned *)argbuf = size;
 }
 
+/*
+ * It's opened once and shared by all threads (reset after fork).  But
+ * the program might close it or dup2() other file over it, so the
+ * device and inode numbers are kept to check if it's still ours.
+ */
+static int statm_fd = -1;
+static dev_t statm_dev;
+static ino_t statm_ino;
+
+/* parse a decimal number after spaces, returns NULL if not found */
+static char *scan_u64(char *p, uint64_t *val)
+{
+	uint64_t v = 0;
+
+	while (*p == ' ')
+		p++;
+
+	if (*p < '0' || *p > '9')
+		return NULL;
+
+	while (*p >= '0' && *p <= '9')
+		v = v * 10 + (*p++ - '0');
+
+	*val = v;
+	return p;
+}
+
+static bool is_statm_fd(int fd)
+{
+	struct stat st;
+
+	if (fd < 0 || fstat(fd, &st) < 0)
+		return false;
+
+	return st.st_dev == statm_dev && st.st_ino == statm_ino;
+}
+
+/* open a new fd to replace @old_fd (which is not ours anymore) */
+static int open_proc_statm(int old_fd)
+{
+	struct stat st;
+	int fd;
+
+	fd = open("/proc/self/statm", O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -1;
+
+	if (fstat(fd, &st) == 0) {
+		statm_dev = st.st_dev;
+		statm_ino = st.st_ino;
+	}
+
+	/* other thread might open it already */
+	if (!__sync_bool_compare_and_swap(&statm_fd, old_fd, fd)) {
+		close(fd);
+		fd = statm_fd;
+	}
+	return fd;
+}
+
+static bool read_proc_statm(int fd, struct uftrace_proc_statm *statm)
+{
+	char data[128];
+	ssize_t len;
+	char *p;
+
+	len = pread(fd, data, sizeof(data) - 1, 0);
+	if (len <= 0)
+		return false;
+	data[len] = '\0';
+
+	p = scan_u64(data, &statm->vmsize);
+	if (p)
+		p = scan_u64(p, &statm->vmrss);
+	if (p)
+		p = scan_u64(p, &statm->shared);
+
+	return p != NULL;
+}
+
 static void save_proc_statm(void *buf)
 {
-	FILE *fp;
 	struct uftrace_proc_statm *statm = buf;
+	int fd = statm_fd;
 
-	fp = fopen("/proc/self/statm", "r");
-	if (fp == NULL)
-		pr_err("failed to open /proc/self/statm");
+	if (unlikely(!is_statm_fd(fd)))
+		fd = open_proc_statm(fd);
 
-	if (fscanf(fp, "%"SCNu64" %"SCNu64" %"SCNu64,
-		   &statm->vmsize, &statm->vmrss, &statm->shared) != 3)
-		pr_err("failed to scan /proc/self/statm");
+	if (unlikely(!read_proc_statm(fd, statm))) {
+		/* it might be changed after the check, retry once */
+		fd = open_proc_statm(fd);
+
+		if (!read_proc_statm(fd, statm)) {
+			pr_dbg("failed to read /proc/self/statm\n");
+			memset(statm, 0, sizeof(*statm));
+			return;
+		}
+	}
 
 	/* Since /proc/[pid]/statm prints the number of pages for each field,
 	 * it'd be better to keep the memory size in KB. */
 	statm->vmsize *= page_size_in_kb;
 	statm->vmrss  *= page_size_in_kb;
 	statm->shared *= page_size_in_kb;
+}
 
-	fclose(fp);
+/* /proc/self was resolved at open time, reopen it in the child */
+void reset_proc_statm(void)
+{
+	if (is_statm_fd(statm_fd))
+		close(statm_fd);
+	statm_fd = -1;
 }
 
 static void save_page_fault(void *buf)
@@ -384,6 +572,103 @@ static void save_page_fault(void *buf)
 	page_fault->minor = ru.ru_minflt;
 }
 
+#define RUSAGE_TYPES  (TRIGGER_READ_MAX_RSS | TRIGGER_READ_CTX_SWITCH)
+
+/* rusage values at function entry (per rstack) */
+struct mcount_rusage_entry {
+	enum trigger_read_type	type;
+	uint64_t		maxrss;
+	uint64_t		nvcsw;
+	uint64_t		nivcsw;
+};
+
+static void save_rusage_entry(struct mcount_thread_data *mtdp,
+			      struct mcount_ret_stack *rstack,
+			      enum trigger_read_type type)
+{
+	struct mcount_rusage_entry *entry;
+	struct rusage ru;
+
+	if (unlikely(mtdp->rusage == NULL)) {
+		void *buf;
+
+		buf = mmap(NULL, mcount_rstack_max * sizeof(*entry),
+			   PROT_READ | PROT_WRITE,
+			   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (buf == MAP_FAILED)
+			return;
+
+		mtdp->rusage = buf;
+	}
+
+	/* context switches are counted for this thread only */
+	if (getrusage(RUSAGE_THREAD, &ru) < 0)
+		return;
+
+	entry = &mtdp->rusage[rstack - mtdp->rstack];
+	entry->type   = type & RUSAGE_TYPES;
+	entry->maxrss = ru.ru_maxrss;
+	entry->nvcsw  = ru.ru_nvcsw;
+	entry->nivcsw = ru.ru_nivcsw;
+
+	rstack->flags |= MCOUNT_FL_READ;
+}
+
+static void save_rusage_exit(struct mcount_thread_data *mtdp,
+			     struct mcount_ret_stack *rstack)
+{
+	struct mcount_rusage_entry *entry;
+	struct mcount_event *event;
+	struct rusage ru;
+
+	if (mtdp->rusage == NULL)
+		return;
+
+	entry = &mtdp->rusage[rstack - mtdp->rstack];
+	if (entry->type == 0 || getrusage(RUSAGE_THREAD, &ru) < 0)
+		return;
+
+	/* it should be written before the exit record */
+	if (entry->type & TRIGGER_READ_MAX_RSS) {
+		struct uftrace_max_rss *max_rss;
+
+		event = mcount_alloc_event(mtdp, sizeof(*max_rss));
+		if (event) {
+			event->id   = EVENT_ID_READ_MAX_RSS;
+			event->time = rstack->end_time - 1;
+			event->idx  = mtdp->idx;
+
+			max_rss = (void *)event->data;
+			max_rss->grow = ru.ru_maxrss - entry->maxrss;
+		}
+	}
+	if (entry->type & TRIGGER_READ_CTX_SWITCH) {
+		struct uftrace_ctx_switch *ctxsw;
+
+		event = mcount_alloc_event(mtdp, sizeof(*ctxsw));
+		if (event) {
+			event->id   = EVENT_ID_READ_CTX_SWITCH;
+			event->time = rstack->end_time - 1;
+			event->idx  = mtdp->idx;
+
+			ctxsw = (void *)event->data;
+			ctxsw->voluntary   = ru.ru_nvcsw - entry->nvcsw;
+			ctxsw->involuntary = ru.ru_nivcsw - entry->nivcsw;
+		}
+	}
+
+	entry->type = 0;
+}
+
+void mcount_rusage_release(struct mcount_thread_data *mtdp)
+{
+	if (mtdp->rusage) {
+		munmap(mtdp->rusage,
+		       mcount_rstack_max * sizeof(struct mcount_rusage_entry));
+	}
+	mtdp->rusage = NULL;
+}
+
 void save_trigger_read(struct mcount_thread_data *mtdp,
 		       struct mcount_ret_stack *rstack,
 		       enum trigger_read_type type)
@@ -391,12 +676,10 @@ void save_trigger_read(struct mcount_thread_data *mtdp,
 	if (type & TRIGGER_READ_PROC_STATM) {
 		struct mcount_event *event;
 
-		if (mtdp->nr_events < MAX_EVENT) {
-			event = &mtdp->event[mtdp->nr_events++];
-
+		event = mcount_alloc_event(mtdp, sizeof(struct uftrace_proc_statm));
+		if (event) {
 			event->id    = EVENT_ID_PROC_STATM;
 			event->time  = rstack->start_time;
-			event->dsize = sizeof(struct uftrace_proc_statm);
 			event->idx   = mtdp->idx;
 			save_proc_statm(event->data);
 		}
@@ -404,17 +687,124 @@ void save_trigger_read(struct mcount_thread_data *mtdp,
 	if (type & TRIGGER_READ_PAGE_FAULT) {
 		struct mcount_event *event;
 
-		if (mtdp->nr_events < MAX_EVENT) {
-			event = &mtdp->event[mtdp->nr_events++];
-
+		event = mcount_alloc_event(mtdp, sizeof(struct uftrace_page_fault));
+		if (event) {
 			event->id    = EVENT_ID_PAGE_FAULT;
 			event->time  = rstack->start_time;
-			event->dsize = sizeof(struct uftrace_page_fault);
 			event->idx   = mtdp->idx;
 			save_page_fault(event->data);
 		}
 	}
+	if (type & (TRIGGER_READ_PMU_CYCLE | TRIGGER_READ_PMU_CACHE |
+		    TRIGGER_READ_PMU_BRANCH))
+		save_pmu_entry(mtdp, rstack, type);
+	if (type & RUSAGE_TYPES)
+		save_rusage_entry(mtdp, rstack, type);
+}
+
+/* save diffs of the values read at entry (MCOUNT_FL_READ) */
+void save_trigger_read_exit(struct mcount_thread_data *mtdp,
+			    struct mcount_ret_stack *rstack)
+{
+	save_pmu_exit(mtdp, rstack);
+	save_rusage_exit(mtdp, rstack);
+
+	rstack->flags &= ~MCOUNT_FL_READ;
+}
+
+#ifdef UNIT_TEST
+TEST_CASE(mcount_read_statm)
+{
+	char data[] = "123 45  6 rest";
+	struct uftrace_proc_statm statm;
+	uint64_t val;
+	char *p;
+	int fd, old_fd;
+
+	p = scan_u64(data, &val);
+	TEST_EQ(val, 123);
+	p = scan_u64(p, &val);
+	TEST_EQ(val, 45);
+	p = scan_u64(p, &val);
+	TEST_EQ(val, 6);
+	TEST_EQ(scan_u64(p, &val), NULL);
+
+	page_size_in_kb = 4;
+	save_proc_statm(&statm);
+	TEST_GT(statm.vmsize, 0);
+	TEST_GT(statm.vmrss, 0);
+	TEST_GE(statm.vmsize, statm.vmrss);
+
+	/* read again with the cached fd */
+	TEST_GE(statm_fd, 0);
+	save_proc_statm(&statm);
+	TEST_GT(statm.vmsize, 0);
+
+	/* the program closed it */
+	close(statm_fd);
+	memset(&statm, 0, sizeof(statm));
+	save_proc_statm(&statm);
+	TEST_GT(statm.vmsize, 0);
+	TEST_EQ(is_statm_fd(statm_fd), true);
+
+	/* the program put other file on it */
+	old_fd = statm_fd;
+	fd = open("/dev/null", O_RDONLY);
+	TEST_GE(fd, 0);
+	TEST_EQ(dup2(fd, old_fd), old_fd);
+	memset(&statm, 0, sizeof(statm));
+	save_proc_statm(&statm);
+	TEST_GT(statm.vmsize, 0);
+	TEST_NE(statm_fd, old_fd);
+	TEST_EQ(is_statm_fd(statm_fd), true);
+	close(old_fd);
+	close(fd);
+
+	reset_proc_statm();
+	TEST_EQ(statm_fd, -1);
+
+	return TEST_OK;
+}
+
+TEST_CASE(mcount_read_rusage)
+{
+	struct mcount_thread_data mtd_test = {};
+	struct mcount_ret_stack rstack[2] = {};
+	struct uftrace_ctx_switch *ctxsw;
+	struct mcount_event *event;
+
+	mtd_test.rstack = rstack;
+	mtd_test.idx = 1;
+
+	save_rusage_entry(&mtd_test, &rstack[0],
+			  TRIGGER_READ_MAX_RSS | TRIGGER_READ_CTX_SWITCH);
+	TEST_NE(mtd_test.rusage, NULL);
+	TEST_EQ(rstack[0].flags & MCOUNT_FL_READ, MCOUNT_FL_READ);
+
+	/* make sure to have a voluntary context switch */
+	usleep(1000);
+
+	rstack[0].end_time = 100;
+	save_trigger_read_exit(&mtd_test, &rstack[0]);
+	TEST_EQ(rstack[0].flags & MCOUNT_FL_READ, 0);
+	TEST_EQ(mtd_test.nr_events, 2);
+
+	event = mcount_next_event(&mtd_test, NULL);
+	TEST_EQ(event->id, EVENT_ID_READ_MAX_RSS);
+	TEST_EQ(event->time, 99);
+
+	event = mcount_next_event(&mtd_test, event);
+	TEST_EQ(event->id, EVENT_ID_READ_CTX_SWITCH);
+	ctxsw = (void *)event->data;
+	TEST_GT(ctxsw->voluntary, 0);
+
+	mcount_release_events(&mtd_test);
+	mcount_rusage_release(&mtd_test);
+	TEST_EQ(mtd_test.rusage, NULL);
+
+	return TEST_OK;
 }
+#endif /* UNIT_TEST */
 
 #else
 void *get_argbuf(struct mcount_thread_data *mtdp,
@@ -433,12 +823,21 @@ void save_trigger_read(struct mcount_thread_data *mtdp,
 		       enum trigger_read_type type)
 {
 }
+
+void save_trigger_read_exit(struct mcount_thread_data *mtdp,
+			    struct mcount_ret_stack *rstack)
+{
+}
+
+void reset_proc_statm(void)
+{
+}
 #endif
 
-static int record_event(struct mcount_thread_data *mtdp)
+static int record_event(struct mcount_thread_data *mtdp,
+			struct mcount_event *event)
 {
 	struct mcount_shmem *shmem = &mtdp->shmem;
-	struct mcount_event *event = &mtdp->event[0];
 	struct mcount_shmem_buffer *curr_buf = shmem->buffer[shmem->curr];
 	size_t maxsize = (size_t)shmem_bufsize - sizeof(**shmem->buffer);
 	struct {
@@ -487,9 +886,6 @@ static int record_event(struct mcount_thread_data *mtdp)
 
 	curr_buf->size += size;
 
-	/* clear event info */
-	mtdp->nr_events--;
-
 	return 0;
 }
 
@@ -510,13 +906,14 @@ static int record_ret_stack(struct mcount_thread_data *mtdp,
 	if (type == UFTRACE_EXIT)
 		timestamp = mrstack->end_time;
 
-	if (unlikely(mtdp->nr_events)) {
-		while (mtdp->nr_events && mtdp->event[0].time < timestamp) {
-			record_event(mtdp);
+	while (unlikely(mtdp->nr_events)) {
+		struct mcount_event *event = mcount_next_event(mtdp, NULL);
 
-			mcount_memcpy4(&mtdp->event[0], &mtdp->event[1],
-				       sizeof(*mtdp->event) * mtdp->nr_events);
-		}
+		if (event->time >= timestamp)
+			break;
+
+		record_event(mtdp, event);
+		mcount_consume_event(mtdp);
 	}
 
 	if ((type == UFTRACE_ENTRY && mrstack->flags & MCOUNT_FL_ARGUMENT) ||
@@ -586,6 +983,53 @@ static int record_ret_stack(struct mcount_thread_data *mtdp,
 	return 0;
 }
 
+/* write entry and exit of a leaf function as a single record */
+static int record_complete_stack(struct mcount_thread_data *mtdp,
+				 struct mcount_ret_stack *mrstack)
+{
+	struct mcount_shmem *shmem = &mtdp->shmem;
+	struct mcount_shmem_buffer *curr_buf;
+	size_t maxsize;
+	size_t size = sizeof(struct uftrace_record) + sizeof(uint64_t);
+	uint64_t *buf;
+	uint64_t rec;
+
+	maxsize = (size_t)shmem_bufsize - sizeof(**shmem->buffer);
+	curr_buf = shmem->buffer[shmem->curr];
+
+	if (unlikely(shmem->curr == -1 || curr_buf->size + size > maxsize)) {
+		if (shmem->done)
+			return 0;
+		if (shmem->curr > -1)
+			finish_shmem_buffer(mtdp, shmem->curr);
+		get_new_shmem_buffer(mtdp);
+
+		if (shmem->curr == -1) {
+			shmem->losts += 2;
+			return -1;
+		}
+
+		curr_buf = shmem->buffer[shmem->curr];
+	}
+
+	/* see is_complete_record() */
+	rec  = UFTRACE_LOST | RECORD_MAGIC << 3;
+	rec += 4;  /* set 'more' bit */
+	rec += mrstack->depth << 6;
+	rec += (uint64_t)mrstack->child_ip << 16;
+
+	buf = (void *)(curr_buf->data + curr_buf->size);
+	buf[0] = mrstack->start_time;
+	buf[1] = rec;
+	buf[2] = mrstack->end_time - mrstack->start_time;
+
+	curr_buf->size += size;
+	mrstack->flags |= MCOUNT_FL_WRITTEN;
+
+	pr_dbg3("rstack[%d] COMPL %lx\n", mrstack->depth, mrstack->child_ip);
+	return 0;
+}
+
 int record_trace_data(struct mcount_thread_data *mtdp,
 		      struct mcount_ret_stack *mrstack,
 		      long *retval)
@@ -649,6 +1093,18 @@ int record_trace_data(struct mcount_thread_data *mtdp,
 		non_written_mrstack++;
 	}
 
+#define NO_COMPLETE_FLAGS  (MCOUNT_FL_WRITTEN | MCOUNT_FL_ARGUMENT | SKIP_FLAGS)
+
+	/*
+	 * Use a complete record if the function returns before writing
+	 * anything (child, event) after the entry.
+	 */
+	if (mrstack->end_time && retval == NULL && mtdp->nr_events == 0 &&
+	    !(mrstack->flags & NO_COMPLETE_FLAGS)) {
+		record_complete_stack(mtdp, mrstack);
+		return 0;
+	}
+
 	if (!(mrstack->flags & (MCOUNT_FL_WRITTEN | SKIP_FLAGS))) {
 		if (record_ret_stack(mtdp, UFTRACE_ENTRY, non_written_mrstack))
 			return 0;
@@ -739,4 +1195,6 @@ next:
 
 	fclose(ifp);
 	fclose(ofp);
+
+	build_maps_index(symtabs);
 }
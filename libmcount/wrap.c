@@ -51,27 +51,18 @@ static void send_dlopen_msg(struct mcount_thread_data *mtdp, const char *sess_id
 		.base_addr = base_addr,
 		.namelen = strlen(libname),
 	};
-	struct uftrace_msg msg = {
-		.magic = UFTRACE_MSG_MAGIC,
-		.type = UFTRACE_MSG_DLOPEN,
-		.len = sizeof(dlop) + dlop.namelen,
-	};
 	struct iovec iov[3] = {
-		{ .iov_base = &msg, .iov_len = sizeof(msg), },
+		{ /* header */ },
 		{ .iov_base = &dlop, .iov_len = sizeof(dlop), },
 		{ .iov_base = (void *)libname, .iov_len = dlop.namelen, },
 	};
-	int len = sizeof(msg) + msg.len;
 
 	if (pfd < 0)
 		return;
 
 	mcount_memcpy4(dlop.sid, sess_id, sizeof(dlop.sid));
 
-	if (writev(pfd, iov, 3) != len) {
-		if (!mcount_should_stop())
-			pr_err("write tid info failed");
-	}
+	uftrace_send_messagev(UFTRACE_MSG_DLOPEN, iov, 3);
 }
 
 /*
@@ -214,6 +205,9 @@ __visible_default void * dlopen(const char *filename, int flags)
 	send_dlopen_msg(mtdp, mcount_session_name(), timestamp,
 			data.base_addr, data.libname);
 
+	if (ret != NULL)
+		mcount_script_dlopen(data.libname, data.base_addr);
+
 	mtdp->recursion_guard = false;
 	return ret;
 }
@@ -0,0 +1,36 @@
+/*
+ * Native script example: count function calls
+ *
+ *   $ gcc -shared -fPIC -I<uftrace-srcdir> -o count.so count.c
+ *
+ * The -I option is not needed if uftrace is installed.
+ *   $ uftrace script -S count.so
+ */
+#include <stdio.h>
+#include "uftrace-script.h"
+
+int uftrace_script_version = UFTRACE_SCRIPT_VERSION;
+
+static unsigned long count;
+
+int uftrace_begin(void)
+{
+	return 0;
+}
+
+int uftrace_entry(struct uftrace_script_context *ctx)
+{
+	count++;
+	return 0;
+}
+
+int uftrace_exit(struct uftrace_script_context *ctx)
+{
+	return 0;
+}
+
+int uftrace_end(void)
+{
+	printf("%lu\n", count);
+	return 0;
+}
@@ -0,0 +1,42 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define NSEC_PER_SEC  1000000000ULL
+
+static unsigned long long now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+#ifdef BENCH_LIB
+/* call through PLT (for plthook) */
+extern int empty(int n);
+#else
+int __attribute__((noinline)) empty(int n)
+{
+	asm volatile ("" ::: "memory");
+	return n;
+}
+#endif
+
+int main(int argc, char *argv[])
+{
+	unsigned long long start, elapsed;
+	int i, n = 1000000;
+	volatile int sum = 0;
+
+	if (argc > 1)
+		n = atoi(argv[1]);
+
+	start = now();
+	for (i = 0; i < n; i++)
+		sum += empty(i);
+	elapsed = now() - start;
+
+	printf("calls: %d elapsed: %llu\n", n, elapsed);
+	return 0;
+}
@@ -0,0 +1,47 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define NSEC_PER_SEC  1000000000ULL
+#define DEPTH  100
+
+static unsigned long long now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+int deep(int n);
+
+/* prevent compiler from converting the recursion to a loop */
+int (* volatile deep_fn)(int) = deep;
+
+int deep(int n)
+{
+	if (n == 0)
+		return 0;
+	return deep_fn(n - 1) + 1;
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned long long start, elapsed;
+	int i, n = 1000000;
+	volatile int sum = 0;
+
+	if (argc > 1)
+		n = atoi(argv[1]);
+
+	/* each deep() makes DEPTH + 1 calls */
+	n /= DEPTH + 1;
+
+	start = now();
+	for (i = 0; i < n; i++)
+		sum += deep(DEPTH);
+	elapsed = now() - start;
+
+	printf("calls: %d elapsed: %llu\n", n * (DEPTH + 1), elapsed);
+	return 0;
+}
@@ -0,0 +1,48 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define NSEC_PER_SEC  1000000000ULL
+
+static unsigned long long now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+#define LEAF(x)  int __attribute__((noinline)) leaf##x(int n)  \
+	{ asm volatile ("" ::: "memory"); return n + x; }
+
+LEAF(0)  LEAF(1)  LEAF(2)  LEAF(3)  LEAF(4)  LEAF(5)  LEAF(6)  LEAF(7)
+LEAF(8)  LEAF(9)  LEAF(10) LEAF(11) LEAF(12) LEAF(13) LEAF(14) LEAF(15)
+
+int fanout(int n)
+{
+	return leaf0(n)  + leaf1(n)  + leaf2(n)  + leaf3(n)  +
+	       leaf4(n)  + leaf5(n)  + leaf6(n)  + leaf7(n)  +
+	       leaf8(n)  + leaf9(n)  + leaf10(n) + leaf11(n) +
+	       leaf12(n) + leaf13(n) + leaf14(n) + leaf15(n);
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned long long start, elapsed;
+	int i, n = 1000000;
+	volatile int sum = 0;
+
+	if (argc > 1)
+		n = atoi(argv[1]);
+
+	/* each fanout() makes 17 calls */
+	n /= 17;
+
+	start = now();
+	for (i = 0; i < n; i++)
+		sum += fanout(i);
+	elapsed = now() - start;
+
+	printf("calls: %d elapsed: %llu\n", n * 17, elapsed);
+	return 0;
+}
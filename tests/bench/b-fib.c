@@ -0,0 +1,42 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define NSEC_PER_SEC  1000000000ULL
+
+static unsigned long long now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+static int calls;
+
+int fib(int n)
+{
+	calls++;
+	if (n <= 2)
+		return 1;
+	return fib(n-1) + fib(n-2);
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned long long start, elapsed;
+	int n = 1000000;
+	volatile int sum = 0;
+
+	if (argc > 1)
+		n = atoi(argv[1]);
+
+	start = now();
+	/* fib(20) makes 13529 calls */
+	while (calls < n)
+		sum += fib(20);
+	elapsed = now() - start;
+
+	printf("calls: %d elapsed: %llu\n", calls, elapsed);
+	return 0;
+}
@@ -0,0 +1,5 @@
+int __attribute__((noinline)) empty(int n)
+{
+	asm volatile ("" ::: "memory");
+	return n;
+}
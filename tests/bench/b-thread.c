@@ -0,0 +1,55 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+
+#define NSEC_PER_SEC  1000000000ULL
+#define NR_THREADS  8
+
+static unsigned long long now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+int __attribute__((noinline)) empty(int n)
+{
+	asm volatile ("" ::: "memory");
+	return n;
+}
+
+void *worker(void *arg)
+{
+	int i, n = (long)arg;
+	volatile int sum = 0;
+
+	for (i = 0; i < n; i++)
+		sum += empty(i);
+	return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned long long start, elapsed;
+	pthread_t th[NR_THREADS];
+	int i, n = 1000000;
+
+	if (argc > 1)
+		n = atoi(argv[1]);
+
+	/* each thread makes n / NR_THREADS calls */
+	n /= NR_THREADS;
+
+	start = now();
+	for (i = 0; i < NR_THREADS; i++)
+		pthread_create(&th[i], NULL, worker, (void *)(long)n);
+	for (i = 0; i < NR_THREADS; i++)
+		pthread_join(th[i], NULL);
+	elapsed = now() - start;
+
+	/* worker() is also traced */
+	printf("calls: %d elapsed: %llu\n", (n + 1) * NR_THREADS, elapsed);
+	return 0;
+}
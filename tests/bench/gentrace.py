@@ -0,0 +1,180 @@
+#!/usr/bin/env python
+#
+# Synthetic trace generator for analysis benchmarks
+#
+# It writes a uftrace data directory with the same layout as the
+# record command (and fstack_test_setup_file() in utils/fstack.c):
+# info, task.txt, sid-<SID>.map, <EXE>.sym and <TID>.dat files.
+# The call graph is a random walk using a fixed seed so that the
+# same arguments always generate the same data.
+#
+
+import os, sys
+import struct, random, shutil
+
+UFTRACE_MAGIC         = b'Ftrace!\0'
+UFTRACE_FILE_VERSION  = 4
+UFTRACE_HEADER_SIZE   = 40
+
+# feat_mask bits
+TASK_SESSION  = 1 << 1
+SYM_REL_ADDR  = 1 << 5
+MAX_STACK     = 1 << 6
+
+# info_mask bits
+EXE_NAME      = 1 << 0
+EXIT_STATUS   = 1 << 2
+CMDLINE       = 1 << 3
+TASKINFO      = 1 << 7
+
+# record types
+UFTRACE_ENTRY = 0
+UFTRACE_EXIT  = 1
+RECORD_MAGIC  = 5
+
+EXE_BASE      = 0x400000
+SYM_START     = 0x1000
+SYM_SIZE      = 0x40
+
+record_struct = struct.Struct('<QQ')
+
+def make_record(time, rtype, depth, addr):
+    # type:2, more:1, magic:3, depth:10, addr:48
+    word = rtype | (RECORD_MAGIC << 3) | (depth << 6) | (addr << 16)
+    return record_struct.pack(time, word)
+
+def write_info(dirname, exename, tids, max_stack):
+    feat = TASK_SESSION | SYM_REL_ADDR | MAX_STACK
+    info = EXE_NAME | EXIT_STATUS | CMDLINE | TASKINFO
+
+    # magic, version, header_size, endian (little), class (64-bit),
+    # feat_mask, info_mask, max_stack, unused
+    hdr = struct.pack('<8sIHBBQQHHI', UFTRACE_MAGIC, UFTRACE_FILE_VERSION,
+                      UFTRACE_HEADER_SIZE, 1, 2, feat, info, max_stack, 0, 0)
+
+    # sections should be written in the order of info bits
+    text  = 'exename:%s\n' % exename
+    text += 'exit_status:0\n'
+    text += 'cmdline:%s\n' % exename
+    text += 'taskinfo:lines=2\n'
+    text += 'taskinfo:nr_tid=%d\n' % len(tids)
+    text += 'taskinfo:tids=%s\n' % ','.join([str(t) for t in tids])
+
+    with open(os.path.join(dirname, 'info'), 'wb') as f:
+        f.write(hdr)
+        f.write(text.encode())
+
+def write_task(dirname, exename, sid, tids, timestamp):
+    def ts(t):
+        return '%d.%09d' % (t // 1000000000, t % 1000000000)
+
+    pid = tids[0]
+    with open(os.path.join(dirname, 'task.txt'), 'w') as f:
+        f.write('SESS timestamp=%s pid=%d sid=%s exename="%s"\n' %
+                (ts(timestamp), pid, sid, exename))
+        for tid in tids:
+            f.write('TASK timestamp=%s tid=%d pid=%d\n' % (ts(timestamp), tid, pid))
+
+def write_map(dirname, exename, sid, nr_syms):
+    end = EXE_BASE + SYM_START + (nr_syms + 1) * SYM_SIZE
+    end = (end + 0xfff) & ~0xfff
+
+    with open(os.path.join(dirname, 'sid-%s.map' % sid), 'w') as f:
+        f.write('%08x-%08x r-xp 00000000 00:00 0 %28s%s\n' %
+                (EXE_BASE, end, '', exename))
+        f.write('7ffd00000000-7ffd00021000 rw-p 00000000 00:00 0 %20s[stack]\n' % '')
+
+def write_sym(dirname, exename, nr_syms):
+    symfile = os.path.join(dirname, os.path.basename(exename) + '.sym')
+
+    with open(symfile, 'w') as f:
+        f.write('%016x T main\n' % SYM_START)
+        for i in range(1, nr_syms):
+            f.write('%016x T func%d\n' % (SYM_START + i * SYM_SIZE, i))
+        f.write('%016x T __sym_end\n' % (SYM_START + nr_syms * SYM_SIZE))
+
+def gen_records(nr_records, depth, nr_syms, timestamp, rand):
+    """ generates (at least) nr_records of matching entry/exit records """
+    stack = []
+    buf = []
+    time = timestamp
+    count = 0
+
+    def sym_addr(idx):
+        return EXE_BASE + SYM_START + idx * SYM_SIZE
+
+    while count < nr_records or stack:
+        time += rand.randint(10, 1000)
+
+        if stack and (count >= nr_records or len(stack) >= depth or
+                      rand.random() < 0.5):
+            idx = stack.pop()
+            buf.append(make_record(time, UFTRACE_EXIT, len(stack), sym_addr(idx)))
+        else:
+            # the first function is always 'main'
+            idx = stack and rand.randrange(nr_syms) or 0
+            buf.append(make_record(time, UFTRACE_ENTRY, len(stack), sym_addr(idx)))
+            stack.append(idx)
+        count += 1
+
+        if len(buf) >= 65536:
+            yield b''.join(buf)
+            buf = []
+
+    yield b''.join(buf)
+
+def generate(dirname, nr_tasks, depth, nr_records, nr_syms, seed=0):
+    exename = '/tmp/uftrace-bench/t-synth'
+    sid = '%016x' % (0xbe4c4000 + seed)
+    pid = 10000
+    tids = [pid + i for i in range(nr_tasks)]
+    timestamp = 1000 * 1000000000
+
+    shutil.rmtree(dirname, ignore_errors=True)
+    os.makedirs(dirname)
+
+    write_info(dirname, exename, tids, max(depth, 1024))
+    write_task(dirname, exename, sid, tids, timestamp)
+    write_map(dirname, exename, sid, nr_syms)
+    write_sym(dirname, exename, nr_syms)
+
+    total = 0
+    for tid in tids:
+        rand = random.Random(seed * 1000 + tid)
+        with open(os.path.join(dirname, '%d.dat' % tid), 'wb') as f:
+            for chunk in gen_records(nr_records // nr_tasks, depth, nr_syms,
+                                     timestamp + 1000, rand):
+                f.write(chunk)
+                total += len(chunk) // record_struct.size
+
+    return total
+
+def parse_argument():
+    import argparse
+
+    parser = argparse.ArgumentParser(description="generate synthetic uftrace data")
+    parser.add_argument("-d", "--data", dest='dirname', default='uftrace.data',
+                        help="name of the data directory to generate")
+    parser.add_argument("-t", "--tasks", dest='tasks', type=int, default=1,
+                        help="number of tasks (threads)")
+    parser.add_argument("-D", "--depth", dest='depth', type=int, default=32,
+                        help="max call depth")
+    parser.add_argument("-n", "--records", dest='records', type=int, default=1000000,
+                        help="total number of records for all tasks")
+    parser.add_argument("-s", "--symbols", dest='symbols', type=int, default=1000,
+                        help="number of symbols (functions)")
+    parser.add_argument("--seed", dest='seed', type=int, default=0,
+                        help="seed for random number generator")
+
+    return parser.parse_args()
+
+if __name__ == "__main__":
+    arg = parse_argument()
+
+    if arg.tasks < 1 or arg.depth < 1 or arg.depth > 1023 or arg.symbols < 1:
+        print("invalid argument")
+        sys.exit(1)
+
+    total = generate(arg.dirname, arg.tasks, arg.depth, arg.records,
+                     arg.symbols, arg.seed)
+    print("%s: %d records for %d tasks" % (arg.dirname, total, arg.tasks))
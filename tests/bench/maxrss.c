@@ -0,0 +1,54 @@
+/*
+ * Run a command and print its elapsed time (in nsec) and peak RSS (in KB).
+ *
+ * The peak RSS of a process includes the memory of its parent at fork
+ * time.  So running it from a (big) script would give a wrong result.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+
+int main(int argc, char *argv[])
+{
+	struct timespec start, end;
+	struct rusage ru;
+	int status;
+	pid_t pid;
+
+	if (argc < 2) {
+		fprintf(stderr, "usage: maxrss <command> [<args>...]\n");
+		return 1;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	pid = fork();
+	if (pid < 0)
+		return 1;
+
+	if (pid == 0) {
+		int fd = open("/dev/null", O_WRONLY);
+
+		/* discard the output of the command */
+		dup2(fd, 1);
+		execvp(argv[1], &argv[1]);
+		_exit(127);
+	}
+
+	if (wait4(pid, &status, 0, &ru) < 0)
+		return 1;
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	if (!WIFEXITED(status) || WEXITSTATUS(status))
+		return 1;
+
+	printf("elapsed: %llu maxrss: %ld\n",
+	       (end.tv_sec - start.tv_sec) * 1000000000ULL +
+	       end.tv_nsec - start.tv_nsec, ru.ru_maxrss);
+	return 0;
+}
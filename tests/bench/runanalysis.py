@@ -0,0 +1,163 @@
+#!/usr/bin/env python
+#
+# Benchmark for analysis commands
+#
+# It generates synthetic trace data using gentrace.py and runs each
+# analysis command against it.  The elapsed time and peak RSS of the
+# command are reported with the number of records processed per second.
+#
+
+import os, sys
+import re, shutil
+import subprocess as sp
+
+import gentrace
+
+objdir = 'objdir' in os.environ and os.environ['objdir'] or '../..'
+srcdir = os.path.join(os.path.dirname(os.path.abspath(__file__)), '../..')
+uftrace = objdir + '/uftrace --no-pager --no-cache -L' + objdir
+
+commands = {
+    'replay':  'replay',
+    'report':  'report',
+    'graph':   'graph',
+    'chrome':  'dump --chrome',
+    'flame':   'dump --flame-graph',
+    'script':  'script -S %s/scripts/count.py' % srcdir,
+}
+
+# keep the order of output stable
+command_list = ['replay', 'report', 'graph', 'chrome', 'flame', 'script']
+
+datadir = 'analysis.data'
+helper  = 'maxrss'
+
+class BenchError(Exception):
+    pass
+
+def pr_debug(msg):
+    if arg.debug:
+        print(msg)
+
+def build_helper():
+    if os.path.exists(helper):
+        return True
+
+    build_cmd = 'gcc -o %s %s.c' % (helper, helper)
+    pr_debug("build command: %s" % build_cmd)
+    return sp.call(build_cmd.split()) == 0
+
+def run(cmd):
+    """ returns elapsed time (in nsec) and peak RSS (in KB) of the command """
+    pr_debug("run command: %s" % cmd)
+
+    # the helper runs the command directly to get the correct peak RSS
+    p = sp.Popen(['./' + helper] + cmd.split(), stdout=sp.PIPE,
+                 stderr=arg.debug and None or sp.PIPE)
+    out = p.communicate()[0].decode(errors='ignore')
+    if p.wait() != 0:
+        raise BenchError(cmd)
+
+    m = re.search(r'elapsed: (\d+) maxrss: (\d+)', out)
+    if m is None:
+        raise BenchError(cmd)
+
+    return int(m.group(1)), int(m.group(2))
+
+def best_of(cmd, repeat):
+    result = [run(cmd) for i in range(repeat)]
+    return min(result, key=lambda r: r[0])
+
+def bench_one(command, records):
+    cmd = '%s %s -d %s' % (uftrace, commands[command], datadir)
+    elapsed, maxrss = best_of(cmd, arg.repeat)
+
+    return {
+        'command': command,
+        'records': records,
+        'elapsed_nsec': elapsed,
+        'records_per_sec': records * 1e9 / elapsed,
+        'maxrss_kb': maxrss,
+    }
+
+def print_header():
+    print("# %d tasks, %d depth, %d records, %d symbols" %
+          (arg.tasks, arg.depth, arg.records, arg.symbols))
+    print("%-8s %12s %14s %12s" %
+          ("command", "elapsed(ms)", "records/sec", "maxrss(KB)"))
+    print("%-8s %12s %14s %12s" % ("=" * 8, "=" * 12, "=" * 14, "=" * 12))
+
+def print_result(command, r):
+    if r is None:
+        print("%-8s %12s" % (command, "skipped"))
+    else:
+        print("%-8s %12.3f %14.0f %12d" %
+              (command, r['elapsed_nsec'] / 1e6, r['records_per_sec'],
+               r['maxrss_kb']))
+    sys.stdout.flush()
+
+def select(name, arg_list, full_list):
+    if arg_list == 'all':
+        return full_list
+    selected = arg_list.split(',')
+    for s in selected:
+        if s not in full_list:
+            print("unknown %s: %s" % (name, s))
+            sys.exit(1)
+    return selected
+
+def parse_argument():
+    import argparse
+
+    parser = argparse.ArgumentParser()
+    parser.add_argument("-c", "--commands", dest='commands', default='all',
+                        help="comma separated list of commands: " + ','.join(command_list))
+    parser.add_argument("-t", "--tasks", dest='tasks', type=int, default=4,
+                        help="number of tasks in the data")
+    parser.add_argument("-D", "--depth", dest='depth', type=int, default=32,
+                        help="max call depth in the data")
+    parser.add_argument("-n", "--records", dest='records', type=int, default=1000000,
+                        help="total number of records in the data")
+    parser.add_argument("-s", "--symbols", dest='symbols', type=int, default=1000,
+                        help="number of symbols in the data")
+    parser.add_argument("-r", "--repeat", dest='repeat', type=int, default=3,
+                        help="number of runs (best result is used)")
+    parser.add_argument("-j", "--json", dest='json', action='store_true',
+                        help="print the result in JSON format")
+    parser.add_argument("-v", "--verbose", dest='debug', action='store_true',
+                        help="show internal command and result for debugging")
+
+    return parser.parse_args()
+
+if __name__ == "__main__":
+    arg = parse_argument()
+
+    if not build_helper():
+        print("cannot build the helper")
+        sys.exit(1)
+
+    records = gentrace.generate(datadir, arg.tasks, arg.depth, arg.records,
+                                arg.symbols)
+    results = []
+
+    if not arg.json:
+        print_header()
+
+    for c in select('command', arg.commands, command_list):
+        try:
+            r = bench_one(c, records)
+        except BenchError as e:
+            pr_debug("failed: %s" % e)
+            r = None
+
+        if r is not None:
+            results.append(r)
+        if not arg.json:
+            print_result(c, r)
+
+    shutil.rmtree(datadir, ignore_errors=True)
+    os.remove(helper)
+
+    if arg.json:
+        import json
+        print(json.dumps(results, indent=2, sort_keys=True))
@@ -0,0 +1,251 @@
+#!/usr/bin/env python
+#
+# Microbenchmark suite for per-call overhead of libmcount
+#
+# Each workload (b-*.c) prints the number of (traced) function calls
+# and the elapsed time of the main part.  It's built with and without
+# instrumentation for each path and run under uftrace record.  The
+# difference of elapsed time divided by the number of calls is the
+# per-call overhead of the path.
+#
+
+import os, sys
+import re, shutil
+import subprocess as sp
+
+objdir = 'objdir' in os.environ and os.environ['objdir'] or '../..'
+srcdir = os.path.join(os.path.dirname(os.path.abspath(__file__)), '../..')
+uftrace = objdir + '/uftrace --no-pager -L' + objdir
+
+default_cflags = ['-fno-inline', '-fno-builtin', '-fno-omit-frame-pointer']
+
+workloads = {
+    'call':    { 'src': 'b-call.c',   'desc': 'empty function in a loop' },
+    'fib':     { 'src': 'b-fib.c',    'desc': 'tight recursion' },
+    'fanout':  { 'src': 'b-fanout.c', 'desc': 'wide fan-out' },
+    'deep':    { 'src': 'b-deep.c',   'desc': 'deep call stack' },
+    'thread':  { 'src': 'b-thread.c', 'desc': 'many threads', 'ldflags': '-pthread' },
+}
+
+paths = {
+    'mcount':  { 'cc': 'gcc',   'cflags': '-pg' },
+    'fentry':  { 'cc': 'gcc',   'cflags': '-pg -mfentry' },
+    'cygprof': { 'cc': 'gcc',   'cflags': '-finstrument-functions' },
+    'xray':    { 'cc': 'clang', 'cflags': '-fxray-instrument -fxray-instruction-threshold=1',
+                 'opts': '-P .' },
+    'plthook': { 'cc': 'gcc',   'cflags': '-DBENCH_LIB', 'lib': True,
+                 'opts': '--force' },
+    'dynamic': { 'cc': 'gcc',   'cflags': '-pg -mfentry -mnop-mcount -fno-pic -fno-pie',
+                 'opts': '-P .' },
+}
+
+variants = {
+    'default':   '',
+    'args':      '-A .@arg1',
+    'trigger':   '-T .@depth=128',
+    'threshold': '-t 1us',
+    'script':    '-S %s/scripts/count.py' % srcdir,
+}
+
+# keep the order of output stable
+workload_list = ['call', 'fib', 'fanout', 'deep', 'thread']
+path_list     = ['mcount', 'fentry', 'cygprof', 'xray', 'plthook', 'dynamic']
+variant_list  = ['default', 'args', 'trigger', 'threshold', 'script']
+
+datadir = 'bench.data'
+
+class BenchError(Exception):
+    pass
+
+def pr_debug(msg):
+    if arg.debug:
+        print(msg)
+
+def build(prog, cc, src, cflags, ldflags, shared=False):
+    if shared:
+        cflags += ' -shared -fPIC'
+    else:
+        ldflags += ' ' + os.getenv('LDFLAGS', '')
+
+    build_cmd = '%s -o %s %s %s %s %s' % \
+                (cc, prog, ' '.join(default_cflags), cflags, src, ldflags)
+    pr_debug("build command: %s" % build_cmd)
+
+    try:
+        p = sp.Popen(build_cmd.split(), stderr=sp.PIPE)
+        err = p.communicate()[1].decode(errors='ignore')
+        if p.wait() != 0:
+            pr_debug(err)
+            return False
+        return True
+    except OSError as e:
+        pr_debug(e.strerror)
+        return False
+
+def run(cmd):
+    pr_debug("run command: %s" % cmd)
+
+    p = sp.Popen(cmd, shell=True, stdout=sp.PIPE, stderr=sp.PIPE)
+    out, err = [x.decode(errors='ignore') for x in p.communicate()]
+    if p.wait() != 0:
+        pr_debug(err)
+        raise BenchError(cmd)
+
+    m = re.search(r'calls: (\d+) elapsed: (\d+)', out)
+    if m is None:
+        raise BenchError(cmd)
+
+    lost = 0
+    m2 = re.search(r'LOST (\d+) records', err)
+    if m2:
+        lost = int(m2.group(1))
+
+    return int(m.group(1)), int(m.group(2)), lost
+
+def count_records():
+    """ returns number of records (entry + exit) in the data """
+    cmd = '%s report -d %s' % (uftrace, datadir)
+    out = sp.check_output(cmd, shell=True).decode(errors='ignore')
+
+    calls = 0
+    for ln in out.split('\n'):
+        # Total time   Self time       Calls  Function
+        m = re.match(r'\s*[\d.]+ \w+\s+[\d.]+ \w+\s+(\d+)\s+', ln)
+        if m:
+            calls += int(m.group(1))
+    return calls * 2
+
+def best_of(cmd, repeat):
+    result = [run(cmd) for i in range(repeat)]
+    return min(result, key=lambda r: r[1])
+
+def bench_one(workload, path, variant):
+    w = workloads[workload]
+    p = paths[path]
+
+    if p.get('lib') and workload != 'call':
+        return None
+
+    ldflags = w.get('ldflags', '')
+    cflags  = '-O%s %s' % (arg.opt, os.getenv('CFLAGS', ''))
+    plain   = 'b-%s' % workload
+    prog    = 'b-%s-%s' % (workload, path)
+
+    if p.get('lib'):
+        if not build('libbench.so', p['cc'], 'b-lib.c', cflags, '', shared=True):
+            return None
+        ldflags += ' -L. -lbench -Wl,-rpath,$ORIGIN'
+        # the program itself is not instrumented
+        plain = prog
+    elif not os.path.exists(plain):
+        if not build(plain, 'gcc', w['src'], cflags, ldflags):
+            return None
+
+    if not os.path.exists(prog):
+        if not build(prog, p['cc'], w['src'], cflags + ' ' + p['cflags'], ldflags):
+            return None
+
+    cmd = './%s %d' % (plain, arg.calls)
+    calls, base, lost = best_of(cmd, arg.repeat)
+
+    cmd = '%s record -d %s %s %s ./%s %d' % \
+          (uftrace, datadir, p.get('opts', ''), variants[variant], prog, arg.calls)
+    calls, traced, lost = best_of(cmd, arg.repeat)
+    records = count_records()
+
+    shutil.rmtree(datadir, ignore_errors=True)
+
+    return {
+        'workload': workload,
+        'path': path,
+        'variant': variant,
+        'calls': calls,
+        'base_nsec': base,
+        'traced_nsec': traced,
+        'overhead_nsec_per_call': float(traced - base) / calls,
+        'records': records,
+        'records_per_sec': records * 1e9 / traced,
+        'lost': lost,
+    }
+
+def print_header():
+    print("%-8s %-8s %-10s %12s %14s %8s" %
+          ("workload", "path", "variant", "nsec/call", "records/sec", "lost"))
+    print("%-8s %-8s %-10s %12s %14s %8s" %
+          ("=" * 8, "=" * 8, "=" * 10, "=" * 12, "=" * 14, "=" * 8))
+
+def print_result(workload, path, variant, r):
+    if r is None:
+        print("%-8s %-8s %-10s %12s" % (workload, path, variant, "skipped"))
+    else:
+        print("%-8s %-8s %-10s %12.2f %14.0f %8d" %
+              (workload, path, variant, r['overhead_nsec_per_call'],
+               r['records_per_sec'], r['lost']))
+    sys.stdout.flush()
+
+def select(name, arg_list, full_list):
+    if arg_list == 'all':
+        return full_list
+    selected = arg_list.split(',')
+    for s in selected:
+        if s not in full_list:
+            print("unknown %s: %s" % (name, s))
+            sys.exit(1)
+    return selected
+
+def parse_argument():
+    import argparse
+
+    parser = argparse.ArgumentParser()
+    parser.add_argument("-w", "--workloads", dest='workloads', default='all',
+                        help="comma separated list of workloads: " + ','.join(workload_list))
+    parser.add_argument("-p", "--paths", dest='paths', default='all',
+                        help="comma separated list of paths: " + ','.join(path_list))
+    parser.add_argument("-V", "--variants", dest='variants', default='all',
+                        help="comma separated list of variants: " + ','.join(variant_list))
+    parser.add_argument("-O", "--optimize-level", dest='opt', default="2",
+                        help="compiler optimization level")
+    parser.add_argument("-n", "--calls", dest='calls', type=int, default=1000000,
+                        help="number of function calls in the workload")
+    parser.add_argument("-r", "--repeat", dest='repeat', type=int, default=3,
+                        help="number of runs (best result is used)")
+    parser.add_argument("-j", "--json", dest='json', action='store_true',
+                        help="print the result in JSON format")
+    parser.add_argument("-v", "--verbose", dest='debug', action='store_true',
+                        help="show internal command and result for debugging")
+
+    return parser.parse_args()
+
+if __name__ == "__main__":
+    arg = parse_argument()
+
+    results = []
+
+    if not arg.json:
+        print_header()
+
+    for w in select('workload', arg.workloads, workload_list):
+        for p in select('path', arg.paths, path_list):
+            for v in select('variant', arg.variants, variant_list):
+                try:
+                    r = bench_one(w, p, v)
+                except BenchError as e:
+                    pr_debug("failed: %s" % e)
+                    r = None
+
+                if r is not None:
+                    results.append(r)
+                if not arg.json:
+                    print_result(w, p, v, r)
+
+    for f in os.listdir('.'):
+        if f.startswith('b-') and not f.endswith('.c'):
+            os.remove(f)
+        elif f in ['libbench.so', 'gmon.out']:
+            os.remove(f)
+    shutil.rmtree(datadir, ignore_errors=True)
+    shutil.rmtree(datadir + '.old', ignore_errors=True)
+
+    if arg.json:
+        import json
+        print(json.dumps(results, indent=2, sort_keys=True))
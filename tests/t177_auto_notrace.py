@@ -0,0 +1,57 @@
+#!/usr/bin/env python
+
+from runtest import TestBase
+import subprocess as sp
+
+TDIR='xxx'
+
+# This test checks fib is dropped by the governor as it's called more
+# than 1 time per second and runs less than 1 sec.  It's checked for
+# every 1024 calls of a function (w/o children) so the leaf fib calls
+# trigger it and the rest of calls are not recorded.  The exact number
+# of recorded calls depends on the tracing method so just check it's
+# less than the total number of calls (13529) for fib(20).
+class TestCase(TestBase):
+    def __init__(self):
+        TestBase.__init__(self, 'fibonacci', """
+  Total time   Self time       Calls  Function
+  ==========  ==========  ==========  ====================================
+    2.065 ms    1.190 ms           1  main
+  875.321 us  875.321 us        2047  fib
+
+  # 1 function(s) dropped by --auto-notrace: fib
+""")
+
+    def pre(self):
+        record_cmd = '%s record -d %s --auto-notrace=1/1s %s 20' % \
+                     (TestBase.ftrace, TDIR, 't-' + self.name)
+        sp.call(record_cmd.split())
+        return TestBase.TEST_SUCCESS
+
+    def runcmd(self):
+        return '%s report -d %s' % (TestBase.ftrace, TDIR)
+
+    def post(self, ret):
+        sp.call(['rm', '-rf', TDIR])
+        return ret
+
+    def sort(self, output):
+        """ This function post-processes output of the test to be compared.
+            It ignores blank lines and checks whether some of fib calls
+            are dropped and the list of dropped functions only.  """
+        result = []
+        for ln in output.split('\n'):
+            if ln.strip() == '':
+                continue
+            if ln.strip().startswith('#'):
+                result.append(ln.strip())
+                continue
+            line = ln.split()
+            if line[0].startswith('='):
+                continue
+            # [0]         [1]   [2]        [3]   [4]    [5]
+            # total_time  unit  self_time  unit  calls  function
+            if line[5] == 'fib' and int(line[4]) < 13529:
+                result.append('fib dropped')
+
+        return '\n'.join(result)
@@ -0,0 +1,30 @@
+#!/usr/bin/env python
+
+from runtest import TestBase
+import subprocess as sp
+
+TDIR='xxx'
+
+# fib is called many times and each call is short.  So it's excluded by
+# --use-profile and only main is traced (atoi takes much less than 1%).
+# The --auto-notrace option is given to make it independent from the
+# machine speed.
+class TestCase(TestBase):
+    def __init__(self):
+        TestBase.__init__(self, 'fibonacci', """
+# DURATION    TID     FUNCTION
+  68.712 us [ 8417] | main();
+""")
+
+    def pre(self):
+        record_cmd = '%s record -d %s %s 20' % (TestBase.ftrace, TDIR, 't-' + self.name)
+        sp.call(record_cmd.split())
+        return TestBase.TEST_SUCCESS
+
+    def runcmd(self):
+        return '%s --use-profile=%s --auto-notrace=1/1s %s 20' % \
+            (TestBase.ftrace, TDIR, 't-' + self.name)
+
+    def post(self, ret):
+        sp.call(['rm', '-rf', TDIR])
+        return ret
@@ -0,0 +1,47 @@
+#!/usr/bin/env python
+
+from runtest import TestBase
+import os
+
+class TestCase(TestBase):
+    def __init__(self):
+        TestBase.__init__(self, 'abc', """
+# DURATION    TID     FUNCTION
+            [32766] | main() {
+            [32766] |   a() {
+            [32766] |     b() {
+            [32766] |       c() {
+   0.609 us [32766] |         getpid();
+            [32766] |         /* read:pmu-cycle (cycle=3211, instructions=1044, IPC=0.33) */
+  13.722 us [32766] |       } /* c */
+  24.950 us [32766] |     } /* b */
+  25.564 us [32766] |   } /* a */
+  26.963 us [32766] | } /* main */
+""")
+
+    def pre(self):
+        # hardware counters are not available in some VMs
+        for pmu in ['cpu', 'cpu_core']:
+            if os.path.exists('/sys/bus/event_source/devices/' + pmu):
+                return TestBase.TEST_SUCCESS
+        return TestBase.TEST_SKIP
+
+    def runcmd(self):
+        uftrace = TestBase.ftrace
+        args    = '-F main -T c@read=pmu-cycle'
+        prog    = 't-' + self.name
+        return '%s %s %s' % (uftrace, args, prog)
+
+    def sort(self, output):
+        result = []
+        for ln in output.split('\n'):
+            # ignore blank lines and comments
+            if ln.strip() == '' or ln.startswith('#'):
+                continue
+            func = ln.split('|', 1)[-1]
+            # remove actual numbers in pmu-cycle
+            if func.find('read:pmu-cycle') > 0:
+                func = '         /* read:pmu-cycle */'
+            result.append(func)
+
+        return '\n'.join(result)
@@ -0,0 +1,42 @@
+#!/usr/bin/env python
+
+from runtest import TestBase
+
+class TestCase(TestBase):
+    def __init__(self):
+        TestBase.__init__(self, 'abc', """
+# DURATION    TID     FUNCTION
+            [32766] | main() {
+            [32766] |   a() {
+            [32766] |     b() {
+            [32766] |       c() {
+   0.609 us [32766] |         getpid();
+  13.722 us [32766] |       } /* c */
+            [32766] |       /* read:ctx-switch (voluntary=0, involuntary=0) */
+  24.950 us [32766] |     } /* b */
+            [32766] |     /* read:max-rss (+0KB) */
+  25.564 us [32766] |   } /* a */
+  26.963 us [32766] | } /* main */
+""")
+
+    def runcmd(self):
+        uftrace = TestBase.ftrace
+        args    = '-F main -T a@read=max-rss -T b@read=ctx-switch'
+        prog    = 't-' + self.name
+        return '%s %s %s' % (uftrace, args, prog)
+
+    def sort(self, output):
+        result = []
+        for ln in output.split('\n'):
+            # ignore blank lines and comments
+            if ln.strip() == '' or ln.startswith('#'):
+                continue
+            func = ln.split('|', 1)[-1]
+            # remove actual numbers in the read events
+            if func.find('read:ctx-switch') > 0:
+                func = '       /* read:ctx-switch */'
+            if func.find('read:max-rss') > 0:
+                func = '     /* read:max-rss */'
+            result.append(func)
+
+        return '\n'.join(result)
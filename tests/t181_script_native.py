@@ -0,0 +1,89 @@
+#!/usr/bin/env python
+
+from runtest import TestBase
+import subprocess as sp
+
+TDIR='xxx'
+FILE='script.c'
+PLUGIN='script.so'
+
+script = """
+#include <stdio.h>
+#include "uftrace-script.h"
+
+int uftrace_script_version = UFTRACE_SCRIPT_VERSION;
+
+int uftrace_begin(void)
+{
+	printf("program begins...\\n");
+	return 0;
+}
+
+int uftrace_entry(struct uftrace_script_context *ctx)
+{
+	printf("entry : %s()\\n", ctx->name);
+	return 0;
+}
+
+int uftrace_exit(struct uftrace_script_context *ctx)
+{
+	printf("exit  : %s()\\n", ctx->name);
+	return 0;
+}
+
+int uftrace_event(struct uftrace_script_context *ctx)
+{
+	printf("event : %s (%d bytes)\\n", ctx->name, ctx->datalen);
+	return 0;
+}
+
+int uftrace_end(void)
+{
+	printf("program is finished\\n");
+	return 0;
+}
+"""
+
+class TestCase(TestBase):
+    def __init__(self):
+        TestBase.__init__(self, 'abc', """
+program begins...
+entry : main()
+entry : a()
+entry : b()
+event : read:page-fault (16 bytes)
+entry : c()
+entry : getpid()
+exit  : getpid()
+exit  : c()
+exit  : b()
+exit  : a()
+exit  : main()
+program is finished
+""")
+
+    def pre(self):
+        f = open(FILE, 'w')
+        f.write(script)
+        f.close()
+
+        build_cmd = 'gcc -shared -fPIC -I.. -o %s %s' % (PLUGIN, FILE)
+        if sp.call(build_cmd.split()) != 0:
+            return TestBase.TEST_BUILD_FAIL
+
+        record_cmd = '%s record -d %s -T b@read=page-fault %s' % \
+                     (TestBase.ftrace, TDIR, 't-abc')
+        sp.call(record_cmd.split())
+        return TestBase.TEST_SUCCESS
+
+    def runcmd(self):
+        uftrace = TestBase.ftrace
+        options = '-F main -S ' + PLUGIN
+        return '%s script -d %s %s' % (uftrace, TDIR, options)
+
+    def sort(self, output):
+        return output.strip()
+
+    def post(self, ret):
+        sp.call(['rm', '-rf', TDIR, FILE, PLUGIN])
+        return ret
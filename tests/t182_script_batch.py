@@ -0,0 +1,67 @@
+#!/usr/bin/env python
+
+from runtest import TestBase
+import subprocess as sp
+
+TDIR='xxx'
+FILE='script.py'
+
+script = """
+import struct
+
+def uftrace_batch(records, symbols):
+  size = struct.calcsize(UFTRACE_BATCH_FORMAT)
+  for i in range(0, len(records), size):
+    r = struct.unpack_from(UFTRACE_BATCH_FORMAT, records, i)
+    if r[6] == 0:
+      print("entry : %s()" % symbols[r[4]])
+    else:
+      print("exit  : %s()" % symbols[r[4]])
+
+def uftrace_entry(ctx):
+  print("should not be called")
+
+def uftrace_end():
+  print("program is finished")
+"""
+
+class TestCase(TestBase):
+    def __init__(self):
+        TestBase.__init__(self, 'abc', """
+entry : main()
+entry : a()
+entry : b()
+entry : c()
+entry : getpid()
+exit  : getpid()
+exit  : c()
+exit  : b()
+exit  : a()
+exit  : main()
+program is finished
+""")
+
+    def pre(self):
+        f = open(FILE, 'w')
+        f.write(script)
+        f.close()
+
+        uftrace = TestBase.ftrace
+        program = 't-' + self.name
+        record_cmd = '%s record -d %s %s' % (uftrace, TDIR, program)
+
+        self.pr_debug("record command: %s" % record_cmd)
+        sp.call(record_cmd.split())
+        return TestBase.TEST_SUCCESS
+
+    def runcmd(self):
+        uftrace = TestBase.ftrace
+        options = '-F main -S ' + FILE
+        return '%s script -d %s %s' % (uftrace, TDIR, options)
+
+    def sort(self, output):
+        return output.strip()
+
+    def post(self, ret):
+        sp.call(['rm', '-rf', TDIR, FILE, FILE + 'c'])
+        return ret
@@ -0,0 +1,44 @@
+#!/usr/bin/env python
+
+from runtest import TestBase
+import subprocess as sp
+
+TDIRS = ['xxx', 'yyy']
+
+class TestCase(TestBase):
+    def __init__(self):
+        TestBase.__init__(self, 'abc', """
+# DURATION    TID     FUNCTION
+            [28141] | main() {
+            [28141] |   a() {
+            [28141] |     b() {
+            [28141] |       c() {
+   0.753 us [28141] |         getpid();
+   1.430 us [28141] |       } /* c */
+   1.915 us [28141] |     } /* b */
+   2.405 us [28141] |   } /* a */
+   3.005 us [28141] | } /* main */
+            [10028145] | main() {
+            [10028145] |   a() {
+            [10028145] |     b() {
+            [10028145] |       c() {
+   0.811 us [10028145] |         getpid();
+   1.504 us [10028145] |       } /* c */
+   1.988 us [10028145] |     } /* b */
+   2.467 us [10028145] |   } /* a */
+   3.071 us [10028145] | } /* main */
+""")
+
+    def pre(self):
+        for d in TDIRS:
+            record_cmd = '%s record -d %s %s' % (TestBase.ftrace, d, 't-abc')
+            sp.call(record_cmd.split())
+        return TestBase.TEST_SUCCESS
+
+    def runcmd(self):
+        # move the second data after the first one
+        return '%s replay -F main -d %s --merge-data=%s@1s' % (TestBase.ftrace, TDIRS[0], TDIRS[1])
+
+    def post(self, ret):
+        sp.call(['rm', '-rf'] + TDIRS)
+        return ret
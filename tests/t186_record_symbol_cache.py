@@ -0,0 +1,66 @@
+#!/usr/bin/env python
+
+from runtest import TestBase
+import subprocess as sp
+import os, re
+
+TDIRS = ['xxx', 'yyy']
+CACHE = 'symcache'
+
+class TestCase(TestBase):
+    def __init__(self):
+        TestBase.__init__(self, 'abc', """
+# DURATION    TID     FUNCTION
+            [28141] | main() {
+            [28141] |   a() {
+            [28141] |     b() {
+            [28141] |       c() {
+   0.753 us [28141] |         getpid();
+   1.430 us [28141] |       } /* c */
+   1.915 us [28141] |     } /* b */
+   2.405 us [28141] |   } /* a */
+   3.005 us [28141] | } /* main */
+""")
+
+    def record(self, tdir):
+        record_cmd = '%s record -d %s --symbol-cache=%s %s' % \
+                     (TestBase.ftrace, tdir, CACHE, 't-abc')
+        sp.call(record_cmd.split())
+
+    def check_cache(self):
+        # the first record saves symbol files using build-id as names
+        self.record(TDIRS[0])
+
+        files = os.listdir(CACHE)
+        exe = [f for f in files if re.match('^[0-9a-f]+\.sym$', f)]
+        mod = [f for f in files if re.match('^[0-9a-f]+\.mod\.sym$', f)]
+        if len(exe) != 1 or len(mod) == 0:
+            return False
+
+        # the second record links symbol files from the cache
+        self.record(TDIRS[1])
+
+        cached = os.stat(os.path.join(CACHE, exe[0]))
+        linked = os.stat(os.path.join(TDIRS[1], 't-abc.sym'))
+        if linked.st_ino != cached.st_ino:
+            return False
+
+        for f in os.listdir(TDIRS[1]):
+            if not f.endswith('.sym'):
+                continue
+            if os.stat(os.path.join(TDIRS[1], f)).st_nlink < 2:
+                return False
+        return True
+
+    def pre(self):
+        if not self.check_cache():
+            sp.call(['rm', '-rf', CACHE] + TDIRS)
+            return TestBase.TEST_DIFF_RESULT
+        return TestBase.TEST_SUCCESS
+
+    def runcmd(self):
+        return '%s replay -F main -d %s' % (TestBase.ftrace, TDIRS[1])
+
+    def post(self, ret):
+        sp.call(['rm', '-rf', CACHE] + TDIRS)
+        return ret
@@ -0,0 +1,36 @@
+#!/usr/bin/env python
+
+from runtest import TestBase
+import subprocess as sp
+
+TDIR='xxx'
+
+# mem_alloc and mem_free take much less than 5% of the total time, so
+# they're not selected by --use-profile.  As main (and all functions on
+# the path to usleep) is selected, they should not be traced even though
+# they're called from a selected function.
+class TestCase(TestBase):
+    def __init__(self):
+        TestBase.__init__(self, 'sleep', """
+# DURATION    TID     FUNCTION
+            [29494] | main() {
+            [29494] |   foo() {
+            [29494] |     bar() {
+   2.060 ms [29494] |       usleep();
+   2.062 ms [29494] |     } /* bar */
+   2.064 ms [29494] |   } /* foo */
+   2.064 ms [29494] | } /* main */
+""")
+
+    def pre(self):
+        record_cmd = '%s record -d %s %s' % (TestBase.ftrace, TDIR, 't-' + self.name)
+        sp.call(record_cmd.split())
+        return TestBase.TEST_SUCCESS
+
+    def runcmd(self):
+        return '%s --use-profile=%s --profile-share=5 %s' % \
+            (TestBase.ftrace, TDIR, 't-' + self.name)
+
+    def post(self, ret):
+        sp.call(['rm', '-rf', TDIR])
+        return ret
@@ -0,0 +1,83 @@
+#!/usr/bin/env python
+
+from runtest import TestBase
+import subprocess as sp
+
+TDIR='xxx'
+FILE='script.c'
+PLUGIN='script.so'
+
+script = """
+#include <stdio.h>
+#include "uftrace-script.h"
+
+int uftrace_script_version = UFTRACE_SCRIPT_VERSION;
+
+int uftrace_entry(struct uftrace_script_context *ctx)
+{
+	struct uftrace_script_arg arg;
+	int i;
+
+	if (ctx->nr_args == 0)
+		return 0;
+
+	printf("%s(", ctx->name);
+	for (i = 0; i < ctx->nr_args; i++) {
+		if (uftrace_script_get_arg(ctx, i, &arg) < 0)
+			break;
+
+		if (arg.type == UFTRACE_SCRIPT_ARG_STRING)
+			printf("%s%.*s", i ? ", " : "", arg.size, arg.val.s);
+		else
+			printf("%s%lld", i ? ", " : "", (long long)arg.val.i);
+	}
+	printf(")\\n");
+	return 0;
+}
+
+int uftrace_exit(struct uftrace_script_context *ctx)
+{
+	struct uftrace_script_arg arg;
+
+	if (uftrace_script_get_arg(ctx, 0, &arg) == 0)
+		printf("%s() = %lld\\n", ctx->name, (long long)arg.val.i);
+	return 0;
+}
+"""
+
+class TestCase(TestBase):
+    def __init__(self):
+        TestBase.__init__(self, 'openclose', """
+fopen(/dev/null, r)
+fclose() = 0
+""")
+
+    def pre(self):
+        f = open(FILE, 'w')
+        f.write(script)
+        f.close()
+
+        build_cmd = 'gcc -shared -fPIC -I.. -o %s %s' % (PLUGIN, FILE)
+        if sp.call(build_cmd.split()) != 0:
+            return TestBase.TEST_BUILD_FAIL
+
+        uftrace = TestBase.ftrace
+        options = '-A fopen@arg1/s,arg2/s -R fclose@retval'
+        program = 't-' + self.name
+        record_cmd = '%s record -d %s %s %s' % (uftrace, TDIR, options, program)
+
+        self.pr_debug("record command: %s" % record_cmd)
+        sp.call(record_cmd.split())
+        return TestBase.TEST_SUCCESS
+
+    def runcmd(self):
+        uftrace = TestBase.ftrace
+        options = '-S ' + PLUGIN
+        return '%s script -d %s %s' % (uftrace, TDIR, options)
+
+    def sort(self, output):
+        return output.strip()
+
+    def post(self, ret):
+        sp.call(['rm', '-rf', TDIR, FILE, PLUGIN])
+        return ret
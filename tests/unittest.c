@@ -231,6 +231,10 @@ void __xray_exit(void)
 {
 }
 
+void sdt_trampoline(void)
+{
+}
+
 #undef main
 int main(int argc, char *argv[])
 {
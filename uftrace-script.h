@@ -0,0 +1,105 @@
+/*
+ * Public interface for native (shared object) scripts of uftrace
+ *
+ * This header is self-contained and installed with uftrace so that a
+ * script can be built without the uftrace source:
+ *
+ *   $ gcc -shared -fPIC -o myscript.so myscript.c
+ *
+ * A native script has (some of) the below functions.
+ *
+ *   int uftrace_begin(void);
+ *   int uftrace_entry(struct uftrace_script_context *ctx);
+ *   int uftrace_exit(struct uftrace_script_context *ctx);
+ *   int uftrace_event(struct uftrace_script_context *ctx);
+ *   int uftrace_end(void);
+ *
+ * It can also have a NULL-terminated array of function names (or regex
+ * patterns) in "UFTRACE_FUNCS" to run the script for them only.  It
+ * should define "uftrace_script_version" like below so that uftrace
+ * can reject a script built for a different version of the interface.
+ *
+ *   int uftrace_script_version = UFTRACE_SCRIPT_VERSION;
+ *
+ * Released under the GPL v2.
+ */
+#ifndef UFTRACE_SCRIPT_H
+#define UFTRACE_SCRIPT_H
+
+#include <stdint.h>
+
+/*
+ * Version of the interface.  It's increased when existing fields are
+ * changed.  New fields are added at the end of the structs and can be
+ * checked with the @size field of the context.
+ */
+#define UFTRACE_SCRIPT_VERSION  2
+
+enum uftrace_script_arg_type {
+	UFTRACE_SCRIPT_ARG_INT,		/* signed integer in @val.i */
+	UFTRACE_SCRIPT_ARG_UINT,	/* unsigned, hex or pointer in @val.u */
+	UFTRACE_SCRIPT_ARG_CHAR,	/* character in @val.i */
+	UFTRACE_SCRIPT_ARG_FLOAT,	/* floating-point in @val.f */
+	UFTRACE_SCRIPT_ARG_STRING,	/* @size bytes at @val.s (no NUL) */
+};
+
+/* an argument or a return value read by uftrace_script_get_arg() */
+struct uftrace_script_arg {
+	int32_t			type;	/* enum uftrace_script_arg_type */
+	int32_t			size;	/* size of data (or string length) */
+	union {
+		int64_t		i;
+		uint64_t	u;
+		double		f;
+		const char	*s;
+	} val;
+};
+
+/*
+ * Context passed to the script.  Pointers in the context are valid
+ * only during the call.
+ *
+ * For functions, @nr_args is the number of arguments at entry or the
+ * number of return values (0 or 1) at exit.  They are read by
+ * uftrace_script_get_arg() below.
+ *
+ * For events, @name is the event name, @address is the event id and
+ * @data has raw event data of @datalen bytes (if any).
+ */
+struct uftrace_script_context {
+	uint32_t		size;		/* sizeof this struct */
+	int32_t			tid;
+	int32_t			depth;
+	int32_t			nr_args;
+	uint64_t		timestamp;
+	uint64_t		duration;	/* exit only */
+	uint64_t		address;
+	const char		*name;
+	/* raw data of arguments (or return value) or event */
+	uint32_t		datalen;
+	const void		*data;
+	/* for internal use of uftrace, call uftrace_script_get_arg() */
+	int			(*get_arg)(const struct uftrace_script_context *ctx,
+					   int n, struct uftrace_script_arg *arg);
+	const void		*priv;
+};
+
+/**
+ * uftrace_script_get_arg - read an argument (or return value)
+ * @ctx: script context
+ * @n: index of argument (starting from 0), should be 0 for return value
+ * @arg: (output) type and value of the argument
+ *
+ * This function returns 0 if @arg is set, or -1 if there's no such
+ * argument.
+ */
+static inline int uftrace_script_get_arg(const struct uftrace_script_context *ctx,
+					 int n, struct uftrace_script_arg *arg)
+{
+	if (n < 0 || n >= ctx->nr_args || ctx->get_arg == 0)
+		return -1;
+
+	return ctx->get_arg(ctx, n, arg);
+}
+
+#endif /* UFTRACE_SCRIPT_H */
@@ -20,8 +20,10 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <argp.h>
+#include <ctype.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <signal.h>
 #include <sys/stat.h>
 #include <time.h>
 
@@ -93,6 +95,15 @@ enum options {
 	OPT_event_full,
 	OPT_nest_libcall,
 	OPT_record,
+	OPT_no_cache,
+	OPT_patch_signal,
+	OPT_auto_notrace,
+	OPT_use_profile,
+	OPT_profile_share,
+	OPT_num_stream,
+	OPT_compress,
+	OPT_merge_data,
+	OPT_symbol_cache,
 };
 
 static struct argp_option uftrace_options[] = {
@@ -119,6 +130,8 @@ static struct argp_option uftrace_options[] = {
 	{ "kernel", 'k', 0, 0, "Trace kernel functions also (if supported)" },
 	{ "host", 'H', "HOST", 0, "Send trace data to HOST instead of write to file" },
 	{ "port", OPT_port, "PORT", 0, "Use PORT for network connection" },
+	{ "num-stream", OPT_num_stream, "NUM", 0, "Send data using NUM connections" },
+	{ "compress", OPT_compress, 0, 0, "Compress data sent to network" },
 	{ "no-pager", OPT_nopager, 0, 0, "Do not use pager" },
 	{ "sort", 's', "KEY[,KEY,...]", 0, "Sort reported functions by KEYs" },
 	{ "avg-total", OPT_avg_total, 0, 0, "Show average/min/max of total function time" },
@@ -137,6 +150,7 @@ static struct argp_option uftrace_options[] = {
 	{ "retval", 'R', "FUNC@retval", 0, "Show function return value" },
 	{ "chrome", OPT_chrome_trace, 0, 0, "Dump recorded data in chrome trace format" },
 	{ "diff", OPT_diff, "DATA", 0, "Report differences" },
+	{ "merge-data", OPT_merge_data, "DATA[@OFFSET][,...]", 0, "Merge DATA (from other hosts) into a timeline" },
 	{ "sort-column", OPT_sort_column, "INDEX", 0, "Sort diff report on column INDEX" },
 	{ "num-thread", OPT_num_thread, "NUM", 0, "Create NUM recorder threads" },
 	{ "no-comment", OPT_no_comment, 0, 0, "Don't show comments of returned functions" },
@@ -162,6 +176,12 @@ static struct argp_option uftrace_options[] = {
 	{ "event-full", OPT_event_full, 0, 0, "Show all events outside of function" },
 	{ "nest-libcall", OPT_nest_libcall, 0, 0, "Show nested library calls" },
 	{ "record", OPT_record, 0, 0, "Record a new trace data before running command" },
+	{ "no-cache", OPT_no_cache, 0, 0, "Don't use (or save) cached analysis result" },
+	{ "patch-signal", OPT_patch_signal, "SIG", 0, "Toggle dynamic patching when SIG is received" },
+	{ "auto-notrace", OPT_auto_notrace, "SPEC", 0, "Drop hot and tiny functions at runtime (e.g. 5%)" },
+	{ "use-profile", OPT_use_profile, "DATA", 0, "Select functions to trace from a previous trace DATA" },
+	{ "profile-share", OPT_profile_share, "PCT", 0, "Min share (can be a fraction) of total time for --use-profile (default: 1)" },
+	{ "symbol-cache", OPT_symbol_cache, "DIR", 0, "Share symbol files in DIR by build-id" },
 	{ 0 }
 };
 
@@ -263,6 +283,39 @@ static int parse_demangle(char *arg)
 	return DEMANGLE_ERROR;
 }
 
+static int parse_signal(char *arg)
+{
+	size_t i;
+	struct {
+		const char *name;
+		int sig;
+	} sigs[] = {
+		{ "HUP", SIGHUP }, { "INT", SIGINT }, { "QUIT", SIGQUIT },
+		{ "USR1", SIGUSR1 }, { "USR2", SIGUSR2 }, { "ALRM", SIGALRM },
+		{ "TERM", SIGTERM }, { "CONT", SIGCONT }, { "PROF", SIGPROF },
+	};
+
+	if (isdigit(arg[0]))
+		return strtol(arg, NULL, 0);
+
+	if (!strncmp(arg, "SIG", 3))
+		arg += 3;
+
+	for (i = 0; i < ARRAY_SIZE(sigs); i++) {
+		if (!strcmp(arg, sigs[i].name))
+			return sigs[i].sig;
+	}
+
+	if (!strncmp(arg, "RTMIN", 5)) {
+		if (arg[5] == '+')
+			return SIGRTMIN + strtol(arg + 6, NULL, 0);
+		if (arg[5] == '\0')
+			return SIGRTMIN;
+	}
+
+	return -1;
+}
+
 static void parse_debug_domain(char *arg)
 {
 	char *str, *saved_str;
@@ -526,6 +579,24 @@ static error_t parse_option(int key, char *arg, struct argp_state *state)
 		}
 		break;
 
+	case OPT_num_stream:
+		opts->nr_stream = strtol(arg, NULL, 0);
+		if (opts->nr_stream <= 0) {
+			pr_use("invalid stream number: %s (ignoring..)\n", arg);
+			opts->nr_stream = 0;
+		}
+		break;
+
+	case OPT_compress:
+		opts->compress = true;
+		break;
+
+	case OPT_merge_data:
+		opts->merge_data = opt_add_string(opts->merge_data, arg);
+		/* the cache is only valid for the data in a single directory */
+		opts->no_cache = true;
+		break;
+
 	case OPT_nopager:
 		opts->use_pager = false;
 		break;
@@ -696,6 +767,49 @@ static error_t parse_option(int key, char *arg, struct argp_state *state)
 		opts->record = true;
 		break;
 
+	case OPT_no_cache:
+		opts->no_cache = true;
+		break;
+
+	case OPT_patch_signal:
+		opts->patch_signal = parse_signal(arg);
+		if (opts->patch_signal <= 0 || opts->patch_signal >= NSIG) {
+			pr_use("invalid signal: %s (ignored)\n", arg);
+			opts->patch_signal = 0;
+		}
+		break;
+
+	case OPT_auto_notrace: {
+		uint64_t rate, time;
+
+		if (parse_auto_notrace(arg, &rate, &time) < 0) {
+			pr_use("invalid auto-notrace spec: %s (ignored)\n", arg);
+			break;
+		}
+		opts->auto_notrace = arg;
+		break;
+	}
+
+	case OPT_use_profile:
+		opts->profile = arg;
+		break;
+
+	case OPT_symbol_cache:
+		opts->symbol_cache = arg;
+		break;
+
+	case OPT_profile_share: {
+		char *end;
+
+		opts->profile_share = strtod(arg, &end);
+		if (*end != '\0' || opts->profile_share <= 0 ||
+		    opts->profile_share > 100) {
+			pr_use("invalid profile share: %s (ignored)\n", arg);
+			opts->profile_share = PROFILE_SHARE_DEFAULT;
+		}
+		break;
+	}
+
 	case ARGP_KEY_ARG:
 		if (state->arg_num) {
 			/*
@@ -904,6 +1018,7 @@ static void free_opts(struct opts *opts)
 	free(opts->retval);
 	free(opts->tid);
 	free(opts->event);
+	free(opts->merge_data);
 }
 
 #ifndef UNIT_TEST
@@ -925,6 +1040,7 @@ int main(int argc, char *argv[])
 		.fields         = NULL,
 		.sort_column	= 2,
 		.event_skip_out = true,
+		.profile_share	= PROFILE_SHARE_DEFAULT,
 	};
 	struct argp argp = {
 		.options = uftrace_options,
@@ -1101,6 +1217,7 @@ TEST_CASE(option_parsing2)
 		"-F", "foo",
 		"-N", "bar",
 		"-Abaz@kernel",
+		"--profile-share=0.5",
 	};
 	int argc = ARRAY_SIZE(argv);
 	int saved_debug = debug;
@@ -1114,6 +1231,7 @@ TEST_CASE(option_parsing2)
 	TEST_STREQ(opts.dirname, "abc.data");
 	TEST_STREQ(opts.filter, "foo;!bar");
 	TEST_STREQ(opts.args, "baz@kernel");
+	TEST_EQ(opts.profile_share, 0.5);
 
 	free_opts(&opts);
 	return TEST_OK;
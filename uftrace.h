@@ -20,6 +20,9 @@
 #define UFTRACE_DIR_NAME     "uftrace.data"
 #define UFTRACE_DIR_OLD_NAME  "ftrace.dir"
 
+/* list of functions dropped by --auto-notrace (in the data dir) */
+#define AUTO_NOTRACE_FILE  "auto-notrace.txt"
+
 #define UFTRACE_RECV_PORT  8090
 
 #define OPT_RSTACK_MAX      65535
@@ -27,6 +30,9 @@
 #define OPT_DEPTH_MAX       OPT_RSTACK_MAX
 #define OPT_DEPTH_DEFAULT   OPT_RSTACK_DEFAULT
 
+/* min share (in percent) of total time for --use-profile */
+#define PROFILE_SHARE_DEFAULT  1
+
 #define KB 1024
 #define MB (KB * 1024)
 
@@ -54,6 +60,8 @@ enum uftrace_feat_bits {
 	MAX_STACK_BIT,
 	EVENT_BIT,
 	PERF_EVENT_BIT,
+	COMPLETE_RECORD_BIT,
+	EVENT_ARGUMENT_BIT,
 
 	FEAT_BIT_MAX,
 
@@ -67,6 +75,8 @@ enum uftrace_feat_bits {
 	MAX_STACK		= (1U << MAX_STACK_BIT),
 	EVENT			= (1U << EVENT_BIT),
 	PERF_EVENT		= (1U << PERF_EVENT_BIT),
+	COMPLETE_RECORD		= (1U << COMPLETE_RECORD_BIT),
+	EVENT_ARGUMENT		= (1U << EVENT_ARGUMENT_BIT),
 };
 
 enum uftrace_info_bits {
@@ -82,6 +92,8 @@ enum uftrace_info_bits {
 	LOADINFO,
 	ARG_SPEC,
 	RECORD_DATE,
+	AUTO_NOTRACE,
+	PROFILE,
 };
 
 struct uftrace_info {
@@ -114,6 +126,11 @@ struct uftrace_info {
 	float load1;
 	float load5;
 	float load15;
+	int nr_auto_notrace;
+	char *auto_notrace;
+	char *profile;
+	char *profile_filter;
+	char *profile_notrace;
 };
 
 enum {
@@ -131,10 +148,25 @@ struct uftrace_session;
 struct uftrace_kernel_reader;
 struct uftrace_perf_reader;
 
+/*
+ * Data directory merged to the main data (--merge-data option).  Task ids
+ * in the merged data are qualified by the host index in higher digits
+ * (e.g. tid 1234 of the first merged data becomes 10001234).
+ */
+#define UFTRACE_HOST_TID_BASE  10000000
+
+struct uftrace_data_host {
+	char			*dirname;
+	int64_t			time_offset;
+};
+
+struct uftrace_task_heap;
+
 struct uftrace_session_link {
 	struct rb_root		root;
 	struct rb_root		tasks;
 	struct uftrace_session *first;
+	struct list_head	syms;
 };
 
 struct ftrace_file_handle {
@@ -146,8 +178,11 @@ struct ftrace_file_handle {
 	struct uftrace_kernel_reader *kernel;
 	struct uftrace_perf_reader *perf;
 	struct ftrace_task_handle *tasks;
+	struct uftrace_task_heap *task_heap;
+	struct uftrace_data_host *hosts;
 	struct uftrace_session_link sessions;
 	int nr_tasks;
+	int nr_hosts;
 	int nr_perf;
 	int last_perf_idx;
 	int depth;
@@ -186,11 +221,17 @@ struct opts {
 	char *diff;
 	char *fields;
 	char *patch;
+	char *auto_notrace;
+	char *profile;
+	char *profile_filter;
+	char *profile_notrace;
 	char *event;
 	char **run_cmd;
 	char *opt_file;
 	char *script_file;
 	char *diff_policy;
+	char *merge_data;
+	char *symbol_cache;
 	int mode;
 	int idx;
 	int depth;
@@ -202,6 +243,9 @@ struct opts {
 	int sort_column;
 	int nr_thread;
 	int rt_prio;
+	int patch_signal;
+	double profile_share;
+	int nr_stream;
 	unsigned long bufsize;
 	unsigned long kernel_bufsize;
 	uint64_t threshold;
@@ -235,6 +279,8 @@ struct opts {
 	bool event_skip_out;
 	bool nest_libcall;
 	bool record;
+	bool no_cache;
+	bool compress;
 	struct uftrace_time_range range;
 };
 
@@ -250,6 +296,7 @@ int command_record(int argc, char *argv[], struct opts *opts);
 int command_replay(int argc, char *argv[], struct opts *opts);
 int command_live(int argc, char *argv[], struct opts *opts);
 int command_report(int argc, char *argv[], struct opts *opts);
+int report_profile(struct opts *opts, char **filter, char **notrace);
 int command_info(int argc, char *argv[], struct opts *opts);
 int command_recv(int argc, char *argv[], struct opts *opts);
 int command_dump(int argc, char *argv[], struct opts *opts);
@@ -267,15 +314,33 @@ int read_task_txt_file(struct uftrace_session_link *sess, char *dirname,
 
 #define SESSION_ID_LEN  16
 
+/*
+ * Symbol tables and filters are immutable after setup so sessions of
+ * the same executable with the same mappings can share them.
+ */
+struct uftrace_sess_syms {
+	struct list_head	 list;
+	int			 refcount;
+	struct symtabs		 symtabs;
+	struct rb_root		 filters;
+	struct rb_root		 fixups;
+};
+
 struct uftrace_session {
 	struct rb_node		 node;
 	char			 sid[SESSION_ID_LEN];
 	uint64_t		 start_time;
 	int			 pid, tid;
-	struct symtabs		 symtabs;
-	struct rb_root		 filters;
-	struct rb_root		 fixups;
+	struct uftrace_sess_syms *syms;
+	/* the first session loaded the syms and sets up filters on it */
+	bool			 syms_owner;
+	struct symtabs		*symtabs;
+	struct rb_root		*filters;
+	struct rb_root		*fixups;
 	struct list_head	 dlopen_libs;
+	/* dlopen'ed libraries sorted by address (see session_add_dlopen) */
+	struct uftrace_dlopen_list **dlopen_index;
+	int			 nr_dlopen;
 	int 			 namelen;
 	char 			 exename[];
 };
@@ -290,6 +355,9 @@ struct uftrace_dlopen_list {
 	struct list_head	list;
 	uint64_t		time;
 	unsigned long		base;
+	unsigned long		end;
+	/* max end address of libraries up to this in the dlopen_index */
+	unsigned long		max_end;
 	struct symtabs		symtabs;
 	char			name[];
 };
@@ -314,6 +382,7 @@ enum uftrace_msg_type {
 	UFTRACE_MSG_LOST,
 	UFTRACE_MSG_DLOPEN,
 	UFTRACE_MSG_FINISH,
+	UFTRACE_MSG_DOORBELL,
 
 	UFTRACE_MSG_SEND_START		= 100,
 	UFTRACE_MSG_SEND_DIR_NAME,
@@ -323,6 +392,10 @@ enum uftrace_msg_type {
 	UFTRACE_MSG_SEND_INFO,
 	UFTRACE_MSG_SEND_META_DATA,
 	UFTRACE_MSG_SEND_END,
+	UFTRACE_MSG_SEND_STREAM,
+	UFTRACE_MSG_SEND_COMPRESSED,
+	UFTRACE_MSG_SEND_CLOCK,
+	UFTRACE_MSG_SEND_CLOCK_OFFSET,
 };
 
 /* msg format for communicating by pipe */
@@ -393,6 +466,7 @@ void walk_tasks(struct uftrace_session_link *sess,
 
 int setup_client_socket(struct opts *opts);
 void send_trace_dir_name(int sock, char *name);
+void sync_trace_clock(int sock);
 void send_trace_data(int sock, int tid, void *data, size_t len);
 void send_trace_kernel_data(int sock, int cpu, void *data, size_t len);
 void send_trace_perf_data(int sock, int cpu, void *data, size_t len);
@@ -400,6 +474,8 @@ void send_trace_metadata(int sock, const char *dirname, char *filename);
 void send_trace_info(int sock, struct uftrace_file_header *hdr,
 		     void *info, int len);
 void send_trace_end(int sock);
+void setup_send_streams(struct opts *opts, int sock);
+void finish_send_streams(void);
 
 void write_task_info(const char *dirname, struct uftrace_msg_task *tmsg);
 void write_fork_info(const char *dirname, struct uftrace_msg_task *tmsg);
@@ -435,6 +511,22 @@ static inline bool is_v3_compat(struct uftrace_record *urec)
 	return urec->magic == RECORD_MAGIC && urec->more == 0;
 }
 
+/*
+ * A complete record is a fused entry and exit record of a function
+ * which has no child, argument and return value.  The time is the
+ * entry time and the duration follows in the next 8 bytes.  It uses
+ * the LOST type with the 'more' bit set which real lost records never
+ * have.  It's only valid if the COMPLETE_RECORD feature bit is set.
+ * The fstack code expands it to entry and exit records when reading
+ * so others don't need to care about it.
+ */
+static inline bool is_complete_record(struct uftrace_record *urec,
+				      uint64_t feat_mask)
+{
+	return (feat_mask & COMPLETE_RECORD) &&
+		urec->type == UFTRACE_LOST && urec->more;
+}
+
 struct fstack_arguments {
 	struct list_head	*args;
 	unsigned		len;
@@ -488,6 +580,11 @@ enum uftrace_event_id {
 	EVENT_ID_BUILTIN = 100000U,
 	EVENT_ID_PROC_STATM,
 	EVENT_ID_PAGE_FAULT,
+	EVENT_ID_READ_PMU_CYCLE,
+	EVENT_ID_READ_PMU_CACHE,
+	EVENT_ID_READ_PMU_BRANCH,
+	EVENT_ID_READ_MAX_RSS,
+	EVENT_ID_READ_CTX_SWITCH,
 
 	/* supported perf events */
 	EVENT_ID_PERF		= 200000U,
@@ -498,6 +595,9 @@ enum uftrace_event_id {
 	EVENT_ID_USER	= 1000000U,
 };
 
+/* max number of SDT arguments (see sys/sdt.h) saved in user events */
+#define SDT_MAX_ARGS  12
+
 struct uftrace_event {
 	struct list_head	list;
 	enum uftrace_event_id	id;
@@ -0,0 +1,395 @@
+/*
+ * Persistent analysis cache for uftrace
+ *
+ * The report and graph commands need to read and merge all record
+ * data just to compute the same (pre-aggregated) result again and
+ * again.  This saves the result in the data directory so that later
+ * runs with the same options can skip reading the data files.
+ *
+ * Released under the GPL v2.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+/* This should be defined before #include "utils.h" */
+#define PR_FMT     "cache"
+#define PR_DOMAIN  DBG_UFTRACE
+
+#include "uftrace.h"
+#include "utils/utils.h"
+#include "utils/cache.h"
+
+/* FNV-1a hash */
+#define FNV_OFFSET  0xcbf29ce484222325ULL
+#define FNV_PRIME   0x100000001b3ULL
+
+static uint64_t hash_update(uint64_t hash, const void *data, size_t len)
+{
+	const unsigned char *p = data;
+
+	while (len--) {
+		hash ^= *p++;
+		hash *= FNV_PRIME;
+	}
+	return hash;
+}
+
+static int filter_data_file(const struct dirent *d)
+{
+	/* skip hidden files and the cache directory itself */
+	if (d->d_name[0] == '.')
+		return 0;
+	return strcmp(d->d_name, UFTRACE_CACHE_DIR);
+}
+
+/**
+ * cache_data_stamp - calculate a stamp of data files
+ * @dirname: name of the data directory
+ *
+ * This function returns a hash value of name, size and modification
+ * time of all files in the @dirname.  Any change in the data files
+ * will result in a different value so that old cache files can be
+ * invalidated.  It returns 0 if the directory cannot be read.
+ */
+uint64_t cache_data_stamp(char *dirname)
+{
+	struct dirent **list;
+	struct stat stbuf;
+	uint64_t hash = FNV_OFFSET;
+	char *filename;
+	int i, num;
+
+	num = scandir(dirname, &list, filter_data_file, alphasort);
+	if (num < 0)
+		return 0;
+
+	for (i = 0; i < num; i++) {
+		xasprintf(&filename, "%s/%s", dirname, list[i]->d_name);
+
+		if (stat(filename, &stbuf) == 0) {
+			uint64_t val[3] = {
+				stbuf.st_size,
+				stbuf.st_mtim.tv_sec,
+				stbuf.st_mtim.tv_nsec,
+			};
+
+			hash = hash_update(hash, list[i]->d_name,
+					   strlen(list[i]->d_name) + 1);
+			hash = hash_update(hash, val, sizeof(val));
+		}
+
+		free(filename);
+		free(list[i]);
+	}
+	free(list);
+
+	/* 0 is used for an error */
+	return hash ?: 1;
+}
+
+/**
+ * cache_setup - initialize cache key for the analysis
+ * @cache: cache handle
+ * @opts: uftrace command line options
+ * @cmd: name of the (sub-)command
+ * @arg: extra argument which affects the result (can be %NULL)
+ *
+ * This function builds a key string from options which affect the
+ * (pre-aggregated) analysis result.  Options which only change the
+ * output format (like sort keys) are not part of the key.
+ */
+void cache_setup(struct uftrace_cache *cache, struct opts *opts,
+		 const char *cmd, const char *arg)
+{
+	memset(cache, 0, sizeof(*cache));
+
+	xasprintf(&cache->key,
+		  "%s:%s;F=%s;T=%s;tid=%s;D=%d;t=%"PRIu64";"
+		  "r=%"PRIu64"%s~%"PRIu64"%s;k=%d%d%d;e=%d;"
+		  "avg=%d%d;max_stack=%d;disable=%d;demangle=%d",
+		  cmd, arg ?: "", opts->filter ?: "", opts->trigger ?: "",
+		  opts->tid ?: "", opts->depth, opts->threshold,
+		  opts->range.start, opts->range.start_elapsed ? "e" : "",
+		  opts->range.stop, opts->range.stop_elapsed ? "e" : "",
+		  opts->kernel, opts->kernel_skip_out, opts->kernel_only,
+		  opts->event_skip_out, opts->avg_total, opts->avg_self,
+		  opts->max_stack, opts->disabled, demangler);
+}
+
+static char *cache_filename(struct uftrace_cache *cache, char *dirname)
+{
+	char *filename;
+	uint64_t hash;
+
+	hash = hash_update(FNV_OFFSET, cache->key, strlen(cache->key));
+	xasprintf(&filename, "%s/%s/%016"PRIx64".cache",
+		  dirname, UFTRACE_CACHE_DIR, hash);
+	return filename;
+}
+
+static void cache_close(struct uftrace_cache *cache)
+{
+	if (cache->fp)
+		fclose(cache->fp);
+	cache->fp = NULL;
+}
+
+/**
+ * cache_open_read - open an existing cache file
+ * @cache: cache handle set up by cache_setup()
+ * @dirname: name of the data directory
+ *
+ * This function returns %true if a cache file for the key exists and
+ * it's still valid for the current data.  The caller can read the
+ * contents with cache_read_*() functions and should call
+ * cache_finish() at the end.
+ */
+bool cache_open_read(struct uftrace_cache *cache, char *dirname)
+{
+	char magic[sizeof(UFTRACE_CACHE_MAGIC)];
+	uint64_t version, stamp;
+	char *key = NULL;
+
+	if (cache->key == NULL)
+		return false;
+
+	cache->stamp = cache_data_stamp(dirname);
+	if (cache->stamp == 0)
+		return false;
+
+	cache->filename = cache_filename(cache, dirname);
+	cache->fp = fopen(cache->filename, "r");
+	if (cache->fp == NULL)
+		return false;
+
+	if (fread_all(magic, sizeof(magic), cache->fp) < 0 ||
+	    memcmp(magic, UFTRACE_CACHE_MAGIC, sizeof(magic)))
+		goto invalid;
+
+	if (cache_read_u64(cache, &version) < 0 ||
+	    version != UFTRACE_CACHE_VERSION)
+		goto invalid;
+
+	if (cache_read_u64(cache, &stamp) < 0 || stamp != cache->stamp)
+		goto invalid;
+
+	/* check the key to avoid hash collision */
+	key = cache_read_str(cache);
+	if (key == NULL || strcmp(key, cache->key))
+		goto invalid;
+
+	free(key);
+	pr_dbg("using cache file: %s\n", cache->filename);
+	return true;
+
+invalid:
+	pr_dbg("ignoring stale cache file: %s\n", cache->filename);
+	free(key);
+	cache_close(cache);
+	return false;
+}
+
+/**
+ * cache_open_write - create a new cache file
+ * @cache: cache handle set up by cache_setup()
+ * @dirname: name of the data directory
+ *
+ * This function creates a temporary file to write the cache contents.
+ * It'll be renamed to the real cache file by cache_finish() only if
+ * it was written successfully.  It returns %false if the cache file
+ * cannot be created (e.g. no write permission to the data directory).
+ */
+bool cache_open_write(struct uftrace_cache *cache, char *dirname)
+{
+	char *cachedir;
+
+	if (cache->key == NULL)
+		return false;
+
+	/* it might have a (broken) cache file opened for read */
+	cache_close(cache);
+
+	if (cache->stamp == 0)
+		cache->stamp = cache_data_stamp(dirname);
+	if (cache->stamp == 0)
+		return false;
+
+	if (cache->filename == NULL)
+		cache->filename = cache_filename(cache, dirname);
+
+	xasprintf(&cachedir, "%s/%s", dirname, UFTRACE_CACHE_DIR);
+	if (mkdir(cachedir, 0755) < 0 && errno != EEXIST) {
+		pr_dbg("cannot create cache directory: %s: %m\n", cachedir);
+		free(cachedir);
+		return false;
+	}
+	free(cachedir);
+
+	xasprintf(&cache->tmpname, "%s.%d", cache->filename, getpid());
+	cache->fp = fopen(cache->tmpname, "w");
+	if (cache->fp == NULL) {
+		pr_dbg("cannot create cache file: %s: %m\n", cache->tmpname);
+		return false;
+	}
+
+	fwrite(UFTRACE_CACHE_MAGIC, sizeof(UFTRACE_CACHE_MAGIC), 1, cache->fp);
+	cache_write_u64(cache, UFTRACE_CACHE_VERSION);
+	cache_write_u64(cache, cache->stamp);
+	cache_write_str(cache, cache->key);
+
+	return true;
+}
+
+/**
+ * cache_finish - finish using the cache
+ * @cache: cache handle
+ * @success: whether the cache contents was processed successfully
+ *
+ * This function closes the cache file and releases resources.  When
+ * a cache file was written and @success is %true, it'll be used by
+ * later runs.  Otherwise the (partial) cache file is discarded.
+ */
+void cache_finish(struct uftrace_cache *cache, bool success)
+{
+	if (cache->fp && ferror(cache->fp))
+		success = false;
+
+	cache_close(cache);
+
+	if (cache->tmpname) {
+		if (!success || rename(cache->tmpname, cache->filename) < 0)
+			unlink(cache->tmpname);
+		else
+			pr_dbg("cache file saved: %s\n", cache->filename);
+	}
+	else if (!success && cache->filename) {
+		/* failed to read a valid cache: remove it */
+		unlink(cache->filename);
+	}
+
+	free(cache->key);
+	free(cache->filename);
+	free(cache->tmpname);
+	memset(cache, 0, sizeof(*cache));
+}
+
+void cache_write_u64(struct uftrace_cache *cache, uint64_t val)
+{
+	fwrite(&val, sizeof(val), 1, cache->fp);
+}
+
+void cache_write_str(struct uftrace_cache *cache, const char *str)
+{
+	uint64_t len = str ? strlen(str) : -1ULL;
+
+	cache_write_u64(cache, len);
+	if (str)
+		fwrite(str, len, 1, cache->fp);
+}
+
+int cache_read_u64(struct uftrace_cache *cache, uint64_t *val)
+{
+	return fread_all(val, sizeof(*val), cache->fp);
+}
+
+/* number of bytes not read yet, to check counts read from the cache */
+uint64_t cache_remaining(struct uftrace_cache *cache)
+{
+	struct stat st;
+	long pos;
+
+	pos = ftell(cache->fp);
+	if (pos < 0 || fstat(fileno(cache->fp), &st) < 0 || st.st_size < pos)
+		return 0;
+
+	return st.st_size - pos;
+}
+
+/* NOTE: it returns NULL for both of NULL string and an error */
+char *cache_read_str(struct uftrace_cache *cache)
+{
+	uint64_t len;
+	char *str;
+
+	if (cache_read_u64(cache, &len) < 0 || len == -1ULL)
+		return NULL;
+
+	/* sanity check */
+	if (len > 64 * KB)
+		return NULL;
+
+	str = xmalloc(len + 1);
+	if (fread_all(str, len, cache->fp) < 0) {
+		free(str);
+		return NULL;
+	}
+	str[len] = '\0';
+
+	return str;
+}
+
+#ifdef UNIT_TEST
+
+#define CACHE_TEST_DIR  "cache.test"
+
+TEST_CASE(cache_read_write)
+{
+	struct opts opts = {
+		.filter = "main",
+		.depth = OPT_DEPTH_DEFAULT,
+	};
+	struct uftrace_cache cache;
+	uint64_t val;
+	char *str;
+	FILE *fp;
+
+	create_directory(CACHE_TEST_DIR);
+
+	fp = fopen(CACHE_TEST_DIR "/0.dat", "w");
+	TEST_NE(fp, NULL);
+	fprintf(fp, "data");
+	fclose(fp);
+
+	cache_setup(&cache, &opts, "test", NULL);
+	TEST_EQ(cache_open_read(&cache, CACHE_TEST_DIR), false);
+	TEST_EQ(cache_open_write(&cache, CACHE_TEST_DIR), true);
+	cache_write_u64(&cache, 1234);
+	cache_write_str(&cache, "hello");
+	cache_finish(&cache, true);
+
+	cache_setup(&cache, &opts, "test", NULL);
+	TEST_EQ(cache_open_read(&cache, CACHE_TEST_DIR), true);
+	TEST_EQ(cache_read_u64(&cache, &val), 0);
+	TEST_EQ(val, 1234);
+	str = cache_read_str(&cache);
+	TEST_STREQ(str, "hello");
+	free(str);
+	cache_finish(&cache, true);
+
+	/* different options should not use the cache */
+	opts.depth = 2;
+	cache_setup(&cache, &opts, "test", NULL);
+	TEST_EQ(cache_open_read(&cache, CACHE_TEST_DIR), false);
+	cache_finish(&cache, false);
+	opts.depth = OPT_DEPTH_DEFAULT;
+
+	/* changing data file should invalidate the cache */
+	fp = fopen(CACHE_TEST_DIR "/0.dat", "a");
+	TEST_NE(fp, NULL);
+	fprintf(fp, "more data");
+	fclose(fp);
+
+	cache_setup(&cache, &opts, "test", NULL);
+	TEST_EQ(cache_open_read(&cache, CACHE_TEST_DIR), false);
+	cache_finish(&cache, false);
+
+	remove_directory(CACHE_TEST_DIR);
+	return TEST_OK;
+}
+
+#endif /* UNIT_TEST */
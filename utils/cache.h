@@ -0,0 +1,42 @@
+#ifndef UFTRACE_CACHE_H
+#define UFTRACE_CACHE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#define UFTRACE_CACHE_DIR      "cache"
+#define UFTRACE_CACHE_MAGIC    "uftcache"
+#define UFTRACE_CACHE_VERSION  3
+
+struct opts;
+
+/*
+ * Analysis cache saved in the data directory.  A cache file is
+ * identified by a key string (made of the command name and options
+ * affecting the result) and validated by a stamp computed from the
+ * size and modification time of the data files.
+ */
+struct uftrace_cache {
+	FILE		*fp;
+	char		*key;
+	char		*filename;
+	char		*tmpname;
+	uint64_t	stamp;
+};
+
+void cache_setup(struct uftrace_cache *cache, struct opts *opts,
+		 const char *cmd, const char *arg);
+bool cache_open_read(struct uftrace_cache *cache, char *dirname);
+bool cache_open_write(struct uftrace_cache *cache, char *dirname);
+void cache_finish(struct uftrace_cache *cache, bool success);
+
+uint64_t cache_data_stamp(char *dirname);
+
+void cache_write_u64(struct uftrace_cache *cache, uint64_t val);
+void cache_write_str(struct uftrace_cache *cache, const char *str);
+int cache_read_u64(struct uftrace_cache *cache, uint64_t *val);
+char *cache_read_str(struct uftrace_cache *cache);
+uint64_t cache_remaining(struct uftrace_cache *cache);
+
+#endif /* UFTRACE_CACHE_H */
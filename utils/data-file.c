@@ -92,20 +92,14 @@ out:
 	return ret;
 }
 
-/**
- * read_task_txt_file - read 'task.txt' file from data directory
- * @sess: session link to manage sessions and tasks
- * @dirname: name of the data directory
- * @needs_session: read session info too
- * @sym_rel_addr: whethere symbol address is relative
- *
- * This function read the task.txt file in the @dirname and build task
- * (and session when @needs_session is %true) information.
- *
- * It returns 0 for success, -1 for error.
+/*
+ * The @tid_base and @time_offset are added to task ids and timestamps
+ * in the file so that tasks from other hosts can be merged.
  */
-int read_task_txt_file(struct uftrace_session_link *sess, char *dirname,
-		       bool needs_session, bool sym_rel_addr)
+static int __read_task_txt_file(struct uftrace_session_link *sess,
+				char *dirname, bool needs_session,
+				bool sym_rel_addr, int tid_base,
+				int64_t time_offset)
 {
 	FILE *fp;
 	char *fname = NULL;
@@ -131,14 +125,20 @@ int read_task_txt_file(struct uftrace_session_link *sess, char *dirname,
 			sscanf(line + 5, "timestamp=%lu.%lu tid=%d pid=%d",
 			       &sec, &nsec, &tmsg.tid, &tmsg.pid);
 
+			tmsg.tid += tid_base;
+			tmsg.pid += tid_base;
 			tmsg.time = (uint64_t)sec * NSEC_PER_SEC + nsec;
+			tmsg.time += time_offset;
 			create_task(sess, &tmsg, false, needs_session);
 		}
 		else if (!strncmp(line, "FORK", 4)) {
 			sscanf(line + 5, "timestamp=%lu.%lu pid=%d ppid=%d",
 			       &sec, &nsec, &tmsg.tid, &tmsg.pid);
 
+			tmsg.tid += tid_base;
+			tmsg.pid += tid_base;
 			tmsg.time = (uint64_t)sec * NSEC_PER_SEC + nsec;
+			tmsg.time += time_offset;
 			create_task(sess, &tmsg, true, needs_session);
 		}
 		else if (!strncmp(line, "SESS", 4)) {
@@ -157,8 +157,10 @@ int read_task_txt_file(struct uftrace_session_link *sess, char *dirname,
 			if (pos)
 				*pos = '\0';
 
+			smsg.task.pid += tid_base;
 			smsg.task.tid = smsg.task.pid;
 			smsg.task.time = (uint64_t)sec * NSEC_PER_SEC + nsec;
+			smsg.task.time += time_offset;
 			smsg.namelen = strlen(exename);
 
 			create_session(sess, &smsg, dirname, exename, sym_rel_addr);
@@ -181,8 +183,10 @@ int read_task_txt_file(struct uftrace_session_link *sess, char *dirname,
 			if (pos)
 				*pos = '\0';
 
+			dlop.task.tid += tid_base;
 			dlop.task.pid = dlop.task.tid;
 			dlop.task.time = (uint64_t)sec * NSEC_PER_SEC + nsec;
+			dlop.task.time += time_offset;
 			dlop.namelen = strlen(exename);
 
 			s = get_session_from_sid(sess, dlop.sid);
@@ -197,6 +201,25 @@ int read_task_txt_file(struct uftrace_session_link *sess, char *dirname,
 	return 0;
 }
 
+/**
+ * read_task_txt_file - read 'task.txt' file from data directory
+ * @sess: session link to manage sessions and tasks
+ * @dirname: name of the data directory
+ * @needs_session: read session info too
+ * @sym_rel_addr: whethere symbol address is relative
+ *
+ * This function read the task.txt file in the @dirname and build task
+ * (and session when @needs_session is %true) information.
+ *
+ * It returns 0 for success, -1 for error.
+ */
+int read_task_txt_file(struct uftrace_session_link *sess, char *dirname,
+		       bool needs_session, bool sym_rel_addr)
+{
+	return __read_task_txt_file(sess, dirname, needs_session,
+				    sym_rel_addr, 0, 0);
+}
+
 /**
  * read_events_file - read 'events.txt' file from data directory
  * @dirname: name of the data directory
@@ -357,6 +380,160 @@ static void check_data_order(struct ftrace_file_handle *handle)
 		pr_dbg("bitfield order is different!\n");
 }
 
+/* read clock offset to the receiver estimated by 'uftrace recv' */
+static int64_t read_clock_offset(const char *dirname)
+{
+	FILE *fp;
+	char *fname = NULL;
+	int64_t offset = 0;
+
+	xasprintf(&fname, "%s/%s", dirname, "clock.txt");
+
+	fp = fopen(fname, "r");
+	if (fp != NULL) {
+		if (fscanf(fp, "offset=%"SCNd64, &offset) != 1)
+			offset = 0;
+		fclose(fp);
+	}
+
+	free(fname);
+	return offset;
+}
+
+static int64_t parse_clock_offset(char *str)
+{
+	if (*str == '-')
+		return -(int64_t)parse_time(str + 1, 9);
+	if (*str == '+')
+		str++;
+	return parse_time(str, 9);
+}
+
+static bool same_string(const char *a, const char *b)
+{
+	return !strcmp(a ?: "", b ?: "");
+}
+
+/*
+ * Add tasks and sessions in @dirname to @handle.  Their task ids are
+ * qualified by the host index and their timestamps are moved by the
+ * offset so that records of all hosts can be merged in a timeline.
+ */
+static int merge_data_dir(struct ftrace_file_handle *handle, char *dirname,
+			  int64_t time_offset)
+{
+	struct ftrace_file_handle tmp = {};
+	struct uftrace_data_host *host;
+	char *fname = NULL;
+	int tid_base;
+	int i, ret = -1;
+
+	xasprintf(&fname, "%s/%s", dirname, "info");
+	tmp.fp = fopen(fname, "rb");
+	if (tmp.fp == NULL) {
+		pr_warn("cannot open %s: %m\n", fname);
+		goto out;
+	}
+
+	if (fread(&tmp.hdr, sizeof(tmp.hdr), 1, tmp.fp) != 1 ||
+	    memcmp(tmp.hdr.magic, UFTRACE_MAGIC_STR, UFTRACE_MAGIC_LEN)) {
+		pr_warn("invalid data in %s\n", dirname);
+		goto out;
+	}
+
+	check_data_order(&tmp);
+	if (tmp.needs_byte_swap != handle->needs_byte_swap ||
+	    tmp.needs_bit_swap != handle->needs_bit_swap) {
+		pr_warn("cannot merge %s: different data order\n", dirname);
+		goto out;
+	}
+
+	if (tmp.hdr.version < UFTRACE_FILE_VERSION_MIN ||
+	    tmp.hdr.version > UFTRACE_FILE_VERSION ||
+	    read_uftrace_info(tmp.hdr.info_mask, &tmp) < 0) {
+		pr_warn("cannot read uftrace info in %s\n", dirname);
+		goto out;
+	}
+
+	/* only task.txt has enough info to adjust task ids */
+	if (!(tmp.hdr.feat_mask & TASK_SESSION)) {
+		pr_warn("cannot merge %s: no session info\n", dirname);
+		goto out;
+	}
+
+	if (!same_string(tmp.info.argspec, handle->info.argspec) ||
+	    !same_string(tmp.info.retspec, handle->info.retspec))
+		pr_warn("%s has different argument spec\n", dirname);
+
+	handle->hosts = xrealloc(handle->hosts,
+				 (handle->nr_hosts + 1) * sizeof(*host));
+	host = &handle->hosts[handle->nr_hosts++];
+	host->dirname = xstrdup(dirname);
+	host->time_offset = time_offset;
+
+	tid_base = handle->nr_hosts * UFTRACE_HOST_TID_BASE;
+
+	if (__read_task_txt_file(&handle->sessions, host->dirname, true,
+				 tmp.hdr.feat_mask & SYM_REL_ADDR,
+				 tid_base, time_offset) < 0) {
+		pr_warn("cannot read task info in %s\n", dirname);
+		/* keep the host to preserve the index of later hosts */
+	}
+
+	handle->info.tids = xrealloc(handle->info.tids,
+				     (handle->info.nr_tid + tmp.info.nr_tid) *
+				     sizeof(*handle->info.tids));
+	for (i = 0; i < tmp.info.nr_tid; i++)
+		handle->info.tids[handle->info.nr_tid++] = tmp.info.tids[i] + tid_base;
+
+	if (!(tmp.hdr.feat_mask & MAX_STACK))
+		tmp.hdr.max_stack = MCOUNT_RSTACK_MAX;
+	if (handle->hdr.max_stack < tmp.hdr.max_stack)
+		handle->hdr.max_stack = tmp.hdr.max_stack;
+
+	pr_dbg("merge %s as host %d (time offset: %"PRId64" nsec)\n",
+	       dirname, handle->nr_hosts, time_offset);
+	ret = 0;
+
+out:
+	if (tmp.fp)
+		fclose(tmp.fp);
+	clear_uftrace_info(&tmp.info);
+	free(fname);
+	return ret;
+}
+
+/*
+ * The --merge-data option has a list of DATA[@OFFSET].  The OFFSET is
+ * added to timestamps in the DATA to match the main data.  If it's
+ * omitted, it uses the clock offsets estimated by 'uftrace recv'.
+ */
+static void open_merge_data(struct opts *opts, struct ftrace_file_handle *handle)
+{
+	int64_t base_offset, offset;
+	char *str, *spec, *pos, *tmp;
+
+	base_offset = read_clock_offset(handle->dirname);
+
+	str = xstrdup(opts->merge_data);
+
+	spec = strtok_r(str, ",;", &tmp);
+	while (spec) {
+		pos = strrchr(spec, '@');
+		if (pos) {
+			*pos++ = '\0';
+			offset = parse_clock_offset(pos);
+		}
+		else
+			offset = read_clock_offset(spec) - base_offset;
+
+		merge_data_dir(handle, spec, offset);
+
+		spec = strtok_r(NULL, ",;", &tmp);
+	}
+	free(str);
+}
+
 int open_data_file(struct opts *opts, struct ftrace_file_handle *handle)
 {
 	int ret = -1;
@@ -400,11 +577,15 @@ ok:
 	handle->depth = opts->depth;
 	handle->nr_tasks = 0;
 	handle->tasks = NULL;
+	handle->task_heap = NULL;
+	handle->nr_hosts = 0;
+	handle->hosts = NULL;
 	handle->time_filter = opts->threshold;
 	handle->time_range = opts->range;
 	handle->sessions.root  = RB_ROOT;
 	handle->sessions.tasks = RB_ROOT;
 	handle->sessions.first = NULL;
+	INIT_LIST_HEAD(&handle->sessions.syms);
 	handle->kernel = NULL;
 	handle->nr_perf = 0;
 	handle->perf = NULL;
@@ -460,6 +641,9 @@ ok:
 	if (!(handle->hdr.feat_mask & MAX_STACK))
 		handle->hdr.max_stack = MCOUNT_RSTACK_MAX;
 
+	if (opts->merge_data)
+		open_merge_data(opts, handle);
+
 	if (handle->hdr.feat_mask & KERNEL) {
 		struct uftrace_kernel_reader *kernel;
 
@@ -506,6 +690,11 @@ void close_data_file(struct opts *opts, struct ftrace_file_handle *handle)
 
 	delete_sessions(&handle->sessions);
 
+	while (handle->nr_hosts > 0)
+		free(handle->hosts[--handle->nr_hosts].dirname);
+	free(handle->hosts);
+	handle->hosts = NULL;
+
 	clear_uftrace_info(&handle->info);
 	reset_task_handle(handle);
 }
@@ -80,10 +80,16 @@ void setup_color(enum color_setting color)
 	}
 }
 
+/*
+ * Some commands set FSETLOCKING_BYCALLER on the logfp for speed, but
+ * symbol loading can print messages from multiple threads.  Lock the
+ * stream explicitly so that messages (and colors) don't get mixed.
+ */
 void __pr_dbg(const char *fmt, ...)
 {
 	va_list ap;
 
+	flockfile(logfp);
 	color(TERM_COLOR_GRAY, logfp);
 
 	va_start(ap, fmt);
@@ -91,12 +97,14 @@ void __pr_dbg(const char *fmt, ...)
 	va_end(ap);
 
 	color(TERM_COLOR_RESET, logfp);
+	funlockfile(logfp);
 }
 
 void __pr_err(const char *fmt, ...)
 {
 	va_list ap;
 
+	flockfile(logfp);
 	color(TERM_COLOR_RED, logfp);
 
 	va_start(ap, fmt);
@@ -104,6 +112,7 @@ void __pr_err(const char *fmt, ...)
 	va_end(ap);
 
 	color(TERM_COLOR_RESET, logfp);
+	funlockfile(logfp);
 
 	exit(1);
 }
@@ -114,6 +123,7 @@ void __pr_err_s(const char *fmt, ...)
 	int saved_errno = errno;
 	char buf[512];
 
+	flockfile(logfp);
 	color(TERM_COLOR_RED, logfp);
 
 	va_start(ap, fmt);
@@ -123,6 +133,7 @@ void __pr_err_s(const char *fmt, ...)
 	fprintf(logfp, ": %s\n", strerror_r(saved_errno, buf, sizeof(buf)));
 
 	color(TERM_COLOR_RESET, logfp);
+	funlockfile(logfp);
 
 	exit(1);
 }
@@ -131,6 +142,7 @@ void __pr_warn(const char *fmt, ...)
 {
 	va_list ap;
 
+	flockfile(logfp);
 	color(TERM_COLOR_YELLOW, logfp);
 
 	va_start(ap, fmt);
@@ -138,6 +150,7 @@ void __pr_warn(const char *fmt, ...)
 	va_end(ap);
 
 	color(TERM_COLOR_RESET, logfp);
+	funlockfile(logfp);
 }
 
 void __pr_out(const char *fmt, ...)
@@ -27,6 +27,7 @@ struct demangle_data {
 	char *new;
 	const char *func;
 	char *expected;
+	char expbuf[2];
 	int line;
 	int pos;
 	int len;
@@ -38,8 +39,6 @@ struct demangle_data {
 	const char *debug[MAX_DEBUG_DEPTH];
 };
 
-static char dd_expbuf[2];
-
 static int dd_eof(struct demangle_data *dd)
 {
 	return dd->pos >= dd->len;
@@ -98,8 +97,8 @@ static char __dd_consume(struct demangle_data *dd, const char *dbg)
 			dd->func = __func__;				\
 			dd->line = __LINE__;				\
 			dd->pos--;					\
-			dd->expected = dd_expbuf;			\
-			dd_expbuf[0] = exp_c;				\
+			dd->expected = dd->expbuf;			\
+			dd->expbuf[0] = exp_c;				\
 		}							\
 		return -1;						\
 	}								\
@@ -111,8 +110,8 @@ static char __dd_consume(struct demangle_data *dd, const char *dbg)
 			dd->func = __func__;				\
 			dd->line = __LINE__;				\
 			dd->pos--;					\
-			dd->expected = dd_expbuf;			\
-			dd_expbuf[0] = exp_c;				\
+			dd->expected = dd->expbuf;			\
+			dd->expbuf[0] = exp_c;				\
 		}							\
 		return -1;						\
 	}								\
@@ -20,15 +20,24 @@
 static void snprintf_trigger_read(char *buf, size_t len,
 				  enum trigger_read_type type)
 {
+	const char *names[] = {
+		"proc/statm", "page-fault", "pmu-cycle", "pmu-cache", "pmu-branch",
+		"max-rss", "ctx-switch",
+	};
+	size_t pos = 0;
+	unsigned i;
+
 	buf[0] = '\0';
 
 	if (type == TRIGGER_READ_NONE)
 		snprintf(buf, len, "none");
 
-	if (type & TRIGGER_READ_PROC_STATM)
-		snprintf(buf, len, "%s%s", buf[0] ? "|" : "", "proc/statm");
-	if (type & TRIGGER_READ_PAGE_FAULT)
-		snprintf(buf, len, "%s%s", buf[0] ? "|" : "", "page-fault");
+	for (i = 0; i < ARRAY_SIZE(names) && pos < len; i++) {
+		if (type & (1U << i)) {
+			pos += snprintf(buf + pos, len - pos, "%s%s",
+					pos ? "|" : "", names[i]);
+		}
+	}
 }
 
 static void print_trigger(struct uftrace_trigger *tr)
@@ -53,6 +62,8 @@ static void print_trigger(struct uftrace_trigger *tr)
 		pr_dbg("\ttrigger: recover\n");
 	if (tr->flags & TRIGGER_FL_FINISH)
 		pr_dbg("\ttrigger: finish\n");
+	if (tr->flags & TRIGGER_FL_SCRIPT)
+		pr_dbg("\ttrigger: script\n");
 
 	if (tr->flags & TRIGGER_FL_ARGUMENT) {
 		struct uftrace_arg_spec *arg;
@@ -585,6 +596,16 @@ static int parse_read_action(char *action, struct uftrace_trigger *tr)
 		tr->read |= TRIGGER_READ_PROC_STATM;
 	if (!strcmp(target, "page-fault"))
 		tr->read |= TRIGGER_READ_PAGE_FAULT;
+	if (!strcmp(target, "pmu-cycle"))
+		tr->read |= TRIGGER_READ_PMU_CYCLE;
+	if (!strcmp(target, "pmu-cache"))
+		tr->read |= TRIGGER_READ_PMU_CACHE;
+	if (!strcmp(target, "pmu-branch"))
+		tr->read |= TRIGGER_READ_PMU_BRANCH;
+	if (!strcmp(target, "max-rss"))
+		tr->read |= TRIGGER_READ_MAX_RSS;
+	if (!strcmp(target, "ctx-switch"))
+		tr->read |= TRIGGER_READ_CTX_SWITCH;
 
 	/* set READ flag only if valid type set */
 	if (tr->read)
@@ -918,6 +939,18 @@ void uftrace_setup_retval(char *retval_str, struct symtabs *symtabs,
 	setup_trigger(retval_str, symtabs, root, TRIGGER_FL_RETVAL, NULL, false);
 }
 
+/**
+ * uftrace_setup_script - construct rbtree of functions to run script
+ * @script_str - CSV of function names (or regex patterns)
+ * @symtabs    - symbol tables to find symbol address
+ * @root       - root of resulting rbtree
+ */
+void uftrace_setup_script(char *script_str, struct symtabs *symtabs,
+			  struct rb_root *root)
+{
+	setup_trigger(script_str, symtabs, root, TRIGGER_FL_SCRIPT, NULL, false);
+}
+
 /**
  * uftrace_cleanup_filter - delete filters in rbtree
  * @root - root of the filter rbtree
@@ -1214,6 +1247,12 @@ TEST_CASE(trigger_setup_actions)
 	TEST_EQ(tr.flags, TRIGGER_FL_TRACE_OFF | TRIGGER_FL_DEPTH);
 	TEST_EQ(tr.depth, 1);
 
+	uftrace_setup_trigger("foo::baz2@read=pmu-cycle", &stabs, &root, NULL, false);
+	memset(&tr, 0, sizeof(tr));
+	TEST_NE(uftrace_match_filter(0x4000, &root, &tr), NULL);
+	TEST_EQ(tr.flags, TRIGGER_FL_READ);
+	TEST_EQ(tr.read, TRIGGER_READ_PMU_CYCLE);
+
 	uftrace_cleanup_filter(&root);
 	TEST_EQ(RB_EMPTY_ROOT(&root), true);
 
@@ -1265,6 +1304,40 @@ TEST_CASE(trigger_setup_filters)
 	return TEST_OK;
 }
 
+TEST_CASE(trigger_setup_script)
+{
+	struct symtabs stabs = {
+		.loaded = false,
+	};
+	struct rb_root root = RB_ROOT;
+	struct uftrace_trigger tr;
+	enum filter_mode fmode;
+
+	filter_test_load_symtabs(&stabs);
+
+	uftrace_setup_script("foo::baz.*", &stabs, &root);
+	TEST_EQ(RB_EMPTY_ROOT(&root), false);
+
+	memset(&tr, 0, sizeof(tr));
+	TEST_NE(uftrace_match_filter(0x4100, &root, &tr), NULL);
+	TEST_EQ(tr.flags, TRIGGER_FL_SCRIPT);
+
+	memset(&tr, 0, sizeof(tr));
+	TEST_EQ(uftrace_match_filter(0x2100, &root, &tr), NULL);
+
+	/* it should not change filter mode of existing entries */
+	uftrace_setup_filter("foo::baz1", &stabs, &root, &fmode, false);
+	memset(&tr, 0, sizeof(tr));
+	TEST_NE(uftrace_match_filter(0x3100, &root, &tr), NULL);
+	TEST_EQ(tr.flags, TRIGGER_FL_SCRIPT | TRIGGER_FL_FILTER);
+	TEST_EQ(tr.fmode, FILTER_MODE_IN);
+
+	uftrace_cleanup_filter(&root);
+	TEST_EQ(RB_EMPTY_ROOT(&root), true);
+
+	return TEST_OK;
+}
+
 TEST_CASE(trigger_setup_args)
 {
 	struct symtabs stabs = {
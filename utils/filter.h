@@ -28,6 +28,7 @@ enum trigger_flag {
 	TRIGGER_FL_TIME_FILTER	= (1U << 10),
 	TRIGGER_FL_READ		= (1U << 11),
 	TRIGGER_FL_FINISH	= (1U << 12),
+	TRIGGER_FL_SCRIPT	= (1U << 13),
 };
 
 enum filter_mode {
@@ -49,9 +50,14 @@ enum uftrace_arg_format {
 };
 
 enum trigger_read_type {
-	TRIGGER_READ_NONE,
-	TRIGGER_READ_PROC_STATM,
-	TRIGGER_READ_PAGE_FAULT,
+	TRIGGER_READ_NONE		= 0,
+	TRIGGER_READ_PROC_STATM		= (1U << 0),
+	TRIGGER_READ_PAGE_FAULT		= (1U << 1),
+	TRIGGER_READ_PMU_CYCLE		= (1U << 2),
+	TRIGGER_READ_PMU_CACHE		= (1U << 3),
+	TRIGGER_READ_PMU_BRANCH		= (1U << 4),
+	TRIGGER_READ_MAX_RSS		= (1U << 5),
+	TRIGGER_READ_CTX_SWITCH		= (1U << 6),
 };
 
 #define ARG_TYPE_INDEX  0
@@ -116,6 +122,32 @@ struct uftrace_page_fault {
 	uint64_t		minor;
 };
 
+/* hardware counters are saved as diffs between function entry and exit */
+struct uftrace_pmu_cycle {
+	uint64_t		cycles;
+	uint64_t		instrs;
+};
+
+struct uftrace_pmu_cache {
+	uint64_t		refers;
+	uint64_t		misses;
+};
+
+struct uftrace_pmu_branch {
+	uint64_t		branch;
+	uint64_t		misses;
+};
+
+/* getrusage(2) values are also saved as diffs */
+struct uftrace_max_rss {
+	uint64_t		grow;  /* increase of max RSS in KB */
+};
+
+struct uftrace_ctx_switch {
+	uint64_t		voluntary;
+	uint64_t		involuntary;
+};
+
 typedef void (*trigger_fn_t)(struct uftrace_trigger *tr, void *arg);
 
 struct symtabs;
@@ -130,6 +162,8 @@ void uftrace_setup_argument(char *trigger_str, struct symtabs *symtabs,
 			   struct rb_root *root);
 void uftrace_setup_retval(char *trigger_str, struct symtabs *symtabs,
 			 struct rb_root *root);
+void uftrace_setup_script(char *script_str, struct symtabs *symtabs,
+			  struct rb_root *root);
 
 struct uftrace_filter *uftrace_match_filter(uint64_t ip, struct rb_root *root,
 					    struct uftrace_trigger *tr);
@@ -37,6 +37,24 @@ struct ftrace_task_handle *get_task_handle(struct ftrace_file_handle *handle,
 	return NULL;
 }
 
+/* task ids of merged data have the host index (see merge_data_dir) */
+static char *task_data_filename(struct ftrace_file_handle *handle,
+				struct ftrace_task_handle *task, int tid)
+{
+	const char *dirname = handle->dirname;
+	int host = tid / UFTRACE_HOST_TID_BASE;
+	char *filename;
+
+	if (host > 0 && host <= handle->nr_hosts) {
+		dirname = handle->hosts[host - 1].dirname;
+		task->time_offset = handle->hosts[host - 1].time_offset;
+		tid %= UFTRACE_HOST_TID_BASE;
+	}
+
+	xasprintf(&filename, "%s/%d.dat", dirname, tid);
+	return filename;
+}
+
 void setup_task_handle(struct ftrace_file_handle *handle,
 		       struct ftrace_task_handle *task, int tid)
 {
@@ -44,13 +62,13 @@ void setup_task_handle(struct ftrace_file_handle *handle,
 	char *filename;
 	int max_stack;
 
-	xasprintf(&filename, "%s/%d.dat", handle->dirname, tid);
-
 	memset(task, 0, sizeof(*task));
 
 	task->h = handle;
 	task->t = find_task(&handle->sessions, tid);
 
+	filename = task_data_filename(handle, task, tid);
+
 	task->tid = tid;
 	task->fp = fopen(filename, "rb");
 	if (task->fp == NULL) {
@@ -111,6 +129,9 @@ void reset_task_handle(struct ftrace_file_handle *handle)
 	free(handle->tasks);
 	handle->tasks = NULL;
 
+	free(handle->task_heap);
+	handle->task_heap = NULL;
+
 	handle->nr_tasks = 0;
 }
 
@@ -155,6 +176,10 @@ void setup_task_filter(char *tid_filter, struct ftrace_file_handle *handle)
 	} while (*p);
 
 setup:
+	/* the heap has indices of old tasks */
+	free(handle->task_heap);
+	handle->task_heap = NULL;
+
 	handle->nr_tasks = handle->info.nr_tid;
 	handle->tasks = xmalloc(sizeof(*handle->tasks) * handle->nr_tasks);
 
@@ -180,7 +205,7 @@ setup:
 			task->h    = handle;
 
 			/* need to read the data to check elapsed time */
-			xasprintf(&filename, "%s/%d.dat", handle->dirname, tid);
+			filename = task_data_filename(handle, task, tid);
 			task->fp = fopen(filename, "rb");
 			if (task->fp) {
 				if (!__read_task_ustack(task)) {
@@ -205,7 +230,11 @@ static int setup_filters(struct uftrace_session *s, void *arg)
 {
 	char *filter_str = arg;
 
-	uftrace_setup_filter(filter_str, &s->symtabs, &s->filters,
+	/* shared filters are set up by the owner only */
+	if (!s->syms_owner)
+		return 0;
+
+	uftrace_setup_filter(filter_str, s->symtabs, s->filters,
 			     &fstack_filter_mode, true);
 	return 0;
 }
@@ -214,7 +243,10 @@ static int setup_trigger(struct uftrace_session *s, void *arg)
 {
 	char *trigger_str = arg;
 
-	uftrace_setup_trigger(trigger_str, &s->symtabs, &s->filters,
+	if (!s->syms_owner)
+		return 0;
+
+	uftrace_setup_trigger(trigger_str, s->symtabs, s->filters,
 			      &fstack_filter_mode, true);
 	return 0;
 }
@@ -222,7 +254,10 @@ static int setup_trigger(struct uftrace_session *s, void *arg)
 static int count_filters(struct uftrace_session *s, void *arg)
 {
 	int *count = arg;
-	struct rb_node *node = rb_first(&s->filters);
+	struct rb_node *node = rb_first(s->filters);
+
+	if (!s->syms_owner)
+		return 0;
 
 	while (node) {
 		(*count)++;
@@ -288,11 +323,14 @@ static int build_fixup_filter(struct uftrace_session *s, void *arg)
 {
 	size_t i;
 
+	if (!s->syms_owner)
+		return 0;
+
 	pr_dbg("fixup for some special functions\n");
 
 	for (i = 0; i < ARRAY_SIZE(fixup_syms); i++) {
-		uftrace_setup_trigger((char *)fixup_syms[i], &s->symtabs,
-				      &s->fixups, NULL, false);
+		uftrace_setup_trigger((char *)fixup_syms[i], s->symtabs,
+				      s->fixups, NULL, false);
 	}
 	return 0;
 }
@@ -313,8 +351,11 @@ static int build_arg_spec(struct uftrace_session *s, void *arg)
 {
 	char *argspec = arg;
 
+	if (!s->syms_owner)
+		return 0;
+
 	if (argspec)
-		uftrace_setup_argument(argspec, &s->symtabs, &s->filters);
+		uftrace_setup_argument(argspec, s->symtabs, s->filters);
 
 	return 0;
 }
@@ -323,8 +364,11 @@ static int build_ret_spec(struct uftrace_session *s, void *arg)
 {
 	char *retspec = arg;
 
+	if (!s->syms_owner)
+		return 0;
+
 	if (retspec)
-		uftrace_setup_retval(retspec, &s->symtabs, &s->filters);
+		uftrace_setup_retval(retspec, s->symtabs, s->filters);
 
 	return 0;
 }
@@ -430,7 +474,7 @@ int fstack_entry(struct ftrace_task_handle *task,
 	if (sess) {
 		struct uftrace_filter *fixup;
 
-		fixup = uftrace_match_filter(addr, &sess->fixups, tr);
+		fixup = uftrace_match_filter(addr, sess->fixups, tr);
 		if (unlikely(fixup)) {
 			if (!strncmp(fixup->name, "exec", 4))
 				fstack->flags |= FSTACK_FL_EXEC;
@@ -447,7 +491,7 @@ int fstack_entry(struct ftrace_task_handle *task,
 			}
 		}
 
-		uftrace_match_filter(addr, &sess->filters, tr);
+		uftrace_match_filter(addr, sess->filters, tr);
 	}
 
 
@@ -567,7 +611,7 @@ int fstack_update(int type, struct ftrace_task_handle *task,
 		}
 		else {
 			task->display_depth++;
-			if (!is_kernel_address(&sess->symtabs,
+			if (!is_kernel_address(sess->symtabs,
 					       fstack->addr)) {
 				task->user_display_depth++;
 			}
@@ -587,7 +631,7 @@ int fstack_update(int type, struct ftrace_task_handle *task,
 		else
 			task->display_depth = 0;
 
-		if (!is_kernel_address(&sess->symtabs,
+		if (!is_kernel_address(sess->symtabs,
 				       fstack->addr)) {
 			if (task->user_display_depth > 0)
 				task->user_display_depth--;
@@ -631,13 +675,13 @@ static int fstack_check_skip(struct ftrace_task_handle *task,
 
 	if (sess == NULL) {
 		struct uftrace_session *fsess = sessions->first;
-		if (is_kernel_address(&fsess->symtabs, addr))
+		if (is_kernel_address(fsess->symtabs, addr))
 			sess = fsess;
 		else
 			return -1;
 	}
 
-	uftrace_match_filter(addr, &sess->filters, &tr);
+	uftrace_match_filter(addr, sess->filters, &tr);
 
 	if (tr.flags & TRIGGER_FL_FILTER) {
 		if (tr.fmode == FILTER_MODE_OUT)
@@ -697,7 +741,7 @@ struct ftrace_task_handle *fstack_skip(struct ftrace_file_handle *handle,
 			break;
 
 		/* skip kernel functions outside user functions */
-		if (is_kernel_address(&fsess->symtabs, next_stack->addr)) {
+		if (is_kernel_address(fsess->symtabs, next_stack->addr)) {
 			if (has_kernel_data(handle->kernel) &&
 			    !next->user_stack_count && handle->kernel->skip_out)
 				goto next;
@@ -904,10 +948,42 @@ static void swap_bitfields(struct uftrace_record *rstack)
 	rstack->addr  = (data >> 16) & 0xffffffffffffULL;
 }
 
+/* split a complete record into entry and (pending) exit records */
+static int expand_complete_record(struct ftrace_task_handle *task)
+{
+	struct uftrace_record *entry = &task->ustack;
+	struct uftrace_record *exit  = &task->ustack_exit;
+	uint64_t duration;
+
+	if (fread(&duration, sizeof(duration), 1, task->fp) != 1) {
+		pr_dbg("cannot read duration of complete record\n");
+		return -1;
+	}
+
+	if (task->h->needs_byte_swap)
+		duration = bswap_64(duration);
+
+	entry->type = UFTRACE_ENTRY;
+	entry->more = 0;
+
+	*exit = *entry;
+	exit->type = UFTRACE_EXIT;
+	exit->time = entry->time + duration;
+
+	task->exit_pending = true;
+	return 0;
+}
+
 static int __read_task_ustack(struct ftrace_task_handle *task)
 {
 	FILE *fp = task->fp;
 
+	if (task->exit_pending) {
+		task->ustack = task->ustack_exit;
+		task->exit_pending = false;
+		return 0;
+	}
+
 	if (fread(&task->ustack, sizeof(task->ustack), 1, fp) != 1) {
 		if (feof(fp))
 			return -1;
@@ -926,6 +1002,11 @@ static int __read_task_ustack(struct ftrace_task_handle *task)
 		return -1;
 	}
 
+	task->ustack.time += task->time_offset;
+
+	if (is_complete_record(&task->ustack, task->h->hdr.feat_mask))
+		return expand_complete_record(task);
+
 	return 0;
 }
 
@@ -992,7 +1073,7 @@ int read_task_args(struct ftrace_task_handle *task,
 		return -1;
 	}
 
-	fl = uftrace_match_filter(rstack->addr, &sess->filters, &tr);
+	fl = uftrace_match_filter(rstack->addr, sess->filters, &tr);
 	if (fl == NULL) {
 		pr_dbg("cannot find filter: %lx\n", rstack->addr);
 		return -1;
@@ -1071,7 +1152,12 @@ int read_task_event(struct ftrace_task_handle *task,
 
 		save_task_event(task, &statm, sizeof(statm));
 	}
-	else if (rec->addr == EVENT_ID_PAGE_FAULT) {
+	else if (rec->addr == EVENT_ID_PAGE_FAULT ||
+		 rec->addr == EVENT_ID_READ_PMU_CYCLE ||
+		 rec->addr == EVENT_ID_READ_PMU_CACHE ||
+		 rec->addr == EVENT_ID_READ_PMU_BRANCH ||
+		 rec->addr == EVENT_ID_READ_CTX_SWITCH) {
+		/* they have two 64-bit counters like page fault */
 		struct uftrace_page_fault pgfault;
 
 		if (read_task_event_size(task, &pgfault, sizeof(pgfault)) < 0)
@@ -1084,6 +1170,41 @@ int read_task_event(struct ftrace_task_handle *task,
 
 		save_task_event(task, &pgfault, sizeof(pgfault));
 	}
+	else if (rec->addr == EVENT_ID_READ_MAX_RSS) {
+		struct uftrace_max_rss max_rss;
+
+		if (read_task_event_size(task, &max_rss, sizeof(max_rss)) < 0)
+			return -1;
+
+		if (task->h->needs_byte_swap)
+			max_rss.grow = bswap_64(max_rss.grow);
+
+		save_task_event(task, &max_rss, sizeof(max_rss));
+	}
+	else if (rec->addr >= EVENT_ID_USER &&
+		 (task->h->hdr.feat_mask & EVENT_ARGUMENT)) {
+		/* SDT arguments saved as an array of 64-bit values */
+		uint64_t args[SDT_MAX_ARGS];
+		uint16_t len;
+		unsigned i;
+
+		if (fread(&len, sizeof(len), 1, task->fp) != 1)
+			return -1;
+
+		if (task->h->needs_byte_swap)
+			len = bswap_16(len);
+
+		if (len > sizeof(args) ||
+		    fread(args, len, 1, task->fp) != 1)
+			return -1;
+
+		if (task->h->needs_byte_swap) {
+			for (i = 0; i < len / sizeof(*args); i++)
+				args[i] = bswap_64(args[i]);
+		}
+
+		save_task_event(task, args, len);
+	}
 	else
 		pr_err_ns("unknown event has data: %u\n", rec->addr);
 
@@ -1177,7 +1298,7 @@ get_task_ustack(struct ftrace_file_handle *handle, int idx)
 						 curr->time);
 
 		if (sess)
-			uftrace_match_filter(curr->addr, &sess->filters,
+			uftrace_match_filter(curr->addr, sess->filters,
 					     &tr);
 
 		if (task->filter.time)
@@ -1263,30 +1384,102 @@ out:
 	return &task->ustack;
 }
 
-static int read_user_stack(struct ftrace_file_handle *handle,
-			   struct ftrace_task_handle **task)
+/*
+ * Min-heap of tasks ordered by time of the next record (and index of
+ * the task for the same time).  The time in a node can be stale as
+ * the task might be consumed after it's added, but it's still a lower
+ * bound since records in a task are ordered.  So it only needs to
+ * update the root until it finds the time is up-to-date.
+ */
+struct uftrace_task_heap {
+	int nr;
+	struct task_heap_node {
+		uint64_t time;
+		int idx;
+	} node[];
+};
+
+static bool task_heap_less(struct task_heap_node *a, struct task_heap_node *b)
+{
+	if (a->time != b->time)
+		return a->time < b->time;
+	return a->idx < b->idx;
+}
+
+static void task_heap_down(struct uftrace_task_heap *heap, int pos)
 {
-	int i, next_i = -1;
-	uint64_t next_time = 0;
+	struct task_heap_node tmp = heap->node[pos];
+	int child;
+
+	while ((child = pos * 2 + 1) < heap->nr) {
+		if (child + 1 < heap->nr &&
+		    task_heap_less(&heap->node[child + 1], &heap->node[child]))
+			child++;
+
+		if (!task_heap_less(&heap->node[child], &tmp))
+			break;
+
+		heap->node[pos] = heap->node[child];
+		pos = child;
+	}
+	heap->node[pos] = tmp;
+}
+
+static struct uftrace_task_heap *setup_task_heap(struct ftrace_file_handle *handle)
+{
+	struct uftrace_task_heap *heap;
 	struct uftrace_record *tmp;
+	int i;
+
+	heap = xmalloc(sizeof(*heap) + handle->info.nr_tid * sizeof(*heap->node));
+	heap->nr = 0;
 
 	for (i = 0; i < handle->info.nr_tid; i++) {
 		tmp = get_task_ustack(handle, i);
 		if (tmp == NULL)
 			continue;
 
-		if (next_i < 0 || tmp->time < next_time) {
-			next_time = tmp->time;
-			next_i = i;
-		}
+		heap->node[heap->nr].time = tmp->time;
+		heap->node[heap->nr].idx  = i;
+		heap->nr++;
 	}
 
-	if (next_i < 0)
-		return -1;
+	for (i = heap->nr / 2 - 1; i >= 0; i--)
+		task_heap_down(heap, i);
+
+	return heap;
+}
+
+static int read_user_stack(struct ftrace_file_handle *handle,
+			   struct ftrace_task_handle **task)
+{
+	struct uftrace_task_heap *heap = handle->task_heap;
+	struct task_heap_node *root;
+	struct uftrace_record *tmp;
+
+	if (heap == NULL)
+		heap = handle->task_heap = setup_task_heap(handle);
+
+	while (heap->nr) {
+		root = &heap->node[0];
+
+		tmp = get_task_ustack(handle, root->idx);
+		if (tmp == NULL) {
+			/* the task is done */
+			*root = heap->node[--heap->nr];
+		}
+		else if (tmp->time != root->time) {
+			root->time = tmp->time;
+		}
+		else {
+			*task = &handle->tasks[root->idx];
+			return root->idx;
+		}
 
-	*task = &handle->tasks[next_i];
+		task_heap_down(heap, 0);
+	}
 
-	return next_i;
+	return -1;
 }
 
 /* convert perf sched events to a virtual schedule function */
@@ -1760,6 +1953,7 @@ static struct uftrace_record test_record[NUM_TASK][NUM_RECORD] = {
 };
 
 static struct uftrace_session test_sess;
+static struct uftrace_sess_syms test_syms;
 static struct ftrace_file_handle fstack_test_handle;
 static void fstack_test_finish_file(void);
 
@@ -1774,7 +1968,11 @@ static int fstack_test_setup_file(struct ftrace_file_handle *handle, int nr_tid)
 	handle->hdr.max_stack = 16;
 
 	/* it doesn't have kernel functions */
-	test_sess.symtabs.kernel_base = -1ULL;
+	test_syms.symtabs.kernel_base = -1ULL;
+	test_sess.syms    = &test_syms;
+	test_sess.symtabs = &test_syms.symtabs;
+	test_sess.filters = &test_syms.filters;
+	test_sess.fixups  = &test_syms.fixups;
 
 	handle->sessions.root  = RB_ROOT;
 	handle->sessions.tasks = RB_ROOT;
@@ -1938,4 +2136,86 @@ TEST_CASE(fstack_time)
 	return TEST_OK;
 }
 
+TEST_CASE(fstack_complete)
+{
+	struct ftrace_file_handle *handle = &fstack_test_handle;
+	struct ftrace_task_handle *task;
+	struct uftrace_record complete = {
+		200, UFTRACE_LOST, true, RECORD_MAGIC, 1, 0x41000,
+	};
+	uint64_t duration = 100;
+	FILE *fp;
+	int i;
+
+	TEST_EQ(fstack_test_setup_file(handle, 1), 0);
+	handle->time_filter = 0;
+	handle->hdr.feat_mask |= COMPLETE_RECORD;
+
+	/* replace the middle two records with a complete record */
+	fp = fopen("tmp.dir/1234.dat", "w");
+	TEST_NE(fp, NULL);
+	fwrite(&test_record[0][0], sizeof(complete), 1, fp);
+	fwrite(&complete, sizeof(complete), 1, fp);
+	fwrite(&duration, sizeof(duration), 1, fp);
+	fwrite(&test_record[0][3], sizeof(complete), 1, fp);
+	fclose(fp);
+
+	for (i = 0; i < NUM_RECORD; i++) {
+		TEST_EQ(read_rstack(handle, &task), 0);
+		TEST_EQ(task->tid, test_tids[0]);
+		TEST_EQ((uint64_t)task->rstack->time,  (uint64_t)test_record[0][i].time);
+		TEST_EQ((uint64_t)task->rstack->type,  (uint64_t)test_record[0][i].type);
+		TEST_EQ((uint64_t)task->rstack->more,  0);
+		TEST_EQ((uint64_t)task->rstack->depth, (uint64_t)test_record[0][i].depth);
+		TEST_EQ((uint64_t)task->rstack->addr,  (uint64_t)test_record[0][i].addr);
+	}
+	TEST_EQ(read_rstack(handle, &task), -1);
+
+	return TEST_OK;
+}
+
+TEST_CASE(fstack_merge)
+{
+	struct ftrace_file_handle *handle = &fstack_test_handle;
+	struct ftrace_task_handle *task;
+	struct uftrace_data_host host = {
+		.dirname	= "tmp.dir",
+		.time_offset	= 1000,
+	};
+	int merge_tids[NUM_TASK] = {
+		1234, UFTRACE_HOST_TID_BASE + 5678,
+	};
+	int i, k;
+
+	TEST_EQ(fstack_test_setup_file(handle, ARRAY_SIZE(test_tids)), 0);
+	reset_task_handle(handle);
+
+	/* pretend the second task came from other host */
+	handle->hosts = &host;
+	handle->nr_hosts = 1;
+	handle->info.tids = merge_tids;
+	setup_task_filter(NULL, handle);
+
+	for (i = 0; i < NUM_TASK; i++)
+		handle->tasks[i].t = &test_tasks[i];
+
+	for (i = 0; i < NUM_TASK; i++) {
+		for (k = 0; k < NUM_RECORD; k++) {
+			TEST_EQ(read_rstack(handle, &task), 0);
+			TEST_EQ(task->tid, merge_tids[i]);
+			TEST_EQ((uint64_t)task->rstack->time,
+				(uint64_t)test_record[i][k].time + i * host.time_offset);
+			TEST_EQ((uint64_t)task->rstack->addr,
+				(uint64_t)test_record[i][k].addr);
+		}
+	}
+	TEST_EQ(read_rstack(handle, &task), -1);
+
+	handle->info.tids = test_tids;
+	handle->hosts = NULL;
+	handle->nr_hosts = 0;
+
+	return TEST_OK;
+}
+
 #endif /* UNIT_TEST */
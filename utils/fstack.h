@@ -33,6 +33,8 @@ struct time_filter_stack {
 
 struct ftrace_task_handle {
 	int tid;
+	/* added to timestamps of the task (for merged data) */
+	int64_t time_offset;
 	bool valid;
 	bool done;
 	bool lost_seen;
@@ -44,6 +46,9 @@ struct ftrace_task_handle {
 	struct uftrace_task *t;
 	struct ftrace_file_handle *h;
 	struct uftrace_record ustack;
+	/* exit part of a complete record, returned at next read */
+	struct uftrace_record ustack_exit;
+	bool exit_pending;
 	struct uftrace_record kstack;
 	struct uftrace_record *rstack;
 	struct uftrace_rstack_list rstack_list;
@@ -1404,7 +1404,7 @@ static int read_kernel_cpu(struct ftrace_file_handle *handle, int cpu)
 		 * it might set TRACE trigger, which shows
 		 * function even if it's less than the time filter.
 		 */
-		uftrace_match_filter(real_addr, &sess->filters, &tr);
+		uftrace_match_filter(real_addr, sess->filters, &tr);
 
 		if (curr->type == UFTRACE_ENTRY) {
 			/* it needs to wait until matching exit found */
@@ -1653,6 +1653,7 @@ struct uftrace_record * get_kernel_record(struct uftrace_kernel_reader *kernel,
 
 static struct ftrace_file_handle test_handle;
 static struct uftrace_session test_sess;
+static struct uftrace_sess_syms test_syms;
 static void kernel_test_finish_file(void);
 static void kernel_test_finish_handle(void);
 
@@ -1937,7 +1938,11 @@ static int kernel_test_setup_handle(struct uftrace_kernel_reader *kernel,
 		handle->tasks[i].fp  = (void *)1;  /* prevent retry */
 	}
 
-	test_sess.symtabs.kernel_base = 0xffff0000UL;
+	test_syms.symtabs.kernel_base = 0xffff0000UL;
+	test_sess.syms    = &test_syms;
+	test_sess.symtabs = &test_syms.symtabs;
+	test_sess.filters = &test_syms.filters;
+	test_sess.fixups  = &test_syms.fixups;
 	handle->sessions.first = &test_sess;
 
 	atexit(kernel_test_finish_handle);
@@ -0,0 +1,586 @@
+/*
+ * Shared memory message ring between libmcount and the record process
+ *
+ * Released under the GPL v2.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+
+#include "uftrace.h"
+#include "utils/utils.h"
+#include "utils/compiler.h"
+#include "utils/msg-ring.h"
+
+#define RING_MSG(ring, pos)  \
+	((struct uftrace_msg *)((ring)->data +				\
+				((pos) & ((ring)->nr_slots - 1)) *	\
+				MSG_RING_SLOT_SIZE))
+
+/* state words are placed after the message slots */
+#define RING_SLOT(ring, pos)  \
+	(((volatile uint64_t *)((ring)->data +				\
+				(ring)->nr_slots * MSG_RING_SLOT_SIZE)) +	\
+	 ((pos) & ((ring)->nr_slots - 1)))
+
+static unsigned msg_slots(size_t len)
+{
+	return DIV_ROUND_UP(sizeof(struct uftrace_msg) + len,
+			    MSG_RING_SLOT_SIZE);
+}
+
+/* returns state of the slot at @pos, or -1 if it's not for the @pos */
+static int slot_state(struct uftrace_msg_ring *ring, uint64_t pos,
+		      uint64_t *val)
+{
+	uint64_t v = *RING_SLOT(ring, pos);
+
+	if (val)
+		*val = v;
+	if (MSG_SLOT_POS(v) != (uint32_t)pos)
+		return -1;
+	return MSG_SLOT_STATE(v);
+}
+
+static bool msg_ready(struct uftrace_msg_ring *ring, uint64_t pos)
+{
+	int state = slot_state(ring, pos, NULL);
+
+	return state == MSG_SLOT_PUBLISHED || state == MSG_SLOT_ABORTED;
+}
+
+static uint64_t msg_ring_time(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+/* check whether the (unclaimed) slot at @tail is given up */
+static bool msg_stalled(struct uftrace_msg_ring *ring, uint64_t tail)
+{
+	uint64_t now = msg_ring_time();
+
+	if (ring->stall_time == 0 || ring->stall_tail != tail) {
+		ring->stall_tail = tail;
+		ring->stall_time = now;
+		return false;
+	}
+
+	return now - ring->stall_time >= MSG_RING_STALL_TIME;
+}
+
+static bool writer_alive(int tid)
+{
+	return kill(tid, 0) == 0 || errno != ESRCH;
+}
+
+/* make the slots free for the next round and move the tail */
+static void msg_ring_consume(struct uftrace_msg_ring *ring, uint64_t tail,
+			     unsigned nr)
+{
+	unsigned i;
+
+	/* finish reading the message before writers reuse the slots */
+	full_memory_barrier();
+
+	for (i = 0; i < nr; i++) {
+		uint64_t pos = tail + i + ring->nr_slots;
+
+		*RING_SLOT(ring, pos) = MSG_SLOT_VAL(pos, 0, MSG_SLOT_FREE);
+	}
+
+	full_memory_barrier();
+	ring->tail = tail + nr;
+}
+
+/* copy payload to/from the ring, it might be wrapped around */
+static void ring_copy_to(struct uftrace_msg_ring *ring, size_t idx,
+			 const void *buf, size_t len)
+{
+	size_t total = ring->nr_slots * MSG_RING_SLOT_SIZE;
+	size_t n;
+
+	idx %= total;
+	n = total - idx;
+	if (n > len)
+		n = len;
+
+	memcpy(ring->data + idx, buf, n);
+	memcpy(ring->data, buf + n, len - n);
+}
+
+static void ring_copy_from(struct uftrace_msg_ring *ring, size_t idx,
+			   void *buf, size_t len)
+{
+	size_t total = ring->nr_slots * MSG_RING_SLOT_SIZE;
+	size_t n;
+
+	idx %= total;
+	n = total - idx;
+	if (n > len)
+		n = len;
+
+	memcpy(buf, ring->data + idx, n);
+	memcpy(buf + n, ring->data, len - n);
+}
+
+void msg_ring_init(struct uftrace_msg_ring *ring, unsigned nr_slots)
+{
+	unsigned i;
+
+	memset(ring, 0, msg_ring_size(nr_slots));
+	ring->nr_slots = nr_slots;
+
+	for (i = 0; i < nr_slots; i++)
+		*RING_SLOT(ring, i) = MSG_SLOT_VAL(i, 0, MSG_SLOT_FREE);
+}
+
+/* returns the first position of @nr slots or -EAGAIN if the ring is full */
+static int64_t msg_ring_reserve(struct uftrace_msg_ring *ring, unsigned nr)
+{
+	uint64_t head;
+
+	do {
+		head = ring->head;
+		if (head + nr - ring->tail > ring->nr_slots)
+			return -EAGAIN;
+	}
+	while (!__sync_bool_compare_and_swap(&ring->head, head, head + nr));
+
+	return head;
+}
+
+/*
+ * Claim the reserved slots before writing to them.  It fails if the
+ * reader gave up the slots (since this writer was too slow), then the
+ * remaining slots are marked as aborted so the reader can skip them.
+ */
+static int msg_ring_claim(struct uftrace_msg_ring *ring, uint64_t head,
+			  unsigned nr, int tid)
+{
+	unsigned i;
+	uint64_t pos;
+
+	for (i = 0; i < nr; i++) {
+		pos = head + i;
+		if (!__sync_bool_compare_and_swap(RING_SLOT(ring, pos),
+				MSG_SLOT_VAL(pos, 0, MSG_SLOT_FREE),
+				MSG_SLOT_VAL(pos, tid, MSG_SLOT_CLAIMED)))
+			break;
+	}
+
+	if (i == nr)
+		return 0;
+
+	/* give up the whole message (the reader might take some of them) */
+	for (i = 0; i < nr; i++) {
+		pos = head + i;
+		__sync_bool_compare_and_swap(RING_SLOT(ring, pos),
+				MSG_SLOT_VAL(pos, 0, MSG_SLOT_FREE),
+				MSG_SLOT_VAL(pos, 0, MSG_SLOT_ABORTED));
+		__sync_bool_compare_and_swap(RING_SLOT(ring, pos),
+				MSG_SLOT_VAL(pos, tid, MSG_SLOT_CLAIMED),
+				MSG_SLOT_VAL(pos, 0, MSG_SLOT_ABORTED));
+	}
+	return -ESTALE;
+}
+
+static void msg_ring_publish(struct uftrace_msg_ring *ring, uint64_t head,
+			     unsigned nr, int tid)
+{
+	unsigned i;
+
+	/* the reader sees the message only after the first slot is set */
+	write_memory_barrier();
+
+	for (i = nr; i > 0; i--) {
+		uint64_t pos = head + i - 1;
+
+		*RING_SLOT(ring, pos) = MSG_SLOT_VAL(pos, tid, MSG_SLOT_PUBLISHED);
+	}
+}
+
+/**
+ * msg_ring_write - write a message to the ring
+ * @ring: message ring
+ * @type: message type (UFTRACE_MSG_*)
+ * @iov: payload of the message
+ * @iovcnt: number of entries in @iov
+ * @end: pointer to save the position after the message (can be %NULL)
+ *
+ * This function is called by multiple threads (and processes) at the
+ * same time.  It returns 0 on success, -EAGAIN if the ring is full,
+ * -E2BIG if the message cannot fit in the ring at all or -ESTALE if
+ * the reader gave up the slots.  The message is not in the ring when
+ * it returns an error.
+ */
+int msg_ring_write(struct uftrace_msg_ring *ring, int type,
+		   struct iovec *iov, int iovcnt, uint64_t *end)
+{
+	struct uftrace_msg *msg;
+	int64_t head;
+	size_t len = 0;
+	size_t idx;
+	unsigned nr;
+	int tid;
+	int i;
+
+	for (i = 0; i < iovcnt; i++)
+		len += iov[i].iov_len;
+
+	nr = msg_slots(len);
+	if (nr > ring->nr_slots)
+		return -E2BIG;
+
+	head = msg_ring_reserve(ring, nr);
+	if (head < 0)
+		return head;
+
+	tid = syscall(SYS_gettid);
+	if (msg_ring_claim(ring, head, nr, tid) < 0)
+		return -ESTALE;
+
+	msg = RING_MSG(ring, head);
+	msg->magic = UFTRACE_MSG_MAGIC;
+	msg->type  = type;
+	msg->len   = len;
+
+	idx = (void *)msg->data - (void *)ring->data;
+	for (i = 0; i < iovcnt; i++) {
+		ring_copy_to(ring, idx, iov[i].iov_base, iov[i].iov_len);
+		idx += iov[i].iov_len;
+	}
+
+	msg_ring_publish(ring, head, nr, tid);
+
+	if (end)
+		*end = head + nr;
+	return 0;
+}
+
+/**
+ * msg_ring_need_kick - check whether writer should ring the doorbell
+ * @ring: message ring
+ *
+ * This function should be called after msg_ring_write().  It returns
+ * %true if the reader is sleeping and this writer is the one to wake
+ * it up.
+ */
+bool msg_ring_need_kick(struct uftrace_msg_ring *ring)
+{
+	/* pairs with the barrier in msg_ring_prepare_wait() */
+	full_memory_barrier();
+
+	if (!ring->waiting)
+		return false;
+
+	return __sync_bool_compare_and_swap(&ring->waiting, 1, 0);
+}
+
+/**
+ * msg_ring_read - read a message from the ring
+ * @ring: message ring
+ * @msg: pointer to save the message header
+ * @buf: buffer to save the message payload
+ * @size: size of the @buf
+ *
+ * This function should be called by a single reader.  It returns 1
+ * if a message was read, 0 if no message is ready.  If the payload
+ * is bigger than @size, the message is discarded and it returns -1.
+ *
+ * If the next slot is not claimed for MSG_RING_STALL_TIME, it assumes
+ * the writer is gone and gives up the slot.  Slots claimed by a writer
+ * which no longer exists are skipped as well.
+ */
+int msg_ring_read(struct uftrace_msg_ring *ring, struct uftrace_msg *msg,
+		  void *buf, size_t size)
+{
+	uint64_t tail;
+	uint64_t val;
+	struct uftrace_msg *rmsg;
+	unsigned nr;
+	int ret = 1;
+
+retry:
+	tail = ring->tail;
+	if (tail == ring->head)
+		return 0;
+
+	switch (slot_state(ring, tail, &val)) {
+	case MSG_SLOT_PUBLISHED:
+		break;
+
+	case MSG_SLOT_ABORTED:
+		msg_ring_consume(ring, tail, 1);
+		goto retry;
+
+	case MSG_SLOT_CLAIMED:
+		/* the writer is still copying the message */
+		if (writer_alive(MSG_SLOT_TID(val)))
+			return 0;
+
+		pr_dbg("skip a slot of dead writer in the message ring\n");
+		msg_ring_consume(ring, tail, 1);
+		goto retry;
+
+	case MSG_SLOT_FREE:
+		/* reserved but not claimed yet */
+		if (!msg_stalled(ring, tail))
+			return 0;
+
+		/* the writer will see it when it tries to claim the slot */
+		if (!__sync_bool_compare_and_swap(RING_SLOT(ring, tail), val,
+				MSG_SLOT_VAL(tail, 0, MSG_SLOT_ABORTED)))
+			goto retry;
+
+		pr_dbg("skip an unclaimed slot in the message ring\n");
+		msg_ring_consume(ring, tail, 1);
+		goto retry;
+
+	default:
+		/* the slot is not released for this round yet */
+		return 0;
+	}
+
+	read_memory_barrier();
+
+	rmsg = RING_MSG(ring, tail);
+	memcpy(msg, rmsg, sizeof(*msg));
+
+	nr = msg_slots(msg->len);
+	if (nr > ring->head - tail) {
+		/* it should not happen, but don't trust the writer */
+		pr_dbg("invalid message length in the message ring\n");
+		msg_ring_consume(ring, tail, 1);
+		goto retry;
+	}
+
+	if (msg->len <= size)
+		ring_copy_from(ring, (void *)rmsg->data - (void *)ring->data,
+			       buf, msg->len);
+	else
+		ret = -1;
+
+	msg_ring_consume(ring, tail, nr);
+	return ret;
+}
+
+/**
+ * msg_ring_consumed - check whether the reader consumed messages
+ * @ring: message ring
+ * @pos: position returned by msg_ring_write()
+ *
+ * This function returns %true if the reader finished messages in the
+ * ring written before @pos.
+ */
+bool msg_ring_consumed(struct uftrace_msg_ring *ring, uint64_t pos)
+{
+	return (int64_t)(ring->tail - pos) >= 0;
+}
+
+/**
+ * msg_ring_prepare_wait - check whether reader can sleep
+ * @ring: message ring
+ *
+ * This function returns %true if no message is ready so that the
+ * reader can sleep on the doorbell.  Otherwise it returns %false
+ * and the reader should read the messages first.
+ */
+bool msg_ring_prepare_wait(struct uftrace_msg_ring *ring)
+{
+	ring->waiting = 1;
+
+	/* pairs with the barrier in msg_ring_need_kick() */
+	full_memory_barrier();
+
+	if (ring->tail != ring->head && msg_ready(ring, ring->tail)) {
+		ring->waiting = 0;
+		return false;
+	}
+	return true;
+}
+
+void msg_ring_finish_wait(struct uftrace_msg_ring *ring)
+{
+	ring->waiting = 0;
+}
+
+#ifdef UNIT_TEST
+
+#define TEST_NR_SLOTS  8
+
+TEST_CASE(msg_ring_basic)
+{
+	struct uftrace_msg_ring *ring;
+	struct uftrace_msg msg;
+	struct iovec iov[2];
+	char name[] = "/uftrace-0123456789abcdef-1234-000";
+	char big[TEST_NR_SLOTS * MSG_RING_SLOT_SIZE];
+	char buf[sizeof(big)];
+	int i, val = 42;
+
+	ring = xmalloc(msg_ring_size(TEST_NR_SLOTS));
+	msg_ring_init(ring, TEST_NR_SLOTS);
+
+	TEST_EQ(msg_ring_read(ring, &msg, buf, sizeof(buf)), 0);
+	TEST_EQ(msg_ring_prepare_wait(ring), true);
+
+	iov[0].iov_base = &val;
+	iov[0].iov_len  = sizeof(val);
+	TEST_EQ(msg_ring_write(ring, UFTRACE_MSG_LOST, iov, 1, NULL), 0);
+
+	/* the reader was waiting, so the first writer should kick it */
+	TEST_EQ(msg_ring_need_kick(ring), true);
+	TEST_EQ(msg_ring_need_kick(ring), false);
+	TEST_EQ(msg_ring_prepare_wait(ring), false);
+
+	TEST_EQ(msg_ring_read(ring, &msg, buf, sizeof(buf)), 1);
+	TEST_EQ(msg.magic, UFTRACE_MSG_MAGIC);
+	TEST_EQ(msg.type, UFTRACE_MSG_LOST);
+	TEST_EQ(msg.len, sizeof(val));
+	TEST_EQ(*(int *)buf, 42);
+
+	/* messages wrap around the end of the ring */
+	iov[0].iov_base = &val;
+	iov[0].iov_len  = sizeof(val);
+	iov[1].iov_base = name;
+	iov[1].iov_len  = sizeof(name);
+	for (i = 0; i < TEST_NR_SLOTS * 2; i++) {
+		val = i;
+		TEST_EQ(msg_ring_write(ring, UFTRACE_MSG_REC_END, iov, 2, NULL), 0);
+		TEST_EQ(msg_ring_read(ring, &msg, buf, sizeof(buf)), 1);
+		TEST_EQ(msg.type, UFTRACE_MSG_REC_END);
+		TEST_EQ(msg.len, sizeof(val) + sizeof(name));
+		TEST_EQ(*(int *)buf, i);
+		TEST_STREQ(buf + sizeof(val), name);
+	}
+	TEST_EQ(msg_ring_read(ring, &msg, buf, sizeof(buf)), 0);
+
+	/* fill the ring (each message takes a slot) */
+	for (i = 0; i < TEST_NR_SLOTS; i++)
+		TEST_EQ(msg_ring_write(ring, UFTRACE_MSG_REC_END, iov, 2, NULL), 0);
+	TEST_EQ(msg_ring_write(ring, UFTRACE_MSG_REC_END, iov, 2, NULL), -EAGAIN);
+
+	for (i = 0; i < TEST_NR_SLOTS; i++)
+		TEST_EQ(msg_ring_read(ring, &msg, buf, sizeof(buf)), 1);
+	TEST_EQ(msg_ring_read(ring, &msg, buf, sizeof(buf)), 0);
+
+	/* move to the last slot and write a message using two slots */
+	while ((ring->tail & (TEST_NR_SLOTS - 1)) != TEST_NR_SLOTS - 1) {
+		TEST_EQ(msg_ring_write(ring, UFTRACE_MSG_REC_END, iov, 2, NULL), 0);
+		TEST_EQ(msg_ring_read(ring, &msg, buf, sizeof(buf)), 1);
+	}
+
+	for (i = 0; i < MSG_RING_SLOT_SIZE; i++)
+		big[i] = 'a' + (i % 26);
+	iov[0].iov_base = big;
+	iov[0].iov_len  = MSG_RING_SLOT_SIZE;
+	TEST_EQ(msg_ring_write(ring, UFTRACE_MSG_SESSION, iov, 1, NULL), 0);
+	TEST_EQ(msg_ring_read(ring, &msg, buf, sizeof(buf)), 1);
+	TEST_EQ(msg.len, MSG_RING_SLOT_SIZE);
+	TEST_EQ(memcmp(buf, big, MSG_RING_SLOT_SIZE), 0);
+
+	/* too big message */
+	memset(big, 'x', sizeof(big));
+	iov[0].iov_base = big;
+	iov[0].iov_len  = sizeof(big);
+	TEST_EQ(msg_ring_write(ring, UFTRACE_MSG_SESSION, iov, 1, NULL), -E2BIG);
+
+	/* message bigger than the reader's buffer is discarded */
+	iov[0].iov_len  = MSG_RING_SLOT_SIZE * 2;
+	TEST_EQ(msg_ring_write(ring, UFTRACE_MSG_SESSION, iov, 1, NULL), 0);
+	TEST_EQ(msg_ring_read(ring, &msg, buf, MSG_RING_SLOT_SIZE), -1);
+	TEST_EQ(msg_ring_read(ring, &msg, buf, sizeof(buf)), 0);
+
+	/* a writer reserved a slot and died before claiming it */
+	ring->head++;
+	iov[0].iov_base = &val;
+	iov[0].iov_len  = sizeof(val);
+	val = 1234;
+	TEST_EQ(msg_ring_write(ring, UFTRACE_MSG_LOST, iov, 1, NULL), 0);
+
+	TEST_EQ(msg_ring_read(ring, &msg, buf, sizeof(buf)), 0);
+	TEST_EQ(msg_ring_read(ring, &msg, buf, sizeof(buf)), 0);
+
+	/* pretend it's been a while */
+	ring->stall_time = msg_ring_time() - MSG_RING_STALL_TIME;
+	TEST_EQ(msg_ring_read(ring, &msg, buf, sizeof(buf)), 1);
+	TEST_EQ(msg.type, UFTRACE_MSG_LOST);
+	TEST_EQ(*(int *)buf, 1234);
+	TEST_EQ(ring->tail, ring->head);
+
+	free(ring);
+	return TEST_OK;
+}
+
+TEST_CASE(msg_ring_stall)
+{
+	struct uftrace_msg_ring *ring;
+	struct uftrace_msg msg;
+	struct iovec iov[1];
+	char buf[TEST_NR_SLOTS * MSG_RING_SLOT_SIZE];
+	char data[MSG_RING_SLOT_SIZE];
+	int64_t late;
+	uint64_t end;
+	pid_t child;
+	int i, val;
+
+	ring = xmalloc(msg_ring_size(TEST_NR_SLOTS));
+	msg_ring_init(ring, TEST_NR_SLOTS);
+
+	/* a slow writer reserved two slots but the reader gave up */
+	late = msg_ring_reserve(ring, 2);
+	TEST_EQ(late, 0);
+	TEST_EQ(msg_ring_read(ring, &msg, buf, sizeof(buf)), 0);
+	ring->stall_time = msg_ring_time() - MSG_RING_STALL_TIME;
+	TEST_EQ(msg_ring_read(ring, &msg, buf, sizeof(buf)), 0);
+	TEST_EQ(ring->tail, 1);
+
+	/* the writer cannot claim them, then the reader skips the rest */
+	TEST_EQ(msg_ring_claim(ring, late, 2, getpid()), -ESTALE);
+	TEST_EQ(msg_ring_read(ring, &msg, buf, sizeof(buf)), 0);
+	TEST_EQ(ring->tail, ring->head);
+
+	/* old messages are not seen after the ring wraps around */
+	memset(data, 'x', sizeof(data));
+	iov[0].iov_base = data;
+	iov[0].iov_len  = sizeof(data);
+	for (i = 0; i < TEST_NR_SLOTS / 2; i++) {
+		TEST_EQ(msg_ring_write(ring, UFTRACE_MSG_SESSION, iov, 1, &end), 0);
+		TEST_EQ(msg_ring_consumed(ring, end), false);
+		TEST_EQ(msg_ring_read(ring, &msg, buf, sizeof(buf)), 1);
+		TEST_EQ(msg_ring_consumed(ring, end), true);
+	}
+	ring->head++;
+	TEST_EQ(msg_ring_read(ring, &msg, buf, sizeof(buf)), 0);
+
+	/* a writer claimed a slot and died */
+	child = fork();
+	if (child == 0)
+		_exit(0);
+	waitpid(child, NULL, 0);
+
+	TEST_EQ(msg_ring_claim(ring, ring->tail, 1, child), 0);
+	val = 5678;
+	iov[0].iov_base = &val;
+	iov[0].iov_len  = sizeof(val);
+	TEST_EQ(msg_ring_write(ring, UFTRACE_MSG_LOST, iov, 1, NULL), 0);
+
+	/* it's skipped without waiting */
+	TEST_EQ(msg_ring_read(ring, &msg, buf, sizeof(buf)), 1);
+	TEST_EQ(msg.type, UFTRACE_MSG_LOST);
+	TEST_EQ(*(int *)buf, 5678);
+	TEST_EQ(ring->tail, ring->head);
+
+	free(ring);
+	return TEST_OK;
+}
+
+#endif /* UNIT_TEST */
@@ -0,0 +1,80 @@
+#ifndef UFTRACE_MSG_RING_H
+#define UFTRACE_MSG_RING_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/uio.h>
+
+#include "../uftrace.h"
+
+#define MSG_RING_SLOT_SIZE  64
+#define MSG_RING_NR_SLOTS   4096  /* should be power of 2 */
+
+/* the reader skips a message not published in this time (in nsec) */
+#define MSG_RING_STALL_TIME  1000000000ULL
+
+/*
+ * Message ring shared between libmcount and the record process.
+ *
+ * Writers (traced threads and processes) reserve consecutive slots
+ * and copy a message (header + payload) into them.  Each slot has a
+ * state word with the position (generation) of the slot, the tid of
+ * the writer and the state below.  A writer claims the reserved slots
+ * before writing anything and publishes them at last so that the
+ * reader can tell whether the message is complete and is not a stale
+ * one from the previous round.  The reader consumes messages in order
+ * and only sleeps on the pipe (doorbell) when the ring is empty.
+ *
+ * A writer might be killed (or stopped) after reserving slots, so the
+ * reader gives up unclaimed slots if they're not claimed for a while.
+ * Then the writer fails to claim and sends the message to the pipe.
+ * Claimed slots are given up only if the writer is gone.
+ */
+enum msg_slot_state {
+	MSG_SLOT_FREE,		/* not claimed by a writer yet */
+	MSG_SLOT_CLAIMED,	/* writer is copying the message */
+	MSG_SLOT_PUBLISHED,	/* message is ready */
+	MSG_SLOT_ABORTED,	/* writer gave up the slot */
+};
+
+#define MSG_SLOT_STATE_MASK  3
+
+/* (lower 32-bit of) position, writer tid and state of a slot */
+#define MSG_SLOT_VAL(pos, tid, state)						(((uint64_t)(uint32_t)(pos) << 32) | ((uint64_t)(tid) << 2) | (state))
+
+#define MSG_SLOT_POS(val)    ((uint32_t)((val) >> 32))
+#define MSG_SLOT_TID(val)    ((int)(((val) & 0xffffffffU) >> 2))
+#define MSG_SLOT_STATE(val)  ((val) & MSG_SLOT_STATE_MASK)
+
+struct uftrace_msg_ring {
+	/* next slot to be reserved by writers */
+	volatile uint64_t	head __attribute__((aligned(64)));
+	/* next slot to be read by the reader */
+	volatile uint64_t	tail __attribute__((aligned(64)));
+	/* reader is waiting on the doorbell */
+	volatile int		waiting;
+	unsigned		nr_slots;
+	/* (reader only) the tail slot found unclaimed and the time */
+	uint64_t		stall_tail;
+	uint64_t		stall_time;
+	/* message slots followed by the state words of each slot */
+	unsigned char		data[] __attribute__((aligned(64)));
+};
+
+static inline size_t msg_ring_size(unsigned nr_slots)
+{
+	return sizeof(struct uftrace_msg_ring) +
+		nr_slots * (MSG_RING_SLOT_SIZE + sizeof(uint64_t));
+}
+
+void msg_ring_init(struct uftrace_msg_ring *ring, unsigned nr_slots);
+int msg_ring_write(struct uftrace_msg_ring *ring, int type,
+		   struct iovec *iov, int iovcnt, uint64_t *end);
+bool msg_ring_need_kick(struct uftrace_msg_ring *ring);
+int msg_ring_read(struct uftrace_msg_ring *ring, struct uftrace_msg *msg,
+		  void *buf, size_t size);
+bool msg_ring_consumed(struct uftrace_msg_ring *ring, uint64_t pos);
+bool msg_ring_prepare_wait(struct uftrace_msg_ring *ring);
+void msg_ring_finish_wait(struct uftrace_msg_ring *ring);
+
+#endif /* UFTRACE_MSG_RING_H */
@@ -0,0 +1,310 @@
+/*
+ * Native (shared object) script binding for function entry and exit
+ *
+ * A native script is a shared object which has (some of) the functions
+ * in "uftrace-script.h".  They receive struct uftrace_script_context
+ * which is converted from struct script_context without copying the
+ * data, so that it can avoid the cost of converting every record to
+ * script objects.  Arguments are decoded only when the script asks.
+ *
+ * Released under the GPL v2.
+ */
+
+/* This should be defined before #include "utils.h" */
+#define PR_FMT     "script"
+#define PR_DOMAIN  DBG_SCRIPT
+
+#include <dlfcn.h>
+#include "uftrace-script.h"
+#include "utils/utils.h"
+#include "utils/script.h"
+#include "utils/script-native.h"
+#include "utils/filter.h"
+
+/* shared object handle returned by dlopen() */
+static void *native_handle;
+
+typedef int (*native_callback_t)(struct uftrace_script_context *ctx);
+
+static int (*native_uftrace_begin)(void);
+static native_callback_t native_uftrace_entry;
+static native_callback_t native_uftrace_exit;
+static native_callback_t native_uftrace_event;
+
+/* internal data of the context (passed to native_get_arg) */
+struct native_context {
+	struct script_context	*sc_ctx;
+	bool			retval;
+};
+
+static void native_convert_arg(struct uftrace_arg_spec *spec, void *data,
+			       struct uftrace_script_arg *arg)
+{
+	union {
+		char		c;
+		short		s;
+		int		i;
+		long long	L;
+		float		f;
+		double		d;
+		long double	D;
+		unsigned char	v[16];
+	} val;
+	unsigned short slen;
+
+	memset(val.v, 0, sizeof(val));
+	arg->size = spec->size;
+
+	switch (spec->fmt) {
+	case ARG_FMT_STR:
+	case ARG_FMT_STD_STRING:
+		/* string length is saved in the first 2 bytes */
+		memcpy(&slen, data, sizeof(slen));
+		arg->type  = UFTRACE_SCRIPT_ARG_STRING;
+		arg->size  = slen;
+		arg->val.s = data + 2;
+		break;
+
+	case ARG_FMT_FLOAT:
+		memcpy(val.v, data, spec->size);
+		arg->type = UFTRACE_SCRIPT_ARG_FLOAT;
+		if (spec->size == 4)
+			arg->val.f = val.f;
+		else if (spec->size == 8)
+			arg->val.f = val.d;
+		else
+			arg->val.f = (double)val.D;
+		break;
+
+	case ARG_FMT_CHAR:
+		memcpy(val.v, data, 1);
+		arg->type  = UFTRACE_SCRIPT_ARG_CHAR;
+		arg->val.i = val.c;
+		break;
+
+	case ARG_FMT_UINT:
+	case ARG_FMT_HEX:
+	case ARG_FMT_FUNC_PTR:
+		memcpy(val.v, data, spec->size);
+		arg->type  = UFTRACE_SCRIPT_ARG_UINT;
+		arg->val.u = val.L;
+		break;
+
+	default:
+		memcpy(val.v, data, spec->size);
+		arg->type = UFTRACE_SCRIPT_ARG_INT;
+		switch (spec->size) {
+		case 1:
+			arg->val.i = val.c;
+			break;
+		case 2:
+			arg->val.i = val.s;
+			break;
+		case 4:
+			arg->val.i = val.i;
+			break;
+		default:
+			arg->val.i = val.L;
+			break;
+		}
+		break;
+	}
+}
+
+/* the data is packed in the order of argspec (see save_to_argbuf) */
+static int native_get_arg(const struct uftrace_script_context *ctx, int n,
+			  struct uftrace_script_arg *arg)
+{
+	const struct native_context *nctx = ctx->priv;
+	struct script_context *sc_ctx = nctx->sc_ctx;
+	struct uftrace_arg_spec *spec;
+	void *data = sc_ctx->argbuf;
+	void *end = data + sc_ctx->arglen;
+	unsigned short slen;
+
+	list_for_each_entry(spec, sc_ctx->argspec, list) {
+		/* skip unwanted arguments or retval */
+		if (nctx->retval != (spec->idx == RETVAL_IDX))
+			continue;
+
+		if (data + sizeof(slen) > end)
+			break;
+
+		if (n-- == 0) {
+			native_convert_arg(spec, data, arg);
+			return 0;
+		}
+
+		if (spec->fmt == ARG_FMT_STR || spec->fmt == ARG_FMT_STD_STRING) {
+			memcpy(&slen, data, sizeof(slen));
+			data += ALIGN(slen + 2, 4);
+		}
+		else {
+			data += ALIGN(spec->size, 4);
+		}
+	}
+	return -1;
+}
+
+static void native_setup_context(struct uftrace_script_context *ctx,
+				 struct native_context *nctx,
+				 struct script_context *sc_ctx, bool retval)
+{
+	struct uftrace_arg_spec *spec;
+
+	ctx->size      = sizeof(*ctx);
+	ctx->tid       = sc_ctx->tid;
+	ctx->depth     = sc_ctx->depth;
+	ctx->nr_args   = 0;
+	ctx->timestamp = sc_ctx->timestamp;
+	ctx->duration  = sc_ctx->duration;
+	ctx->address   = sc_ctx->address;
+	ctx->name      = sc_ctx->name;
+	ctx->datalen   = sc_ctx->arglen;
+	ctx->data      = sc_ctx->arglen ? sc_ctx->argbuf : NULL;
+	ctx->get_arg   = native_get_arg;
+	ctx->priv      = nctx;
+
+	nctx->sc_ctx = sc_ctx;
+	nctx->retval = retval;
+
+	/* argspec is not valid if it has no argument */
+	if (sc_ctx->arglen == 0)
+		return;
+
+	list_for_each_entry(spec, sc_ctx->argspec, list) {
+		if (retval == (spec->idx == RETVAL_IDX))
+			ctx->nr_args++;
+	}
+}
+
+static int native_entry(struct script_context *sc_ctx)
+{
+	struct uftrace_script_context ctx;
+	struct native_context nctx;
+
+	native_setup_context(&ctx, &nctx, sc_ctx, false);
+	return native_uftrace_entry(&ctx);
+}
+
+static int native_exit(struct script_context *sc_ctx)
+{
+	struct uftrace_script_context ctx;
+	struct native_context nctx;
+
+	native_setup_context(&ctx, &nctx, sc_ctx, true);
+	return native_uftrace_exit(&ctx);
+}
+
+/* events have raw data only */
+static int native_event(struct script_context *sc_ctx)
+{
+	struct uftrace_script_context ctx = {
+		.size      = sizeof(ctx),
+		.tid       = sc_ctx->tid,
+		.depth     = sc_ctx->depth,
+		.timestamp = sc_ctx->timestamp,
+		.address   = sc_ctx->address,
+		.name      = sc_ctx->name,
+		.datalen   = sc_ctx->arglen,
+		.data      = sc_ctx->arglen ? sc_ctx->argbuf : NULL,
+	};
+
+	return native_uftrace_event(&ctx);
+}
+
+static int native_nop_context(struct script_context *sc_ctx)
+{
+	return 0;
+}
+
+static int native_nop(void)
+{
+	return 0;
+}
+
+int script_init_for_native(char *so_pathname)
+{
+	char *pathname = NULL;
+	const char **funcs;
+	int *version;
+
+	pr_dbg("initialize native scripting engine for %s\n", so_pathname);
+
+	/* dlopen() searches library paths if it doesn't have a slash */
+	if (strchr(so_pathname, '/') == NULL)
+		xasprintf(&pathname, "./%s", so_pathname);
+	else
+		pathname = xstrdup(so_pathname);
+
+	native_handle = dlopen(pathname, RTLD_NOW | RTLD_LOCAL);
+	free(pathname);
+
+	if (native_handle == NULL) {
+		pr_warn("%s cannot be loaded: %s\n", so_pathname, dlerror());
+		return -1;
+	}
+
+	version = dlsym(native_handle, "uftrace_script_version");
+	if (version && *version != UFTRACE_SCRIPT_VERSION) {
+		pr_warn("%s has script version %d (expected %d)\n",
+			so_pathname, *version, UFTRACE_SCRIPT_VERSION);
+		dlclose(native_handle);
+		native_handle = NULL;
+		return -1;
+	}
+
+	/* check if script has its own list of functions to run */
+	funcs = dlsym(native_handle, "UFTRACE_FUNCS");
+	while (funcs && *funcs)
+		script_add_filter((char *)*funcs++);
+
+	/* missing callbacks are replaced to nop to skip NULL checks */
+	native_uftrace_entry = dlsym(native_handle, "uftrace_entry");
+	if (native_uftrace_entry == NULL) {
+		pr_dbg("uftrace_entry is not found!\n");
+		script_uftrace_entry = native_nop_context;
+	}
+	else
+		script_uftrace_entry = native_entry;
+
+	native_uftrace_exit = dlsym(native_handle, "uftrace_exit");
+	if (native_uftrace_exit == NULL) {
+		pr_dbg("uftrace_exit is not found!\n");
+		script_uftrace_exit = native_nop_context;
+	}
+	else
+		script_uftrace_exit = native_exit;
+
+	script_uftrace_end = dlsym(native_handle, "uftrace_end");
+	if (script_uftrace_end == NULL) {
+		pr_dbg("uftrace_end is not found!\n");
+		script_uftrace_end = native_nop;
+	}
+
+	/* events are optional and callers should check it */
+	native_uftrace_event = dlsym(native_handle, "uftrace_event");
+	if (native_uftrace_event)
+		script_uftrace_event = native_event;
+
+	/* Call "uftrace_begin" immediately if possible. */
+	native_uftrace_begin = dlsym(native_handle, "uftrace_begin");
+	if (native_uftrace_begin)
+		native_uftrace_begin();
+
+	pr_dbg("native script initialization finished\n");
+	return 0;
+}
+
+void script_finish_for_native(void)
+{
+	/* script_uftrace_end() might be called after this in libmcount */
+	script_uftrace_entry = native_nop_context;
+	script_uftrace_exit  = native_nop_context;
+	script_uftrace_event = NULL;
+	script_uftrace_end   = native_nop;
+
+	if (native_handle)
+		dlclose(native_handle);
+	native_handle = NULL;
+}
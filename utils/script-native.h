@@ -0,0 +1,12 @@
+/*
+ * Native (shared object) script binding for function entry and exit
+ *
+ * Released under the GPL v2.
+ */
+#ifndef __UFTRACE_SCRIPT_NATIVE_H__
+#define __UFTRACE_SCRIPT_NATIVE_H__
+
+int script_init_for_native(char *so_pathname);
+void script_finish_for_native(void);
+
+#endif /* __UFTRACE_SCRIPT_NATIVE_H__ */
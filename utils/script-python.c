@@ -17,6 +17,7 @@
 #include "utils/symbol.h"
 #include "utils/fstack.h"
 #include "utils/filter.h"
+#include "utils/rbtree.h"
 #include "utils/script.h"
 #include "utils/script-python.h"
 
@@ -39,6 +40,7 @@ static PyAPI_FUNC(void) (*__PyErr_Print)(void);
 static PyAPI_FUNC(void) (*__PyErr_Clear)(void);
 
 static PyAPI_FUNC(PyObject *) (*__PyObject_GetAttrString)(PyObject *, const char *);
+static PyAPI_FUNC(int) (*__PyObject_SetAttrString)(PyObject *, const char *, PyObject *);
 static PyAPI_FUNC(int) (*__PyCallable_Check)(PyObject *);
 static PyAPI_FUNC(PyObject *) (*__PyObject_CallObject)(PyObject *callable_object, PyObject *args);
 
@@ -55,15 +57,54 @@ static PyAPI_FUNC(PyObject *) (*__PyTuple_New)(Py_ssize_t size);
 static PyAPI_FUNC(int) (*__PyTuple_SetItem)(PyObject *, Py_ssize_t, PyObject *);
 static PyAPI_FUNC(PyObject *) (*__PyTuple_GetItem)(PyObject *, Py_ssize_t);
 
+static PyAPI_FUNC(PyObject *) (*__PyList_New)(Py_ssize_t size);
 static PyAPI_FUNC(Py_ssize_t) (*__PyList_Size)(PyObject *);
 static PyAPI_FUNC(PyObject *) (*__PyList_GetItem)(PyObject *, Py_ssize_t);
+static PyAPI_FUNC(int) (*__PyList_Append)(PyObject *, PyObject *);
+
+static PyAPI_FUNC(PyObject *) (*__PyByteArray_FromStringAndSize)(const char *, Py_ssize_t);
 
 static PyAPI_FUNC(PyObject *) (*__PyDict_New)(void);
 static PyAPI_FUNC(int) (*__PyDict_SetItem)(PyObject *mp, PyObject *key, PyObject *item);
 static PyAPI_FUNC(int) (*__PyDict_SetItemString)(PyObject *dp, const char *key, PyObject *item);
 static PyAPI_FUNC(PyObject *) (*__PyDict_GetItem)(PyObject *mp, PyObject *key);
 
-static PyObject *pModule, *pFuncEntry, *pFuncExit, *pFuncEnd;
+static PyObject *pModule, *pFuncEntry, *pFuncExit, *pFuncEnd, *pFuncBatch;
+
+/* number of records delivered to "uftrace_batch" at once */
+#define PY_BATCH_SIZE  4096
+
+/*
+ * A record in the batch, it should match to PY_BATCH_FORMAT.
+ * The name of function is in the symbol list at the index of sym_id.
+ */
+struct python_batch_record {
+	uint64_t	timestamp;
+	uint64_t	duration;	/* exit only */
+	uint64_t	address;
+	uint32_t	tid;
+	uint32_t	sym_id;
+	int16_t		depth;
+	uint8_t		type;		/* 0: entry, 1: exit */
+	uint8_t		unused[5];
+};
+
+/* format string for struct.unpack() in python */
+#define PY_BATCH_FORMAT  "=QQQIIhB5x"
+
+struct python_batch_sym {
+	struct rb_node	node;
+	char		*name;
+	unsigned	id;
+};
+
+static struct python_batch_record *batch_records;
+static unsigned nr_batch_records;
+
+/* symbol ids are given by name to cover symbols in different modules */
+static struct rb_root batch_syms = RB_ROOT;
+static unsigned nr_batch_syms;
+static PyObject *pBatchSyms;
 
 enum py_context_idx {
 	PY_CTX_TID = 0,
@@ -479,8 +520,151 @@ int python_uftrace_exit(struct script_context *sc_ctx)
 	return 0;
 }
 
+static unsigned python_batch_sym_id(char *name)
+{
+	struct rb_node *parent = NULL;
+	struct rb_node **p = &batch_syms.rb_node;
+	struct python_batch_sym *iter, *sym;
+	PyObject *pName;
+	int cmp;
+
+	while (*p) {
+		parent = *p;
+		iter = rb_entry(parent, struct python_batch_sym, node);
+
+		cmp = strcmp(iter->name, name);
+		if (cmp == 0)
+			return iter->id;
+
+		if (cmp > 0)
+			p = &parent->rb_left;
+		else
+			p = &parent->rb_right;
+	}
+
+	sym = xmalloc(sizeof(*sym));
+	sym->name = xstrdup(name);
+	sym->id = nr_batch_syms++;
+
+	rb_link_node(&sym->node, parent, p);
+	rb_insert_color(&sym->node, &batch_syms);
+
+	/* the list is shared by all batches and grows with new symbols */
+	pName = __PyString_FromString(name);
+	__PyList_Append(pBatchSyms, pName);
+	Py_XDECREF(pName);
+
+	return sym->id;
+}
+
+static void python_batch_flush(void)
+{
+	PyObject *pRecords, *pArgs;
+
+	if (nr_batch_records == 0)
+		return;
+
+	/* bytearray supports buffer protocol (struct, array, numpy) */
+	pRecords = __PyByteArray_FromStringAndSize((char *)batch_records,
+					nr_batch_records * sizeof(*batch_records));
+
+	/* PyTuple_SetItem() steals the reference */
+	pArgs = __PyTuple_New(2);
+	__PyTuple_SetItem(pArgs, 0, pRecords);
+	Py_XINCREF(pBatchSyms);
+	__PyTuple_SetItem(pArgs, 1, pBatchSyms);
+
+	/* Call python function "uftrace_batch". */
+	__PyObject_CallObject(pFuncBatch, pArgs);
+	if (debug) {
+		if (__PyErr_Occurred() && !python_error_reported) {
+			pr_dbg("uftrace_batch failed:\n");
+			__PyErr_Print();
+
+			python_error_reported = true;
+		}
+	}
+
+	Py_XDECREF(pArgs);
+	nr_batch_records = 0;
+}
+
+static void python_batch_add(struct script_context *sc_ctx, int type)
+{
+	struct python_batch_record *rec;
+
+	rec = &batch_records[nr_batch_records++];
+	rec->timestamp = sc_ctx->timestamp;
+	rec->duration  = sc_ctx->duration;
+	rec->address   = sc_ctx->address;
+	rec->tid       = sc_ctx->tid;
+	rec->sym_id    = python_batch_sym_id(sc_ctx->name);
+	rec->depth     = sc_ctx->depth;
+	rec->type      = type;
+
+	if (nr_batch_records == PY_BATCH_SIZE)
+		python_batch_flush();
+}
+
+static int python_batch_entry(struct script_context *sc_ctx)
+{
+	python_batch_add(sc_ctx, 0);
+	return 0;
+}
+
+static int python_batch_exit(struct script_context *sc_ctx)
+{
+	python_batch_add(sc_ctx, 1);
+	return 0;
+}
+
+static void python_batch_finish(void)
+{
+	struct rb_node *node;
+	struct python_batch_sym *sym;
+
+	while (!RB_EMPTY_ROOT(&batch_syms)) {
+		node = rb_first(&batch_syms);
+		rb_erase(node, &batch_syms);
+
+		sym = rb_entry(node, struct python_batch_sym, node);
+		free(sym->name);
+		free(sym);
+	}
+
+	free(batch_records);
+	batch_records = NULL;
+	nr_batch_syms = 0;
+}
+
+/*
+ * Deliver records to "uftrace_batch" (if the script has it) instead of
+ * calling "uftrace_entry" and "uftrace_exit" for each record.  Note that
+ * arguments and return values are not delivered in the batch.
+ */
+void script_enable_batch_for_python(void)
+{
+	if (pFuncBatch == NULL)
+		return;
+
+	pBatchSyms = __PyList_New(0);
+	if (pBatchSyms == NULL)
+		return;
+
+	batch_records = xmalloc(PY_BATCH_SIZE * sizeof(*batch_records));
+
+	script_uftrace_entry = python_batch_entry;
+	script_uftrace_exit  = python_batch_exit;
+
+	pr_dbg("deliver records to uftrace_batch\n");
+}
+
 int python_uftrace_end(void)
 {
+	/* deliver the remaining records first */
+	if (batch_records)
+		python_batch_flush();
+
 	if (unlikely(!pFuncEnd))
 		return -1;
 
@@ -515,6 +699,7 @@ int script_init_for_python(char *py_pathname)
 	INIT_PY_API_FUNC(PyErr_Clear);
 
 	INIT_PY_API_FUNC(PyObject_GetAttrString);
+	INIT_PY_API_FUNC(PyObject_SetAttrString);
 	INIT_PY_API_FUNC(PyCallable_Check);
 	INIT_PY_API_FUNC(PyObject_CallObject);
 
@@ -531,8 +716,12 @@ int script_init_for_python(char *py_pathname)
 	INIT_PY_API_FUNC(PyTuple_SetItem);
 	INIT_PY_API_FUNC(PyTuple_GetItem);
 
+	INIT_PY_API_FUNC(PyList_New);
 	INIT_PY_API_FUNC(PyList_Size);
 	INIT_PY_API_FUNC(PyList_GetItem);
+	INIT_PY_API_FUNC(PyList_Append);
+
+	INIT_PY_API_FUNC(PyByteArray_FromStringAndSize);
 
 	INIT_PY_API_FUNC(PyDict_New);
 	INIT_PY_API_FUNC(PyDict_SetItem);
@@ -567,16 +756,31 @@ int script_init_for_python(char *py_pathname)
 	if (pFuncBegin && __PyCallable_Check(pFuncBegin))
 		__PyObject_CallObject(pFuncBegin, NULL);
 
+	pFuncBatch = __PyObject_GetAttrString(pModule, "uftrace_batch");
+	if (!pFuncBatch || !__PyCallable_Check(pFuncBatch)) {
+		pr_dbg("uftrace_batch is not callable!\n");
+		pFuncBatch = NULL;
+		__PyErr_Clear();
+	}
+	else {
+		PyObject *pFormat = __PyString_FromString(PY_BATCH_FORMAT);
+
+		/* let the script know the record format */
+		__PyObject_SetAttrString(pModule, "UFTRACE_BATCH_FORMAT", pFormat);
+		Py_XDECREF(pFormat);
+	}
+
+	/* entry and exit are not needed if it has uftrace_batch */
 	pFuncEntry = __PyObject_GetAttrString(pModule, "uftrace_entry");
 	if (!pFuncEntry || !__PyCallable_Check(pFuncEntry)) {
-		if (__PyErr_Occurred())
+		if (__PyErr_Occurred() && !pFuncBatch)
 			__PyErr_Print();
 		pr_dbg("uftrace_entry is not callable!\n");
 		pFuncEntry = NULL;
 	}
 	pFuncExit = __PyObject_GetAttrString(pModule, "uftrace_exit");
 	if (!pFuncExit || !__PyCallable_Check(pFuncExit)) {
-		if (__PyErr_Occurred())
+		if (__PyErr_Occurred() && !pFuncBatch)
 			__PyErr_Print();
 		pr_dbg("uftrace_exit is not callable!\n");
 		pFuncExit = NULL;
@@ -595,6 +799,7 @@ int script_init_for_python(char *py_pathname)
 
 void script_finish_for_python(void)
 {
+	python_batch_finish();
 	__Py_Finalize();
 }
 
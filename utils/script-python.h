@@ -12,22 +12,23 @@
 
 #include <python2.7/Python.h>
 
-#define SCRIPT_ENABLED 1
+#define SCRIPT_PYTHON_ENABLED 1
 int script_init_for_python(char *py_pathname);
 void script_finish_for_python(void);
-
+void script_enable_batch_for_python(void);
 
 #else /* HAVE_LIBPYTHON2 */
 
 
 /* Do nothing if libpython2.7.so is not installed. */
-#define SCRIPT_ENABLED 0
+#define SCRIPT_PYTHON_ENABLED 0
 static inline int script_init_for_python(char *py_pathname)
 {
 	return -1;
 }
 
 static inline void script_finish_for_python(void) {}
+static inline void script_enable_batch_for_python(void) {}
 
 #endif /* HAVE_LIBPYTHON2 */
 
@@ -17,6 +17,7 @@
 #include "utils/list.h"
 #include "utils/utils.h"
 #include "utils/script-python.h"
+#include "utils/script-native.h"
 
 
 /* This will be set by getenv("UFTRACE_SCRIPT"). */
@@ -27,6 +28,7 @@ static enum script_type_t script_lang;
 /* The below functions are used both in record time and script command. */
 script_uftrace_entry_t script_uftrace_entry;
 script_uftrace_exit_t script_uftrace_exit;
+script_uftrace_event_t script_uftrace_event;
 script_uftrace_end_t script_uftrace_end;
 
 struct script_filter_item {
@@ -44,10 +46,16 @@ static enum script_type_t get_script_type(const char *str)
 
 	/*
 	 * The given script will be detected by the file suffix.
-	 * As of now, it only handles ".py" suffix for python.
+	 * As of now, it handles ".py" suffix for python and ".so"
+	 * for native (shared object) scripts.
 	 */
+	if (ext == NULL)
+		return SCRIPT_UNKNOWN;
+
 	if (!strcmp(ext, ".py"))
 		return SCRIPT_PYTHON;
+	if (!strcmp(ext, ".so"))
+		return SCRIPT_NATIVE;
 
 	return SCRIPT_UNKNOWN;
 }
@@ -92,6 +100,29 @@ int script_match_filter(char *func)
 	return 0;
 }
 
+/**
+ * script_setup_trigger - add functions matched by script filters
+ * @symtabs - symbol tables to find functions
+ * @root    - root of the trigger rbtree
+ *
+ * It resolves the filter patterns to functions once so that callers can
+ * check TRIGGER_FL_SCRIPT instead of calling script_match_filter() for
+ * every function.  It returns false if the script has no filter which
+ * means the script should run for all functions.
+ */
+bool script_setup_trigger(struct symtabs *symtabs, struct rb_root *root)
+{
+	struct script_filter_item *item;
+
+	if (list_empty(&filters))
+		return false;
+
+	list_for_each_entry(item, &filters, list)
+		uftrace_setup_script(item->name, symtabs, root);
+
+	return true;
+}
+
 void script_finish_filter(void)
 {
 	struct script_filter_item *item, *tmp;
@@ -114,11 +145,21 @@ int script_init(char *script_pathname)
 	script_lang = get_script_type(script_pathname);
 	switch (script_lang) {
 	case SCRIPT_PYTHON:
-		if (script_init_for_python(script_pathname) < 0) {
+		if (!SCRIPT_PYTHON_ENABLED) {
+			pr_warn("python script is not supported due to missing libpython2.7.so\n");
+			script_pathname = NULL;
+		}
+		else if (script_init_for_python(script_pathname) < 0) {
 			pr_dbg("failed to init python scripting\n");
 			script_pathname = NULL;
 		}
 		break;
+	case SCRIPT_NATIVE:
+		if (script_init_for_native(script_pathname) < 0) {
+			pr_dbg("failed to init native scripting\n");
+			script_pathname = NULL;
+		}
+		break;
 	default:
 		pr_warn("unsupported script type: %s\n", script_pathname);
 		script_pathname = NULL;
@@ -130,12 +171,27 @@ int script_init(char *script_pathname)
 	return 0;
 }
 
+/* only for the script command as libmcount calls scripts in each thread */
+void script_enable_batch(void)
+{
+	switch (script_lang) {
+	case SCRIPT_PYTHON:
+		script_enable_batch_for_python();
+		break;
+	default:
+		break;
+	}
+}
+
 void script_finish(void)
 {
 	switch (script_lang) {
 	case SCRIPT_PYTHON:
 		script_finish_for_python();
 		break;
+	case SCRIPT_NATIVE:
+		script_finish_for_native();
+		break;
 	default:
 		break;
 	}
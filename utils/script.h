@@ -10,14 +10,25 @@
 
 #include "libmcount/mcount.h"
 #include "utils/script-python.h"
+#include "utils/script-native.h"
+
+/* native script (shared object) is always supported */
+#define SCRIPT_ENABLED 1
 
 /* script type */
 enum script_type_t {
 	SCRIPT_UNKNOWN = 0,
-	SCRIPT_PYTHON
+	SCRIPT_PYTHON,
+	SCRIPT_NATIVE,
 };
 
-/* context information passed to script */
+/*
+ * context information passed to script
+ *
+ * For events, @name is the event name, @address is the event id and
+ * @argbuf has raw event data (if any) without @argspec.  Native scripts
+ * get struct uftrace_script_context in "uftrace-script.h" instead.
+ */
 struct script_context {
 	int			tid;
 	int			depth;
@@ -35,18 +46,25 @@ extern char *script_str;
 
 typedef int (*script_uftrace_entry_t)(struct script_context *sc_ctx);
 typedef int (*script_uftrace_exit_t)(struct script_context *sc_ctx);
+typedef int (*script_uftrace_event_t)(struct script_context *sc_ctx);
 typedef int (*script_uftrace_end_t)(void);
 
 /* The below functions are used both in record time and script command. */
 extern script_uftrace_entry_t script_uftrace_entry;
 extern script_uftrace_exit_t script_uftrace_exit;
+extern script_uftrace_event_t script_uftrace_event;
 extern script_uftrace_end_t script_uftrace_end;
 
 int script_init(char *script_pathname);
+void script_enable_batch(void);
 void script_finish(void);
 
+struct symtabs;
+struct rb_root;
+
 void script_add_filter(char *func);
 int script_match_filter(char *func);
+bool script_setup_trigger(struct symtabs *symtabs, struct rb_root *root);
 void script_finish_filter(void);
 
 #endif /* __UFTRACE_SCRIPT_H__ */
@@ -11,6 +11,7 @@
 #include "utils/rbtree.h"
 #include "utils/utils.h"
 #include "utils/fstack.h"
+#include "utils/filter.h"
 #include "libmcount/mcount.h"
 
 static void delete_tasks(struct uftrace_session_link *sessions);
@@ -78,6 +79,8 @@ void read_session_map(char *dirname, struct symtabs *symtabs, char *sid)
 		maps = &map->next;
 	}
 	fclose(fp);
+
+	build_maps_index(symtabs);
 }
 
 static void delete_session_map(struct symtabs *symtabs)
@@ -90,6 +93,118 @@ static void delete_session_map(struct symtabs *symtabs)
 		free(map);
 		map = tmp;
 	}
+	symtabs->maps = NULL;
+
+	free(symtabs->maps_index);
+	symtabs->maps_index = NULL;
+	symtabs->nr_maps = 0;
+}
+
+static bool same_session_map(struct symtabs *a, struct symtabs *b)
+{
+	struct uftrace_mmap *x = a->maps;
+	struct uftrace_mmap *y = b->maps;
+
+	while (x && y) {
+		if (x->start != y->start || x->end != y->end ||
+		    strcmp(x->libname, y->libname))
+			return false;
+
+		x = x->next;
+		y = y->next;
+	}
+	return x == NULL && y == NULL;
+}
+
+/*
+ * Find symbol tables of a previous session which has the same executable
+ * and memory mappings.  Sessions created by exec of the same program
+ * (like in 'make -j' or shell scripts) share a single copy of them.
+ */
+static struct uftrace_sess_syms *
+find_session_syms(struct uftrace_session_link *sessions,
+		  struct symtabs *symtabs, char *exename)
+{
+	struct uftrace_sess_syms *syms;
+
+	list_for_each_entry(syms, &sessions->syms, list) {
+		struct symtabs *stabs = &syms->symtabs;
+
+		if (strcmp(stabs->filename, exename) ||
+		    strcmp(stabs->dirname, symtabs->dirname) ||
+		    stabs->flags != symtabs->flags ||
+		    stabs->kernel_base != symtabs->kernel_base)
+			continue;
+
+		if (same_session_map(stabs, symtabs))
+			return syms;
+	}
+	return NULL;
+}
+
+static void get_session_syms(struct uftrace_session_link *sessions,
+			     struct uftrace_session *s, char *dirname,
+			     bool sym_rel_addr)
+{
+	struct uftrace_sess_syms *syms;
+	struct symtabs symtabs = {
+		.dirname = dirname,
+		.flags = SYMTAB_FL_USE_SYMFILE | SYMTAB_FL_DEMANGLE |
+			 SYMTAB_FL_PARALLEL | SYMTAB_FL_SHARE_MODULE,
+	};
+
+	if (sym_rel_addr)
+		symtabs.flags |= SYMTAB_FL_ADJ_OFFSET;
+
+	/* the session link might not be initialized */
+	if (sessions->syms.next == NULL)
+		INIT_LIST_HEAD(&sessions->syms);
+
+	read_session_map(dirname, &symtabs, s->sid);
+	set_kernel_base(&symtabs, s->sid);
+
+	syms = find_session_syms(sessions, &symtabs, s->exename);
+	if (syms) {
+		pr_dbg2("share symbols for session %.16s\n", s->sid);
+		delete_session_map(&symtabs);
+		goto out;
+	}
+
+	syms = xzalloc(sizeof(*syms));
+	s->syms_owner = true;
+	syms->symtabs = symtabs;
+	syms->filters = RB_ROOT;
+	syms->fixups = RB_ROOT;
+
+	/* sessions (and exename) can be deleted in any order */
+	load_symtabs(&syms->symtabs, dirname, xstrdup(s->exename));
+	load_module_symtabs(&syms->symtabs);
+
+	list_add_tail(&syms->list, &sessions->syms);
+
+out:
+	syms->refcount++;
+
+	s->syms    = syms;
+	s->symtabs = &syms->symtabs;
+	s->filters = &syms->filters;
+	s->fixups  = &syms->fixups;
+}
+
+static void put_session_syms(struct uftrace_sess_syms *syms)
+{
+	if (--syms->refcount > 0)
+		return;
+
+	list_del(&syms->list);
+
+	uftrace_cleanup_filter(&syms->filters);
+	uftrace_cleanup_filter(&syms->fixups);
+	unload_module_symtabs(&syms->symtabs);
+	unload_symtabs(&syms->symtabs);
+	delete_session_map(&syms->symtabs);
+	free((void *)syms->symtabs.filename);
+	free(syms);
 }
 
 /**
@@ -101,6 +216,7 @@ static void delete_session_map(struct symtabs *symtabs)
  *
  * This function allocates a new session started by a task.  The new
  * session will be added to sessions tree sorted by pid and timestamp.
+ * The symbol tables are shared with other sessions if possible.
  */
 void create_session(struct uftrace_session_link *sessions,
 		    struct uftrace_msg_sess *msg, char *dirname, char *exename,
@@ -133,21 +249,12 @@ void create_session(struct uftrace_session_link *sessions,
 	s->namelen = msg->namelen;
 	memcpy(s->exename, exename, s->namelen);
 	s->exename[s->namelen] = 0;
-	s->filters = RB_ROOT;
 	INIT_LIST_HEAD(&s->dlopen_libs);
 
 	pr_dbg2("new session: pid = %d, session = %.16s\n",
 		s->pid, s->sid);
 
-	s->symtabs.flags = SYMTAB_FL_USE_SYMFILE | SYMTAB_FL_DEMANGLE;
-	if (sym_rel_addr)
-		s->symtabs.flags |= SYMTAB_FL_ADJ_OFFSET;
-
-	read_session_map(dirname, &s->symtabs, s->sid);
-	load_symtabs(&s->symtabs, dirname, s->exename);
-	set_kernel_base(&s->symtabs, s->sid);
-
-	load_module_symtabs(&s->symtabs);
+	get_session_syms(sessions, s, dirname, sym_rel_addr);
 
 	if (sessions->first == NULL)
 		sessions->first = s;
@@ -243,6 +350,48 @@ get_session_from_sid(struct uftrace_session_link *sessions, char sid[])
 	return NULL;
 }
 
+static unsigned long symtab_end(struct symtab *symtab)
+{
+	struct sym *sym;
+
+	if (symtab->nr_sym == 0)
+		return 0;
+
+	sym = &symtab->sym[symtab->nr_sym - 1];
+	return sym->addr + sym->size;
+}
+
+static void add_dlopen_index(struct uftrace_session *sess,
+			     struct uftrace_dlopen_list *udl)
+{
+	struct uftrace_dlopen_list **idx;
+	unsigned long max_end = 0;
+	int i, pos;
+
+	sess->dlopen_index = xrealloc(sess->dlopen_index,
+				      (sess->nr_dlopen + 1) * sizeof(*idx));
+	idx = sess->dlopen_index;
+
+	/* keep the index sorted by base address */
+	for (pos = sess->nr_dlopen; pos > 0; pos--) {
+		if (idx[pos - 1]->base <= udl->base)
+			break;
+	}
+	memmove(&idx[pos + 1], &idx[pos], (sess->nr_dlopen - pos) * sizeof(*idx));
+	idx[pos] = udl;
+	sess->nr_dlopen++;
+
+	/* update max end address of the following entries */
+	if (pos > 0)
+		max_end = idx[pos - 1]->max_end;
+
+	for (i = pos; i < sess->nr_dlopen; i++) {
+		if (max_end < idx[i]->end)
+			max_end = idx[i]->end;
+		idx[i]->max_end = max_end;
+	}
+}
+
 /**
  * session_add_dlopen - add dlopen'ed library to the mapping table
  * @sess: pointer to a current session
@@ -266,16 +415,22 @@ void session_add_dlopen(struct uftrace_session *sess, uint64_t timestamp,
 
 	memset(&udl->symtabs, 0, sizeof(udl->symtabs));
 	udl->symtabs.flags = SYMTAB_FL_DEMANGLE | SYMTAB_FL_USE_SYMFILE;
-	udl->symtabs.kernel_base = sess->symtabs.kernel_base;
-	udl->symtabs.dirname = sess->symtabs.dirname;
+	udl->symtabs.kernel_base = sess->symtabs->kernel_base;
+	udl->symtabs.dirname = sess->symtabs->dirname;
 
 	load_dlopen_symtabs(&udl->symtabs, base_addr, libname);
 
+	udl->end = symtab_end(&udl->symtabs.symtab);
+	if (udl->end < symtab_end(&udl->symtabs.dsymtab))
+		udl->end = symtab_end(&udl->symtabs.dsymtab);
+
 	list_for_each_entry(pos, &sess->dlopen_libs, list) {
 		if (pos->time > timestamp)
 			break;
 	}
 	list_add_tail(&udl->list, &pos->list);
+
+	add_dlopen_index(sess, udl);
 }
 
 /**
@@ -286,24 +441,45 @@ void session_add_dlopen(struct uftrace_session *sess, uint64_t timestamp,
  *
  * This functions find a matching symbol from a dlopen'ed library in
  * @sess using @addr.  The @timestamp is needed to determine which
- * library should be searched.
+ * library should be searched: it's the last one loaded before the
+ * @timestamp at the address since a library can be unloaded and other
+ * library can be loaded at the same address later.
  */
 struct sym * session_find_dlsym(struct uftrace_session *sess, uint64_t timestamp,
 				unsigned long addr)
 {
-	struct uftrace_dlopen_list *pos, *udl = NULL;
-	struct sym *sym = NULL;
+	struct uftrace_dlopen_list **idx = sess->dlopen_index;
+	struct uftrace_dlopen_list *udl = NULL;
+	int lo = 0, hi = sess->nr_dlopen;
+	int i;
 
-	list_for_each_entry(pos, &sess->dlopen_libs, list) {
-		if (pos->time > timestamp)
-			break;
+	/* find the first library loaded above the address */
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
 
-		udl = pos;
+		if (idx[mid]->base <= addr)
+			lo = mid + 1;
+		else
+			hi = mid;
 	}
-	if (udl)
-		sym = find_symtabs(&udl->symtabs, addr);
 
-	return sym;
+	/*
+	 * Libraries below can contain the address only if their max end
+	 * is greater.  They don't overlap unless unloaded, so it usually
+	 * checks a single library.
+	 */
+	for (i = lo - 1; i >= 0 && idx[i]->max_end > addr; i--) {
+		if (idx[i]->time > timestamp || idx[i]->end <= addr)
+			continue;
+
+		if (udl == NULL || udl->time < idx[i]->time)
+			udl = idx[i];
+	}
+
+	if (udl == NULL)
+		return NULL;
+
+	return find_symtabs(&udl->symtabs, addr);
 }
 
 void delete_session(struct uftrace_session *sess)
@@ -315,9 +491,9 @@ void delete_session(struct uftrace_session *sess)
 		unload_symtabs(&udl->symtabs);
 		free(udl);
 	}
+	free(sess->dlopen_index);
 
-	unload_symtabs(&sess->symtabs);
-	delete_session_map(&sess->symtabs);
+	put_session_syms(sess->syms);
 	free(sess);
 }
 
@@ -570,7 +746,7 @@ struct sym * task_find_sym(struct uftrace_session_link *sessions,
 	if (sess == NULL)
 		return NULL;
 
-	symtabs = &sess->symtabs;
+	symtabs = sess->symtabs;
 	sym = find_symtabs(symtabs, rec->addr);
 
 	if (sym == NULL)
@@ -603,13 +779,13 @@ struct sym * task_find_sym_addr(struct uftrace_session_link *sessions,
 	if (sess == NULL) {
 		struct uftrace_session *fsess = sessions->first;
 
-		if (is_kernel_address(&fsess->symtabs, addr))
+		if (is_kernel_address(fsess->symtabs, addr))
 			sess = fsess;
 		else
 			return NULL;
 	}
 
-	sym = find_symtabs(&sess->symtabs, addr);
+	sym = find_symtabs(sess->symtabs, addr);
 	if (sym == NULL)
 		sym = session_find_dlsym(sess, time, addr);
 
@@ -670,6 +846,61 @@ TEST_CASE(session_search)
 	return TEST_OK;
 }
 
+TEST_CASE(session_shared_syms)
+{
+	struct uftrace_session *s1, *s2, *s3;
+	const char *sids[] = { "first", "second", "third" };
+	const char *other_map = "00500000-00501000 r-xp 00000000 08:03 4096 unittest\n";
+	int i;
+
+	for (i = 0; i < 3; i++) {
+		struct uftrace_msg_sess msg = {
+			.task = {
+				.pid = i + 1,
+				.tid = i + 1,
+				.time = i * 100,
+			},
+			.namelen = 8,  /* = strlen("unittest") */
+		};
+		char mapfile[32];
+		const char *map = i < 2 ? session_map : other_map;
+		int fd;
+
+		strcpy(msg.sid, sids[i]);
+		snprintf(mapfile, sizeof(mapfile), "sid-%s.map", sids[i]);
+
+		fd = creat(mapfile, 0400);
+		write(fd, map, strlen(map));
+		close(fd);
+		create_session(&test_sessions, &msg, ".", "unittest", false);
+		remove(mapfile);
+	}
+
+	s1 = find_session(&test_sessions, 1, 0);
+	s2 = find_session(&test_sessions, 2, 100);
+	s3 = find_session(&test_sessions, 3, 200);
+	TEST_NE(s1, NULL);
+	TEST_NE(s2, NULL);
+	TEST_NE(s3, NULL);
+
+	/* same executable and mappings share symbols and filters */
+	TEST_EQ(s1->symtabs, s2->symtabs);
+	TEST_EQ(s1->filters, s2->filters);
+	TEST_EQ(s1->syms->refcount, 2);
+	TEST_EQ(s1->syms_owner, true);
+	TEST_EQ(s2->syms_owner, false);
+
+	/* different mappings */
+	TEST_NE(s1->symtabs, s3->symtabs);
+	TEST_EQ(s3->syms->refcount, 1);
+
+	delete_sessions(&test_sessions);
+	TEST_EQ(RB_EMPTY_ROOT(&test_sessions.root), true);
+	TEST_EQ(list_empty(&test_sessions.syms), true);
+
+	return TEST_OK;
+}
+
 TEST_CASE(task_search)
 {
 	struct uftrace_task *task;
@@ -986,6 +1217,40 @@ TEST_CASE(task_symbol_dlopen)
 	TEST_NE(sym, NULL);
 	TEST_STREQ(sym->name, "foo");
 
+	/* not loaded yet */
+	sym = session_find_dlsym(test_sessions.first, 150, 0x7003410);
+	TEST_EQ(sym, NULL);
+
+	fp = fopen("libuftrace-test.so.1.sym", "w");
+	fprintf(fp, "0100 T _start\n");
+	fprintf(fp, "0200 T bar\n");
+	fprintf(fp, "0300 T __sym_end\n");
+	fclose(fp);
+
+	/* load other library below and then at the same address */
+	session_add_dlopen(test_sessions.first, 300, 0x7001000, "libuftrace-test.so.1");
+	session_add_dlopen(test_sessions.first, 400, 0x7003000, "libuftrace-test.so.1");
+	remove("libuftrace-test.so.1.sym");
+
+	TEST_EQ(test_sessions.first->nr_dlopen, 3);
+
+	sym = session_find_dlsym(test_sessions.first, 350, 0x7003410);
+	TEST_NE(sym, NULL);
+	TEST_STREQ(sym->name, "foo");
+
+	sym = session_find_dlsym(test_sessions.first, 350, 0x7001210);
+	TEST_NE(sym, NULL);
+	TEST_STREQ(sym->name, "bar");
+
+	sym = session_find_dlsym(test_sessions.first, 450, 0x7003210);
+	TEST_NE(sym, NULL);
+	TEST_STREQ(sym->name, "bar");
+
+	/* the later library doesn't cover the address */
+	sym = session_find_dlsym(test_sessions.first, 450, 0x7003410);
+	TEST_NE(sym, NULL);
+	TEST_STREQ(sym->name, "foo");
+
 	delete_sessions(&test_sessions);
 	TEST_EQ(RB_EMPTY_ROOT(&test_sessions.root), true);
 
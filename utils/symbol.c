@@ -15,6 +15,8 @@
 #include <unistd.h>
 #include <assert.h>
 #include <inttypes.h>
+#include <pthread.h>
+#include <sys/stat.h>
 
 /* This should be defined before #include "utils.h" */
 #define PR_FMT     "symbol"
@@ -56,6 +58,31 @@ static int addrfind(const void *a, const void *b)
 	return 1;
 }
 
+static int mapsort(const void *a, const void *b)
+{
+	const struct uftrace_mmap *mapa = *(const struct uftrace_mmap **)a;
+	const struct uftrace_mmap *mapb = *(const struct uftrace_mmap **)b;
+
+	if (mapa->start > mapb->start)
+		return 1;
+	if (mapa->start < mapb->start)
+		return -1;
+	return 0;
+}
+
+static int mapfind(const void *a, const void *b)
+{
+	uint64_t addr = *(uint64_t *) a;
+	const struct uftrace_mmap *map = *(const struct uftrace_mmap **)b;
+
+	if (map->start <= addr && addr < map->end)
+		return 0;
+
+	if (map->start > addr)
+		return -1;
+	return 1;
+}
+
 static int namesort(const void *a, const void *b)
 {
 	const struct sym *syma = *(const struct sym **)a;
@@ -190,6 +217,95 @@ elf_error:
 	goto out;
 }
 
+/**
+ * read_build_id - read GNU build-id of an ELF file
+ * @filename: name of the ELF file
+ * @buf: buffer to save the build-id as a hex string
+ * @len: size of @buf (should be at least BUILD_ID_STR_SIZE)
+ *
+ * This function returns 0 if it found the build-id, or -1.
+ */
+int read_build_id(const char *filename, char *buf, int len)
+{
+	unsigned char build_id[BUILD_ID_SIZE] = {};
+	int fd;
+	Elf *elf;
+	Elf_Scn *sec = NULL;
+	Elf_Data *data;
+	GElf_Nhdr nhdr;
+	size_t shdrstr_idx;
+	size_t offset = 0;
+	size_t name_offset, desc_offset;
+
+	if (len < BUILD_ID_STR_SIZE)
+		return -1;
+
+	fd = open(filename, O_RDONLY);
+	if (fd < 0)
+		return -1;
+
+	elf_version(EV_CURRENT);
+
+	elf = elf_begin(fd, ELF_C_READ_MMAP, NULL);
+	if (elf == NULL)
+		goto close_fd;
+
+	if (elf_getshdrstrndx(elf, &shdrstr_idx) < 0)
+		goto end_elf;
+
+	while ((sec = elf_nextscn(elf, sec)) != NULL) {
+		GElf_Shdr shdr;
+		char *str;
+
+		if (gelf_getshdr(sec, &shdr) == NULL)
+			goto end_elf;
+
+		str = elf_strptr(elf, shdrstr_idx, shdr.sh_name);
+		if (str && !strcmp(str, ".note.gnu.build-id"))
+			break;
+	}
+
+	if (sec == NULL)
+		goto end_elf;
+
+	data = elf_getdata(sec, NULL);
+	if (data == NULL)
+		goto end_elf;
+
+	while ((offset = gelf_getnote(data, offset, &nhdr,
+				      &name_offset, &desc_offset)) != 0) {
+		if (nhdr.n_type == NT_GNU_BUILD_ID &&
+		    !strcmp((char *)data->d_buf + name_offset, "GNU")) {
+			size_t size = nhdr.n_descsz;
+
+			if (size > BUILD_ID_SIZE)
+				size = BUILD_ID_SIZE;
+
+			memcpy(build_id, (void *)data->d_buf + desc_offset, size);
+			break;
+		}
+	}
+end_elf:
+	elf_end(elf);
+close_fd:
+	close(fd);
+
+	if (offset == 0) {
+		if (sec == NULL)
+			pr_dbg("cannot find build-id section: %s\n", filename);
+		else
+			pr_dbg("error during ELF processing: %s\n",
+			       elf_errmsg(elf_errno()));
+		return -1;
+	}
+
+	for (offset = 0; offset < BUILD_ID_SIZE; offset++)
+		sprintf(&buf[offset * 2], "%02x", build_id[offset]);
+	buf[BUILD_ID_STR_SIZE - 1] = '\0';
+
+	return 0;
+}
+
 static void __unload_symtab(struct symtab *symtab)
 {
 	size_t i;
@@ -951,9 +1067,22 @@ void load_dlopen_symtabs(struct symtabs *symtabs, unsigned long offset,
 static int load_module_symbol(struct symtab *symtab, const char *symfile,
 			      unsigned long offset);
 
-void load_module_symtabs(struct symtabs *symtabs)
+/* max number of threads to load module symbols */
+#define MAX_MODULE_THREADS  8
+
+typedef void (*module_func_t)(struct symtabs *symtabs,
+			      struct uftrace_mmap *map);
+
+struct module_work {
+	struct symtabs		*symtabs;
+	struct uftrace_mmap	**maps;
+	int			nr_maps;
+	int			next;
+	module_func_t		func;
+};
+
+static bool skip_module(struct symtabs *symtabs, struct uftrace_mmap *map)
 {
-	struct uftrace_mmap *maps;
 	static const char * const skip_libs[] = {
 		/* uftrace internal libraries */
 		"libmcount.so",
@@ -969,32 +1098,344 @@ void load_module_symtabs(struct symtabs *symtabs)
 		"ld-linux-x86-64.so.2",
 	};
 	size_t k;
-	unsigned long flags = symtabs->flags;
 
-	assert(symtabs->maps);
+	if (!strcmp(map->libname, symtabs->filename))
+		return true;
+	if (map->libname[0] == '[')
+		return true;
 
-	maps = symtabs->maps;
-	while (maps) {
-		struct symtab dsymtab = {};
+	for (k = 0; k < ARRAY_SIZE(skip_libs); k++) {
+		if (!strcmp(basename(map->libname), skip_libs[k]))
+			return true;
+	}
+	return false;
+}
 
-		if (!strcmp(maps->libname, symtabs->filename))
-			goto next;
-		if (maps->libname[0] == '[')
-			goto next;
+/*
+ * Symbol files of modules are named after the basename of the library.
+ * But a different library with the same basename (in other directory)
+ * uses its full path (with '/' converted to '_') instead.
+ */
+static char *module_symfile(const char *dirname, const char *libname,
+			    bool fullpath)
+{
+	char *symfile = NULL;
+	char *name;
+	char *p;
 
-		for (k = 0; k < ARRAY_SIZE(skip_libs); k++) {
-			if (!strcmp(basename(maps->libname), skip_libs[k]))
-				goto next;
+	if (!fullpath) {
+		xasprintf(&symfile, "%s/%s.sym", dirname, basename(libname));
+		return symfile;
+	}
+
+	name = xstrdup(libname);
+	for (p = name; *p; p++) {
+		if (*p == '/')
+			*p = '_';
+	}
+
+	xasprintf(&symfile, "%s/%s.sym", dirname, name);
+	free(name);
+	return symfile;
+}
+
+/* returns name of the saved symbol file of @libname, or NULL */
+static char *find_module_symfile(const char *dirname, const char *libname)
+{
+	char *symfile;
+
+	symfile = module_symfile(dirname, libname, true);
+	if (access(symfile, F_OK) == 0)
+		return symfile;
+	free(symfile);
+
+	symfile = module_symfile(dirname, libname, false);
+	if (access(symfile, F_OK) == 0)
+		return symfile;
+	free(symfile);
+
+	return NULL;
+}
+
+static void *module_worker(void *arg)
+{
+	struct module_work *work = arg;
+	int i;
+
+	while ((i = __sync_fetch_and_add(&work->next, 1)) < work->nr_maps)
+		work->func(work->symtabs, work->maps[i]);
+
+	return NULL;
+}
+
+/*
+ * Call @func for each module in the @symtabs.  Modules don't share
+ * anything so they can be processed by multiple threads when
+ * SYMTAB_FL_PARALLEL is set (libmcount should not create threads).
+ */
+static void for_each_module(struct symtabs *symtabs, module_func_t func)
+{
+	struct module_work work = {
+		.symtabs = symtabs,
+		.func    = func,
+	};
+	struct uftrace_mmap *map;
+	pthread_t threads[MAX_MODULE_THREADS];
+	int nr_threads = 1;
+	int nr_maps = 0;
+	int i;
+
+	for (map = symtabs->maps; map; map = map->next)
+		nr_maps++;
+
+	work.maps = xmalloc(nr_maps * sizeof(*work.maps));
+	for (map = symtabs->maps; map; map = map->next) {
+		if (!skip_module(symtabs, map))
+			work.maps[work.nr_maps++] = map;
+	}
+
+	if (symtabs->flags & SYMTAB_FL_PARALLEL) {
+		nr_threads = sysconf(_SC_NPROCESSORS_ONLN);
+		if (nr_threads > MAX_MODULE_THREADS)
+			nr_threads = MAX_MODULE_THREADS;
+		if (nr_threads > work.nr_maps)
+			nr_threads = work.nr_maps;
+	}
+
+	/* libelf sets its global version once, do it before threads */
+	elf_version(EV_CURRENT);
+
+	/* the current thread is also a worker */
+	for (i = 1; i < nr_threads; i++) {
+		if (pthread_create(&threads[i], NULL, module_worker, &work) != 0)
+			break;
+	}
+	nr_threads = i;
+
+	module_worker(&work);
+
+	for (i = 1; i < nr_threads; i++)
+		pthread_join(threads[i], NULL);
+
+	free(work.maps);
+}
+
+/* read symbols of the module at base address 0 */
+static void read_module_symtab(struct symtabs *symtabs,
+			       struct uftrace_mmap *map,
+			       struct symtab *symtab, bool *relative)
+{
+	struct symtab dsymtab = {};
+	unsigned long flags = symtabs->flags;
+
+	/* modules saved at record time are preferred */
+	if (symtabs->dirname && (flags & SYMTAB_FL_USE_SYMFILE)) {
+		char *symfile;
+		int ret = -1;
+
+		symfile = find_module_symfile(symtabs->dirname, map->libname);
+		if (symfile)
+			ret = load_module_symbol(symtab, symfile, 0);
+		free(symfile);
+
+		if (ret == 0) {
+			/* old data has absolute addresses */
+			*relative = flags & SYMTAB_FL_ADJ_OFFSET;
+			return;
 		}
+	}
 
-		pr_dbg2("load module symbol table: %s\n", maps->libname);
+	pr_dbg2("load module symbol table: %s\n", map->libname);
 
-		load_symtab(&maps->symtab, maps->libname, maps->start, flags);
-		load_dynsymtab(&dsymtab, maps->libname, maps->start, flags);
-		merge_symtabs(&maps->symtab, &dsymtab);
+	load_symtab(symtab, map->libname, 0, flags);
+	load_dynsymtab(&dsymtab, map->libname, 0, flags);
+	merge_symtabs(symtab, &dsymtab);
+	*relative = true;
+}
 
-next:
-		maps = maps->next;
+/* copy symbols at the @offset, names are shared with the @src */
+static void copy_module_symtab(struct symtab *dst, struct symtab *src,
+			       uint64_t offset)
+{
+	size_t i;
+
+	dst->nr_sym = dst->nr_alloc = src->nr_sym;
+	dst->name_sorted = src->name_sorted;
+
+	if (src->nr_sym == 0)
+		return;
+
+	dst->sym = xmalloc(src->nr_sym * sizeof(*dst->sym));
+	memcpy(dst->sym, src->sym, src->nr_sym * sizeof(*dst->sym));
+	for (i = 0; i < src->nr_sym; i++)
+		dst->sym[i].addr += offset;
+
+	dst->sym_names = xmalloc(src->nr_sym * sizeof(*dst->sym_names));
+	for (i = 0; i < src->nr_sym; i++)
+		dst->sym_names[i] = dst->sym + (src->sym_names[i] - src->sym);
+}
+
+/*
+ * Symbol tables of modules shared by sessions.  Sessions of the same
+ * program (by exec) usually have the same libraries at different
+ * addresses (by ASLR), so keep the symbols at base address 0 and copy
+ * them with the load address to each session instead of reading (and
+ * demangling) the same file again.
+ */
+struct shared_module {
+	struct list_head	list;
+	char			*dirname;
+	unsigned long		flags;
+	int			refcount;
+	bool			relative;
+	struct symtab		symtab;
+	char			libname[];
+};
+
+static LIST_HEAD(shared_modules);
+static pthread_mutex_t shared_modules_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static struct shared_module *find_shared_module(struct symtabs *symtabs,
+						 struct uftrace_mmap *map)
+{
+	struct shared_module *mod;
+
+	list_for_each_entry(mod, &shared_modules, list) {
+		if (!strcmp(mod->libname, map->libname) &&
+		    !strcmp(mod->dirname, symtabs->dirname) &&
+		    mod->flags == symtabs->flags)
+			return mod;
+	}
+	return NULL;
+}
+
+static void load_module_symtab(struct symtabs *symtabs,
+			       struct uftrace_mmap *map)
+{
+	struct shared_module *mod;
+
+	if (!(symtabs->flags & SYMTAB_FL_SHARE_MODULE)) {
+		bool relative;
+		size_t i;
+
+		read_module_symtab(symtabs, map, &map->symtab, &relative);
+		for (i = 0; relative && i < map->symtab.nr_sym; i++)
+			map->symtab.sym[i].addr += map->start;
+		return;
+	}
+
+	pthread_mutex_lock(&shared_modules_lock);
+	mod = find_shared_module(symtabs, map);
+	if (mod)
+		mod->refcount++;
+	pthread_mutex_unlock(&shared_modules_lock);
+
+	if (mod == NULL) {
+		mod = xzalloc(sizeof(*mod) + strlen(map->libname) + 1);
+		mod->dirname = xstrdup(symtabs->dirname);
+		mod->flags = symtabs->flags;
+		mod->refcount = 1;
+		strcpy(mod->libname, map->libname);
+
+		read_module_symtab(symtabs, map, &mod->symtab, &mod->relative);
+
+		/* a module is loaded by a thread at a time */
+		pthread_mutex_lock(&shared_modules_lock);
+		list_add(&mod->list, &shared_modules);
+		pthread_mutex_unlock(&shared_modules_lock);
+	}
+	else {
+		pr_dbg2("share module symbol table: %s\n", map->libname);
+	}
+
+	copy_module_symtab(&map->symtab, &mod->symtab,
+			   mod->relative ? map->start : 0);
+}
+
+/**
+ * build_maps_index - build a sorted array of maps for lookup
+ * @symtabs: symbol table which has maps
+ *
+ * Memory mappings in a process don't overlap so find_symtabs() can use
+ * binary search on the index instead of walking the map list for each
+ * address.  It should be called after (re-)reading the maps and the
+ * index (symtabs->maps_index) should be freed with the maps.
+ */
+void build_maps_index(struct symtabs *symtabs)
+{
+	struct uftrace_mmap *map;
+	size_t i = 0;
+
+	free(symtabs->maps_index);
+	symtabs->maps_index = NULL;
+	symtabs->nr_maps = 0;
+
+	for (map = symtabs->maps; map; map = map->next)
+		symtabs->nr_maps++;
+
+	if (symtabs->nr_maps == 0)
+		return;
+
+	symtabs->maps_index = xmalloc(symtabs->nr_maps * sizeof(map));
+	for (map = symtabs->maps; map; map = map->next)
+		symtabs->maps_index[i++] = map;
+
+	qsort(symtabs->maps_index, symtabs->nr_maps, sizeof(map), mapsort);
+}
+
+void load_module_symtabs(struct symtabs *symtabs)
+{
+	assert(symtabs->maps);
+
+	for_each_module(symtabs, load_module_symtab);
+}
+
+/* release the symbols of @map and the shared module if it's the last user */
+static void put_shared_module(struct symtabs *symtabs,
+			      struct uftrace_mmap *map)
+{
+	struct shared_module *mod;
+
+	/* symbol names belong to the shared module */
+	free(map->symtab.sym);
+	free(map->symtab.sym_names);
+	map->symtab.sym = NULL;
+	map->symtab.sym_names = NULL;
+	map->symtab.nr_sym = 0;
+
+	pthread_mutex_lock(&shared_modules_lock);
+	mod = find_shared_module(symtabs, map);
+	if (mod && --mod->refcount == 0)
+		list_del(&mod->list);
+	else
+		mod = NULL;
+	pthread_mutex_unlock(&shared_modules_lock);
+
+	if (mod) {
+		__unload_symtab(&mod->symtab);
+		free(mod->dirname);
+		free(mod);
+	}
+}
+
+/**
+ * unload_module_symtabs - release module symbols loaded by load_module_symtabs
+ * @symtabs: symbol tables of the session
+ *
+ * Module symbol tables shared by sessions are freed when the last
+ * session using them is unloaded.
+ */
+void unload_module_symtabs(struct symtabs *symtabs)
+{
+	struct uftrace_mmap *map;
+
+	for (map = symtabs->maps; map; map = map->next) {
+		/* skipped modules can be loaded by find_symtabs() later */
+		if (!skip_module(symtabs, map) &&
+		    (symtabs->flags & SYMTAB_FL_SHARE_MODULE))
+			put_shared_module(symtabs, map);
+		else
+			__unload_symtab(&map->symtab);
 	}
 }
 
@@ -1130,6 +1571,109 @@ out:
 	return 0;
 }
 
+/* persistent symbol cache directory shared by recordings */
+static char *symbol_cache_dir;
+
+/**
+ * setup_symbol_cache - set the directory of the symbol cache
+ * @dirname: name of the cache directory (can be NULL)
+ *
+ * Symbol files are saved in the cache directory using the build-id of
+ * the ELF file as their name.  Later recordings of the same binaries
+ * can link the cached files instead of reading ELF files again.
+ */
+void setup_symbol_cache(const char *dirname)
+{
+	if (dirname == NULL)
+		return;
+
+	if (mkdir(dirname, 0755) < 0 && errno != EEXIST) {
+		pr_warn("cannot create symbol cache %s: %m\n", dirname);
+		return;
+	}
+
+	free(symbol_cache_dir);
+	symbol_cache_dir = xstrdup(dirname);
+}
+
+/* name of the cached symbol file, it's NULL if not available */
+static char *symbol_cache_file(const char *filename, const char *suffix)
+{
+	char build_id[BUILD_ID_STR_SIZE];
+	char *cachefile = NULL;
+
+	if (symbol_cache_dir == NULL)
+		return NULL;
+
+	if (read_build_id(filename, build_id, sizeof(build_id)) < 0)
+		return NULL;
+
+	xasprintf(&cachefile, "%s/%s%s", symbol_cache_dir, build_id, suffix);
+	return cachefile;
+}
+
+static int copy_symbol_file(const char *src, const char *dst)
+{
+	char buf[4096];
+	size_t len;
+	FILE *ifp, *ofp;
+	int ret = 0;
+
+	ifp = fopen(src, "r");
+	if (ifp == NULL)
+		return -1;
+
+	ofp = fopen(dst, "wx");
+	if (ofp == NULL) {
+		fclose(ifp);
+		return errno == EEXIST ? 0 : -1;
+	}
+
+	while ((len = fread(buf, 1, sizeof(buf), ifp)) > 0) {
+		if (fwrite(buf, 1, len, ofp) != len) {
+			ret = -1;
+			break;
+		}
+	}
+
+	fclose(ifp);
+	if (fclose(ofp) < 0)
+		ret = -1;
+	if (ret < 0)
+		unlink(dst);
+	return ret;
+}
+
+/* hard link is preferred, but copy it if @src is in other filesystem */
+static int link_symbol_file(const char *src, const char *dst)
+{
+	if (link(src, dst) == 0 || errno == EEXIST)
+		return 0;
+	if (errno != EXDEV && errno != EPERM)
+		return -1;
+
+	return copy_symbol_file(src, dst);
+}
+
+/* put @symfile into the cache atomically as other record may read it */
+static void store_symbol_cache(const char *symfile, const char *cachefile)
+{
+	char *tmpfile = NULL;
+
+	if (access(cachefile, F_OK) == 0)
+		return;
+
+	xasprintf(&tmpfile, "%s.%d.%lx", cachefile, getpid(),
+		  (unsigned long)pthread_self());
+	if (link_symbol_file(symfile, tmpfile) == 0) {
+		if (rename(tmpfile, cachefile) < 0)
+			unlink(tmpfile);
+		else
+			pr_dbg2("saved symbol cache: %s\n", cachefile);
+	}
+	free(tmpfile);
+}
+
 void save_symbol_file(struct symtabs *symtabs, const char *dirname,
 		      const char *exename)
 {
@@ -1143,6 +1687,7 @@ void save_symbol_file(struct symtabs *symtabs, const char *dirname,
 	Elf *elf = NULL;
 	GElf_Phdr phdr;
 	size_t nr = 0;
+	bool cacheable = false;
 
 	xasprintf(&symfile, "%s/%s.sym", dirname, basename(exename));
 
@@ -1181,6 +1726,7 @@ void save_symbol_file(struct symtabs *symtabs, const char *dirname,
 
 	/* save relative offset of symbol address */
 	symtabs->flags |= SYMTAB_FL_ADJ_OFFSET;
+	cacheable = true;
 
 do_it:
 	/* dynamic symbols */
@@ -1203,10 +1749,19 @@ do_it:
 			(char) stab->sym[i-1].type, "__sym_end");
 	}
 
+	fclose(fp);
+
+	if (cacheable) {
+		char *cachefile = symbol_cache_file(exename, ".sym");
+
+		if (cachefile)
+			store_symbol_cache(symfile, cachefile);
+		free(cachefile);
+	}
+
 	elf_end(elf);
 	close(fd);
 	free(symfile);
-	fclose(fp);
 }
 
 static int load_module_symbol(struct symtab *symtab, const char *symfile,
@@ -1354,23 +1909,161 @@ static void save_module_symbol(struct symtab *stab, const char *symfile,
 	fclose(fp);
 }
 
-void save_module_symtabs(struct symtabs *symtabs)
+/**
+ * link_cached_symbol_file - link symbol file of @exename from the cache
+ * @symtabs: symbol tables of the session
+ * @dirname: name of the data directory
+ * @exename: name of the executable (or dlopen-ed library)
+ *
+ * This function returns 0 if the symbol file of @exename exists in the
+ * @dirname (by linking the cached file) so that it doesn't need to call
+ * save_symbol_file().  Otherwise it returns -1.
+ */
+int link_cached_symbol_file(struct symtabs *symtabs, const char *dirname,
+			    const char *exename)
 {
 	char *symfile = NULL;
-	struct uftrace_mmap *map;
+	char *cachefile;
+	int ret = -1;
+
+	cachefile = symbol_cache_file(exename, ".sym");
+	if (cachefile == NULL)
+		return -1;
 
-	map = symtabs->maps;
-	while (map) {
-		xasprintf(&symfile, "%s/%s.sym", symtabs->dirname,
-			  basename(map->libname));
+	xasprintf(&symfile, "%s/%s.sym", dirname, basename(exename));
+	if (access(cachefile, F_OK) == 0 &&
+	    link_symbol_file(cachefile, symfile) == 0) {
+		pr_dbg2("use cached symbol file: %s\n", cachefile);
+
+		symtabs->dirname = dirname;
+		symtabs->filename = exename;
+		/* same as save_symbol_file() does */
+		symtabs->flags |= SYMTAB_FL_ADJ_OFFSET;
+		ret = 0;
+	}
+
+	free(symfile);
+	free(cachefile);
+	return ret;
+}
+
+/* owners of module symbol files saved by this process */
+struct saved_module {
+	struct list_head	list;
+	char			*symfile;
+	char			libname[];
+};
 
-		save_module_symbol(&map->symtab, symfile, map->start);
+static LIST_HEAD(saved_modules);
+static pthread_mutex_t saved_modules_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * Returns name of the symbol file to save @map, or NULL if the same
+ * library was saved already.  Sessions (and threads) can have other
+ * libraries with the same basename so check the full path of the
+ * library saved under the name before skipping it.
+ */
+static char *get_module_symfile(struct symtabs *symtabs,
+				struct uftrace_mmap *map)
+{
+	struct saved_module *sm;
+	char *symfile;
+	bool found = false;
+	bool other = false;
+
+	symfile = module_symfile(symtabs->dirname, map->libname, false);
+
+	pthread_mutex_lock(&saved_modules_lock);
+	list_for_each_entry(sm, &saved_modules, list) {
+		if (!strcmp(sm->symfile, symfile)) {
+			found = true;
+			other = strcmp(sm->libname, map->libname);
+			break;
+		}
+	}
+
+	if (!found) {
+		/* it might be saved for the main executable */
+		if (access(symfile, F_OK) == 0) {
+			other = true;
+		}
+		else {
+			sm = xmalloc(sizeof(*sm) + strlen(map->libname) + 1);
+			sm->symfile = xstrdup(symfile);
+			strcpy(sm->libname, map->libname);
+			list_add(&sm->list, &saved_modules);
+		}
+	}
+	pthread_mutex_unlock(&saved_modules_lock);
 
+	if (found && !other) {
+		/* other session already saved it */
 		free(symfile);
-		symfile = NULL;
+		return NULL;
+	}
 
-		map = map->next;
+	if (other) {
+		free(symfile);
+
+		symfile = module_symfile(symtabs->dirname, map->libname, true);
+		if (access(symfile, F_OK) == 0) {
+			free(symfile);
+			return NULL;
+		}
 	}
+	return symfile;
+}
+
+static void save_module_symtab(struct symtabs *symtabs,
+			       struct uftrace_mmap *map)
+{
+	struct symtab dsymtab = {};
+	char *symfile;
+	char *cachefile;
+
+	symfile = get_module_symfile(symtabs, map);
+	if (symfile == NULL)
+		return;
+
+	cachefile = symbol_cache_file(map->libname, ".mod.sym");
+	if (cachefile && access(cachefile, F_OK) == 0 &&
+	    link_symbol_file(cachefile, symfile) == 0) {
+		pr_dbg2("use cached symbol file: %s\n", cachefile);
+		free(cachefile);
+		goto out;
+	}
+
+	pr_dbg2("load module symbol table: %s\n", map->libname);
+
+	load_symtab(&map->symtab, map->libname, map->start, symtabs->flags);
+	load_dynsymtab(&dsymtab, map->libname, map->start, symtabs->flags);
+	merge_symtabs(&map->symtab, &dsymtab);
+
+	save_module_symbol(&map->symtab, symfile, map->start);
+	if (cachefile && map->symtab.nr_sym)
+		store_symbol_cache(symfile, cachefile);
+
+	/* it's not used in the record anymore */
+	__unload_symtab(&map->symtab);
+	free(cachefile);
+
+out:
+	free(symfile);
+}
+
+/**
+ * save_module_symtabs - save symbol files of modules in the session
+ * @symtabs: symbol tables of the session
+ *
+ * It reads symbols of each module (or links the cached symbol file
+ * if available) and saves them in the data directory.  Modules are
+ * processed in parallel if SYMTAB_FL_PARALLEL is set.
+ */
+void save_module_symtabs(struct symtabs *symtabs)
+{
+	assert(symtabs->maps);
+
+	for_each_module(symtabs, save_module_symtab);
 }
 
 int save_kernel_symbol(char *dirname)
@@ -1518,12 +2211,21 @@ struct sym * find_symtabs(struct symtabs *symtabs, uint64_t addr)
 	if (sym)
 		return sym;
 
-	maps = symtabs->maps;
-	while (maps) {
-		if (maps->start <= addr && addr < maps->end)
-			break;
+	if (symtabs->maps_index) {
+		struct uftrace_mmap **pmap;
 
-		maps = maps->next;
+		pmap = bsearch(&addr, symtabs->maps_index, symtabs->nr_maps,
+			       sizeof(*pmap), mapfind);
+		maps = pmap ? *pmap : NULL;
+	}
+	else {
+		maps = symtabs->maps;
+		while (maps) {
+			if (maps->start <= addr && addr < maps->end)
+				break;
+
+			maps = maps->next;
+		}
 	}
 
 	if (maps) {
@@ -1531,15 +2233,16 @@ struct sym * find_symtabs(struct symtabs *symtabs, uint64_t addr)
 			bool found = false;
 
 			if (symtabs->flags & SYMTAB_FL_USE_SYMFILE) {
-				char *symfile = NULL;
+				char *symfile;
 				unsigned long offset = 0;
 
 				if (symtabs->flags & SYMTAB_FL_ADJ_OFFSET)
 					offset = maps->start;
 
-				xasprintf(&symfile, "%s/%s.sym", symtabs->dirname,
-					  basename(maps->libname));
-				if (!load_module_symbol(&maps->symtab, symfile,
+				symfile = find_module_symfile(symtabs->dirname,
+							      maps->libname);
+				if (symfile &&
+				    !load_module_symbol(&maps->symtab, symfile,
 							offset)) {
 					found = true;
 				}
@@ -57,6 +57,8 @@ enum symtab_flag {
 	SYMTAB_FL_ADJ_OFFSET	= (1U << 2),
 	SYMTAB_FL_SKIP_NORMAL	= (1U << 3),
 	SYMTAB_FL_SKIP_DYNAMIC	= (1U << 4),
+	SYMTAB_FL_PARALLEL	= (1U << 5),
+	SYMTAB_FL_SHARE_MODULE	= (1U << 6),
 };
 
 struct symtabs {
@@ -68,6 +70,9 @@ struct symtabs {
 	struct symtab dsymtab;
 	uint64_t kernel_base;
 	struct uftrace_mmap *maps;
+	/* maps sorted by address for binary search (see build_maps_index) */
+	struct uftrace_mmap **maps_index;
+	size_t nr_maps;
 };
 
 /* only meaningful for 64-bit systems */
@@ -101,10 +106,20 @@ int load_elf_dynsymtab(struct symtab *dsymtab, Elf *elf,
 		       unsigned long offset, unsigned long flags);
 
 void load_module_symtabs(struct symtabs *symtabs);
+void unload_module_symtabs(struct symtabs *symtabs);
+void build_maps_index(struct symtabs *symtabs);
 void save_module_symtabs(struct symtabs *symtabs);
+void setup_symbol_cache(const char *dirname);
+int link_cached_symbol_file(struct symtabs *symtabs, const char *dirname,
+			    const char *exename);
 void load_dlopen_symtabs(struct symtabs *symtabs, unsigned long offset,
 			 const char *filename);
 
+#define BUILD_ID_SIZE      20
+#define BUILD_ID_STR_SIZE  (BUILD_ID_SIZE * 2 + 1)
+
+int read_build_id(const char *filename, char *buf, int len);
+
 bool check_libpthread(const char *filename);
 int check_trace_functions(const char *filename);
 int check_static_binary(const char *filename);
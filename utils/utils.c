@@ -154,6 +154,17 @@ int remove_directory(char *dirname)
 			continue;
 
 		snprintf(buf, sizeof(buf), "%s/%s", dirname, ent->d_name);
+
+		/* data directory might have a sub-directory for cache */
+		if (ent->d_type == DT_DIR) {
+			if (remove_directory(buf) < 0) {
+				saved_errno = errno;
+				ret = -1;
+				break;
+			}
+			continue;
+		}
+
 		if (unlink(buf) < 0) {
 			saved_errno = errno;
 			ret = -1;
@@ -379,6 +390,57 @@ uint64_t parse_time(char *arg, int limited_digits)
 	return val;
 }
 
+/*
+ * per-call overhead of tracing a function (in nsec) used to convert
+ * the overhead budget to thresholds.  It's from 'make bench' result
+ * of the 'call' workload on a typical x86_64 machine.
+ */
+#define AUTO_NOTRACE_CALL_COST  200
+
+/**
+ * parse_auto_notrace - parse spec of --auto-notrace option
+ * @spec: either "PCT%" or "RATE[/TIME]"
+ * @rate: (output) min number of calls per second
+ * @time: (output) max average duration of a function
+ *
+ * A function called more than @rate times per second and runs less
+ * than @time in average is dropped at runtime.  When an overhead
+ * budget (in percent) is given, the tracing overhead of such a function
+ * is more than the budget (of its own run time), and it consumes more
+ * than a tenth of the budget (of total run time).
+ */
+int parse_auto_notrace(char *spec, uint64_t *rate, uint64_t *time)
+{
+	char *pos;
+	unsigned long val;
+
+	val = strtoul(spec, &pos, 0);
+	if (pos == spec || val == 0)
+		return -1;
+
+	if (*pos == '%') {
+		if (pos[1] != '\0' || val > 100)
+			return -1;
+
+		*time = AUTO_NOTRACE_CALL_COST * 100 / val;
+		*rate = NSEC_PER_SEC * val / 100 / AUTO_NOTRACE_CALL_COST / 10;
+		return 0;
+	}
+
+	*rate = val;
+	*time = 1000;  /* 1 usec */
+
+	if (*pos == '/') {
+		*time = parse_time(pos + 1, 3);
+		if (*time == 0)
+			return -1;
+	}
+	else if (*pos != '\0')
+		return -1;
+
+	return 0;
+}
+
 char * strjoin(char *left, char *right, char *delim)
 {
 	size_t llen = left ? strlen(left) : 0;
@@ -577,6 +639,21 @@ char *get_event_name(struct ftrace_file_handle *handle, unsigned evt_id)
 		case EVENT_ID_PAGE_FAULT:
 			xasprintf(&evt_name, "read:page-fault");
 			break;
+		case EVENT_ID_READ_PMU_CYCLE:
+			xasprintf(&evt_name, "read:pmu-cycle");
+			break;
+		case EVENT_ID_READ_PMU_CACHE:
+			xasprintf(&evt_name, "read:pmu-cache");
+			break;
+		case EVENT_ID_READ_PMU_BRANCH:
+			xasprintf(&evt_name, "read:pmu-branch");
+			break;
+		case EVENT_ID_READ_MAX_RSS:
+			xasprintf(&evt_name, "read:max-rss");
+			break;
+		case EVENT_ID_READ_CTX_SWITCH:
+			xasprintf(&evt_name, "read:ctx-switch");
+			break;
 		default:
 			xasprintf(&evt_name, "builtin_event:%u", evt_id);
 			break;
@@ -619,6 +696,30 @@ char *absolute_dirname(const char *path, char *resolved_path)
 }
 
 #ifdef UNIT_TEST
+TEST_CASE(parse_auto_notrace)
+{
+	uint64_t rate, time;
+
+	TEST_EQ(parse_auto_notrace("5%", &rate, &time), 0);
+	TEST_EQ(rate, 25000);
+	TEST_EQ(time, 4000);
+
+	TEST_EQ(parse_auto_notrace("100000", &rate, &time), 0);
+	TEST_EQ(rate, 100000);
+	TEST_EQ(time, 1000);
+
+	TEST_EQ(parse_auto_notrace("100000/500ns", &rate, &time), 0);
+	TEST_EQ(rate, 100000);
+	TEST_EQ(time, 500);
+
+	TEST_EQ(parse_auto_notrace("0%", &rate, &time), -1);
+	TEST_EQ(parse_auto_notrace("200%", &rate, &time), -1);
+	TEST_EQ(parse_auto_notrace("1000x", &rate, &time), -1);
+	TEST_EQ(parse_auto_notrace("abc", &rate, &time), -1);
+
+	return TEST_OK;
+}
+
 TEST_CASE(parse_cmdline)
 {
 	char **cmdv;
@@ -248,6 +248,7 @@ void wait_for_pager(void);
 
 bool check_time_range(struct uftrace_time_range *range, uint64_t timestamp);
 uint64_t parse_time(char *arg, int limited_digits);
+int parse_auto_notrace(char *spec, uint64_t *rate, uint64_t *time);
 
 char * strjoin(char *left, char *right, char *delim);
 